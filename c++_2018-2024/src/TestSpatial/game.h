@@ -1,12 +1,27 @@
 #ifndef __WASTELADNS_GAME_H__
 #define __WASTELADNS_GAME_H__
 
+#include <chrono>
+
 namespace Game
 {
     const char* inputMeshPath = "assets/meshes/mesh_ona_quads.obj";
     const char* inputPoints = "assets/meshes/pts_1k.txt";
     const char* outputFilteredPoints = "assets/meshes/pts_1k_inside.txt";
     const char* outputFilteredProjectedPoints = "assets/meshes/pts_1k_projected.txt";
+    // optional, large point sets only go through the batched classification, and are never kept in memory
+    // their inside points get projected through the distance grid
+    const char* inputPointCloud = "assets/meshes/pts_cloud.txt";
+    const char* outputPointCloudInside = "assets/meshes/pts_cloud_inside.txt";
+    const char* outputPointCloudProjected = "assets/meshes/pts_cloud_projected.txt";
+    // built on the first run, and rebuilt if the mesh or the grid settings change
+    const char* cachedDistanceGridPath = "assets/meshes/mesh_ona_quads.grid";
+    const u32 distanceGridResolution = 128; // cells along the mesh's longest side
+    const f32 distanceGridBandCells = 1.f;
+    // the grid takes tens of seconds to build, so smaller point sets only use it if it's already cached
+    const u32 distanceGridMinPointCount = 1 << 18;
+    // grid queries should match the tree exactly, one in this many is checked against it
+    const u32 distanceGridCheckStride = 64;
 
     struct Time {
         struct Config {
@@ -89,6 +104,7 @@ namespace Game
     
     struct MeshQuery {
         BVH::Tree bvh;
+        BVH::DistanceGrid distanceGrid;
         std::vector<Vec3> input;
         std::vector<Vec3> inputProjected;
         std::vector<Vec3> outputInside;
@@ -114,6 +130,136 @@ namespace Game
         MeshQuery meshQuery;
         DebugVis debugVis;
     };
+    void distanceGridSettings(f32& cellSize, f32& band, const BVH::Tree& bvh) {
+        const Vec3 extents = Math::subtract(bvh.nodes[0].max, bvh.nodes[0].min);
+        cellSize = Math::max(Math::max(extents.x, extents.y), extents.z) / distanceGridResolution;
+        band = cellSize * distanceGridBandCells;
+    }
+    // Returns whether cachePath had a grid for this mesh and the current settings
+    bool loadDistanceGrid(BVH::DistanceGrid& grid, const char* cachePath, const BVH::Tree& bvh, const std::vector<f32>& vertices, const std::vector<u16>& indices) {
+        const u32 meshHash = BVH::hashMesh(&vertices[0], (u32)vertices.size() / 3, &indices[0], (u32)indices.size());
+        f32 cellSize, band;
+        distanceGridSettings(cellSize, band, bvh);
+        FILE* f;
+        if (Platform::fopen(&f, cachePath, "rb") != 0) return false;
+        std::vector<u8> data;
+        u8 buffer[64 * 1024];
+        size_t readSize;
+        while ((readSize = Platform::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+            data.insert(data.end(), buffer, buffer + readSize);
+        }
+        Platform::fclose(f);
+        if (data.size() > 0 && BVH::deserializeDistanceGrid(grid, &data[0], data.size(), meshHash, (u32)indices.size() / 3)
+            && grid.cellSize == cellSize && grid.band == band) return true;
+        grid = {}; // so it's not mistaken for a loaded grid
+        return false;
+    }
+    void loadOrBuildDistanceGrid(BVH::DistanceGrid& grid, const char* cachePath, const BVH::Tree& bvh, const std::vector<f32>& vertices, const std::vector<u16>& indices) {
+        if (loadDistanceGrid(grid, cachePath, bvh, vertices, indices)) return;
+
+        f32 cellSize, band;
+        distanceGridSettings(cellSize, band, bvh);
+        auto start = std::chrono::steady_clock::now();
+        BVH::buildDistanceGrid(grid, bvh, &vertices[0], (u32)vertices.size() / 3, &indices[0], (u32)indices.size(), cellSize, band, BVH::defaultThreadCount());
+        f64 buildSeconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+        Platform::printf("distance grid: %ux%ux%u cells, %u candidates, built in %.3fs\n",
+            grid.dims[0], grid.dims[1], grid.dims[2], (u32)grid.candidates.size(), buildSeconds);
+        FILE* f;
+        if (Platform::fopen(&f, cachePath, "wb") == 0) {
+            std::vector<u8> data;
+            BVH::serializeDistanceGrid(data, grid);
+            Platform::fwrite(&data[0], 1, data.size(), f);
+            Platform::fclose(f);
+        }
+    }
+    struct DistanceGridCheck {
+        u64 checkedCount;
+        u64 fartherCount; // grid points further from the query than the tree's, by more than rounding
+        f32 maxExtraDistance;
+    };
+    // Projects p through the grid, and for one in every distanceGridCheckStride points, through the tree too
+    void projectThroughDistanceGrid(Vec3& closest, DistanceGridCheck& check, const u64 pointIndex, const BVH::DistanceGrid& grid, const BVH::Tree& bvh, const Vec3& p, const f32* vertexPool, const u16* indexPool) {
+        BVH::findClosestPoint(closest, grid, bvh, p, vertexPool, indexPool);
+        if (pointIndex % distanceGridCheckStride != 0) return;
+        Vec3 closestTree;
+        f32 distanceSq;
+        BVH::findClosestPoint(closestTree, distanceSq, bvh, p, vertexPool, indexPool);
+        const f32 extraDistance = Math::mag(Math::subtract(closest, p)) - Math::sqrt(distanceSq);
+        check.checkedCount++;
+        // points on shared edges can come from either triangle, only their distance needs to match
+        if (extraDistance > grid.cellSize * 1e-4f) check.fartherCount++;
+        check.maxExtraDistance = Math::max(check.maxExtraDistance, extraDistance);
+    }
+    void printDistanceGridCheck(const char* inputPath, const u64 projectedCount, const f64 projectSeconds, const DistanceGridCheck& check) {
+        Platform::printf("%s: %llu points projected through the distance grid in %.3fs (%.0f points/s), %llu of %llu checked against the tree are further, max extra distance %g\n",
+            inputPath, (unsigned long long)projectedCount, projectSeconds, projectedCount / Math::max(projectSeconds, 1e-9),
+            (unsigned long long)check.fartherCount, (unsigned long long)check.checkedCount, check.maxExtraDistance);
+    }
+    // Streams the points in inputPath through BVH::classifyPointsInside, a chunk at a time,
+    // and writes the ones inside the mesh to outputPath, in their original order
+    // Their projections onto the mesh go to outputProjectedPath, through the distance grid, which is built if needed
+    void classifyPointFile(const char* inputPath, const char* outputPath, const char* outputProjectedPath, BVH::DistanceGrid& grid, const BVH::Tree& bvh, const std::vector<f32>& vertices, const std::vector<u16>& indices) {
+        FILE* in;
+        if (Platform::fopen(&in, inputPath, "r") != 0) return;
+        FILE* out;
+        if (Platform::fopen(&out, outputPath, "w") != 0) {
+            Platform::fclose(in);
+            return;
+        }
+        FILE* outProjected;
+        if (Platform::fopen(&outProjected, outputProjectedPath, "w") != 0) {
+            Platform::fclose(in);
+            Platform::fclose(out);
+            return;
+        }
+        if (grid.cellFirst.size() == 0) {
+            loadOrBuildDistanceGrid(grid, cachedDistanceGridPath, bvh, vertices, indices);
+        }
+        const f32* vertexPool = &vertices[0];
+        const u16* indexPool = &indices[0];
+        const u32 chunkSize = 1 << 20;
+        const u32 threadCount = BVH::defaultThreadCount();
+        std::vector<Vec3> points;
+        std::vector<u8> inside(chunkSize);
+        points.reserve(chunkSize);
+        u64 pointCount = 0, insideCount = 0;
+        f64 classifySeconds = 0.0, projectSeconds = 0.0;
+        DistanceGridCheck check = {};
+        bool done = false;
+        while (!done) {
+            points.clear();
+            while (points.size() < chunkSize) {
+                Vec3 v;
+                if (Platform::fscanf(in, "%f%f%f", &v.x, &v.y, &v.z) != 3) {
+                    done = true;
+                    break;
+                }
+                points.push_back(v);
+            }
+            if (points.size() == 0) break;
+
+            auto start = std::chrono::steady_clock::now();
+            BVH::classifyPointsInside(&inside[0], bvh, &points[0], (u32)points.size(), vertexPool, indexPool, threadCount);
+            classifySeconds += std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+            for (u32 i = 0; i < points.size(); i++) {
+                if (!inside[i]) continue;
+                fprintf(out, "%f %f %f\n", points[i].x, points[i].y, points[i].z);
+                start = std::chrono::steady_clock::now();
+                Vec3 closest;
+                projectThroughDistanceGrid(closest, check, insideCount, grid, bvh, points[i], vertexPool, indexPool);
+                projectSeconds += std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+                fprintf(outProjected, "%f %f %f\n", closest.x, closest.y, closest.z);
+                insideCount++;
+            }
+            pointCount += points.size();
+        }
+        Platform::fclose(in);
+        Platform::fclose(out);
+        Platform::fclose(outProjected);
+        Platform::printf("%s: %llu points, %llu inside, classified in %.3fs (%.0f points/s, %u threads)\n",
+            inputPath, (unsigned long long)pointCount, (unsigned long long)insideCount, classifySeconds, pointCount / Math::max(classifySeconds, 1e-9), threadCount);
+        printDistanceGridCheck(inputPath, insideCount, projectSeconds, check);
+    }
 	void start(Instance& game, Platform::GameConfig& config, const Platform::State& platform) {
 
 		game.time = {};
@@ -222,23 +368,44 @@ namespace Game
             {
                 BVH::buildTree(query.bvh, &vertices[0], &indices[0], (u32)indices.size());
                 meshCentroid = {};
-                if (query.bvh.nodes.size() > 0) {
+                bool useDistanceGrid = false;
+                if (query.bvh.nodes.size() > 0 && query.input.size() >= distanceGridMinPointCount) {
+                    loadOrBuildDistanceGrid(query.distanceGrid, cachedDistanceGridPath, query.bvh, vertices, indices);
+                    useDistanceGrid = true;
+                } else if (query.bvh.nodes.size() > 0) {
+                    useDistanceGrid = loadDistanceGrid(query.distanceGrid, cachedDistanceGridPath, query.bvh, vertices, indices);
+                }
+                if (query.bvh.nodes.size() > 0 && query.input.size() > 0) {
+                    // Determine whether each point is inside the mesh by casting rays from it and counting the intersections
+                    std::vector<u8> inside(query.input.size());
+                    const u32 threadCount = BVH::defaultThreadCount();
+                    auto start = std::chrono::steady_clock::now();
+                    BVH::classifyPointsInside(&inside[0], query.bvh, &query.input[0], (u32)query.input.size(), &vertices[0], &indices[0], threadCount);
+                    f64 classifySeconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+                    Platform::printf("%s: %u points, classified in %.3fs (%.0f points/s, %u threads)\n",
+                        inputPoints, (u32)query.input.size(), classifySeconds, query.input.size() / Math::max(classifySeconds, 1e-9), threadCount);
+                    DistanceGridCheck check = {};
+                    start = std::chrono::steady_clock::now();
                     for (u32 i = 0; i < query.input.size(); i++) {
 
                         // Find the projected point for every input point (this is not technically necessary, but we'll use it all for visualization anyway)
                         Vec3 closest;
-                        BVH::findClosestPoint(closest, query.bvh, query.input[i], &vertices[0], &indices[0], (u32)indices.size());
+                        if (useDistanceGrid) {
+                            projectThroughDistanceGrid(closest, check, i, query.distanceGrid, query.bvh, query.input[i], &vertices[0], &indices[0]);
+                        } else {
+                            f32 distanceSq;
+                            BVH::findClosestPoint(closest, distanceSq, query.bvh, query.input[i], &vertices[0], &indices[0]);
+                        }
                         query.inputProjected.push_back(closest);
-                        // Determine whether the point is inside the mesh by casting a ray in any direction from it and counting the intersections
-                        // We'll use the direction opposite to the closest poinst, which is likely to not collide with as many bounding boxes
-                        Vec3 rayDirection = Math::subtract(query.input[i], closest);
-                        Math::normalizeSafe(rayDirection);
-                        std::vector<f32> closestTs;
-                        if (BVH::queryIsPointInside(closestTs, query.bvh, query.input[i], rayDirection, &vertices[0], &indices[0], (u32)indices.size())) {
+                        if (inside[i]) {
                             query.outputInsideProjected.push_back(closest);
                             query.outputInside.push_back(query.input[i]);
                         }
                     }
+                    if (useDistanceGrid) {
+                        f64 projectSeconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+                        printDistanceGridCheck(inputPoints, query.input.size(), projectSeconds, check);
+                    }
                 }
                 // get mesh centroid so we can center the camera
                 meshCentroid = Math::scale(Math::add(query.bvh.nodes[0].max, query.bvh.nodes[0].min), 0.5f);
@@ -263,6 +430,9 @@ namespace Game
                     Platform::fclose(f);
                 }
             }
+            if (query.bvh.nodes.size() > 0) {
+                classifyPointFile(inputPointCloud, outputPointCloudInside, outputPointCloudProjected, query.distanceGrid, query.bvh, vertices, indices);
+            }
         }
 
         game.renderMgr.renderScene = {};
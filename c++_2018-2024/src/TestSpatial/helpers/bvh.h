@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <float.h>
 
 namespace BVH {
@@ -295,10 +298,11 @@ namespace BVH {
 			f32 distanceSqCB = Math::dot(pp_cb, pp_cb);
 			Vec3 pp_ac = Math::subtract(Math::scale(ac, Math::clamp(Math::dot(ac, pc) / Math::dot(ac, ac), 0.f, 1.f)), pc);
 			f32 distanceSqAC = Math::dot(pp_ac, pp_ac);
-			if (distanceSqBA < distanceSqCB && distanceSqBA < distanceSqAC) {
+			// ties happen when the closest point is a vertex, shared by two edges
+			if (distanceSqBA <= distanceSqCB && distanceSqBA <= distanceSqAC) {
 				closestPoint = Math::add(pp_ba, p);
 				closestDistSq = distanceSqBA;
-			} else if (distanceSqCB < distanceSqBA && distanceSqCB < distanceSqAC) {
+			} else if (distanceSqCB <= distanceSqAC) {
 				closestPoint = Math::add(pp_cb, p);
 				closestDistSq = distanceSqCB;
 			} else {
@@ -316,7 +320,7 @@ namespace BVH {
 		// distance to the node's bb (the minimum possible distance from the query point to a primitive inside the node)
 		f32 distanceSq;
 	};
-	void findClosestPoint(Vec3& resultPoint, const Tree& bvh, const Vec3& p, f32* vertexPool, const u16* indexPool, const u32 indexCount) {
+	void findClosestPoint(Vec3& resultPoint, f32& resultDistanceSq, const Tree& bvh, const Vec3& p, const f32* vertexPool, const u16* indexPool) {
 		// heap is sorted keeping the node with the shortest candidate distance on top
 		auto cmp = [](const DistanceQueryNode& a, const DistanceQueryNode& b) { return a.distanceSq > b.distanceSq; };
 		std::priority_queue<DistanceQueryNode, std::vector<DistanceQueryNode>, decltype(cmp)> nodeHeap(cmp);
@@ -369,6 +373,503 @@ namespace BVH {
 		}
 
 		resultPoint = closestPoint;
+		resultDistanceSq = closestDistanceSq;
+	}
+
+	// Batched inside / outside classification, for large point sets
+	// Same ray parity test as queryIsPointInside, but all points cast their rays along the same directions,
+	// so that packets of nearby points go down the tree together. Points get sorted along a morton curve
+	// to make packets out of neighbors, and are split among threads in chunks of the sorted order
+	// Parity can go wrong in two ways: rays that graze an edge or a vertex, or run along a triangle, may
+	// count the wrong number of crossings, so those votes are discarded; and meshes aren't always closed,
+	// so a ray through a hole or a doubled face flips the result. Every point takes the majority of
+	// several directions: two that agree are enough, more directions are only cast on disagreement
+	const Vec3 insideRayDirs[] = { // unit length, and away from the axes and diagonals that meshes tend to line up with
+		  Vec3(0.801702f, 0.342183f, 0.490065f)
+		, Vec3(-0.313932f, 0.877033f, -0.363723f)
+		, Vec3(0.132720f, -0.516638f, 0.845870f)
+		, Vec3(-0.671021f, -0.440339f, -0.596537f)
+		, Vec3(0.452186f, -0.801443f, -0.391426f)
+	};
+	const u32 insideRayDirCount = sizeof(insideRayDirs) / sizeof(insideRayDirs[0]);
+	const u32 insidePacketSize = 8;
+	const u32 insideChunkSize = 1024; // points per thread task, a multiple of insidePacketSize
+	// barycentric distance to an edge under which a crossing is considered a graze
+	const f32 insideEdgeEpsilon = 1e-5f;
+
+	struct Crossing { enum Enum { None, Crossed, Ambiguous }; };
+	// queryRayIntersectsWithTriangle, but reporting crossings that are too close to call
+	Crossing::Enum queryRayCrossesTriangle(const Vec3& p, const Vec3& dir, const Vec3& a, const Vec3& b, const Vec3& c) {
+		Vec3 ba = Math::subtract(b, a);
+		Vec3 ca = Math::subtract(c, a);
+		Vec3 pa = Math::subtract(p, a);
+		Vec3 n = Math::cross(ba, ca);
+		f32 dirn = Math::dot(dir, n);
+		// ray parallel to the triangle: it can only be ambiguous if it runs along it
+		// (dir is unit length, so this compares the sine of the angle between them)
+		if (Math::abs(dirn) <= insideEdgeEpsilon * Math::mag(n)) {
+			return Math::abs(Math::dot(n, pa)) <= insideEdgeEpsilon * Math::mag(n) * Math::mag(pa) ? Crossing::Ambiguous : Crossing::None;
+		}
+		Vec3 q = Math::cross(pa, dir);
+		f32 d = 1.f / dirn;
+		f32 u = d * Math::dot(Math::negate(q), ca);
+		f32 v = d * Math::dot(q, ba);
+		f32 t = d * Math::dot(Math::negate(n), pa);
+		if (t <= 0.f) return Crossing::None;
+		f32 w = 1.f - u - v;
+		if (u < -insideEdgeEpsilon || v < -insideEdgeEpsilon || w < -insideEdgeEpsilon) return Crossing::None;
+		if (u < insideEdgeEpsilon || v < insideEdgeEpsilon || w < insideEdgeEpsilon) return Crossing::Ambiguous;
+		return Crossing::Crossed;
+	}
+	struct InsidePacketQueryNode {
+		u32 nodeId;
+		u32 rayMask;
+	};
+	// Counts the crossings of count (up to insidePacketSize) rays that share a direction, visiting every node hit by any of them
+	// Returns a mask of the rays that hit an ambiguous crossing, their counts shouldn't be used
+	u32 countCrossingsPacket(u32* crossings, std::vector<InsidePacketQueryNode>& nodeStack, const Tree& bvh, const Vec3* points, const u32 count, const Vec3& dir, const f32* vertexPool, const u16* indexPool) {
+		// slab test, same as queryRayIntersectsWithBox: the direction is shared, so are its inverse and the near side of each axis
+		const Vec3 invDir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+		const bool negX = invDir.x < 0.f, negY = invDir.y < 0.f, negZ = invDir.z < 0.f;
+		u32 ambiguousMask = 0;
+		for (u32 i = 0; i < count; i++) { crossings[i] = 0; }
+
+		nodeStack.clear();
+		nodeStack.push_back(InsidePacketQueryNode{ 0, (1u << count) - 1 });
+		while (nodeStack.size() > 0) {
+			InsidePacketQueryNode n = nodeStack.back();
+			nodeStack.pop_back();
+			const Node& node = bvh.nodes[n.nodeId];
+			u32 rayMask = 0;
+			for (u32 i = 0; i < count; i++) {
+				if (!(n.rayMask & (1 << i))) continue;
+				const Vec3& p = points[i];
+				f32 nearT = Math::max(Math::max(
+					((negX ? node.max.x : node.min.x) - p.x) * invDir.x,
+					((negY ? node.max.y : node.min.y) - p.y) * invDir.y),
+					((negZ ? node.max.z : node.min.z) - p.z) * invDir.z);
+				f32 farT = Math::min(Math::min(
+					((negX ? node.min.x : node.max.x) - p.x) * invDir.x,
+					((negY ? node.min.y : node.max.y) - p.y) * invDir.y),
+					((negZ ? node.min.z : node.max.z) - p.z) * invDir.z);
+				if (farT >= 0.f && nearT <= farT) { rayMask |= 1 << i; }
+			}
+			if (!rayMask) continue;
+
+			if (node.isLeaf) {
+				u32 triangleId = node.triangleId;
+				Vec3 a(vertexPool[indexPool[triangleId * 3] * 3]
+					, vertexPool[indexPool[triangleId * 3] * 3 + 1]
+					, vertexPool[indexPool[triangleId * 3] * 3 + 2]);
+				Vec3 b(vertexPool[indexPool[triangleId * 3 + 1] * 3]
+					, vertexPool[indexPool[triangleId * 3 + 1] * 3 + 1]
+					, vertexPool[indexPool[triangleId * 3 + 1] * 3 + 2]);
+				Vec3 c(vertexPool[indexPool[triangleId * 3 + 2] * 3]
+					, vertexPool[indexPool[triangleId * 3 + 2] * 3 + 1]
+					, vertexPool[indexPool[triangleId * 3 + 2] * 3 + 2]);
+				for (u32 i = 0; i < count; i++) {
+					if (!(rayMask & (1 << i))) continue;
+					Crossing::Enum crossing = queryRayCrossesTriangle(points[i], dir, a, b, c);
+					if (crossing == Crossing::Crossed) { crossings[i]++; }
+					else if (crossing == Crossing::Ambiguous) { ambiguousMask |= 1 << i; }
+				}
+			} else {
+				nodeStack.push_back(InsidePacketQueryNode{ node.lchildId, rayMask });
+				nodeStack.push_back(InsidePacketQueryNode{ node.lchildId + 1, rayMask });
+			}
+		}
+		return ambiguousMask;
+	}
+	u32 mortonCode(const Vec3& p, const Vec3& min, const Vec3& invExtents) {
+		// 10 bits per axis, interleaved
+		auto spreadBits = [](u32 v) -> u32 {
+			v = (v * 0x00010001u) & 0xFF0000FFu;
+			v = (v * 0x00000101u) & 0x0F00F00Fu;
+			v = (v * 0x00000011u) & 0xC30C30C3u;
+			v = (v * 0x00000005u) & 0x49249249u;
+			return v;
+		};
+		u32 code = 0;
+		for (u32 axis = 0; axis < 3; axis++) {
+			f32 normalized = Math::clamp((p.coords[axis] - min.coords[axis]) * invExtents.coords[axis], 0.f, 1.f);
+			code |= spreadBits((u32)(normalized * 1023.f)) << axis;
+		}
+		return code;
+	}
+	struct ClassifyPointsContext {
+		const Tree* bvh;
+		const Vec3* points;
+		const u32* sortedIds;
+		u8* inside;
+		const f32* vertexPool;
+		const u16* indexPool;
+		u32 pointCount;
+		std::atomic<u32> nextChunk;
+	};
+	void classifyPointsThread(ClassifyPointsContext& ctx) {
+		std::vector<InsidePacketQueryNode> nodeStack;
+		nodeStack.reserve(128);
+		const u32 chunkCount = (ctx.pointCount + insideChunkSize - 1) / insideChunkSize;
+		u32 chunk;
+		while ((chunk = ctx.nextChunk++) < chunkCount) {
+			const u32 chunkEnd = Math::min((chunk + 1) * insideChunkSize, ctx.pointCount);
+			for (u32 begin = chunk * insideChunkSize; begin < chunkEnd; begin += insidePacketSize) {
+				const u32 count = Math::min(insidePacketSize, chunkEnd - begin);
+				Vec3 points[insidePacketSize];
+				u32 crossings[insidePacketSize];
+				u32 votes[insidePacketSize][2] = {}; // outside, inside
+				for (u32 i = 0; i < count; i++) { points[i] = ctx.points[ctx.sortedIds[begin + i]]; }
+				for (u32 dirId = 0; dirId < 2; dirId++) {
+					u32 ambiguousMask = countCrossingsPacket(crossings, nodeStack, *ctx.bvh, points, count, insideRayDirs[dirId], ctx.vertexPool, ctx.indexPool);
+					for (u32 i = 0; i < count; i++) {
+						if (!(ambiguousMask & (1 << i))) { votes[i][crossings[i] % 2]++; }
+					}
+				}
+				for (u32 i = 0; i < count; i++) {
+					// disagreements and grazes are rare: settle them one point at a time
+					for (u32 dirId = 2; votes[i][0] < 2 && votes[i][1] < 2 && dirId < insideRayDirCount; dirId++) {
+						u32 pointCrossings;
+						if (!countCrossingsPacket(&pointCrossings, nodeStack, *ctx.bvh, &points[i], 1, insideRayDirs[dirId], ctx.vertexPool, ctx.indexPool)) {
+							votes[i][pointCrossings % 2]++;
+						}
+					}
+					ctx.inside[ctx.sortedIds[begin + i]] = votes[i][1] > votes[i][0] ? 1 : 0;
+				}
+			}
+		}
+	}
+	u32 defaultThreadCount() {
+		u32 count = std::thread::hardware_concurrency();
+		return count > 0 ? count : 1;
+	}
+	// Writes 1 to inside[i] if points[i] is inside the mesh, 0 otherwise. The mesh doesn't need to be closed:
+	// small holes and doubled faces get outvoted (see insideRayDirs), but points near large openings can go either way
+	void classifyPointsInside(u8* inside, const Tree& bvh, const Vec3* points, const u32 pointCount, const f32* vertexPool, const u16* indexPool, const u32 threadCount) {
+		if (pointCount == 0 || bvh.nodes.size() == 0) return;
+
+		// sort along a morton curve over the mesh's bounds, points outside of them get clamped to the sides
+		const Vec3& min = bvh.nodes[0].min;
+		const Vec3 extents = Math::subtract(bvh.nodes[0].max, bvh.nodes[0].min);
+		const Vec3 invExtents(
+			  extents.x > 0.f ? 1.f / extents.x : 0.f
+			, extents.y > 0.f ? 1.f / extents.y : 0.f
+			, extents.z > 0.f ? 1.f / extents.z : 0.f);
+		std::vector<u64> keys(pointCount);
+		for (u32 i = 0; i < pointCount; i++) {
+			keys[i] = ((u64)mortonCode(points[i], min, invExtents) << 32) | i;
+		}
+		std::sort(keys.begin(), keys.end());
+		std::vector<u32> sortedIds(pointCount);
+		for (u32 i = 0; i < pointCount; i++) { sortedIds[i] = (u32)keys[i]; }
+
+		ClassifyPointsContext ctx;
+		ctx.bvh = &bvh;
+		ctx.points = points;
+		ctx.sortedIds = &sortedIds[0];
+		ctx.inside = inside;
+		ctx.vertexPool = vertexPool;
+		ctx.indexPool = indexPool;
+		ctx.pointCount = pointCount;
+		ctx.nextChunk = 0;
+		const u32 chunkCount = (pointCount + insideChunkSize - 1) / insideChunkSize;
+		const u32 workerCount = Math::min(Math::max(threadCount, 1u), chunkCount);
+		std::vector<std::thread> workers;
+		for (u32 i = 1; i < workerCount; i++) {
+			workers.push_back(std::thread(classifyPointsThread, std::ref(ctx)));
+		}
+		classifyPointsThread(ctx);
+		for (std::thread& worker : workers) { worker.join(); }
+	}
+
+	// Narrow band distance grid, for repeated closest point queries against the same mesh
+	// Every cell within band of the mesh stores the triangles that can be closest to some point in the cell:
+	// the distance from any point in the cell to the mesh is bounded by its distance to the mesh point closest
+	// to the cell center, so no triangle further away than that from the whole cell is stored
+	// That keeps queries exact, they only need to test the cell's list. Cells outside the band store nothing,
+	// and queries there (or outside the grid) fall back to the tree
+	struct DistanceGridCandidate {
+		u32 triangleId;
+		// candidates are sorted by this, a query point r away from the center is at least centerDistance - r
+		// away from the triangle, so the search can stop at the first candidate that can't beat the best one
+		f32 centerDistance;
+	};
+	struct DistanceGrid {
+		Vec3 min;
+		f32 cellSize;
+		f32 band;
+		u32 dims[3];
+		u32 meshHash; // of the vertices and indices the grid was built from, to validate cached grids
+		std::vector<u32> cellFirst; // cell i's candidates are candidates[cellFirst[i], cellFirst[i + 1])
+		std::vector<DistanceGridCandidate> candidates;
+	};
+	const u32 distanceGridFileTag = 0x44495247; // "GRID"
+	const u32 distanceGridFileVersion = 1;
+	const u32 distanceGridMaxCellCount = 1 << 24;
+	// times a cell gets split to bound its distance to a triangle, each level is 8 times the work
+	const u32 distanceGridBoundDepth = 2;
+
+	u32 hashMesh(const f32* vertexPool, const u32 vertexCount, const u16* indexPool, const u32 indexCount) {
+		// fnv-1a over the raw bytes
+		u32 hash = 2166136261u;
+		const u8* bytes = (const u8*)vertexPool;
+		for (u32 i = 0; i < vertexCount * 3 * sizeof(f32); i++) { hash = (hash ^ bytes[i]) * 16777619u; }
+		bytes = (const u8*)indexPool;
+		for (u32 i = 0; i < indexCount * sizeof(u16); i++) { hash = (hash ^ bytes[i]) * 16777619u; }
+		return hash;
+	}
+	f32 distanceBoxToBoxSq(const Vec3& minA, const Vec3& maxA, const Vec3& minB, const Vec3& maxB) {
+		Vec3 gap = Math::max(Math::max(Math::subtract(minB, maxA), Math::subtract(minA, maxB)), Vec3(0.f, 0.f, 0.f));
+		return Math::magSq(gap);
+	}
+	// Whether any point in the cube may be within maxDistance of the triangle. The distance from the center
+	// is off by at most half the cube's diagonal, when that's not enough to tell, the cube gets split
+	bool cubeMayBeNearTriangle(const Vec3& center, const f32 halfSize, const f32 maxDistance, const Vec3& a, const Vec3& b, const Vec3& c, const u32 depth) {
+		Vec3 closestPoint;
+		f32 distanceSq;
+		closestPointOnTriangleSq(closestPoint, distanceSq, center, a, b, c);
+		if (distanceSq <= maxDistance * maxDistance) return true;
+		if (Math::sqrt(distanceSq) - halfSize * Math::sqrt(3.f) > maxDistance) return false;
+		if (depth == 0) return true;
+		const f32 childHalfSize = halfSize * 0.5f;
+		for (u32 i = 0; i < 8; i++) {
+			Vec3 childCenter(
+				  center.x + ((i & 1) ? childHalfSize : -childHalfSize)
+				, center.y + ((i & 2) ? childHalfSize : -childHalfSize)
+				, center.z + ((i & 4) ? childHalfSize : -childHalfSize));
+			if (cubeMayBeNearTriangle(childCenter, childHalfSize, maxDistance, a, b, c, depth - 1)) return true;
+		}
+		return false;
+	}
+	// Appends every triangle that may be within maxDistance of some point in the cube
+	void findTrianglesNearCube(std::vector<DistanceGridCandidate>& candidates, std::vector<u32>& nodeStack, const Tree& bvh, const Vec3& center, const f32 halfSize, const f32 maxDistance, const f32* vertexPool, const u16* indexPool) {
+		const Vec3 halfExtents(halfSize, halfSize, halfSize);
+		const Vec3 cubeMin = Math::subtract(center, halfExtents);
+		const Vec3 cubeMax = Math::add(center, halfExtents);
+		const f32 maxDistanceSq = maxDistance * maxDistance;
+		nodeStack.clear();
+		nodeStack.push_back(0);
+		while (nodeStack.size() > 0) {
+			const Node& node = bvh.nodes[nodeStack.back()];
+			nodeStack.pop_back();
+			if (distanceBoxToBoxSq(node.min, node.max, cubeMin, cubeMax) > maxDistanceSq) continue;
+
+			if (node.isLeaf) {
+				u32 triangleId = node.triangleId;
+				Vec3 a(vertexPool[indexPool[triangleId * 3] * 3]
+					, vertexPool[indexPool[triangleId * 3] * 3 + 1]
+					, vertexPool[indexPool[triangleId * 3] * 3 + 2]);
+				Vec3 b(vertexPool[indexPool[triangleId * 3 + 1] * 3]
+					, vertexPool[indexPool[triangleId * 3 + 1] * 3 + 1]
+					, vertexPool[indexPool[triangleId * 3 + 1] * 3 + 2]);
+				Vec3 c(vertexPool[indexPool[triangleId * 3 + 2] * 3]
+					, vertexPool[indexPool[triangleId * 3 + 2] * 3 + 1]
+					, vertexPool[indexPool[triangleId * 3 + 2] * 3 + 2]);
+				if (cubeMayBeNearTriangle(center, halfSize, maxDistance, a, b, c, distanceGridBoundDepth)) {
+					Vec3 closestPoint;
+					f32 distanceSq;
+					closestPointOnTriangleSq(closestPoint, distanceSq, center, a, b, c);
+					candidates.push_back(DistanceGridCandidate{ triangleId, Math::sqrt(distanceSq) });
+				}
+			} else {
+				nodeStack.push_back(node.lchildId);
+				nodeStack.push_back(node.lchildId + 1);
+			}
+		}
+	}
+	struct BuildDistanceGridContext {
+		DistanceGrid* grid;
+		const Tree* bvh;
+		const f32* vertexPool;
+		const u16* indexPool;
+		std::vector<DistanceGridCandidate>* sliceCandidates; // per z slice, concatenated once all slices are done
+		std::atomic<u32> nextSlice;
+	};
+	void buildDistanceGridThread(BuildDistanceGridContext& ctx) {
+		DistanceGrid& grid = *ctx.grid;
+		const f32 halfSize = grid.cellSize * 0.5f;
+		const f32 halfDiagonal = halfSize * Math::sqrt(3.f);
+		// slack for rounding errors in the bounds, so the closest triangle is never left out
+		const f32 epsilon = grid.cellSize * 1e-3f;
+		std::vector<u32> nodeStack;
+		nodeStack.reserve(128);
+		u32 z;
+		while ((z = ctx.nextSlice++) < grid.dims[2]) {
+			std::vector<DistanceGridCandidate>& candidates = ctx.sliceCandidates[z];
+			for (u32 y = 0; y < grid.dims[1]; y++) {
+				for (u32 x = 0; x < grid.dims[0]; x++) {
+					const u32 cellId = (z * grid.dims[1] + y) * grid.dims[0] + x;
+					const Vec3 center = Math::add(grid.min, Math::scale(Vec3(x + 0.5f, y + 0.5f, z + 0.5f), grid.cellSize));
+					Vec3 closestPoint;
+					f32 distanceSq;
+					findClosestPoint(closestPoint, distanceSq, *ctx.bvh, center, ctx.vertexPool, ctx.indexPool);
+					const u32 first = (u32)candidates.size();
+					if (Math::sqrt(distanceSq) - halfDiagonal <= grid.band) {
+						// the distance to a point is largest at one of the cell's corners
+						f32 maxDistanceSq = 0.f;
+						for (u32 i = 0; i < 8; i++) {
+							Vec3 corner(
+								  center.x + ((i & 1) ? halfSize : -halfSize)
+								, center.y + ((i & 2) ? halfSize : -halfSize)
+								, center.z + ((i & 4) ? halfSize : -halfSize));
+							maxDistanceSq = Math::max(maxDistanceSq, Math::magSq(Math::subtract(corner, closestPoint)));
+						}
+						findTrianglesNearCube(candidates, nodeStack, *ctx.bvh, center, halfSize, Math::sqrt(maxDistanceSq) + epsilon, ctx.vertexPool, ctx.indexPool);
+						std::sort(candidates.begin() + first, candidates.end(), [](const DistanceGridCandidate& a, const DistanceGridCandidate& b) {
+							return a.centerDistance < b.centerDistance;
+						});
+					}
+					// counts for now, turned into offsets once all slices are done
+					grid.cellFirst[cellId] = (u32)candidates.size() - first;
+				}
+			}
+		}
+	}
+	// cellSize and band are in mesh units, cells up to band away from the mesh (plus a cell diagonal) get candidates
+	void buildDistanceGrid(DistanceGrid& grid, const Tree& bvh, const f32* vertexPool, const u32 vertexCount, const u16* indexPool, const u32 indexCount, const f32 cellSize, const f32 band, const u32 threadCount) {
+		grid.cellFirst.clear();
+		grid.candidates.clear();
+		grid.cellSize = cellSize;
+		grid.band = band;
+		grid.meshHash = hashMesh(vertexPool, vertexCount, indexPool, indexCount);
+		if (bvh.nodes.size() == 0 || cellSize <= 0.f) {
+			grid.min = {};
+			grid.dims[0] = grid.dims[1] = grid.dims[2] = 0;
+			return;
+		}
+		const Vec3 bandExtents(band, band, band);
+		grid.min = Math::subtract(bvh.nodes[0].min, bandExtents);
+		const Vec3 extents = Math::subtract(Math::add(bvh.nodes[0].max, bandExtents), grid.min);
+		for (u32 axis = 0; axis < 3; axis++) {
+			grid.dims[axis] = Math::max((u32)::ceilf(extents.coords[axis] / cellSize), 1u);
+		}
+		const u32 cellCount = grid.dims[0] * grid.dims[1] * grid.dims[2];
+		assert(cellCount <= distanceGridMaxCellCount);
+		grid.cellFirst.resize(cellCount + 1);
+
+		std::vector<std::vector<DistanceGridCandidate>> sliceCandidates(grid.dims[2]);
+		BuildDistanceGridContext ctx;
+		ctx.grid = &grid;
+		ctx.bvh = &bvh;
+		ctx.vertexPool = vertexPool;
+		ctx.indexPool = indexPool;
+		ctx.sliceCandidates = &sliceCandidates[0];
+		ctx.nextSlice = 0;
+		const u32 workerCount = Math::min(Math::max(threadCount, 1u), grid.dims[2]);
+		std::vector<std::thread> workers;
+		for (u32 i = 1; i < workerCount; i++) {
+			workers.push_back(std::thread(buildDistanceGridThread, std::ref(ctx)));
+		}
+		buildDistanceGridThread(ctx);
+		for (std::thread& worker : workers) { worker.join(); }
+
+		// slices are in cell order, so their lists can be concatenated as they are
+		u32 first = 0;
+		for (u32 cellId = 0; cellId < cellCount; cellId++) {
+			const u32 count = grid.cellFirst[cellId];
+			grid.cellFirst[cellId] = first;
+			first += count;
+		}
+		grid.cellFirst[cellCount] = first;
+		grid.candidates.reserve(first);
+		for (u32 z = 0; z < grid.dims[2]; z++) {
+			grid.candidates.insert(grid.candidates.end(), sliceCandidates[z].begin(), sliceCandidates[z].end());
+		}
+	}
+	// Same result as the tree version: inside the band, only the triangles stored in the point's cell get tested
+	void findClosestPoint(Vec3& resultPoint, const DistanceGrid& grid, const Tree& bvh, const Vec3& p, const f32* vertexPool, const u16* indexPool) {
+		const Vec3 cellCoords = Math::scale(Math::subtract(p, grid.min), 1.f / grid.cellSize);
+		if (cellCoords.x >= 0.f && cellCoords.y >= 0.f && cellCoords.z >= 0.f
+			&& cellCoords.x < (f32)grid.dims[0] && cellCoords.y < (f32)grid.dims[1] && cellCoords.z < (f32)grid.dims[2]) {
+			const u32 x = (u32)cellCoords.x, y = (u32)cellCoords.y, z = (u32)cellCoords.z;
+			const u32 cellId = (z * grid.dims[1] + y) * grid.dims[0] + x;
+			const u32 first = grid.cellFirst[cellId];
+			const u32 last = grid.cellFirst[cellId + 1];
+			if (first < last) {
+				const Vec3 center = Math::add(grid.min, Math::scale(Vec3(x + 0.5f, y + 0.5f, z + 0.5f), grid.cellSize));
+				const f32 centerDistance = Math::mag(Math::subtract(p, center));
+				const f32 epsilon = grid.cellSize * 1e-3f;
+				f32 closestDistanceSq = FLT_MAX;
+				f32 closestDistance = FLT_MAX;
+				for (u32 i = first; i < last; i++) {
+					if (grid.candidates[i].centerDistance - centerDistance > closestDistance + epsilon) break;
+					u32 triangleId = grid.candidates[i].triangleId;
+					Vec3 a(vertexPool[indexPool[triangleId * 3] * 3]
+						, vertexPool[indexPool[triangleId * 3] * 3 + 1]
+						, vertexPool[indexPool[triangleId * 3] * 3 + 2]);
+					Vec3 b(vertexPool[indexPool[triangleId * 3 + 1] * 3]
+						, vertexPool[indexPool[triangleId * 3 + 1] * 3 + 1]
+						, vertexPool[indexPool[triangleId * 3 + 1] * 3 + 2]);
+					Vec3 c(vertexPool[indexPool[triangleId * 3 + 2] * 3]
+						, vertexPool[indexPool[triangleId * 3 + 2] * 3 + 1]
+						, vertexPool[indexPool[triangleId * 3 + 2] * 3 + 2]);
+					Vec3 candidateClosestPoint;
+					f32 candidateClosestDistanceSq;
+					closestPointOnTriangleSq(candidateClosestPoint, candidateClosestDistanceSq, p, a, b, c);
+					if (candidateClosestDistanceSq < closestDistanceSq) {
+						closestDistanceSq = candidateClosestDistanceSq;
+						closestDistance = Math::sqrt(closestDistanceSq);
+						resultPoint = candidateClosestPoint;
+					}
+				}
+				return;
+			}
+		}
+		f32 distanceSq;
+		findClosestPoint(resultPoint, distanceSq, bvh, p, vertexPool, indexPool);
+	}
+
+	// File layout: tag, version, mesh hash, min, cell size, band, dims, candidate count, cellFirst, candidates
+	void serializeDistanceGrid(std::vector<u8>& data, const DistanceGrid& grid) {
+		auto write = [&data](const void* src, size_t size) {
+			data.insert(data.end(), (const u8*)src, (const u8*)src + size);
+		};
+		const u32 candidateCount = (u32)grid.candidates.size();
+		data.clear();
+		write(&distanceGridFileTag, sizeof(u32));
+		write(&distanceGridFileVersion, sizeof(u32));
+		write(&grid.meshHash, sizeof(u32));
+		write(grid.min.coords, 3 * sizeof(f32));
+		write(&grid.cellSize, sizeof(f32));
+		write(&grid.band, sizeof(f32));
+		write(grid.dims, 3 * sizeof(u32));
+		write(&candidateCount, sizeof(u32));
+		if (grid.cellFirst.size() > 0) { write(&grid.cellFirst[0], grid.cellFirst.size() * sizeof(u32)); }
+		if (candidateCount > 0) { write(&grid.candidates[0], candidateCount * sizeof(DistanceGridCandidate)); }
+	}
+	// Returns false if the data is not a grid, was built from a different mesh, or is corrupt
+	bool deserializeDistanceGrid(DistanceGrid& grid, const u8* data, const size_t size, const u32 meshHash, const u32 triangleCount) {
+		size_t offset = 0;
+		auto read = [data, size, &offset](void* dst, size_t readSize) {
+			if (offset + readSize > size) return false;
+			memcpy(dst, data + offset, readSize);
+			offset += readSize;
+			return true;
+		};
+		u32 tag, version, candidateCount;
+		if (!read(&tag, sizeof(u32)) || tag != distanceGridFileTag) return false;
+		if (!read(&version, sizeof(u32)) || version != distanceGridFileVersion) return false;
+		if (!read(&grid.meshHash, sizeof(u32)) || grid.meshHash != meshHash) return false;
+		if (!read(grid.min.coords, 3 * sizeof(f32))
+			|| !read(&grid.cellSize, sizeof(f32))
+			|| !read(&grid.band, sizeof(f32))
+			|| !read(grid.dims, 3 * sizeof(u32))
+			|| !read(&candidateCount, sizeof(u32))) return false;
+		const u64 cellCount = (u64)grid.dims[0] * grid.dims[1] * grid.dims[2];
+		if (cellCount == 0 || cellCount > distanceGridMaxCellCount) return false;
+		if (offset + (cellCount + 1) * sizeof(u32) + (u64)candidateCount * sizeof(DistanceGridCandidate) != size) return false;
+		grid.cellFirst.resize((size_t)cellCount + 1);
+		grid.candidates.resize(candidateCount);
+		read(&grid.cellFirst[0], grid.cellFirst.size() * sizeof(u32));
+		if (candidateCount > 0) { read(&grid.candidates[0], candidateCount * sizeof(DistanceGridCandidate)); }
+		// queries index straight into the candidate list and the mesh, so every range and id must be in bounds
+		if (grid.cellFirst[0] != 0 || grid.cellFirst[cellCount] != candidateCount) return false;
+		for (u64 i = 0; i < cellCount; i++) {
+			if (grid.cellFirst[i] > grid.cellFirst[i + 1]) return false;
+		}
+		for (u32 i = 0; i < candidateCount; i++) {
+			if (grid.candidates[i].triangleId >= triangleCount) return false;
+		}
+		return true;
 	}
 
 }; // namespace BVH
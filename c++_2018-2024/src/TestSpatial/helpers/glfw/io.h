@@ -19,6 +19,8 @@ namespace Platform {
     }
     int fclose(FILE *f) { return ::fclose(f); }
     int fgetc(FILE* f) { return ::fgetc(f); }
+    size_t fread(void* dst, size_t size, size_t count, FILE* f) { return ::fread(dst, size, count, f); }
+    size_t fwrite(const void* src, size_t size, size_t count, FILE* f) { return ::fwrite(src, size, count, f); }
     int fscanf(FILE *f, const char* format, ...) {
         va_list va;
         va_start(va, format);
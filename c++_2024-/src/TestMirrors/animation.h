@@ -30,7 +30,7 @@ struct State {
     f32 scale;
 };
 typedef u32 Handle;
-struct NodeMeta { enum Enum { HandleBits = 32, HandleMask = 0xffffffff, MaxNodes = HandleMask - 1 }; }; // handle=0 reserved for 0 initialization
+struct NodeMeta { enum Enum { HandleBits = 32, HandleMask = 0xffffffff, MaxNodes = allocator::SparsePoolHandle::MaxCap }; }; // handle=0 reserved for 0 initialization
 struct Node {
     Skeleton skeleton; // constant mesh_to_joint matrices, as well as posed joint_to_parent matrices
     Clip* clips;
@@ -38,23 +38,20 @@ struct Node {
     u32 clipCount;
 };
 struct Scene {
-    allocator::Pool<Node> nodes;
+    allocator::SparsePool<Node> nodes;
 };
 
 force_inline Node& get_node(Scene& scene, const Handle handle) {
-    return allocator::get_pool_slot(scene.nodes, handle - 1);
+    return allocator::get_pool_slot(scene.nodes, handle);
 }
 force_inline Handle handle_from_node(Scene& scene, Node& node) {
-    return allocator::get_pool_index(scene.nodes, node) + 1;
+    return allocator::get_pool_handle(scene.nodes, node);
 }
 
 void updateAnimation(Scene& scene, const f32 dt) {
 
-    for (u32 n = 0, count = 0; n < scene.nodes.cap && count < scene.nodes.count; n++) {
-        if (scene.nodes.data[n].alive == 0) { continue; }
-        count++;
-
-        animation::Node& animatedData = scene.nodes.data[n].state.live;
+    for (u32 n = 0; n < scene.nodes.count; n++) {
+        animation::Node& animatedData = scene.nodes.data[n];
         State& state = animatedData.state;
         const Clip& clip = animatedData.clips[state.animIndex];
         const Skeleton& skeleton = animatedData.skeleton;
@@ -0,0 +1,1280 @@
+#ifndef __WASTELADNS_BENCHMARKS_H__
+#define __WASTELADNS_BENCHMARKS_H__
+
+// Micro-benchmarks behind some of the data structure choices, so the numbers can be reproduced on
+// each platform. They run on the calling thread when requested, and stall the game meanwhile.
+// Results are written to a text file, one section per benchmark
+namespace benchmarks {
+
+struct Rng { u32 state; };
+u32 next(Rng& rng) { // xorshift32
+    u32 x = rng.state;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    rng.state = x;
+    return x;
+}
+f64 ns_per(const f64 seconds, const f64 count) { return seconds * 1e9 / count; }
+
+// keeps the optimizer from discarding the benchmarked work
+volatile u64 sink;
+
+// Fixed size arena carved out of another one, for outputs that must survive scoped copies of it
+// (same as the gather's worker arenas): size must be an upper bound, it never commits past its end
+allocator::PagedArena slice_arena(allocator::PagedArena& arena, const size_t size) {
+    allocator::PagedArena slice = {};
+    slice.curr = (u8*)allocator::alloc_arena(arena, size, 64);
+    slice.end = slice.curr + size;
+    slice.pagesize = arena.pagesize;
+    return slice;
+}
+f32 randf(Rng& rng) { return (next(rng) >> 8) / (f32)(1 << 24); }
+float3 random_direction(Rng& rng) {
+    while (true) {
+        const float3 v(randf(rng) * 2.f - 1.f, randf(rng) * 2.f - 1.f, randf(rng) * 2.f - 1.f);
+        const f32 len2 = math::dot(v, v);
+        if (len2 > 0.01f && len2 <= 1.f) { return math::scale(v, 1.f / math::sqrt(len2)); }
+    }
+}
+// Random 5 plane frustum (no far plane) looking at the box from around it, with planes facing in
+void random_frustum(float4* planes, Rng& rng, const float3& boxMin, const float3& boxMax) {
+    const float3 center = math::scale(math::add(boxMin, boxMax), 0.5f);
+    const f32 radius = math::mag(math::subtract(boxMax, boxMin));
+    const float3 eye = math::add(center, math::scale(random_direction(rng), radius * 0.6f));
+    const float3 target = math::add(center, math::scale(random_direction(rng), radius * 0.25f));
+    const float3 front = math::normalize(math::subtract(target, eye));
+    const float3 worldUp = math::abs(front.z) < 0.99f ? float3(0.f, 0.f, 1.f) : float3(1.f, 0.f, 0.f);
+    const float3 right = math::normalize(math::cross(front, worldUp));
+    const float3 up = math::cross(right, front);
+    const f32 halfFov = (5.f + 20.f * randf(rng)) * math::d2r32;
+    const f32 s = math::sin(halfFov), c = math::cos(halfFov);
+    const float3 normals[5] = {
+        front,
+        math::add(math::scale(front, s), math::scale(right, c)),
+        math::add(math::scale(front, s), math::scale(right, -c)),
+        math::add(math::scale(front, s), math::scale(up, c)),
+        math::add(math::scale(front, s), math::scale(up, -c)),
+    };
+    for (u32 p = 0; p < 5; p++) {
+        const float3 n = math::normalize(normals[p]);
+        const float3 onPlane = p == 0 ? math::add(eye, math::scale(front, radius * 0.01f)) : eye;
+        planes[p] = float4(n, -math::dot(n, onPlane));
+    }
+}
+
+// Pool vs SparsePool, with a churn pattern similar to the scene's nodes: fill the pool, free a
+// random half, then iterate over the live objects, and look them up through their index / handle
+struct PoolObject { float4x4 matrix; u32 id; };
+void run_pools(FILE* f, allocator::PagedArena scratch) {
+    const u32 cap = 64 * 1024;
+    const u32 freeCount = cap / 2;
+    const u32 liveCount = cap - freeCount;
+    const u32 reps = 64;
+    allocator::Pool<PoolObject> pool;
+    allocator::SparsePool<PoolObject> sparse;
+    allocator::init_pool(pool, cap, scratch);
+    allocator::init_pool(sparse, cap, scratch);
+    u32* indices = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * cap, alignof(u32));
+    u32* handles = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * cap, alignof(u32));
+    // same random order for both pools: each entry is a position in the list of live objects,
+    // which is kept packed by moving the last one into the freed position
+    u32* freeOrder = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * freeCount, alignof(u32));
+    Rng rng = { 0x9e3779b9 };
+    for (u32 i = 0; i < freeCount; i++) { freeOrder[i] = next(rng) % (cap - i); }
+
+    f64 pooltime[4], sparsetime[4]; // alloc, free, iterate, lookup
+    {
+        f64 start = platform::time_now();
+        for (u32 i = 0; i < cap; i++) {
+            PoolObject& o = allocator::alloc_pool(pool);
+            o = {}; o.id = i;
+            indices[i] = allocator::get_pool_index(pool, o);
+        }
+        f64 end = platform::time_now();
+        pooltime[0] = ns_per(end - start, cap);
+        start = end;
+        for (u32 i = 0; i < freeCount; i++) {
+            const u32 r = freeOrder[i];
+            allocator::free_pool(pool, allocator::get_pool_slot(pool, indices[r]));
+            indices[r] = indices[cap - i - 1];
+        }
+        end = platform::time_now();
+        pooltime[1] = ns_per(end - start, freeCount);
+        start = end;
+        u64 sum = 0;
+        for (u32 rep = 0; rep < reps; rep++) {
+            for (u32 n = 0, count = 0; n < pool.cap && count < pool.count; n++) {
+                if (pool.data[n].alive == 0) { continue; }
+                count++;
+                sum += pool.data[n].state.live.id;
+            }
+        }
+        end = platform::time_now();
+        pooltime[2] = ns_per(end - start, (f64)reps * liveCount);
+        start = end;
+        for (u32 rep = 0; rep < reps; rep++) {
+            for (u32 i = 0; i < liveCount; i++) {
+                sum += allocator::get_pool_slot(pool, indices[i]).id;
+            }
+        }
+        end = platform::time_now();
+        pooltime[3] = ns_per(end - start, (f64)reps * liveCount);
+        sink = sum;
+    }
+    {
+        f64 start = platform::time_now();
+        for (u32 i = 0; i < cap; i++) {
+            PoolObject& o = allocator::alloc_pool(sparse);
+            o = {}; o.id = i;
+            handles[i] = allocator::get_pool_handle(sparse, o);
+        }
+        f64 end = platform::time_now();
+        sparsetime[0] = ns_per(end - start, cap);
+        start = end;
+        for (u32 i = 0; i < freeCount; i++) {
+            const u32 r = freeOrder[i];
+            allocator::free_pool(sparse, handles[r]);
+            handles[r] = handles[cap - i - 1];
+        }
+        end = platform::time_now();
+        sparsetime[1] = ns_per(end - start, freeCount);
+        start = end;
+        u64 sum = 0;
+        for (u32 rep = 0; rep < reps; rep++) {
+            for (u32 n = 0; n < sparse.count; n++) { sum += sparse.data[n].id; }
+        }
+        end = platform::time_now();
+        sparsetime[2] = ns_per(end - start, (f64)reps * liveCount);
+        start = end;
+        for (u32 rep = 0; rep < reps; rep++) {
+            for (u32 i = 0; i < liveCount; i++) {
+                sum += allocator::get_pool_slot(sparse, handles[i]).id;
+            }
+        }
+        end = platform::time_now();
+        sparsetime[3] = ns_per(end - start, (f64)reps * liveCount);
+        sink = sum;
+    }
+
+    const char* rows[] = { "alloc", "free", "iterate", "lookup" };
+    fprintf(f, "[pools] %u objects of %zu bytes, %u live after freeing a random half\n",
+        cap, sizeof(PoolObject), liveCount);
+    fprintf(f, "%-10s %12s %12s (ns per object)\n", "", "Pool", "SparsePool");
+    for (u32 i = 0; i < countof(rows); i++) {
+        fprintf(f, "%-10s %12.2f %12.2f\n", rows[i], pooltime[i], sparsetime[i]);
+    }
+    fprintf(f, "\n");
+}
+
+// ConcurrentArena under parallel producers, on 1 to N threads: each thread makes a burst of mixed
+// size allocations, mostly small, with the odd one larger than a block, and fills each one with its
+// own pattern. The contents are validated once all threads are done, so overlapping blocks show up
+// as errors. With no thread blocks (a block size of 0), every allocation bumps the shared offset,
+// which is the contended baseline. Only the allocations are timed
+struct ArenaStressThread {
+    u8** ptrs;
+    u32* sizes;
+    u8* aligns; // log2
+    f64 time;
+};
+struct ArenaStress {
+    allocator::ConcurrentArena& arena;
+    ArenaStressThread* threads;
+    u32 allocCount;
+    u32 largeSize;
+    u32 seed;
+};
+void arenaStressTask(void* data, u32 threadId) {
+    ArenaStress& ctx = *(ArenaStress*)data;
+    ArenaStressThread& t = ctx.threads[threadId];
+    Rng rng = { ctx.seed + threadId * 0x9e3779b9 };
+    for (u32 i = 0; i < ctx.allocCount; i++) {
+        const u32 r = next(rng);
+        t.sizes[i] = (r & 4095) == 0 ? ctx.largeSize + (r >> 20) : 8 + ((r >> 12) & 255);
+        t.aligns[i] = (u8)((r >> 20) & 3) * 2; // 1 to 64
+    }
+    allocator::ThreadArena thread;
+    allocator::init_arena(thread, ctx.arena);
+    const f64 start = platform::time_now();
+    for (u32 i = 0; i < ctx.allocCount; i++) {
+        t.ptrs[i] = (u8*)allocator::alloc_arena(thread, t.sizes[i], (ptrdiff_t)1 << t.aligns[i]);
+    }
+    t.time = platform::time_now() - start;
+    for (u32 i = 0; i < ctx.allocCount; i++) { memset(t.ptrs[i], (u8)(threadId * 31 + i), t.sizes[i]); }
+}
+void run_concurrent_arena(FILE* f, allocator::PagedArena scratch, allocator::ConcurrentArena& arena) {
+    const u32 allocCount = 32 * 1024;
+    const u32 resetCount = 3;
+    const u32 maxThreads = jobs::worker_count();
+    ArenaStressThread threads[jobs::maxWorkerCount];
+    for (u32 i = 0; i < maxThreads; i++) {
+        threads[i].ptrs = (u8**)allocator::alloc_arena(scratch, sizeof(u8*) * allocCount, alignof(u8*));
+        threads[i].sizes = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * allocCount, alignof(u32));
+        threads[i].aligns = (u8*)allocator::alloc_arena(scratch, allocCount, 1);
+    }
+    const size_t blocksize = arena.blocksize;
+    fprintf(f, "[concurrent arena] %u mixed size allocations per thread, best of %u resets, %zu byte blocks\n",
+        allocCount, resetCount, blocksize);
+    fprintf(f, "%-8s %16s %16s %8s %10s %10s\n",
+        "threads", "blocks Mallocs/s", "bump Mallocs/s", "speedup", "used MB", "errors");
+    for (u32 threadCount = 1;; threadCount = math::min(threadCount * 2, maxThreads)) {
+        f64 best[2] = { 1e9, 1e9 };
+        size_t used = 0;
+        u64 errors = 0;
+        for (u32 mode = 0; mode < 2; mode++) {
+            arena.blocksize = mode == 0 ? blocksize : 0;
+            for (u32 rep = 0; rep < resetCount; rep++) {
+                allocator::reset_arena(arena);
+                ArenaStress ctx = { arena, threads, allocCount, (u32)blocksize * 2, 0x2545f491 + rep };
+                jobs::parallel_for(arenaStressTask, &ctx, threadCount);
+                f64 time = 0.;
+                for (u32 t = 0; t < threadCount; t++) {
+                    const ArenaStressThread& thread = threads[t];
+                    time = math::max(time, thread.time);
+                    for (u32 i = 0; i < allocCount; i++) {
+                        const u8* p = thread.ptrs[i];
+                        const u8 pattern = (u8)(t * 31 + i);
+                        bool valid = ((uintptr_t)p & (((uintptr_t)1 << thread.aligns[i]) - 1)) == 0;
+                        for (u32 b = 0; b < thread.sizes[i] && valid; b++) { valid = p[b] == pattern; }
+                        errors += !valid;
+                    }
+                }
+                best[mode] = math::min(best[mode], time);
+                if (mode == 0) { used = allocator::used_bytes(arena); }
+            }
+        }
+        const f64 total = (f64)threadCount * allocCount;
+        fprintf(f, "%-8u %16.1f %16.1f %7.2fx %10.1f %10llu\n",
+            threadCount, total / best[0] * 1e-6, total / best[1] * 1e-6, best[1] / best[0],
+            used / (1024. * 1024.), (unsigned long long)errors);
+        if (threadCount == maxThreads) { break; }
+    }
+    arena.blocksize = blocksize;
+    fprintf(f, "\n");
+}
+
+// TLSF heap under a room cycling workload: each room loads a few hundred resources, mostly small,
+// with a quarter of them large, and each switch frees a random 70% of the ones still alive.
+// Alloc and free are timed in batches, contents are validated outside of the timed loops
+void run_tlsf(FILE* f, allocator::PagedArena scratch) {
+    struct Resource { u8* data; size_t size; u8 tag; };
+    const u32 roomCount = 200;
+    const u32 maxRoomResources = 600;
+    const u32 maxLive = 4096;
+    Resource* live =
+        (Resource*)allocator::alloc_arena(scratch, sizeof(Resource) * maxLive, alignof(Resource));
+    // the heap is the last user of the arena, so its chunks stay contiguous
+    allocator::TLSF heap;
+    allocator::init_tlsf(heap, scratch, 16 * 1024 * 1024);
+
+    Rng rng = { 0x2545f491 };
+    u32 liveCount = 0;
+    u64 allocCount = 0, freeCount = 0;
+    f64 allocTime = 0., freeTime = 0.;
+    size_t peakHeapBytes = 0, peakUsedBytes = 0;
+    f32 maxFragmentation = 0.f, sumFragmentation = 0.f;
+    bool valid = true;
+    for (u32 room = 0; room < roomCount; room++) {
+        // switch rooms: move a random 70% of the live resources to the back, and free them
+        const u32 toFree = liveCount * 7 / 10;
+        for (u32 i = 0; i < toFree; i++) {
+            const u32 r = next(rng) % (liveCount - i);
+            const Resource tmp = live[r];
+            live[r] = live[liveCount - i - 1];
+            live[liveCount - i - 1] = tmp;
+        }
+        liveCount -= toFree;
+        for (u32 i = liveCount; i < liveCount + toFree; i++) {
+            const Resource& res = live[i];
+            valid = valid && res.data[0] == res.tag && res.data[res.size - 1] == res.tag;
+        }
+        f64 start = platform::time_now();
+        for (u32 i = liveCount; i < liveCount + toFree; i++) { allocator::free_tlsf(heap, live[i].data); }
+        freeTime += platform::time_now() - start;
+        freeCount += toFree;
+
+        // load the next room
+        const u32 count = 200 + next(rng) % (maxRoomResources - 200 + 1);
+        assert(liveCount + count <= maxLive);
+        for (u32 i = liveCount; i < liveCount + count; i++) {
+            Resource& res = live[i];
+            res.size = (next(rng) % 4) == 0 ?
+                  64 * 1024 + next(rng) % (2 * 1024 * 1024 - 64 * 1024)
+                : 16 + next(rng) % (4096 - 16);
+            res.tag = (u8)(room + i);
+        }
+        start = platform::time_now();
+        for (u32 i = liveCount; i < liveCount + count; i++) {
+            live[i].data = (u8*)allocator::alloc_tlsf(heap, live[i].size, 16);
+        }
+        allocTime += platform::time_now() - start;
+        allocCount += count;
+        for (u32 i = liveCount; i < liveCount + count; i++) {
+            live[i].data[0] = live[i].data[live[i].size - 1] = live[i].tag;
+        }
+        liveCount += count;
+
+        const allocator::TLSFStats stats = allocator::get_stats(heap);
+        peakHeapBytes = math::max(peakHeapBytes, stats.heapBytes);
+        peakUsedBytes = math::max(peakUsedBytes, stats.usedBytes);
+        maxFragmentation = math::max(maxFragmentation, stats.fragmentation);
+        sumFragmentation += stats.fragmentation;
+    }
+    for (u32 i = 0; i < liveCount; i++) {
+        const Resource& res = live[i];
+        valid = valid && res.data[0] == res.tag && res.data[res.size - 1] == res.tag;
+        allocator::free_tlsf(heap, res.data);
+    }
+    const allocator::TLSFStats stats = allocator::get_stats(heap);
+
+    fprintf(f, "[tlsf] %u rooms of 200-%u resources (16B-4KB, a quarter 64KB-2MB), "
+               "70%% freed on each switch\n", roomCount, maxRoomResources);
+    fprintf(f, "alloc      %12.2f ns (%llu allocations)\n",
+        ns_per(allocTime, (f64)allocCount), (unsigned long long)allocCount);
+    fprintf(f, "free       %12.2f ns (%llu frees)\n",
+        ns_per(freeTime, (f64)freeCount), (unsigned long long)freeCount);
+    fprintf(f, "peak       %12.3f MB heap, %.3f MB used\n",
+        peakHeapBytes / (1024. * 1024.), peakUsedBytes / (1024. * 1024.));
+    fprintf(f, "fragmentation after each load: %.2f%% average, %.2f%% max\n",
+        sumFragmentation * 100.f / roomCount, maxFragmentation * 100.f);
+    fprintf(f, "after freeing everything: %u free blocks, %.3f MB heap\n",
+        stats.freeBlocks, stats.heapBytes / (1024. * 1024.));
+    fprintf(f, "contents %s\n\n", valid ? "valid" : "CORRUPTED");
+}
+
+// Builds the tree for a mesh with each builder: build time (best of a few runs), tree stats, and
+// random frustum queries. Queries are conservative (leaf bounds are tested, not triangles), so
+// trees are checked against testing every triangle's bounds: they may mark more, but never fewer
+struct BuilderConfig {
+    const char* name;
+    bool lbvh;
+    bvh::BuildParams sahParams;
+    bvh::LBVHParams lbvhParams;
+};
+const u32 maxBuilderConfigCount = 8;
+void compare_builders(
+    FILE* f, allocator::PagedArena scratch, const renderer::CPUMesh& mesh,
+    const BuilderConfig* builders, const u32 builderCount, const u32 buildReps, const u32 queryCount) {
+    assert(builderCount <= maxBuilderConfigCount);
+    const u32 triangleCount = mesh.indexCount / 3;
+    u32* sourceIds = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * triangleCount, alignof(u32));
+    for (u32 i = 0; i < triangleCount; i++) { sourceIds[i] = i; }
+    const size_t treeSize =
+        triangleCount * (2 * sizeof(bvh::Node) + sizeof(bvh::WideNode) + 3 * sizeof(u32)) + 64 * 1024;
+
+    bvh::Tree trees[maxBuilderConfigCount];
+    bvh::BuildStats stats[maxBuilderConfigCount];
+    f64 buildTime[maxBuilderConfigCount];
+    for (u32 b = 0; b < builderCount; b++) {
+        const BuilderConfig& builder = builders[b];
+        buildTime[b] = 1e9;
+        // the last build is the one that's kept
+        for (u32 rep = 0; rep <= buildReps; rep++) {
+            allocator::PagedArena buildScratch = scratch;
+            allocator::PagedArena out = slice_arena(rep < buildReps ? buildScratch : scratch, treeSize);
+            const f64 start = platform::time_now();
+            if (builder.lbvh) {
+                bvh::buildTreeLBVH(out, buildScratch, trees[b], stats[b], builder.lbvhParams,
+                    &(mesh.vertices[0].x), mesh.indices, mesh.indexCount, sourceIds);
+            } else {
+                bvh::buildTree(out, buildScratch, trees[b], stats[b], builder.sahParams,
+                    &(mesh.vertices[0].x), mesh.indices, mesh.indexCount, sourceIds);
+            }
+            if (rep < buildReps) { buildTime[b] = math::min(buildTime[b], platform::time_now() - start); }
+        }
+    }
+
+    bvh::Triangle* triangles = (bvh::Triangle*)allocator::alloc_arena(
+        scratch, sizeof(bvh::Triangle) * triangleCount, alignof(bvh::Triangle));
+    for (u32 i = 0; i < triangleCount; i++) {
+        bvh::makeTriangle(triangles[i], &(mesh.vertices[0].x), mesh.indices, sourceIds, i);
+    }
+    bool* visible = (bool*)allocator::alloc_arena(scratch, triangleCount, 1);
+    u8* reference = (u8*)allocator::alloc_arena(scratch, triangleCount, 1);
+    f64 queryTime[maxBuilderConfigCount] = {};
+    u64 visibleCount[maxBuilderConfigCount] = {};
+    u64 missedCount[maxBuilderConfigCount] = {};
+    u64 referenceCount = 0;
+    Rng rng = { 0x51ed270b };
+    const bvh::Node& root = trees[0].nodes[0];
+    for (u32 q = 0; q < queryCount; q++) {
+        float4 planes[5];
+        random_frustum(planes, rng, root.min, root.max);
+        for (u32 i = 0; i < triangleCount; i++) {
+            const bvh::Triangle& tri = triangles[i];
+            bool out = false;
+            for (u32 p = 0; p < 5 && !out; p++) {
+                // summed in the same order as the query, so borderline triangles round the same way
+                const float4& pl = planes[p];
+                out = (pl.x * (pl.x > 0.f ? tri.max.x : tri.min.x) + pl.y * (pl.y > 0.f ? tri.max.y : tri.min.y))
+                    + (pl.z * (pl.z > 0.f ? tri.max.z : tri.min.z) + pl.w) < 0.f;
+            }
+            reference[i] = !out;
+            referenceCount += !out;
+        }
+        for (u32 b = 0; b < builderCount; b++) {
+            memset(visible, 0, triangleCount);
+            const f64 start = platform::time_now();
+            bvh::findTrianglesIntersectingFrustum(scratch, visible, trees[b], planes, 5);
+            queryTime[b] += platform::time_now() - start;
+            // sources are numbered in leaf order, sourceOrder maps them back to the triangles
+            for (u32 i = 0; i < trees[b].sourceCount; i++) {
+                visibleCount[b] += visible[i];
+                missedCount[b] += reference[trees[b].sourceOrder[i]] && !visible[i];
+            }
+        }
+    }
+
+    fprintf(f, "%u triangles, %.1f with bounds in the frustum per query\n",
+        triangleCount, referenceCount / (f64)queryCount);
+    fprintf(f, "%-16s %10s %8s %8s %6s %8s %12s %10s %8s\n",
+        "", "build ms", "nodes", "leaves", "depth", "SAH", "queries ms", "visible", "missed");
+    for (u32 b = 0; b < builderCount; b++) {
+        fprintf(f, "%-16s %10.3f %8u %8u %6u %8.2f %12.3f %10.1f %8llu\n",
+            builders[b].name, buildTime[b] * 1000., stats[b].nodeCount, stats[b].leafCount,
+            stats[b].depth, stats[b].sahCost, queryTime[b] * 1000.,
+            visibleCount[b] / (f64)queryCount, (unsigned long long)missedCount[b]);
+    }
+}
+
+// SAH vs midpoint split, and bin counts, on the mirror meshes
+void run_bvh_builders(FILE* f, allocator::PagedArena scratch, const game::Resources& resources) {
+    const u32 buildReps = 5;
+    const u32 queryCount = 2000;
+    const BuilderConfig builders[] = {
+        { "midpoint", false, { 16, 4, bvh::SplitMethod::Midpoint } },
+        { "SAH 4 bins", false, { 4, 4, bvh::SplitMethod::SAH } },
+        { "SAH 8 bins", false, { 8, 4, bvh::SplitMethod::SAH } },
+        { "SAH 16 bins", false, { 16, 4, bvh::SplitMethod::SAH } },
+        { "SAH 32 bins", false, { 32, 4, bvh::SplitMethod::SAH } },
+    };
+    fprintf(f, "[bvh builders] best of %u builds, %u random 5 plane frustum queries\n",
+        buildReps, queryCount);
+    for (u32 m = 0; m < game::Resources::MeshesMeta::Count; m++) {
+        const renderer::CPUMesh& mesh = resources.meshes[m].cpuBuffer;
+        if (mesh.indexCount < 3) { continue; }
+        fprintf(f, "mesh %u: ", m);
+        compare_builders(f, scratch, mesh, builders, countof(builders), buildReps, queryCount);
+    }
+    fprintf(f, "\n");
+}
+
+// Bumpy sphere of about triangleCount triangles, with a random radius per vertex: rings * segments
+// quads, with twice as many segments as rings
+void make_sphere_mesh(renderer::CPUMesh& mesh, allocator::PagedArena& arena, const u32 triangleCount) {
+    const u32 rings = math::max((u32)(math::sqrt(triangleCount / 4.f) + 0.5f), 2u);
+    const u32 segments = 2 * rings;
+    mesh.vertexCount = (rings + 1) * segments;
+    mesh.indexCount = rings * segments * 6;
+    mesh.vertices = (float3*)allocator::alloc_arena(
+        arena, sizeof(float3) * mesh.vertexCount, alignof(float3));
+    mesh.indices = (u32*)allocator::alloc_arena(arena, sizeof(u32) * mesh.indexCount, alignof(u32));
+    Rng rng = { 0x6b43a9b5 };
+    for (u32 r = 0; r <= rings; r++) {
+        const f32 polar = math::pi32 * r / rings;
+        for (u32 s = 0; s < segments; s++) {
+            const f32 azimuth = 2.f * math::pi32 * s / segments;
+            const f32 radius = 1.f + 0.02f * randf(rng);
+            mesh.vertices[r * segments + s] = float3(
+                radius * math::sin(polar) * math::cos(azimuth),
+                radius * math::sin(polar) * math::sin(azimuth),
+                radius * math::cos(polar));
+        }
+    }
+    u32* index = mesh.indices;
+    for (u32 r = 0; r < rings; r++) {
+        for (u32 s = 0; s < segments; s++) {
+            const u32 a = r * segments + s;
+            const u32 b = r * segments + (s + 1) % segments;
+            const u32 c = a + segments;
+            const u32 d = b + segments;
+            *index++ = a; *index++ = c; *index++ = b;
+            *index++ = b; *index++ = c; *index++ = d;
+        }
+    }
+}
+// The mirror meshes are far below the size where the spawn code switches to buildTreeLBVH, so
+// the LBVH builder (with and without treelet passes) only gets exercised on synthetic meshes,
+// at the sizes of the dense meshes it's meant for
+void run_lbvh(FILE* f, allocator::PagedArena scratch) {
+    struct SphereConfig { u32 triangleCount; u32 buildReps; u32 queryCount; };
+    const SphereConfig spheres[] = {
+        { 100 * 1000, 3, 200 },
+        { 1000 * 1000, 2, 50 },
+    };
+    const BuilderConfig builders[] = {
+        { "SAH 16 bins", false, { 16, 4, bvh::SplitMethod::SAH } },
+        { "LBVH", true, {}, { 30, 0, 4 } },
+        { "LBVH 1 treelet", true, {}, { 30, 1, 4 } },
+        { "LBVH 63 bits", true, {}, { 63, 1, 4 } },
+    };
+    fprintf(f, "[lbvh] bumpy spheres, builds on %u threads, random 5 plane frustum queries\n",
+        jobs::worker_count());
+    for (u32 i = 0; i < countof(spheres); i++) {
+        const SphereConfig& sphere = spheres[i];
+        allocator::PagedArena sphereScratch = scratch;
+        renderer::CPUMesh mesh;
+        make_sphere_mesh(mesh, sphereScratch, sphere.triangleCount);
+        fprintf(f, "best of %u builds, %u queries: ", sphere.buildReps, sphere.queryCount);
+        compare_builders(
+            f, sphereScratch, mesh, builders, countof(builders), sphere.buildReps, sphere.queryCount);
+    }
+    fprintf(f, "\n");
+}
+
+// Frustum queries on the 4-wide tree vs the binary tree it was collapsed from, walked the way
+// findTrianglesIntersectingFrustum used to: one child box at a time, against every plane, either
+// with all 8 corners as it used to, or with only the far and near corners, to tell the two changes
+// apart. Children of a node that's fully inside skip the tests. The far and near corner distances
+// are summed the same way in the wide query, so those two must find the same sources. The 8 corner
+// test sums in another order, so it may disagree on boxes that touch a plane
+struct FrustumStatus { enum Enum { In, Intersecting, Out }; };
+FrustumStatus::Enum box_in_frustum_8corners(
+    const float4* planes, const u32 numPlanes, const float3& min, const float3& max) {
+    const float4 boxPoints[8] = {
+        { min.x, min.y, min.z, 1.f }, { max.x, min.y, min.z, 1.f },
+        { min.x, max.y, min.z, 1.f }, { max.x, max.y, min.z, 1.f },
+        { min.x, min.y, max.z, 1.f }, { max.x, min.y, max.z, 1.f },
+        { min.x, max.y, max.z, 1.f }, { max.x, max.y, max.z, 1.f }
+    };
+    FrustumStatus::Enum status = FrustumStatus::In;
+    for (u32 p = 0; p < numPlanes; p++) {
+        u32 out = 0;
+        for (u32 c = 0; c < 8; c++) { out += math::dot(planes[p], boxPoints[c]) < 0.f; }
+        if (out == 8) { return FrustumStatus::Out; }
+        if (out > 0) { status = FrustumStatus::Intersecting; }
+    }
+    return status;
+}
+FrustumStatus::Enum box_in_frustum_corners(
+    const float4* planes, const u32 numPlanes, const float3& min, const float3& max) {
+    FrustumStatus::Enum status = FrustumStatus::In;
+    for (u32 p = 0; p < numPlanes; p++) {
+        const float4& pl = planes[p];
+        const f32 farDist = (pl.x * (pl.x > 0.f ? max.x : min.x) + pl.y * (pl.y > 0.f ? max.y : min.y))
+            + (pl.z * (pl.z > 0.f ? max.z : min.z) + pl.w);
+        if (farDist < 0.f) { return FrustumStatus::Out; }
+        const f32 nearDist = (pl.x * (pl.x > 0.f ? min.x : max.x) + pl.y * (pl.y > 0.f ? min.y : max.y))
+            + (pl.z * (pl.z > 0.f ? min.z : max.z) + pl.w);
+        if (nearDist < 0.f) { status = FrustumStatus::Intersecting; }
+    }
+    return status;
+}
+void find_triangles_binary(
+    allocator::PagedArena scratch, bool* sourceVisibility, const bvh::Tree& tree,
+    const float4* planes, const u32 numPlanes, const bool corners8) {
+    struct QueryNode { u32 nodeId; FrustumStatus::Enum status; };
+    QueryNode* nodeStack = (QueryNode*)allocator::alloc_arena(
+        scratch, tree.nodeCount * sizeof(QueryNode), alignof(QueryNode));
+    u32 stackCount = 0;
+    nodeStack[stackCount++] = { 0, FrustumStatus::Intersecting };
+    while (stackCount > 0) {
+        const QueryNode n = nodeStack[--stackCount];
+        const bvh::Node& node = tree.nodes[n.nodeId];
+        if (bvh::isLeaf(node)) {
+            for (u32 i = 0; i < node.triangleCount; i++) {
+                sourceVisibility[tree.sourceIds[node.offset + i]] = true;
+            }
+            continue;
+        }
+        for (u32 c = 0; c < 2; c++) {
+            const bvh::Node& child = tree.nodes[node.offset + c];
+            FrustumStatus::Enum status = n.status;
+            if (status != FrustumStatus::In) {
+                status = corners8 ?
+                      box_in_frustum_8corners(planes, numPlanes, child.min, child.max)
+                    : box_in_frustum_corners(planes, numPlanes, child.min, child.max);
+            }
+            if (status != FrustumStatus::Out) { nodeStack[stackCount++] = { node.offset + c, status }; }
+        }
+    }
+}
+void run_wide_queries(FILE* f, allocator::PagedArena scratch, const game::Resources& resources) {
+    const u32 reps = 3;
+    const bvh::BuildParams params = { 16, 4, bvh::SplitMethod::SAH };
+    struct QueryMesh { const char* name; u32 sphereTriangles; u32 queryCount; };
+    const QueryMesh meshes[] = {
+        { "toilet lo", 0, 2000 },
+        { "toilet hi", 0, 2000 },
+        { "sphere 100k", 100 * 1000, 200 },
+        { "sphere 1M", 1000 * 1000, 50 },
+    };
+    static_assert(countof(meshes) == game::Resources::MeshesMeta::Count + 2, "one entry per mirror mesh");
+    fprintf(f, "[wide queries] SAH 16 bins trees, best of %u runs, random 5 plane frustums, us per query\n", reps);
+    fprintf(f, "%-12s %9s %8s %8s %12s %12s %10s %8s %8s %12s\n", "", "triangles", "nodes", "wide",
+        "binary 8c", "binary 2c", "wide", "vs 8c", "vs 2c", "differ 8c, 2c");
+    for (u32 m = 0; m < countof(meshes); m++) {
+        const QueryMesh& queryMesh = meshes[m];
+        allocator::PagedArena meshScratch = scratch;
+        renderer::CPUMesh sphere;
+        const renderer::CPUMesh* mesh = &sphere;
+        if (queryMesh.sphereTriangles) { make_sphere_mesh(sphere, meshScratch, queryMesh.sphereTriangles); }
+        else { mesh = &resources.meshes[m].cpuBuffer; }
+        if (mesh->indexCount < 3) { continue; }
+        const u32 triangleCount = mesh->indexCount / 3;
+        u32* sourceIds = (u32*)allocator::alloc_arena(meshScratch, sizeof(u32) * triangleCount, alignof(u32));
+        for (u32 i = 0; i < triangleCount; i++) { sourceIds[i] = i; }
+        bvh::Tree tree;
+        bvh::BuildStats stats;
+        bvh::buildTree(meshScratch, meshScratch, tree, stats, params,
+            &(mesh->vertices[0].x), mesh->indices, mesh->indexCount, sourceIds);
+
+        float4* planes = (float4*)allocator::alloc_arena(
+            meshScratch, sizeof(float4) * 5 * queryMesh.queryCount, alignof(float4));
+        Rng rng = { 0x3c6ef372 };
+        for (u32 q = 0; q < queryMesh.queryCount; q++) {
+            random_frustum(&planes[q * 5], rng, tree.nodes[0].min, tree.nodes[0].max);
+        }
+        bool* visible[3];
+        for (u32 v = 0; v < 3; v++) { visible[v] = (bool*)allocator::alloc_arena(meshScratch, triangleCount, 1); }
+        u64 differing[2] = {};
+        for (u32 q = 0; q < queryMesh.queryCount; q++) {
+            for (u32 v = 0; v < 3; v++) { memset(visible[v], 0, triangleCount); }
+            find_triangles_binary(meshScratch, visible[0], tree, &planes[q * 5], 5, true);
+            find_triangles_binary(meshScratch, visible[1], tree, &planes[q * 5], 5, false);
+            bvh::findTrianglesIntersectingFrustum(meshScratch, visible[2], tree, &planes[q * 5], 5);
+            for (u32 i = 0; i < tree.sourceCount; i++) {
+                differing[0] += visible[0][i] != visible[2][i];
+                differing[1] += visible[1][i] != visible[2][i];
+            }
+        }
+        f64 best[3] = { 1e9, 1e9, 1e9 };
+        for (u32 rep = 0; rep < reps; rep++) {
+            for (u32 v = 0; v < 3; v++) {
+                const f64 start = platform::time_now();
+                for (u32 q = 0; q < queryMesh.queryCount; q++) {
+                    if (v < 2) { find_triangles_binary(meshScratch, visible[v], tree, &planes[q * 5], 5, v == 0); }
+                    else { bvh::findTrianglesIntersectingFrustum(meshScratch, visible[v], tree, &planes[q * 5], 5); }
+                }
+                best[v] = math::min(best[v], platform::time_now() - start);
+            }
+        }
+        const f64 us = 1e6 / queryMesh.queryCount;
+        fprintf(f, "%-12s %9u %8u %8u %12.2f %12.2f %10.2f %7.2fx %7.2fx %5llu, %5llu\n",
+            queryMesh.name, triangleCount, tree.nodeCount, tree.wideNodeCount,
+            best[0] * us, best[1] * us, best[2] * us, best[0] / best[2], best[1] / best[2],
+            (unsigned long long)differing[0], (unsigned long long)differing[1]);
+    }
+    fprintf(f, "\n");
+}
+
+// Ray throughput on the mirror meshes, one ray at a time vs packets, for closest and any hit.
+// Camera rays are 2x2 pixel quads of 64x64 views of the mesh, so packets are coherent; random
+// rays go between two points of the mesh's bounding sphere, the worst case for packets.
+// Packets must find the same hits as single rays
+void run_rays(FILE* f, allocator::PagedArena scratch, const game::Resources& resources) {
+    const u32 reps = 3;
+    const u32 viewCount = 8;
+    const u32 viewSize = 64;
+    const u32 rayCount = viewCount * viewSize * viewSize;
+    const bvh::BuildParams params = { 16, 4, bvh::SplitMethod::SAH };
+    const char* meshNames[] = { "throne", "mid-smooth" };
+    static_assert(countof(meshNames) == game::Resources::MeshesMeta::Count, "one name per mirror mesh");
+    fprintf(f, "[rays] SAH 16 bins trees, %u rays per set, best of %u runs, Mrays/s\n", rayCount, reps);
+    fprintf(f, "%-12s %-8s %10s %10s %8s %10s %10s %8s %8s %8s\n", "", "rays",
+        "closest 1", "closest 4", "speedup", "any 1", "any 4", "speedup", "hit %", "differ");
+    for (u32 m = 0; m < game::Resources::MeshesMeta::Count; m++) {
+        allocator::PagedArena meshScratch = scratch;
+        const renderer::CPUMesh& mesh = resources.meshes[m].cpuBuffer;
+        if (mesh.indexCount < 3) { continue; }
+        const u32 triangleCount = mesh.indexCount / 3;
+        u32* sourceIds = (u32*)allocator::alloc_arena(meshScratch, sizeof(u32) * triangleCount, alignof(u32));
+        for (u32 i = 0; i < triangleCount; i++) { sourceIds[i] = i; }
+        bvh::Tree tree;
+        bvh::BuildStats stats;
+        bvh::buildTree(meshScratch, meshScratch, tree, stats, params,
+            &(mesh.vertices[0].x), mesh.indices, mesh.indexCount, sourceIds);
+        // sources are numbered in leaf order, sourceOrder maps them back to the triangles
+        float3* vertices = (float3*)allocator::alloc_arena(
+            meshScratch, sizeof(float3) * 3 * tree.sourceCount, alignof(float3));
+        u32* vertexOffsets = (u32*)allocator::alloc_arena(
+            meshScratch, sizeof(u32) * (tree.sourceCount + 1), alignof(u32));
+        for (u32 i = 0; i < tree.sourceCount; i++) {
+            const u32 triangle = tree.sourceOrder[i];
+            for (u32 v = 0; v < 3; v++) { vertices[i * 3 + v] = mesh.vertices[mesh.indices[triangle * 3 + v]]; }
+            vertexOffsets[i] = i * 3;
+        }
+        vertexOffsets[tree.sourceCount] = tree.sourceCount * 3;
+        const bvh::RaySources sources = { vertices, vertexOffsets };
+
+        const float3 boundsMin = tree.nodes[0].min, boundsMax = tree.nodes[0].max;
+        const float3 center = math::scale(math::add(boundsMin, boundsMax), 0.5f);
+        const f32 radius = 0.5f * math::mag(math::subtract(boundsMax, boundsMin));
+        bvh::RayPacket* packets = (bvh::RayPacket*)allocator::alloc_arena(
+            meshScratch, sizeof(bvh::RayPacket) * rayCount / bvh::rayPacketSize, alignof(bvh::RayPacket));
+        bvh::Ray* rays = (bvh::Ray*)allocator::alloc_arena(
+            meshScratch, sizeof(bvh::Ray) * rayCount, alignof(bvh::Ray));
+        bvh::RayHit* hits[2];
+        for (u32 h = 0; h < 2; h++) {
+            hits[h] = (bvh::RayHit*)allocator::alloc_arena(
+                meshScratch, sizeof(bvh::RayHit) * rayCount, alignof(bvh::RayHit));
+        }
+        Rng rng = { 0xbb67ae85 };
+        for (u32 set = 0; set < 2; set++) {
+            if (set == 0) {
+                // rays of a packet are the pixels of a 2x2 quad, at 30 degrees fov
+                const f32 pixelSize = 2.f * math::sin(15.f * math::d2r32) / math::cos(15.f * math::d2r32) / viewSize;
+                for (u32 view = 0; view < viewCount; view++) {
+                    const float3 eye = math::add(center, math::scale(random_direction(rng), radius * 2.5f));
+                    const float3 front = math::normalize(math::subtract(center, eye));
+                    const float3 worldUp = math::abs(front.z) < 0.99f ? float3(0.f, 0.f, 1.f) : float3(1.f, 0.f, 0.f);
+                    const float3 right = math::normalize(math::cross(front, worldUp));
+                    const float3 up = math::cross(right, front);
+                    for (u32 quad = 0; quad < viewSize * viewSize / 4; quad++) {
+                        for (u32 lane = 0; lane < 4; lane++) {
+                            const u32 x = (quad % (viewSize / 2)) * 2 + (lane & 1);
+                            const u32 y = (quad / (viewSize / 2)) * 2 + (lane >> 1);
+                            const f32 px = (x + 0.5f - viewSize * 0.5f) * pixelSize;
+                            const f32 py = (y + 0.5f - viewSize * 0.5f) * pixelSize;
+                            const float3 dir = math::add(front,
+                                math::add(math::scale(right, px), math::scale(up, py)));
+                            rays[(view * viewSize * viewSize / 4 + quad) * 4 + lane] = { eye, dir, FLT_MAX };
+                        }
+                    }
+                }
+            } else {
+                for (u32 r = 0; r < rayCount; r++) {
+                    const float3 from = math::add(center, math::scale(random_direction(rng), radius));
+                    const float3 to = math::add(center, math::scale(random_direction(rng), radius));
+                    rays[r] = { from, math::subtract(to, from), 1.f };
+                }
+            }
+            for (u32 p = 0; p < rayCount / bvh::rayPacketSize; p++) {
+                bvh::RayPacket& packet = packets[p];
+                for (u32 lane = 0; lane < bvh::rayPacketSize; lane++) {
+                    const bvh::Ray& ray = rays[p * bvh::rayPacketSize + lane];
+                    packet.originX[lane] = ray.origin.x; packet.originY[lane] = ray.origin.y;
+                    packet.originZ[lane] = ray.origin.z;
+                    packet.dirX[lane] = ray.dir.x; packet.dirY[lane] = ray.dir.y; packet.dirZ[lane] = ray.dir.z;
+                    packet.tMax[lane] = ray.tMax;
+                }
+            }
+
+            f64 best[4] = { 1e9, 1e9, 1e9, 1e9 }; // closest single, packet, any single, packet
+            u64 hitCount = 0, differing = 0;
+            for (u32 rep = 0; rep < reps; rep++) {
+                for (u32 mode = 0; mode < 2; mode++) {
+                    const bvh::RayMode::Enum rayMode = mode == 0 ? bvh::RayMode::ClosestHit : bvh::RayMode::AnyHit;
+                    u32 singleHits = 0, packetHits = 0;
+                    f64 start = platform::time_now();
+                    for (u32 r = 0; r < rayCount; r++) {
+                        hits[0][r].sourceId = bvh::noSource;
+                        singleHits += bvh::intersectRay(hits[0][r], tree, sources, rays[r], rayMode);
+                    }
+                    best[mode * 2] = math::min(best[mode * 2], platform::time_now() - start);
+                    start = platform::time_now();
+                    for (u32 p = 0; p < rayCount / bvh::rayPacketSize; p++) {
+                        const u32 hitMask = bvh::intersectRayPacket(
+                            &hits[1][p * bvh::rayPacketSize], tree, sources, packets[p], rayMode);
+                        for (u32 mask = hitMask; mask; mask &= mask - 1) { packetHits++; }
+                    }
+                    best[mode * 2 + 1] = math::min(best[mode * 2 + 1], platform::time_now() - start);
+                    if (rep > 0) { continue; }
+                    // any hit can stop at a different hit in each version, only whether it hit must match
+                    for (u32 r = 0; r < rayCount; r++) {
+                        const bool hitSingle = hits[0][r].sourceId != bvh::noSource;
+                        const bool hitPacket = hits[1][r].sourceId != bvh::noSource;
+                        differing += hitSingle != hitPacket
+                            || (mode == 0 && hits[0][r].sourceId != hits[1][r].sourceId);
+                    }
+                    differing += singleHits != packetHits;
+                    if (mode == 0) { hitCount = singleHits; }
+                }
+            }
+            const f64 mrays = rayCount * 1e-6;
+            fprintf(f, "%-12s %-8s %10.2f %10.2f %7.2fx %10.2f %10.2f %7.2fx %7.1f%% %8llu\n",
+                meshNames[m], set == 0 ? "camera" : "random",
+                mrays / best[0], mrays / best[1], best[0] / best[1],
+                mrays / best[2], mrays / best[3], best[2] / best[3],
+                100. * hitCount / rayCount, (unsigned long long)differing);
+        }
+    }
+    fprintf(f, "\n");
+}
+
+// Draw node culling through the scene's cull tree vs testing every node, as computeVisibilityWS did
+// before, from 100 to 100k nodes spread at the same density. A tenth of the nodes move each frame,
+// which is what updateCullTree pays for. Both must find the same visible nodes
+void run_cull_scaling(FILE* f, allocator::PagedArena scratch) {
+    const u32 nodeCounts[] = { 100, 1000, 10 * 1000, 100 * 1000 };
+    const u32 queryCount = 200;
+    const u32 frameCount = 16;
+    const u32 reps = 3;
+    fprintf(f, "[cull scaling] random rotated 1-3 unit boxes, %u random 6 plane frustums, best of %u runs\n",
+        queryCount, reps);
+    fprintf(f, "%-8s %10s %12s %12s %12s %8s %10s %10s %8s\n", "nodes", "build ms", "update us",
+        "linear us", "tree us", "speedup", "candidates", "visible", "differ");
+    for (u32 c = 0; c < countof(nodeCounts); c++) {
+        const u32 nodeCount = nodeCounts[c];
+        allocator::PagedArena countScratch = scratch;
+        renderer::Scene scene = {};
+        allocator::init_pool(scene.drawNodes, nodeCount, countScratch);
+        renderer::initCullTree(scene, countScratch);
+        const f32 halfSide = 5.f * ::cbrtf((f32)nodeCount);
+        Rng rng = { 0x6a09e667 };
+        for (u32 n = 0; n < nodeCount; n++) {
+            renderer::DrawNode& node = allocator::alloc_pool(scene.drawNodes);
+            node = {};
+            const float3 axis = random_direction(rng);
+            const float3 side = math::normalize(math::cross(axis, random_direction(rng)));
+            float4x4& m = node.nodeData.worldMatrix;
+            m.col0 = float4(axis, 0.f);
+            m.col1 = float4(side, 0.f);
+            m.col2 = float4(math::cross(axis, side), 0.f);
+            m.col3 = float4(
+                (randf(rng) * 2.f - 1.f) * halfSide, (randf(rng) * 2.f - 1.f) * halfSide,
+                (randf(rng) * 2.f - 1.f) * halfSide, 1.f);
+            node.max = float3(0.5f + randf(rng), 0.5f + randf(rng), 0.5f + randf(rng));
+            node.min = math::negate(node.max);
+            renderer::markCullDirty(scene, renderer::handle_from_node(scene, node));
+        }
+        f64 start = platform::time_now();
+        renderer::updateCullTree(scene);
+        const f64 buildTime = platform::time_now() - start;
+        // small moves, a few of which leave their fat bounds
+        const u32 movedCount = math::max(nodeCount / 10, 1u);
+        f64 updateTime = 1e9;
+        for (u32 frame = 0; frame < frameCount; frame++) {
+            for (u32 i = 0; i < movedCount; i++) {
+                const u32 n = next(rng) % nodeCount;
+                float4x4& m = scene.drawNodes.data[n].state.live.nodeData.worldMatrix;
+                m.col3.xyz = math::add(m.col3.xyz, math::scale(random_direction(rng), 0.2f));
+                renderer::markCullDirty(scene, n + 1);
+            }
+            start = platform::time_now();
+            renderer::updateCullTree(scene);
+            updateTime = math::min(updateTime, platform::time_now() - start);
+        }
+
+        renderer::Frustum* frustums = (renderer::Frustum*)allocator::alloc_arena(
+            countScratch, sizeof(renderer::Frustum) * queryCount, alignof(renderer::Frustum));
+        // cameras look at a random spot in the world, and see up to a far plane past the near one,
+        // so the visible count stops growing with the world size
+        const f32 farDist = 100.f;
+        for (u32 q = 0; q < queryCount; q++) {
+            const float3 target(
+                (randf(rng) * 2.f - 1.f) * halfSide, (randf(rng) * 2.f - 1.f) * halfSide,
+                (randf(rng) * 2.f - 1.f) * halfSide);
+            const float3 targetExtents(20.f, 20.f, 20.f);
+            float4* planes = frustums[q].planes;
+            random_frustum(
+                planes, rng, math::subtract(target, targetExtents), math::add(target, targetExtents));
+            planes[5] = float4(math::negate(planes[0].xyz), farDist - planes[0].w);
+            frustums[q].numPlanes = 6;
+        }
+        u32* visibleLinear = (u32*)allocator::alloc_arena(countScratch, sizeof(u32) * nodeCount, alignof(u32));
+        u32* isEachNodeVisible = (u32*)allocator::alloc_arena(countScratch, sizeof(u32) * nodeCount, alignof(u32));
+        u64 candidates = 0, visible = 0, differing = 0;
+        for (u32 q = 0; q < queryCount; q++) {
+            allocator::PagedArena queryScratch = countScratch;
+            memset(visibleLinear, 0, sizeof(u32) * nodeCount);
+            memset(isEachNodeVisible, 0, sizeof(u32) * nodeCount);
+            for (u32 n = 0; n < nodeCount; n++) {
+                visibleLinear[n] = renderer::isNodeVisibleWS(frustums[q], scene.drawNodes.data[n].state.live);
+            }
+            renderer::VisibleNodes visibleNodes;
+            renderer::computeVisibilityWS(queryScratch, visibleNodes, isEachNodeVisible, frustums[q], scene);
+            u32* candidateIds = (u32*)allocator::alloc_arena(queryScratch, sizeof(u32) * nodeCount, alignof(u32));
+            candidates += aabbtree::findLeavesIntersectingFrustum(
+                candidateIds, scene.cullTree, frustums[q].planes, frustums[q].numPlanes);
+            visible += visibleNodes.visible_nodes_count;
+            for (u32 n = 0; n < nodeCount; n++) { differing += (visibleLinear[n] != 0) != (isEachNodeVisible[n] != 0); }
+        }
+        f64 best[2] = { 1e9, 1e9 };
+        for (u32 rep = 0; rep < reps; rep++) {
+            start = platform::time_now();
+            u64 sum = 0;
+            for (u32 q = 0; q < queryCount; q++) {
+                u32 count = 0;
+                for (u32 n = 0; n < nodeCount; n++) {
+                    if (renderer::isNodeVisibleWS(frustums[q], scene.drawNodes.data[n].state.live)) {
+                        visibleLinear[count++] = n;
+                    }
+                }
+                sum += count;
+            }
+            best[0] = math::min(best[0], platform::time_now() - start);
+            start = platform::time_now();
+            for (u32 q = 0; q < queryCount; q++) {
+                allocator::PagedArena queryScratch = countScratch;
+                renderer::VisibleNodes visibleNodes;
+                renderer::computeVisibilityWS(queryScratch, visibleNodes, isEachNodeVisible, frustums[q], scene);
+                sum += visibleNodes.visible_nodes_count;
+            }
+            best[1] = math::min(best[1], platform::time_now() - start);
+            sink += sum;
+        }
+        fprintf(f, "%-8u %10.3f %12.2f %12.2f %12.2f %7.2fx %10.1f %10.1f %8llu\n",
+            nodeCount, buildTime * 1e3, updateTime * 1e6, best[0] * 1e6 / queryCount,
+            best[1] * 1e6 / queryCount, best[0] / best[1], candidates / (f64)queryCount,
+            visible / (f64)queryCount, (unsigned long long)differing);
+    }
+    fprintf(f, "\n");
+}
+
+// Classifying the mirrors 4 at a time and only clipping the ones that straddle a plane, 4 at a
+// time too, vs clipping every mirror, as find_mirrorPortals did before. Both must keep the same polys
+void run_mirror_classify(FILE* f, allocator::PagedArena scratch, const game::Resources& resources) {
+    const u32 frustumCount = 500;
+    const u32 reps = 5;
+    fprintf(f, "[mirror classify] best of %u runs, %u random 5 plane frustums\n", reps, frustumCount);
+    fprintf(f, "%-8s %8s %8s %8s %10s %14s %14s %8s %10s\n",
+        "", "mirrors", "culled", "inside", "straddling", "clip Mpolys/s", "batch Mpolys/s", "speedup", "differing");
+    for (u32 m = 0; m < game::Resources::MeshesMeta::Count; m++) {
+        allocator::PagedArena meshScratch = scratch;
+        const game::GPUCPUMesh& mesh = resources.meshes[m];
+        if (mesh.cpuBuffer.indexCount < 3) { continue; }
+        u32 mirrorCount = 0, vertexCount = 0;
+        game::count_mirrors(mirrorCount, vertexCount, mesh.cpuBuffer);
+        game::Mirrors mirrors;
+        game::alloc_mirrors(mirrors, mirrorCount, vertexCount, 1, meshScratch);
+        game::spawn_model_as_mirrors(mirrors, mesh, meshScratch, meshScratch, false, nullptr);
+
+        float3 boxMin(FLT_MAX, FLT_MAX, FLT_MAX), boxMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (u32 i = 0; i < mesh.cpuBuffer.vertexCount; i++) {
+            boxMin = math::min(boxMin, mesh.cpuBuffer.vertices[i]);
+            boxMax = math::max(boxMax, mesh.cpuBuffer.vertices[i]);
+        }
+        renderer::Frustum* frustums = (renderer::Frustum*)allocator::alloc_arena(
+            meshScratch, sizeof(renderer::Frustum) * frustumCount, alignof(renderer::Frustum));
+        Rng rng = { 0x2545f491 };
+        for (u32 q = 0; q < frustumCount; q++) {
+            random_frustum(frustums[q].planes, rng, boxMin, boxMax);
+            frustums[q].numPlanes = 5;
+        }
+        u32* ids = (u32*)allocator::alloc_arena(meshScratch, sizeof(u32) * mirrors.count, alignof(u32));
+        for (u32 i = 0; i < mirrors.count; i++) { ids[i] = i; }
+        MirrorPortals portals;
+        portals.portals = (u32*)allocator::alloc_arena(meshScratch, sizeof(u32) * mirrors.count, alignof(u32));
+        portals.polys = (MirrorPortalPoly*)allocator::alloc_arena(
+            meshScratch, sizeof(MirrorPortalPoly) * mirrors.count, alignof(MirrorPortalPoly));
+
+        // correctness, and how the mirrors split: a culled poly must clip away, an inside one
+        // must clip to itself, and a straddling one is clipped the same way in both paths
+        u64 culled = 0, inside = 0, straddling = 0, differing = 0;
+        for (u32 q = 0; q < frustumCount; q++) {
+            const renderer::Frustum& frustum = frustums[q];
+            portals.count = 0;
+            for (u32 i = 0; i < mirrors.count; i += 4) {
+                portals.count = classify_mirrorPortals(
+                    portals.portals, portals.count, &ids[i], math::min(mirrors.count - i, 4u), mirrors, frustum);
+            }
+            culled += mirrors.count - portals.count;
+            for (u32 p = 0; p < portals.count; p++) {
+                if (portals.portals[p] & portalNeedsClipping) { straddling++; }
+                else { inside++; }
+            }
+            clip_mirrorPortals(portals, mirrors, frustum);
+            u32 p = 0;
+            for (u32 i = 0; i < mirrors.count; i++) {
+                float3 clipped[MAX_MIRROR_POLY_VERTICES];
+                u32 clippedCount = game::mirror_vertex_count(mirrors, i);
+                memcpy(clipped, game::mirror_vertices(mirrors, i), sizeof(float3) * clippedCount);
+                clip_poly_in_frustum(
+                    clipped, clippedCount, frustum.planes, frustum.numPlanes, countof(clipped));
+                const bool kept = clippedCount >= 3;
+                if (p == portals.count || (portals.portals[p] & ~portalNeedsClipping) != i) {
+                    differing += kept;
+                    continue;
+                }
+                const u32 portal = portals.portals[p];
+                const float3* poly = game::mirror_vertices(mirrors, i);
+                u32 polyCount = game::mirror_vertex_count(mirrors, i);
+                if (portal & portalNeedsClipping) {
+                    poly = portals.polys[p].vertices;
+                    polyCount = portals.polys[p].count;
+                }
+                p++;
+                differing += !kept
+                    || polyCount != clippedCount || memcmp(poly, clipped, sizeof(float3) * polyCount);
+            }
+        }
+
+        f64 clipTime = 1e9, batchTime = 1e9;
+        for (u32 rep = 0; rep < reps; rep++) {
+            f64 start = platform::time_now();
+            for (u32 q = 0; q < frustumCount; q++) {
+                const renderer::Frustum& frustum = frustums[q];
+                for (u32 i = 0; i < mirrors.count; i++) {
+                    float3 poly[MAX_MIRROR_POLY_VERTICES];
+                    u32 polyCount = game::mirror_vertex_count(mirrors, i);
+                    memcpy(poly, game::mirror_vertices(mirrors, i), sizeof(float3) * polyCount);
+                    clip_poly_in_frustum(poly, polyCount, frustum.planes, frustum.numPlanes, countof(poly));
+                    sink += polyCount;
+                }
+            }
+            clipTime = math::min(clipTime, platform::time_now() - start);
+            start = platform::time_now();
+            for (u32 q = 0; q < frustumCount; q++) {
+                const renderer::Frustum& frustum = frustums[q];
+                portals.count = 0;
+                for (u32 i = 0; i < mirrors.count; i += 4) {
+                    portals.count = classify_mirrorPortals(
+                        portals.portals, portals.count, &ids[i], math::min(mirrors.count - i, 4u), mirrors, frustum);
+                }
+                clip_mirrorPortals(portals, mirrors, frustum);
+                sink += portals.count;
+            }
+            batchTime = math::min(batchTime, platform::time_now() - start);
+        }
+
+        const f64 total = (f64)frustumCount * mirrors.count;
+        fprintf(f, "mesh %-3u %8u %7.1f%% %7.1f%% %9.1f%% %14.1f %14.1f %7.2fx %10llu\n",
+            m, mirrors.count, 100. * culled / total, 100. * inside / total, 100. * straddling / total,
+            total / clipTime * 1e-6, total / batchTime * 1e-6, clipTime / batchTime,
+            (unsigned long long)differing);
+    }
+    fprintf(f, "\n");
+}
+
+// The camera tree as parallel arrays, vs the single node struct it used to be (links, planes,
+// matrices and the 256 byte GPU marker name of profile builds, 640 bytes). The trees are the Hall's,
+// gathered in full at its max bounce depth from random orbit poses, and laid out back to back.
+// Each pass reads what the game reads: the walk follows renderMirrorTree (links, and the matrices
+// of each node and its parent), and the cull tests a few boxes against each node's planes, like
+// the culling loop in update. Cold runs evict the trees from the cache first
+struct CameraNodeAoS {
+    float4x4 viewMatrix;
+    float4x4 projectionMatrix;
+    float4x4 vpMatrix;
+    renderer::Frustum frustum;
+    float3 pos;
+    u32 depth;
+    u32 siblingIndex;
+    u32 parentIndex;
+    u32 sourceId;
+    char str[256];
+};
+struct CameraTreeLayouts {
+    CameraNodeAoS* aos;
+    CameraNode* nodes;
+    renderer::Frustum* frustums;
+    Camera* cameras;
+    u32* treeStarts; // one per tree, plus the total node count
+    u32 treeCount;
+};
+// The tree must have been gathered in full, the same way update does without workers
+u32 gather_poseTree(
+    CameraTree& tree, allocator::PagedArena scratch, const Camera& camera, const game::Mirrors& mirrors,
+    const u32 maxDepth) {
+    clear_cameraTree(tree);
+    const u32 rootIndex = push_cameraNode(tree);
+    CameraNode& root = allocator::at(tree.nodes, rootIndex);
+    root = {};
+    root.sourceId = root.parentIndex = 0xffffffff;
+    allocator::at(tree.cameras, rootIndex) = camera;
+    renderer::Frustum& frustum = allocator::at(tree.frustums, rootIndex);
+    frustum = {};
+    renderer::extract_frustum_planes_from_vp(frustum.planes, camera.vpMatrix);
+    frustum.numPlanes = 6;
+    __PROFILEONLY(allocator::at(tree.names, rootIndex).str[0] = '\0';)
+    GatherMirrorTreeContext ctx = { tree, mirrors, maxDepth };
+    const u32 count = gatherMirrorTreeRecursive(ctx, scratch, 1);
+    allocator::at(tree.nodes, rootIndex).siblingIndex = count;
+    return count;
+}
+u64 walk_cameraTrees(const CameraTreeLayouts& trees, u32* parents, const bool aos) {
+    u64 sum = 0;
+    for (u32 t = 0; t < trees.treeCount; t++) {
+        const u32 base = trees.treeStarts[t];
+        const u32 numCameras = trees.treeStarts[t + 1] - base;
+        u32 parentCount = 0;
+        parents[parentCount++] = 0;
+        for (u32 index = 1; index < numCameras; index++) {
+            const u32 parentIndex = parents[parentCount - 1];
+            if (aos) {
+                const CameraNodeAoS& camera = trees.aos[base + index];
+                const CameraNodeAoS& parent = trees.aos[base + parentIndex];
+                sum += camera.sourceId + parent.depth + (u32)(camera.vpMatrix.m[0] + parent.vpMatrix.m[15]);
+            } else {
+                const CameraNode& camera = trees.nodes[base + index];
+                const CameraNode& parent = trees.nodes[base + parentIndex];
+                sum += camera.sourceId + parent.depth
+                    + (u32)(trees.cameras[base + index].vpMatrix.m[0]
+                            + trees.cameras[base + parentIndex].vpMatrix.m[15]);
+            }
+            parents[parentCount++] = index;
+            while (parentCount > 1) {
+                const u32 last = base + parents[parentCount - 1];
+                const u32 siblingIndex = aos ? trees.aos[last].siblingIndex : trees.nodes[last].siblingIndex;
+                if (index + 1 < siblingIndex) { break; }
+                parentCount--;
+            }
+        }
+    }
+    return sum;
+}
+u64 cull_cameraTrees(const CameraTreeLayouts& trees, const float3* boxes, const u32 boxCount, const bool aos) {
+    u64 visible = 0;
+    for (u32 n = 0; n < trees.treeStarts[trees.treeCount]; n++) {
+        const renderer::Frustum& frustum = aos ? trees.aos[n].frustum : trees.frustums[n];
+        for (u32 b = 0; b < boxCount; b++) {
+            const float3& center = boxes[b * 2];
+            const float3& extents = boxes[b * 2 + 1];
+            bool inside = true;
+            for (u32 p = 0; p < frustum.numPlanes && inside; p++) {
+                const float4& plane = frustum.planes[p];
+                const f32 r = extents.x * math::abs(plane.x) + extents.y * math::abs(plane.y)
+                    + extents.z * math::abs(plane.z);
+                inside = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w + r >= 0.f;
+            }
+            visible += inside;
+        }
+    }
+    return visible;
+}
+void run_camera_tree_layout(
+    FILE* f, allocator::PagedArena scratch, CameraTree& tree, const game::Resources& resources) {
+    const u32 poseCount = 64;
+    const u32 boxCount = 16;
+    const u32 reps = 20;
+    const size_t evictSize = 32 * 1024 * 1024;
+    u32 roomId = 0;
+    while (game::roomDefinitions[roomId].mirrorMesh != game::Resources::MeshesMeta::Count) { roomId++; }
+    const game::RoomDefinition& hall = game::roomDefinitions[roomId];
+
+    u32 mirrorCount = 0, vertexCount = 0;
+    for (u32 m = 0; m < game::Resources::MirrorHallMeta::Count; m++) {
+        game::count_mirrors(mirrorCount, vertexCount, resources.mirrorHallMeshes[m].cpuBuffer);
+    }
+    game::Mirrors mirrors;
+    game::alloc_mirrors(mirrors, mirrorCount, vertexCount, game::Resources::MirrorHallMeta::Count, scratch);
+    for (u32 m = 0; m < game::Resources::MirrorHallMeta::Count; m++) {
+        game::spawn_model_as_mirrors(mirrors, resources.mirrorHallMeshes[m], scratch, scratch, false, nullptr);
+    }
+    float3 boxMin(FLT_MAX, FLT_MAX, FLT_MAX), boxMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (u32 i = 0; i < mirrors.count; i++) {
+        const float3* v = game::mirror_vertices(mirrors, i);
+        for (u32 j = 0; j < game::mirror_vertex_count(mirrors, i); j++) {
+            boxMin = math::min(boxMin, v[j]);
+            boxMax = math::max(boxMax, v[j]);
+        }
+    }
+    Rng rng = { 0x68e31da4 };
+    float3* boxes = (float3*)allocator::alloc_arena(scratch, sizeof(float3) * boxCount * 2, alignof(float3));
+    for (u32 b = 0; b < boxCount; b++) {
+        boxes[b * 2] = float3(
+            math::lerp(randf(rng), boxMin.x, boxMax.x), math::lerp(randf(rng), boxMin.y, boxMax.y),
+            math::lerp(randf(rng), boxMin.z, boxMax.z));
+        boxes[b * 2 + 1] = float3(1.f + randf(rng) * 4.f, 1.f + randf(rng) * 4.f, 1.f + randf(rng) * 4.f);
+    }
+
+    // one pass to size the layouts, and another to fill them
+    Camera* poses = (Camera*)allocator::alloc_arena(scratch, sizeof(Camera) * poseCount, alignof(Camera));
+    CameraTreeLayouts trees = {};
+    trees.treeCount = poseCount;
+    trees.treeStarts = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * (poseCount + 1), alignof(u32));
+    u32 nodeCount = 0, maxCount = 0;
+    for (u32 pose = 0; pose < poseCount; pose++) {
+        game::OrbitInput orbit = {};
+        orbit.offset = float3(0.f, -100.f, 0.f);
+        orbit.eulers = float3(
+            math::lerp(randf(rng), hall.minCameraEulers.x, hall.maxCameraEulers.x),
+            math::lerp(randf(rng), hall.minCameraEulers.y, hall.maxCameraEulers.y),
+            math::lerp(randf(rng), hall.minCameraEulers.z, hall.maxCameraEulers.z));
+        orbit.scale = math::lerp(randf(rng), hall.minCameraZoom, hall.maxCameraZoom);
+        Transform transform;
+        game::updateOrbit(transform, orbit);
+        Camera& camera = poses[pose];
+        camera = {};
+        camera::generate_matrix_view(camera.viewMatrix, transform);
+        camera.projectionMatrix = resources.renderCore.perspProjection.matrix;
+        camera.vpMatrix = math::mult(camera.projectionMatrix, camera.viewMatrix);
+        camera.pos = transform.pos;
+        const u32 count = gather_poseTree(tree, scratch, camera, mirrors, hall.maxMirrorBounces);
+        trees.treeStarts[pose] = nodeCount;
+        nodeCount += count;
+        maxCount = math::max(maxCount, count);
+    }
+    trees.treeStarts[poseCount] = nodeCount;
+    trees.aos = (CameraNodeAoS*)allocator::alloc_arena(
+        scratch, sizeof(CameraNodeAoS) * nodeCount, alignof(CameraNodeAoS));
+    trees.nodes = (CameraNode*)allocator::alloc_arena(scratch, sizeof(CameraNode) * nodeCount, alignof(CameraNode));
+    trees.frustums = (renderer::Frustum*)allocator::alloc_arena(
+        scratch, sizeof(renderer::Frustum) * nodeCount, alignof(renderer::Frustum));
+    trees.cameras = (Camera*)allocator::alloc_arena(scratch, sizeof(Camera) * nodeCount, alignof(Camera));
+    for (u32 pose = 0; pose < poseCount; pose++) {
+        const u32 count = gather_poseTree(tree, scratch, poses[pose], mirrors, hall.maxMirrorBounces);
+        for (u32 i = 0, n = trees.treeStarts[pose]; i < count; i++, n++) {
+            const CameraNode& node = allocator::at(tree.nodes, i);
+            const Camera& camera = allocator::at(tree.cameras, i);
+            CameraNodeAoS& a = trees.aos[n];
+            a = {};
+            a.viewMatrix = camera.viewMatrix;
+            a.projectionMatrix = camera.projectionMatrix;
+            a.vpMatrix = camera.vpMatrix;
+            a.frustum = allocator::at(tree.frustums, i);
+            a.pos = camera.pos;
+            a.depth = node.depth;
+            a.siblingIndex = node.siblingIndex;
+            a.parentIndex = node.parentIndex;
+            a.sourceId = node.sourceId;
+            trees.nodes[n] = node;
+            trees.frustums[n] = a.frustum;
+            trees.cameras[n] = camera;
+        }
+    }
+    u32* parents = (u32*)allocator::alloc_arena(scratch, sizeof(u32) * maxCount, alignof(u32));
+    u8* evict = (u8*)allocator::alloc_arena(scratch, evictSize, 64);
+
+    // walk and cull, aos and split, hot and cold
+    f64 best[2][2][2];
+    u64 results[2][2] = {};
+    for (u32 i = 0; i < 8; i++) { (&best[0][0][0])[i] = 1e9; }
+    for (u32 rep = 0; rep < reps; rep++) {
+        for (u32 cold = 0; cold < 2; cold++) {
+            for (u32 pass = 0; pass < 2; pass++) {
+                for (u32 aos = 0; aos < 2; aos++) {
+                    if (cold) { memset(evict, (u8)rep, evictSize); }
+                    const f64 start = platform::time_now();
+                    results[pass][aos] = pass == 0 ?
+                          walk_cameraTrees(trees, parents, aos)
+                        : cull_cameraTrees(trees, boxes, boxCount, aos);
+                    best[pass][aos][cold] = math::min(best[pass][aos][cold], platform::time_now() - start);
+                    sink += results[pass][aos];
+                }
+            }
+        }
+    }
+
+    fprintf(f, "[camera tree layout] hall at %u bounces, %u orbit poses, %u cameras (up to %u per tree), "
+        "best of %u runs\n", hall.maxMirrorBounces, poseCount, nodeCount, maxCount, reps);
+    fprintf(f, "%zu byte nodes vs %zu + %zu + %zu byte arrays, %u boxes culled per camera\n",
+        sizeof(CameraNodeAoS), sizeof(CameraNode), sizeof(renderer::Frustum), sizeof(Camera), boxCount);
+    fprintf(f, "%-6s %-5s %12s %12s %8s %8s\n", "", "", "nodes us", "split us", "speedup", "same");
+    const char* passes[] = { "walk", "cull" };
+    const char* caches[] = { "hot", "cold" };
+    for (u32 pass = 0; pass < 2; pass++) {
+        for (u32 cold = 0; cold < 2; cold++) {
+            fprintf(f, "%-6s %-5s %12.1f %12.1f %7.2fx %8s\n", passes[pass], caches[cold],
+                best[pass][1][cold] * 1e6, best[pass][0][cold] * 1e6, best[pass][1][cold] / best[pass][0][cold],
+                results[pass][0] == results[pass][1] ? "yes" : "no");
+        }
+    }
+    fprintf(f, "\n");
+}
+
+// The arena is taken by copy, and the caller is expected to decommit any pages the benchmarks used,
+// in the concurrent arena too, which is left reset. The camera tree is only used as scratch
+bool run_all(
+    const char* path, allocator::PagedArena scratch, allocator::ConcurrentArena& concurrentArena,
+    CameraTree& cameraTree, const game::Resources& resources) {
+    FILE* f;
+    if (platform::fopen(&f, path, "w") != 0) { return false; }
+    fprintf(f, "%s\n\n", platform::name);
+    run_pools(f, scratch);
+    run_tlsf(f, scratch);
+    run_concurrent_arena(f, scratch, concurrentArena);
+    run_bvh_builders(f, scratch, resources);
+    run_lbvh(f, scratch);
+    run_wide_queries(f, scratch, resources);
+    run_rays(f, scratch, resources);
+    run_cull_scaling(f, scratch);
+    run_mirror_classify(f, scratch, resources);
+    run_camera_tree_layout(f, scratch, cameraTree, resources);
+    platform::fclose(f);
+    return true;
+}
+
+}
+
+#endif // __WASTELADNS_BENCHMARKS_H__
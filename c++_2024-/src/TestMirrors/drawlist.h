@@ -106,12 +106,12 @@ struct DrawMesh { // id of a piece of geometry loaded on the gpu
 };
 struct CPUMesh {
     float3* vertices;
-    u16* indices;
+    u32* indices; // u32, so meshes aren't limited to 65k vertices
     u32 vertexCount;
     u32 indexCount;
 };
 struct DrawNode { // List of meshes (one of each type), and their render data in the scene
-    void* ext_data;
+    u32 animationHandle; // animation::Handle of the node's skinning data, 0 if not skinned
     float3 min;
     float3 max;
     u32 cbuffer_node;
@@ -170,6 +170,11 @@ struct Scene {
     allocator::Pool<DrawNode> drawNodes;
     allocator::Pool<DrawNodeInstanced> instancedDrawNodes;
     allocator::Pool<driver::RscCBuffer> cbuffers;
+    aabbtree::Tree cullTree; // world space bounds of the live drawNodes, user ids are pool indices
+    u32* cullLeaves; // cullTree leaf of each drawNodes slot, or aabbtree::nullNode
+    u32* cullDirtyNodes; // drawNodes slots to refit on the next updateCullTree, see markCullDirty
+    u8* cullDirty; // whether each drawNodes slot is already in cullDirtyNodes
+    u32 cullDirtyCount;
 };
 struct CoreResources {
     driver::RscShaderSet shaders[ShaderTechniques::Count];
@@ -234,86 +239,117 @@ struct Frustum {
     float4 planes[10];
     u32 numPlanes;
 };
-struct CullEntry {
-    float3 boxPointsWS[8]; // todo: surely we can do better?
-    u32 poolId;
-};
-struct CullEntries {
-    CullEntry* entries;
-    u32 count;
-};
-void allocCullEntries(allocator::PagedArena scratchArena, CullEntries& cullEntries, const Scene& scene) {
-    
-    cullEntries.entries = 
-        (CullEntry*)allocator::alloc_arena(
-            scratchArena,
-            scene.drawNodes.count * sizeof(CullEntry),
-            alignof(CullEntry)
-        );
-
-    for (u32 n = 0, count = 0; n < scene.drawNodes.cap && count < scene.drawNodes.count; n++) {
-        if (scene.drawNodes.data[n].alive == 0) { continue; }
-        count++;
-
-        CullEntry& entry = cullEntries.entries[cullEntries.count++];
+// drawNodes move a little bit every frame, this is how much their bounds can change in world
+// units before their cullTree leaf needs reinserting
+const f32 cullTreeMargin = 0.5f;
+void initCullTree(Scene& scene, allocator::PagedArena& arena) {
+    aabbtree::init(scene.cullTree, (u32)scene.drawNodes.cap, cullTreeMargin, arena);
+    scene.cullLeaves = (u32*)allocator::alloc_arena(
+        arena, scene.drawNodes.cap * sizeof(u32), alignof(u32));
+    for (u32 n = 0; n < scene.drawNodes.cap; n++) { scene.cullLeaves[n] = aabbtree::nullNode; }
+    scene.cullDirtyNodes = (u32*)allocator::alloc_arena(
+        arena, scene.drawNodes.cap * sizeof(u32), alignof(u32));
+    scene.cullDirty = (u8*)allocator::alloc_arena(arena, scene.drawNodes.cap, alignof(u8));
+    memset(scene.cullDirty, 0, scene.drawNodes.cap);
+    scene.cullDirtyCount = 0;
+}
+// Queues a drawNodes slot for the next updateCullTree: needs to be called whenever a node is
+// allocated, freed, or has its world matrix or bounds changed
+void markCullDirty(Scene& scene, const DrawNodeHandle handle) {
+    const u32 n = handle - 1;
+    if (scene.cullDirty[n]) { return; }
+    scene.cullDirty[n] = 1;
+    scene.cullDirtyNodes[scene.cullDirtyCount++] = n;
+}
+// Brings the cull tree up to date with the drawNodes marked since the last call, should be called
+// once per frame before any visibility query. Static nodes are never visited, and most moving ones
+// stay within their fat bounds, and don't touch the tree
+void updateCullTree(Scene& scene) {
+    for (u32 i = 0; i < scene.cullDirtyCount; i++) {
+        const u32 n = scene.cullDirtyNodes[i];
+        scene.cullDirty[n] = 0;
+        u32& leaf = scene.cullLeaves[n];
+        if (scene.drawNodes.data[n].alive == 0) {
+            if (leaf != aabbtree::nullNode) {
+                aabbtree::remove(scene.cullTree, leaf);
+                leaf = aabbtree::nullNode;
+            }
+            continue;
+        }
+        // world aabb of the node's oriented box: the extents along each world axis are the
+        // local extents projected onto it via the absolute values of the matrix rows
         const DrawNode& node = scene.drawNodes.data[n].state.live;
-        const float4 boxPointsLS[8] = {
-            { node.min.x, node.min.y, node.min.z, 1.f },
-            { node.max.x, node.min.y, node.min.z, 1.f },
-            { node.min.x, node.max.y, node.min.z, 1.f },
-            { node.max.x, node.max.y, node.min.z, 1.f },
-            { node.min.x, node.min.y, node.max.z, 1.f },
-            { node.max.x, node.min.y, node.max.z, 1.f },
-            { node.min.x, node.max.y, node.max.z, 1.f },
-            { node.max.x, node.max.y, node.max.z, 1.f }
-        };
-        entry.boxPointsWS[0] = math::mult(node.nodeData.worldMatrix, boxPointsLS[0]).xyz;
-        entry.boxPointsWS[1] = math::mult(node.nodeData.worldMatrix, boxPointsLS[1]).xyz;
-        entry.boxPointsWS[2] = math::mult(node.nodeData.worldMatrix, boxPointsLS[2]).xyz;
-        entry.boxPointsWS[3] = math::mult(node.nodeData.worldMatrix, boxPointsLS[3]).xyz;
-        entry.boxPointsWS[4] = math::mult(node.nodeData.worldMatrix, boxPointsLS[4]).xyz;
-        entry.boxPointsWS[5] = math::mult(node.nodeData.worldMatrix, boxPointsLS[5]).xyz;
-        entry.boxPointsWS[6] = math::mult(node.nodeData.worldMatrix, boxPointsLS[6]).xyz;
-        entry.boxPointsWS[7] = math::mult(node.nodeData.worldMatrix, boxPointsLS[7]).xyz;
-        entry.poolId = n;
+        const float4x4& m = node.nodeData.worldMatrix;
+        const float3 centerLS = math::scale(math::add(node.min, node.max), 0.5f);
+        const float3 extentsLS = math::scale(math::subtract(node.max, node.min), 0.5f);
+        const float3 center = math::mult(m, float4(centerLS, 1.f)).xyz;
+        const float3 extents(
+            math::abs(m.col0.x) * extentsLS.x + math::abs(m.col1.x) * extentsLS.y
+                + math::abs(m.col2.x) * extentsLS.z,
+            math::abs(m.col0.y) * extentsLS.x + math::abs(m.col1.y) * extentsLS.y
+                + math::abs(m.col2.y) * extentsLS.z,
+            math::abs(m.col0.z) * extentsLS.x + math::abs(m.col1.z) * extentsLS.y
+                + math::abs(m.col2.z) * extentsLS.z);
+        const float3 min = math::subtract(center, extents);
+        const float3 max = math::add(center, extents);
+        if (leaf == aabbtree::nullNode) { leaf = aabbtree::insert(scene.cullTree, min, max, n); }
+        else { aabbtree::move(scene.cullTree, leaf, min, max); }
     }
+    scene.cullDirtyCount = 0;
+}
+// Exact test of a node's oriented box against world space planes
+bool isNodeVisibleWS(const Frustum& frustum, const DrawNode& node) {
+    const float4 boxPointsLS[8] = {
+        { node.min.x, node.min.y, node.min.z, 1.f },
+        { node.max.x, node.min.y, node.min.z, 1.f },
+        { node.min.x, node.max.y, node.min.z, 1.f },
+        { node.max.x, node.max.y, node.min.z, 1.f },
+        { node.min.x, node.min.y, node.max.z, 1.f },
+        { node.max.x, node.min.y, node.max.z, 1.f },
+        { node.min.x, node.max.y, node.max.z, 1.f },
+        { node.max.x, node.max.y, node.max.z, 1.f }
+    };
+    float4 boxPointsWS[8];
+    for (u32 i = 0; i < 8; i++) {
+        boxPointsWS[i] = math::mult(node.nodeData.worldMatrix, boxPointsLS[i]);
+    }
+    // quad inside frustum
+    for (u32 p = 0; p < frustum.numPlanes; p++) {
+        int out = 0;
+        for (u32 i = 0; i < 8; i++) {
+            out += (math::dot(frustum.planes[p], boxPointsWS[i]) < 0.f) ? 1 : 0;
+        }
+        if (out == 8) { return false; }
+    }
+    // frustum inside quad??
+    return true;
 }
 struct VisibleNodes {
     u32* visible_nodes;
     u32 visible_nodes_count;
 };
 void computeVisibilityWS(allocator::PagedArena& frameArena, VisibleNodes& visibilityFrustum,
-                         u32* isEachNodeVisible, const Frustum& frustum,
-                         const CullEntries& cullEntries) {
+                         u32* isEachNodeVisible, const Frustum& frustum, const Scene& scene) {
 
-    allocator::Buffer<u32> visibleNodes = {};
+    // allocate for the worst case, and give back the unused tail at the end: consecutive lists
+    // end up packed together in the arena, without the copies and slack of a growing buffer
+    const ptrdiff_t maxSize = sizeof(u32) * scene.cullTree.leafCount;
+    u32* visibleNodes = (u32*)allocator::alloc_arena(frameArena, maxSize, alignof(u32));
+    // the tree only rejects nodes whose fat bounds are out of the frustum, the candidates
+    // get the exact test, and are compacted in place
+    const u32 candidateCount = aabbtree::findLeavesIntersectingFrustum(
+        visibleNodes, scene.cullTree, frustum.planes, frustum.numPlanes);
     visibilityFrustum.visible_nodes_count = 0;
-    for (u32 i = 0; i < cullEntries.count; i++) {
-        const CullEntry& entry = cullEntries.entries[i];
-        
-        // quad inside frustum
-        bool visible = true;
-        for (u32 p = 0; p < frustum.numPlanes; p++) {
-            int out = 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[0], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[1], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[2], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[3], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[4], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[5], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[6], 1.f)) < 0.f) ? 1 : 0;
-            out += (math::dot(frustum.planes[p], float4(entry.boxPointsWS[7], 1.f)) < 0.f) ? 1 : 0;
-            if (out == 8) { visible = false; break; }
-        }
-        // frustum inside quad??
-
-        if (visible) {
-            isEachNodeVisible[entry.poolId] = true;
-            push(visibleNodes, frameArena) = entry.poolId;
-            visibilityFrustum.visible_nodes_count++;
+    for (u32 i = 0; i < candidateCount; i++) {
+        const u32 n = visibleNodes[i];
+        if (isNodeVisibleWS(frustum, scene.drawNodes.data[n].state.live)) {
+            isEachNodeVisible[n] = true;
+            visibleNodes[visibilityFrustum.visible_nodes_count++] = n;
         }
     }
-    visibilityFrustum.visible_nodes = visibleNodes.data;
+    visibilityFrustum.visible_nodes = visibleNodes;
+    allocator::shrink_arena(
+        frameArena, visibleNodes, maxSize, sizeof(u32) * visibilityFrustum.visible_nodes_count);
 }
 void computeVisibilityCS(VisibleNodes& visibleNodes, u32* isEachNodeVisible, float4x4& vpMatrix,
                          const Scene& scene) {
@@ -414,10 +450,15 @@ void computeVisibilityCS(VisibleNodes& visibleNodes, u32* isEachNodeVisible, flo
         return true;
     };
 
-    for (u32 n = 0, count = 0; n < scene.drawNodes.cap && count < scene.drawNodes.count; n++) {
-        if (scene.drawNodes.data[n].alive == 0) { continue; }
-        count++;
-
+    // prefilter with the tree, using the planes of the view projection: the candidates are written
+    // after the current visible nodes, and compacted in place with the exact test
+    float4 planes[6];
+    renderer::extract_frustum_planes_from_vp(planes, vpMatrix);
+    u32* candidates = visibleNodes.visible_nodes + visibleNodes.visible_nodes_count;
+    const u32 candidateCount =
+        aabbtree::findLeavesIntersectingFrustum(candidates, scene.cullTree, planes, 6);
+    for (u32 i = 0; i < candidateCount; i++) {
+        const u32 n = candidates[i];
         const DrawNode& node = scene.drawNodes.data[n].state.live;
         if (cull_isVisible(math::mult(vpMatrix, node.nodeData.worldMatrix), node.min, node.max)) {
             visibleNodes.visible_nodes[visibleNodes.visible_nodes_count++] = n;
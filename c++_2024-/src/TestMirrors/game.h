@@ -5,9 +5,13 @@ const size_t persistentArenaSize = 1 * 1024 * 1024;
 const size_t sceneArenaSize = 256 * 1024 * 1024;
 const size_t frameArenaSize = 4 * 1024 * 1024;
 const size_t scratchArenaSize = 4 * 1024 * 1024;
+const size_t resourceHeapChunkSize = 16 * 1024 * 1024;
+const size_t workerScratchArenaSize = 1 * 1024 * 1024;
+const size_t workerScratchBlockSize = 64 * 1024;
+const size_t workerChunkArenaSize = 1 * 1024 * 1024; // only without cheap reservations, see VirtualBuffer
 
 #if __DEBUG
-struct CameraNode;
+struct CameraTree;
 namespace debug {
 struct OverlayMode { enum Enum { All, HelpOnly, ArenaOnly, None, Count }; };
 const char* overlaynames[] = { "All", "Help Only", "Arenas only", "None" };
@@ -24,8 +28,15 @@ OverlayMode::Enum overlaymode = OverlayMode::Enum::All;
 Debug3DView::Enum debug3Dmode = Debug3DView::Enum::None;
 u32 debugCameraStage = 0;
 u32 bvhDepth = 0;
-CameraNode* capturedCameras = nullptr;
+CameraTree* capturedCameras = nullptr;
 EventText eventLabel = {};
+// mem_resident walks the pages of the whole committed range, and the heap stats walk all of the
+// free lists, so the overlay samples both on a timer
+struct ResidentArenas { enum Enum { Frame, Scratch, Persistent, Scene, Count }; };
+const f64 residentSamplePeriod = 0.5;
+f64 residentSampleTime = -residentSamplePeriod;
+size_t residentBytes[ResidentArenas::Count] = {};
+allocator::TLSFStats resourceHeapStats = {};
 
 }
 #endif
@@ -36,6 +47,8 @@ EventText eventLabel = {};
 #include "animation.h"
 #include "physics.h"
 #include "scene.h"
+#include "telemetry.h"
+#include "benchmarks.h"
 
 namespace game
 {
@@ -66,6 +79,8 @@ namespace input
     constexpr ::input::keyboard::Keys::Enum
           EXIT = ::input::keyboard::Keys::ESCAPE
         , CYCLE_ROOM = ::input::keyboard::Keys::N
+        , DUMP_TELEMETRY = ::input::keyboard::Keys::F5
+        , RUN_BENCHMARKS = ::input::keyboard::Keys::F6
         #if __DEBUG
         , TOGGLE_OVERLAY = ::input::keyboard::Keys::H
         , TOGGLE_DEBUG3D = ::input::keyboard::Keys::V
@@ -89,12 +104,24 @@ struct Memory {
     __DEBUGDEF(allocator::PagedArena debugArena;)
     allocator::PagedArena scratchArenaRoot; // to be passed by copy, so it works as a scoped stack allocator
     allocator::PagedArena frameArena;
+    allocator::ConcurrentArena workerScratchArena; // shared by the camera tree gather workers
+    allocator::PagedArena resourceArena; // only used by resourceHeap
+    allocator::TLSF resourceHeap; // for resources that outlive a room, and are freed individually
     u8* frameArenaBuffer; // used to reset allocator::frameArena every frame
     u8* sceneArenaBuffer; // used to reset allocator::sceneArena upon scene switches
+    CameraTree cameraTree; // gathered again on every frame the camera moves
+    CameraTree workerCameraTrees[jobs::maxWorkerCount]; // scratch for the parallel camera tree gather
+    allocator::VirtualBuffer<MirrorPortalCandidate> mirrorCandidates; // scratch for the budgeted gather
+    allocator::VirtualBuffer<MirrorPortalPoly> workerMirrorPolys[jobs::maxWorkerCount]; // same
+    #if !__CHEAP_RESERVE
+    // the worker buffers above grow on their worker's thread, so their chunks can't share an arena
+    allocator::PagedArena workerChunkArenas[jobs::maxWorkerCount];
+    #endif
+    MirrorTreeInputs mirrorTreeInputs; // of the camera tree, which is kept until they change
     // used for debugging visualization
     __DEBUGDEF(u8* persistentArenaBuffer;)
-    // to track largest allocation
-    __DEBUGDEF(uintptr_t scratchArenaHighmark;)
+    // to track largest allocation (and committed pages, so they can be decommitted on scene switches)
+    uintptr_t scratchArenaHighmark;
     __DEBUGDEF(uintptr_t frameArenaHighmark;)
 };
 
@@ -104,8 +131,38 @@ struct Instance {
     Scene scene;
     u32 roomId;
     Resources resources;
+    telemetry::State telemetry;
+    jobs::Pool workerPool; // for per frame work
+    SceneSnapshot roomSnapshots[countof(roomDefinitions)]; // in resourceHeap, captured on first visit
 };
 
+// The scene arena must be empty: rooms are spawned once, and restored from a snapshot afterwards
+void enter_room(Instance& game, const platform::Screen& screen) {
+    SceneSnapshot& snapshot = game.roomSnapshots[game.roomId];
+    if (snapshot.image) {
+        restore_snapshot(game.scene, game.memory.sceneArena, snapshot);
+        return;
+    }
+    const char* prevTag = allocator::tag_arena(game.memory.scratchArenaRoot, "room spawn");
+    spawn_scene_mirrorRoom(
+        game.scene, game.memory.sceneArena, game.memory.scratchArenaRoot,
+        game.resources, screen,
+        roomDefinitions[game.roomId]);
+    allocator::tag_arena(game.memory.scratchArenaRoot, prevTag);
+    capture_snapshot(
+        snapshot, game.memory.resourceHeap, game.scene,
+        game.memory.sceneArenaBuffer, game.memory.sceneArena.curr);
+    #if __DEBUG
+    {
+        // restore at a different address, and check nothing was missed by the relocation
+        allocator::PagedArena scratchArena = game.memory.scratchArenaRoot;
+        Scene restored;
+        restore_snapshot(restored, scratchArena, snapshot);
+        assert(scenes_match(game.scene, restored));
+    }
+    #endif
+}
+
 void loadLaunchConfig(platform::LaunchConfig& config) {
     // hardcoded for now
     config.window_width = 320 * 3;
@@ -132,12 +189,11 @@ void start(Instance& game, platform::GameConfig& config, platform::State& platfo
             game.memory.persistentArena, persistentArenaSize);
         __DEBUGDEF(game.memory.persistentArenaBuffer = game.memory.persistentArena.curr;)
         allocator::init_arena(
-            game.memory.sceneArena, sceneArenaSize);
+            game.memory.sceneArena, sceneArenaSize, platform::PageType::HugeTransparent);
         game.memory.sceneArenaBuffer = game.memory.sceneArena.curr;
         allocator::init_arena(game.memory.scratchArenaRoot, scratchArenaSize);
-        __DEBUGDEF(game.memory.scratchArenaHighmark =
-                (uintptr_t)game.memory.scratchArenaRoot.curr;
-            game.memory.scratchArenaRoot.highmark = &game.memory.scratchArenaHighmark;)
+        game.memory.scratchArenaHighmark = (uintptr_t)game.memory.scratchArenaRoot.curr;
+        game.memory.scratchArenaRoot.highmark = &game.memory.scratchArenaHighmark;
         allocator::init_arena(
             game.memory.frameArena, frameArenaSize);
         game.memory.frameArenaBuffer = game.memory.frameArena.curr;
@@ -146,6 +202,28 @@ void start(Instance& game, platform::GameConfig& config, platform::State& platfo
             game.memory.frameArena.highmark = &game.memory.frameArenaHighmark;)
         __DEBUGDEF(allocator::init_arena(
                 game.memory.debugArena, renderer::im::arena_size);)
+        allocator::init_arena(
+            game.memory.workerScratchArena, workerScratchArenaSize, workerScratchBlockSize);
+        allocator::init_arena(game.memory.resourceArena, resourceHeapChunkSize);
+        allocator::init_tlsf(
+            game.memory.resourceHeap, game.memory.resourceArena, resourceHeapChunkSize);
+        init_cameraTree(game.memory.cameraTree, 1024, game.memory.persistentArena);
+        jobs::init_pool(game.workerPool);
+        for (u32 i = 0; i < game.workerPool.threadCount + 1; i++) {
+            #if __CHEAP_RESERVE
+            allocator::PagedArena& chunkArena = game.memory.persistentArena; // unused
+            #else
+            allocator::PagedArena& chunkArena = game.memory.workerChunkArenas[i];
+            allocator::init_arena(chunkArena, workerChunkArenaSize);
+            #endif
+            init_cameraTree(game.memory.workerCameraTrees[i], 1024, chunkArena);
+            allocator::init_buffer(game.memory.workerMirrorPolys[i], 256, chunkArena);
+        }
+        allocator::init_buffer(game.memory.mirrorCandidates, 1024, game.memory.persistentArena);
+        game.memory.mirrorTreeInputs = {};
+        telemetry::init(
+            game.telemetry, game.memory.persistentArena, game.memory.sceneArena,
+            game.memory.frameArena, game.memory.scratchArenaRoot);
     }
     {
         game.scene = {};
@@ -156,17 +234,19 @@ void start(Instance& game, platform::GameConfig& config, platform::State& platfo
             __DEBUGDEF(, game.memory.debugArena)
         };
         load_coreResources(game.resources, arenas, platform.screen);
-        spawn_scene_mirrorRoom(
-            game.scene, game.memory.sceneArena, game.memory.scratchArenaRoot,
-            game.resources, platform.screen,
-            roomDefinitions[game.roomId]);
-
+        enter_room(game, platform.screen);
     }
 }
 
+// Called once the main loop exits
+void stop(Instance& game) {
+    jobs::shutdown_pool(game.workerPool);
+}
+
 void update(Instance& game, platform::GameConfig& config, platform::State& platform) {
 
     // frame arena reset
+    telemetry::end_frame(game.telemetry);
     game.memory.frameArena.curr = game.memory.frameArenaBuffer;
 
     // frame timing calculations
@@ -208,6 +288,21 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
         if (keyboard.pressed(input::TOGGLE_PAUSE_SCENE_RENDER)) {
             game.time.pausedRender = !game.time.pausedRender;
         }
+        if (keyboard.pressed(input::DUMP_TELEMETRY)) {
+            telemetry::dump_csv(game.telemetry, "arena_telemetry.csv");
+            telemetry::dump_json(game.telemetry, "arena_telemetry.json");
+        }
+        if (keyboard.pressed(input::RUN_BENCHMARKS)) {
+            const char* prevTag = allocator::tag_arena(game.memory.scratchArenaRoot, "benchmarks");
+            benchmarks::run_all(
+                "benchmarks.txt", game.memory.scratchArenaRoot, game.memory.workerScratchArena,
+                game.memory.workerCameraTrees[0], game.resources);
+            allocator::tag_arena(game.memory.scratchArenaRoot, prevTag);
+            // the benchmarks commit far more than the scratch arena usually needs
+            allocator::reset_arena(
+                game.memory.scratchArenaRoot, game.memory.scratchArenaRoot.curr, scratchArenaSize);
+            allocator::reset_arena(game.memory.workerScratchArena, workerScratchArenaSize);
+        }
         #if __DEBUG
         if (keyboard.pressed(input::TOGGLE_OVERLAY)) {
             debug::overlaymode =
@@ -222,10 +317,10 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                 if (debug::capturedCameras) {
                     if (keyboard.down(::input::keyboard::Keys::LEFT_SHIFT)) {
                         if (debug::debugCameraStage == 0) {
-                            debug::debugCameraStage = debug::capturedCameras[0].siblingIndex - 1;
+                            debug::debugCameraStage = allocator::at(debug::capturedCameras->nodes, 0).siblingIndex - 1;
                         } else { debug::debugCameraStage--; }
                     } else {
-                        if (debug::debugCameraStage == debug::capturedCameras[0].siblingIndex - 1) {
+                        if (debug::debugCameraStage == allocator::at(debug::capturedCameras->nodes, 0).siblingIndex - 1) {
                             debug::debugCameraStage = 0;
                         } else { debug::debugCameraStage++; }
                     }
@@ -264,12 +359,14 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
     }
 
     if (prevRoomId != game.roomId) {
-        game.memory.sceneArena.curr = game.memory.sceneArenaBuffer;
+        // give the previous room's pages back to the OS, the new room will commit what it needs
+        allocator::reset_arena(game.memory.sceneArena, game.memory.sceneArenaBuffer, 0);
+        allocator::reset_arena(
+            game.memory.scratchArenaRoot, game.memory.scratchArenaRoot.curr, scratchArenaSize);
         game.scene = {};
-        spawn_scene_mirrorRoom(
-            game.scene, game.memory.sceneArena, game.memory.scratchArenaRoot,
-            game.resources, platform.screen,
-            roomDefinitions[game.roomId]);
+        enter_room(game, platform.screen);
+        // the new mirrors may be at the same address as the old ones
+        game.memory.mirrorTreeInputs = {};
     }
 
     if (step)
@@ -294,6 +391,7 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
             // update player render
             renderer::NodeData& nodeData = renderer::node_from_handle(game.scene.renderScene, game.scene.playerDrawNodeHandle).nodeData;
             nodeData.worldMatrix = game.scene.player.transform.matrix;
+            renderer::markCullDirty(game.scene.renderScene, game.scene.playerDrawNodeHandle);
 
             { // animation hack
                 animation::Node& animatedData = animation::get_node(game.scene.animScene, game.scene.playerAnimatedNodeHandle);
@@ -428,12 +526,12 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
     }
 
     // Render update
-    CameraNode* cameraTree = nullptr;
     Camera mainCamera = {};
     if (!game.time.pausedRender)
     {
         renderer::Scene& scene = game.scene.renderScene;
         renderer::CoreResources& renderCore = game.resources.renderCore;
+        CameraTree& cameraTree = game.memory.cameraTree;
         using namespace renderer;
 
         mainCamera.viewMatrix = game.scene.camera.viewMatrix;
@@ -456,46 +554,69 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
         
             renderer::VisibleNodes* visibleNodesTree = nullptr;
             {
-                allocator::PagedArena scratchArena = game.memory.scratchArenaRoot;
-
                 // gather mirrors
                 u32 numCameras = 0;
                 {
-                    allocator::Buffer<CameraNode> cameraTreeBuffer;
-                    CameraNode mainCameraRoot = {};
-                    // Initialize main camera in our camera tree format
-                    mainCameraRoot.viewMatrix = mainCamera.viewMatrix;
-                    mainCameraRoot.projectionMatrix = mainCamera.projectionMatrix;
-                    mainCameraRoot.vpMatrix = mainCamera.vpMatrix;
-                    mainCameraRoot.pos = mainCamera.pos;
-                    mainCameraRoot.sourceId = mainCameraRoot.parentIndex = 0xffffffff;
-                    mainCameraRoot.depth = 0;
-                    __PROFILEONLY(platform::format(mainCameraRoot.str, sizeof(mainCameraRoot.str), "_");)
-                    renderer::extract_frustum_planes_from_vp(
-                        mainCameraRoot.frustum.planes, mainCamera.vpMatrix);
-                    mainCameraRoot.frustum.numPlanes = 6;
-                    // the buffer will copy this data into it's allocated region as
-                    // it starts adding more cameras
-                    cameraTreeBuffer.data = &mainCameraRoot;
-                    cameraTreeBuffer.cap = cameraTreeBuffer.len = 1;
-                    GatherMirrorTreeContext gatherTreeContext =
-                    { game.memory.frameArena, game.memory.scratchArenaRoot,
-                      cameraTreeBuffer, game.scene.mirrors, game.scene.maxMirrorBounces };
-                    numCameras = gatherMirrorTreeRecursive(gatherTreeContext, 1, mainCameraRoot);
-                    cameraTree = cameraTreeBuffer.data;
-                    cameraTree[0].siblingIndex = numCameras;
+                    renderer::Frustum rootFrustum = {}; // zeroed, it gets compared bitwise
+                    renderer::extract_frustum_planes_from_vp(rootFrustum.planes, mainCamera.vpMatrix);
+                    rootFrustum.numPlanes = 6;
+                    const game::MirrorBudget& budget = game.scene.mirrorBudget;
+                    const bool budgeted =
+                        budget.maxCameras || budget.minPixels > 0.f || budget.minContribution > 0.f;
+                    const float2 screenSize((f32)platform.screen.width, (f32)platform.screen.height);
+                    MirrorTreeInputs& lastInputs = game.memory.mirrorTreeInputs;
+                    const MirrorTreeInputs inputs = make_mirrorTreeInputs(
+                        mainCamera, rootFrustum, game.scene.mirrors, game.scene.maxMirrorBounces,
+                        budget, screenSize);
+                    if (can_reuse_mirrorTree(lastInputs, inputs, cameraTree)) {
+                        // nothing moved, last frame's tree is still good
+                        numCameras = lastInputs.cameraCount;
+                    } else {
+                        clear_cameraTree(cameraTree);
+                        // Initialize main camera in our camera tree format
+                        const u32 rootIndex = push_cameraNode(cameraTree);
+                        CameraNode& mainCameraRoot = allocator::at(cameraTree.nodes, rootIndex);
+                        mainCameraRoot = {};
+                        mainCameraRoot.sourceId = mainCameraRoot.parentIndex = 0xffffffff;
+                        mainCameraRoot.depth = 0;
+                        allocator::at(cameraTree.cameras, rootIndex) = mainCamera;
+                        __PROFILEONLY(platform::format(
+                            allocator::at(cameraTree.names, rootIndex).str, sizeof(CameraName::str), "_");)
+                        allocator::at(cameraTree.frustums, rootIndex) = rootFrustum;
+                        const char* prevTag =
+                            allocator::tag_arena(game.memory.scratchArenaRoot, "camera tree");
+                        if (budgeted) {
+                            numCameras = gatherMirrorTreeBudgeted(
+                                cameraTree, game.memory.workerCameraTrees, game.memory.mirrorCandidates,
+                                game.memory.workerMirrorPolys, game.workerPool,
+                                game.memory.scratchArenaRoot, game.memory.workerScratchArena,
+                                game.scene.mirrors, game.scene.maxMirrorBounces, budget, screenSize);
+                        } else {
+                            numCameras = gatherMirrorTree(
+                                cameraTree, game.memory.workerCameraTrees, game.workerPool,
+                                game.memory.scratchArenaRoot, game.memory.workerScratchArena,
+                                game.scene.mirrors, game.scene.maxMirrorBounces);
+                        }
+                        allocator::tag_arena(game.memory.scratchArenaRoot, prevTag);
+                        allocator::at(cameraTree.nodes, rootIndex).siblingIndex = numCameras;
+                        record_mirrorTree(lastInputs, inputs, numCameras);
+                    }
                 }
 
                 #if __DEBUG
                 if (captureCameras) {
-                    if (debug::capturedCameras) { free(debug::capturedCameras); }
+                    if (!debug::capturedCameras) {
+                        debug::capturedCameras = (CameraTree*)malloc(sizeof(CameraTree));
+                        init_cameraTree(*debug::capturedCameras, numCameras, game.memory.debugArena);
+                    }
                     debug::debugCameraStage = math::min(debug::debugCameraStage, (u32)numCameras - 1);
-                    debug::capturedCameras = (CameraNode*)malloc(sizeof(CameraNode) * numCameras);
-                    memcpy(debug::capturedCameras, cameraTree, sizeof(CameraNode) * numCameras);
+                    copy_cameraTree(*debug::capturedCameras, cameraTree);
                 }
                 #endif
 
                 // figure out which nodes are visible among all of the visibility lists
+                renderer::updateCullTree(scene);
+                const char* prevTag = allocator::tag_arena(game.memory.frameArena, "visibility");
                 u32* isEachNodeVisible =
                     (u32*)allocator::alloc_arena(
                         game.memory.frameArena,
@@ -510,15 +631,14 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                             game.memory.frameArena,
                         scene.drawNodes.count * sizeof(u32), alignof(u32));
                 visibleNodesTree[0].visible_nodes_count = 0;
-                renderer::CullEntries cullEntries = {};
-                allocCullEntries(scratchArena, cullEntries, scene);
                 renderer::computeVisibilityCS(
                     visibleNodesTree[0], isEachNodeVisible, mainCamera.vpMatrix, scene);
                 for (u32 i = 1; i < numCameras; i++) {
                     renderer::computeVisibilityWS(
                         game.memory.frameArena, visibleNodesTree[i], isEachNodeVisible,
-                        cameraTree[i].frustum, cullEntries);
+                        allocator::at(cameraTree.frustums, i), scene);
                 }
+                allocator::tag_arena(game.memory.frameArena, prevTag);
                 
                 // update cbuffers of all visible nodes
                 for (u32 n = 0, count = 0; n < scene.drawNodes.cap && count < scene.drawNodes.count; n++) {
@@ -532,7 +652,7 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                     if (node.cbuffer_ext) {
                         driver::update_cbuffer(
                                 cbuffer_from_handle(scene, node.cbuffer_ext),
-                                node.ext_data);
+                                animation::get_node(game.scene.animScene, node.animationHandle).state.skinning);
                     }
                 }
                 for (u32 n = 0, count = 0; n < scene.instancedDrawNodes.cap && count < scene.instancedDrawNodes.count; n++) {
@@ -558,7 +678,7 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
             driver::set_marker_name(marker, "BASE SCENE"); driver::start_event(marker);
             {
                 RenderSceneContext renderSceneContext = {
-                    cameraTree[0], visibleNodesTree[0], game.scene, renderCore,
+                    mainCamera, 0, visibleNodesTree[0], game.scene, renderCore,
                     renderCore.depthStateAlways,
                     renderCore.depthStateOn,
                     renderCore.depthStateReadOnly,
@@ -569,7 +689,7 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
             driver::end_event();
 
             // render camera tree
-            if (cameraTree[0].siblingIndex > 1) {
+            if (allocator::at(cameraTree.nodes, 0).siblingIndex > 1) {
                 renderMirrorTree(
                         cameraTree, visibleNodesTree, game.scene, renderCore,
                         game.memory.scratchArenaRoot);
@@ -619,18 +739,18 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
 
                 allocator::PagedArena scratchArena = game.memory.scratchArenaRoot; // explicit copy
                 renderer::CoreResources& renderCore = game.resources.renderCore;
-                bvh::Tree& bvh = game.scene.mirrors.bvh;
+                const bvh::Tree& tree = game.scene.mirrors.bvh;
 
                 driver::Marker_t marker;
                 driver::set_marker_name(marker, "BVH"); driver::start_event(marker);
-                if (bvh.nodeCount > 0) {
+                if (tree.nodeCount > 0) {
 
                     struct DrawNode {
-                        u16 nodeid;
-                        u16 depth;
+                        u32 nodeid;
+                        u32 depth;
                     };
                     DrawNode* nodeStack = (DrawNode*)allocator::alloc_arena(
-                        scratchArena, bvh.nodeCount * sizeof(DrawNode), alignof(DrawNode));
+                        scratchArena, tree.nodeCount * sizeof(DrawNode), alignof(DrawNode));
                     u32 stackCount = 0;
                     nodeStack[stackCount++] = { 0, 0 };
                     struct AABB {
@@ -641,23 +761,23 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                     const Color32 boxColor(0.1f, 0.8f, 0.8f, 0.7f);
                     while (stackCount > 0) {
                         DrawNode n = nodeStack[--stackCount];
-                        if (!bvh.nodes[n.nodeid].isLeaf) {
+                        if (!bvh::isLeaf(tree.nodes[n.nodeid])) {
                             if (n.depth == debug::bvhDepth) {
                                 float3 center =
                                     math::scale(
-                                        math::add(bvh.nodes[n.nodeid].min,
-                                            bvh.nodes[n.nodeid].max), 0.5f);
+                                        math::add(tree.nodes[n.nodeid].min,
+                                            tree.nodes[n.nodeid].max), 0.5f);
                                 float3 scale =
                                     math::scale(
                                         math::subtract(
-                                            bvh.nodes[n.nodeid].max, bvh.nodes[n.nodeid].min),
+                                            tree.nodes[n.nodeid].max, tree.nodes[n.nodeid].min),
                                         0.5f);
                                 allocator::push(aabbs, scratchArena) = { center, scale };
                             } else {
                                 nodeStack[stackCount++] =
-                                    DrawNode{ bvh.nodes[n.nodeid].lchildId, u16(n.depth + 1u) };
+                                    DrawNode{ tree.nodes[n.nodeid].offset, n.depth + 1 };
                                 nodeStack[stackCount++] =
-                                    DrawNode{ u16(bvh.nodes[n.nodeid].lchildId + 1u), u16(n.depth + 1u) };
+                                    DrawNode{ tree.nodes[n.nodeid].offset + 1, n.depth + 1 };
                             }
                         }
                     }
@@ -712,6 +832,23 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                     // clean up identity node
                     nodeColor.groupColor = Color32(1.f, 1.f, 1.f, 1.f).RGBAv4();
                     driver::update_cbuffer(node_cbuffer, &nodeColor);
+
+                    // highlight the mirror under the mouse
+                    const game::Mirrors& mirrors = game.scene.mirrors;
+                    const float3 mousepos_WS = camera::screenPosToWorldPos(
+                        platform.input.mouse.x, platform.input.mouse.y,
+                        platform.screen.window_width, platform.screen.window_height,
+                        renderCore.perspProjection.config, game.scene.camera.viewMatrix);
+                    const bvh::RaySources sources = { mirrors.vertices, mirrors.vertexOffsets };
+                    const bvh::Ray ray = {
+                        mainCamera.pos, math::subtract(mousepos_WS, mainCamera.pos), FLT_MAX };
+                    bvh::RayHit hit;
+                    if (bvh::intersectRay(hit, tree, sources, ray, bvh::RayMode::ClosestHit)) {
+                        im::poly(
+                            game::mirror_vertices(mirrors, hit.sourceId),
+                            (u8)game::mirror_vertex_count(mirrors, hit.sourceId),
+                            Color32(1.f, 0.9f, 0.2f, 1.f));
+                    }
                 }
                 renderer::driver::end_event();
             }
@@ -741,7 +878,11 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                             scene.drawNodes.count * sizeof(u32), alignof(u32));
                     memset(isEachNodeVisible, 0, scene.drawNodes.count * sizeof(bool));
                     renderer::VisibleNodes visibleNodesDebug = {};
-                    CameraNode& cameraNode = debug::capturedCameras[debug::debugCameraStage];
+                    const CameraTree& captured = *debug::capturedCameras;
+                    const CameraNode& cameraNode = allocator::at(captured.nodes, debug::debugCameraStage);
+                    const Camera& capturedCamera = allocator::at(captured.cameras, debug::debugCameraStage);
+                    const renderer::Frustum& cameraFrustum =
+                        allocator::at(captured.frustums, debug::debugCameraStage);
                     if (debug::debugCameraStage == 0) {
                         // render culled nodes
                         visibleNodesDebug.visible_nodes =
@@ -750,27 +891,22 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                                 scene.drawNodes.count * sizeof(u32), alignof(u32));
                         visibleNodesDebug.visible_nodes_count = 0;
                         float4x4 vpMatrix =
-                            math::mult(cameraNode.projectionMatrix, cameraNode.viewMatrix);
+                            math::mult(capturedCamera.projectionMatrix, capturedCamera.viewMatrix);
                         renderer::computeVisibilityCS(
                             visibleNodesDebug, isEachNodeVisible, vpMatrix, scene);
                         const Color32 color(0.25f, 0.8f, 0.15f, 0.7f);
                         im::frustum(vpMatrix, color);
                     } else {
                         // render mirror with normal
-                        const game::Mirrors::Poly& p = game.scene.mirrors.polys[cameraNode.sourceId];
-                        // normal is v2-v0xv1-v0 assuming clockwise winding and right handed coordinates
-                        float3 normalWS = math::normalize(
-                            math::cross(
-                                math::subtract(p.v[2], p.v[0]), math::subtract(p.v[1], p.v[0])));
-                        float4 planeWS(
-                            normalWS.x, normalWS.y, normalWS.z,-math::dot(p.v[0], normalWS));
-                        im::plane(planeWS, Color32(1.f, 1.f, 1.f, 1.f));
-
-                        renderer::Frustum& frustum =
-                            debug::capturedCameras[cameraNode.parentIndex].frustum;
+                        const game::Mirrors& mirrors = game.scene.mirrors;
+                        im::plane(mirrors.planes[cameraNode.sourceId], Color32(1.f, 1.f, 1.f, 1.f));
+
+                        const renderer::Frustum& frustum =
+                            allocator::at(captured.frustums, cameraNode.parentIndex);
                         float3 poly[7];
-                        u32 poly_count = p.numPts;
-                        memcpy(poly, p.v, sizeof(float3) * p.numPts);
+                        u32 poly_count = mirror_vertex_count(mirrors, cameraNode.sourceId);
+                        memcpy(poly, mirror_vertices(mirrors, cameraNode.sourceId),
+                               sizeof(float3) * poly_count);
                         clip_poly_in_frustum(
                             poly, poly_count, frustum.planes, frustum.numPlanes, 7);
                         const float2 screenScale(
@@ -789,13 +925,11 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                         renderer::im::poly2d(polyScreen, poly_count, Color32(1.f, 1.f, 1.f, 0.3f));
 
                         // render culled nodes
-                        renderer::CullEntries cullEntries = {};
-                        allocCullEntries(scratchArena, cullEntries, scene);
                         renderer::computeVisibilityWS(
                             scratchArena, visibleNodesDebug, isEachNodeVisible,
-                            cameraNode.frustum, cullEntries);
+                            cameraFrustum, scene);
                         const Color32 color(0.25f, 0.8f, 0.15f, 0.7f);
-                        im::frustum(cameraNode.frustum.planes, cameraNode.frustum.numPlanes, color);
+                        im::frustum(cameraFrustum.planes, cameraFrustum.numPlanes, color);
                     }
                     for (u32 i = 0; i < visibleNodesDebug.visible_nodes_count; i++) {
                         u32 n = visibleNodesDebug.visible_nodes[i];
@@ -918,23 +1052,23 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
 
                 if (keyboard.pressed(input::TOGGLE_CAPTURED_CAMERA)) {
                     platform::format(
-                        debug::eventLabel.text,sizeof(debug::eventLabel.text), "Camera #%d/#%d", debug::debugCameraStage + 1, debug::capturedCameras ? debug::capturedCameras[0].siblingIndex : 0);
+                        debug::eventLabel.text,sizeof(debug::eventLabel.text), "Camera #%d/#%d", debug::debugCameraStage + 1, debug::capturedCameras ? allocator::at(debug::capturedCameras->nodes, 0).siblingIndex : 0);
                     debug::eventLabel.time = platform.time.now;
                     textParamsLeft.color = activeCol;
                 } else {
                     textParamsLeft.color = defaultCol;
                 }
-                renderer::im::text2d(textParamsLeft, "C to toggle camera capture stages (+shift to go back): #%d/#%d", debug::debugCameraStage + 1, debug::capturedCameras ? debug::capturedCameras[0].siblingIndex : 0);
+                renderer::im::text2d(textParamsLeft, "C to toggle camera capture stages (+shift to go back): #%d/#%d", debug::debugCameraStage + 1, debug::capturedCameras ? allocator::at(debug::capturedCameras->nodes, 0).siblingIndex : 0);
                 textParamsLeft.color = defaultCol;
                 textParamsLeft.pos.y -= lineheight;
 
                 if (debug::capturedCameras) {
-                    const u32 numCameras = debug::capturedCameras[0].siblingIndex;
+                    const u32 numCameras = allocator::at(debug::capturedCameras->nodes, 0).siblingIndex;
                     const u32 minidx = debug::debugCameraStage > 10 ? debug::debugCameraStage - 10 : 0;
                     const u32 maxidx = debug::debugCameraStage + 10 < numCameras ? debug::debugCameraStage + 10 : numCameras;
                     for (u32 i = minidx; i < maxidx; i++) {
                         if (i == debug::debugCameraStage) { textParamsLeft.color = activeCol; }
-                        renderer::im::text2d(textParamsLeft, "%*d: %s", debug::capturedCameras[i].depth, i, debug::capturedCameras[i].str);
+                        renderer::im::text2d(textParamsLeft, "%*d: %s", allocator::at(debug::capturedCameras->nodes, i).depth, i, allocator::at(debug::capturedCameras->names, i).str);
                         textParamsLeft.color = defaultCol;
                         textParamsLeft.pos.y -= lineheight;
                     }
@@ -1033,8 +1167,13 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
             if (debug::overlaymode == debug::OverlayMode::All
              || debug::overlaymode == debug::OverlayMode::ArenaOnly)
             {
+                const bool sampleResident =
+                    platform.time.now - debug::residentSampleTime >= debug::residentSamplePeriod;
+                if (sampleResident) { debug::residentSampleTime = platform.time.now; }
                 auto renderArena = [](renderer::im::Text2DParams& textCfg, u8* arenaEnd,
                                         u8* arenaStart, uintptr_t arenaHighmark,
+                                        uintptr_t arenaCommittedEnd, size_t& residentBytes,
+                                        const bool sampleResident,
                                         const char* arenaName, const Color32 defaultCol,
                                         const Color32 baseCol, const Color32 highmarkCol,
                                         const f32 lineheight, const f32 textscale) {
@@ -1064,6 +1203,15 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                             occupancy * 100.f);
                     }
                     textCfg.pos.y -= lineheight;
+                    const size_t committedBytes = arenaCommittedEnd - (uintptr_t)arenaStart;
+                    if (sampleResident) {
+                        residentBytes = platform::mem_resident(arenaStart, committedBytes);
+                    }
+                    renderer::im::text2d(
+                        textCfg, "%s committed: %.3fMB, resident: %.3fMB",
+                        arenaName, committedBytes / (1024.f * 1024.f),
+                        residentBytes / (1024.f * 1024.f));
+                    textCfg.pos.y -= lineheight;
                     textCfg.color = defaultCol;
 
                     renderer::im::box_2d(
@@ -1089,6 +1237,8 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                         (u8*)math::max(
                             (uintptr_t)game.memory.frameArena.end, game.memory.frameArenaHighmark),
                         game.memory.frameArenaBuffer, game.memory.frameArenaHighmark,
+                        allocator::committed_end(game.memory.frameArena),
+                        debug::residentBytes[debug::ResidentArenas::Frame], sampleResident,
                         "Frame arena", defaultCol, arenabaseCol, arenahighmarkCol,
                         lineheight, textscale);
                 }
@@ -1100,6 +1250,8 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                         (u8*)math::max(
                             (uintptr_t)game.memory.scratchArenaRoot.end, game.memory.scratchArenaHighmark),
                         game.memory.scratchArenaRoot.curr, game.memory.scratchArenaHighmark,
+                        allocator::committed_end(game.memory.scratchArenaRoot),
+                        debug::residentBytes[debug::ResidentArenas::Scratch], sampleResident,
                         "Scratch arena", defaultCol, arenabaseCol, arenahighmarkCol,
                         lineheight, textscale);
                 }
@@ -1110,6 +1262,8 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                         textParamsCenter, game.memory.persistentArena.end,
                         game.memory.persistentArenaBuffer,
                         (ptrdiff_t)game.memory.persistentArena.curr,
+                        allocator::committed_end(game.memory.persistentArena),
+                        debug::residentBytes[debug::ResidentArenas::Persistent], sampleResident,
                         "Persistent arena", defaultCol, arenabaseCol, arenahighmarkCol,
                         lineheight, textscale);
                 }
@@ -1120,9 +1274,27 @@ void update(Instance& game, platform::GameConfig& config, platform::State& platf
                         textParamsCenter, game.memory.sceneArena.end,
                         game.memory.sceneArenaBuffer,
                         (ptrdiff_t)game.memory.sceneArena.curr,
+                        allocator::committed_end(game.memory.sceneArena),
+                        debug::residentBytes[debug::ResidentArenas::Scene], sampleResident,
                         "Scene arena", defaultCol, arenabaseCol, arenahighmarkCol,
                         lineheight, textscale);
                 }
+                {
+                    if (sampleResident) {
+                        debug::resourceHeapStats = allocator::get_stats(game.memory.resourceHeap);
+                    }
+                    const allocator::TLSFStats& stats = debug::resourceHeapStats;
+                    textParamsCenter.color = defaultCol;
+                    renderer::im::text2d(
+                        textParamsCenter, "Resource heap: %.3fMB used / %.3fMB, %u blocks",
+                        stats.usedBytes / (1024.f * 1024.f), stats.heapBytes / (1024.f * 1024.f),
+                        stats.usedBlocks);
+                    textParamsCenter.pos.y -= lineheight;
+                    renderer::im::text2d(
+                        textParamsCenter, "Resource heap: %u free blocks, %.3f%% fragmentation",
+                        stats.freeBlocks, stats.fragmentation * 100.f);
+                    textParamsCenter.pos.y -= lineheight;
+                }
                 {
                     const Color32 baseCol(0.65f, 0.65f, 0.65f, 0.4f);
                     const Color32 used3dCol(0.95f, 0.35f, 0.8f, 1.f);
@@ -0,0 +1,286 @@
+#ifndef __WASTELADNS_AABBTREE_H__
+#define __WASTELADNS_AABBTREE_H__
+
+// Dynamic bounding volume tree, for objects that get added, removed and moved every frame
+// (as opposed to bvh::Tree, which is built once from static triangles)
+// Leaves store fattened bounds, so that small motions don't need to touch the tree: only leaves
+// whose object moved out of its fat bounds get reinserted. Insertion picks the sibling with the
+// lowest surface area cost, and rotations on the way up keep the tree balanced
+// Nodes live in a fixed capacity array, and are referenced by index, same as allocator::Pool
+// Queries only read Node, which is kept at 32 bytes (same as bvh::Node): everything only needed
+// to update the tree lives in a parallel array
+namespace aabbtree {
+
+const u32 nullNode = 0xffffffff;
+struct Node {
+    float3 min; // leaves: fattened bounds of the object
+    float3 max;
+    u32 children[2]; // leaves: nullNode, and the user id
+};
+static_assert(sizeof(Node) == 32, "aabbtree::Node should stay 32 bytes");
+struct NodeLinks {
+    u32 parent; // next free node, while the node is in the free list
+    s32 height; // 0 for leaves, -1 for free nodes
+};
+struct Tree {
+    Node* nodes;
+    NodeLinks* links;
+    u32 capacity;
+    u32 root;
+    u32 freeList;
+    u32 leafCount;
+    f32 margin; // leaf bounds are grown by this much on every side
+};
+force_inline bool isLeaf(const Node& n) { return n.children[0] == nullNode; }
+force_inline u32 userId(const Node& n) { return n.children[1]; }
+force_inline f32 halfArea(const float3& min, const float3& max) {
+    const float3 e = math::subtract(max, min);
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+force_inline void combineBounds(Node& n, const Node& a, const Node& b) {
+    n.min = math::min(a.min, b.min);
+    n.max = math::max(a.max, b.max);
+}
+
+void init(Tree& tree, const u32 maxLeafCount, const f32 margin, allocator::PagedArena& arena) {
+    assert(maxLeafCount > 0);
+    tree = {};
+    tree.capacity = 2 * maxLeafCount - 1;
+    tree.nodes = (Node*)allocator::alloc_arena(arena, tree.capacity * sizeof(Node), alignof(Node));
+    tree.links = (NodeLinks*)allocator::alloc_arena(
+        arena, tree.capacity * sizeof(NodeLinks), alignof(NodeLinks));
+    for (u32 i = 0; i < tree.capacity; i++) {
+        tree.nodes[i] = {};
+        tree.links[i].parent = i + 1 < tree.capacity ? i + 1 : nullNode;
+        tree.links[i].height = -1;
+    }
+    tree.root = nullNode;
+    tree.freeList = 0;
+    tree.margin = margin;
+}
+u32 allocNode(Tree& tree) {
+    assert(tree.freeList != nullNode); // can't regrow without messing up existing node ids
+    const u32 nodeId = tree.freeList;
+    NodeLinks& links = tree.links[nodeId];
+    tree.freeList = links.parent;
+    links.parent = nullNode;
+    links.height = 0;
+    tree.nodes[nodeId].children[0] = tree.nodes[nodeId].children[1] = nullNode;
+    return nodeId;
+}
+void freeNode(Tree& tree, const u32 nodeId) {
+    NodeLinks& links = tree.links[nodeId];
+    links.parent = tree.freeList;
+    links.height = -1;
+    tree.freeList = nodeId;
+}
+// Recomputes bounds and height of an internal node from its children
+force_inline void refitNode(Tree& tree, const u32 nodeId) {
+    Node& node = tree.nodes[nodeId];
+    combineBounds(node, tree.nodes[node.children[0]], tree.nodes[node.children[1]]);
+    tree.links[nodeId].height =
+        1 + math::max(tree.links[node.children[0]].height, tree.links[node.children[1]].height);
+}
+// If the children of a differ in height by more than one, the taller child is rotated up to
+// take a's place, and a takes the shorter grandchild. Returns the node now at a's place
+u32 balance(Tree& tree, const u32 a) {
+    Node& nodeA = tree.nodes[a];
+    if (isLeaf(nodeA) || tree.links[a].height < 2) { return a; }
+    const s32 heightDiff =
+        tree.links[nodeA.children[1]].height - tree.links[nodeA.children[0]].height;
+    if (heightDiff >= -1 && heightDiff <= 1) { return a; }
+
+    const u32 up = heightDiff > 1 ? 1 : 0; // side of the child moving up
+    const u32 b = nodeA.children[up];
+    Node& nodeB = tree.nodes[b];
+    const u32 parent = tree.links[a].parent;
+    tree.links[b].parent = parent;
+    tree.links[a].parent = b;
+    if (parent == nullNode) { tree.root = b; }
+    else {
+        Node& p = tree.nodes[parent];
+        p.children[p.children[0] == a ? 0 : 1] = b;
+    }
+    // a keeps the taller grandchild's sibling, b keeps the taller grandchild
+    const u32 g0 = nodeB.children[0], g1 = nodeB.children[1];
+    const bool g0Taller = tree.links[g0].height > tree.links[g1].height;
+    const u32 keep = g0Taller ? g0 : g1;
+    const u32 give = g0Taller ? g1 : g0;
+    nodeB.children[0] = a;
+    nodeB.children[1] = keep;
+    nodeA.children[up] = give;
+    tree.links[give].parent = a;
+    refitNode(tree, a);
+    refitNode(tree, b);
+    return b;
+}
+// Refits bounds and heights from nodeId up to the root, rebalancing along the way
+void refitAncestors(Tree& tree, u32 nodeId) {
+    while (nodeId != nullNode) {
+        refitNode(tree, nodeId);
+        nodeId = balance(tree, nodeId);
+        nodeId = tree.links[nodeId].parent;
+    }
+}
+void insertLeafNode(Tree& tree, const u32 leaf) {
+    if (tree.root == nullNode) {
+        tree.root = leaf;
+        tree.links[leaf].parent = nullNode;
+        return;
+    }
+    // walk down to the best sibling: the cost of a new parent at a node is the area of the
+    // combined bounds, plus the area growth it causes on all of the node's ancestors
+    const Node& leafNode = tree.nodes[leaf];
+    u32 nodeId = tree.root;
+    f32 inheritedCost = 0.f;
+    while (!isLeaf(tree.nodes[nodeId])) {
+        const Node& node = tree.nodes[nodeId];
+        Node combined;
+        combineBounds(combined, node, leafNode);
+        const f32 combinedArea = halfArea(combined.min, combined.max);
+        const f32 siblingCost = combinedArea + inheritedCost;
+        const f32 childInheritedCost = inheritedCost + combinedArea - halfArea(node.min, node.max);
+        f32 childCost[2];
+        for (u32 c = 0; c < 2; c++) {
+            const Node& child = tree.nodes[node.children[c]];
+            combineBounds(combined, child, leafNode);
+            // lower bound for internal children: the leaf will at least cause this much growth
+            const f32 growth = halfArea(combined.min, combined.max)
+                - (isLeaf(child) ? 0.f : halfArea(child.min, child.max));
+            childCost[c] = growth + childInheritedCost;
+        }
+        if (siblingCost <= childCost[0] && siblingCost <= childCost[1]) { break; }
+        inheritedCost = childInheritedCost;
+        nodeId = node.children[childCost[0] <= childCost[1] ? 0 : 1];
+    }
+
+    const u32 sibling = nodeId;
+    const u32 oldParent = tree.links[sibling].parent;
+    const u32 newParent = allocNode(tree);
+    Node& parent = tree.nodes[newParent];
+    tree.links[newParent].parent = oldParent;
+    parent.children[0] = sibling;
+    parent.children[1] = leaf;
+    tree.links[sibling].parent = newParent;
+    tree.links[leaf].parent = newParent;
+    if (oldParent == nullNode) { tree.root = newParent; }
+    else {
+        Node& p = tree.nodes[oldParent];
+        p.children[p.children[0] == sibling ? 0 : 1] = newParent;
+    }
+    refitAncestors(tree, newParent);
+}
+void removeLeafNode(Tree& tree, const u32 leaf) {
+    if (leaf == tree.root) { tree.root = nullNode; return; }
+    const u32 parent = tree.links[leaf].parent;
+    const Node& parentNode = tree.nodes[parent];
+    const u32 grandParent = tree.links[parent].parent;
+    const u32 sibling = parentNode.children[parentNode.children[0] == leaf ? 1 : 0];
+    tree.links[sibling].parent = grandParent;
+    freeNode(tree, parent);
+    if (grandParent == nullNode) { tree.root = sibling; return; }
+    Node& g = tree.nodes[grandParent];
+    g.children[g.children[0] == parent ? 0 : 1] = sibling;
+    refitAncestors(tree, grandParent);
+}
+
+// Returns the leaf id, to be passed to move and remove
+u32 insert(Tree& tree, const float3& min, const float3& max, const u32 userId) {
+    const u32 leaf = allocNode(tree);
+    Node& node = tree.nodes[leaf];
+    const float3 margin(tree.margin, tree.margin, tree.margin);
+    node.min = math::subtract(min, margin);
+    node.max = math::add(max, margin);
+    node.children[1] = userId;
+    insertLeafNode(tree, leaf);
+    tree.leafCount++;
+    return leaf;
+}
+void remove(Tree& tree, const u32 leaf) {
+    removeLeafNode(tree, leaf);
+    freeNode(tree, leaf);
+    tree.leafCount--;
+}
+// Returns whether the leaf had to be reinserted: that only happens when the new bounds aren't
+// contained in the leaf's fat bounds anymore
+bool move(Tree& tree, const u32 leaf, const float3& min, const float3& max) {
+    Node& node = tree.nodes[leaf];
+    if (node.min.x <= min.x && node.min.y <= min.y && node.min.z <= min.z
+     && max.x <= node.max.x && max.y <= node.max.y && max.z <= node.max.z) { return false; }
+    removeLeafNode(tree, leaf);
+    const float3 margin(tree.margin, tree.margin, tree.margin);
+    node.min = math::subtract(min, margin);
+    node.max = math::add(max, margin);
+    insertLeafNode(tree, leaf);
+    return true;
+}
+
+// Writes the user ids of the leaves whose fat bounds touch the frustum, returns how many
+// Same plane mask scheme as bvh::findTrianglesIntersectingFrustum: planes a node is fully inside
+// of are dropped for its subtree. Results are conservative, callers should do their own exact tests
+// Planes are tested four at a time, against the node's center and half extents: the furthest
+// corner along a plane's normal is at center + dot(abs(normal), extents), the nearest at center -
+u32 findLeavesIntersectingFrustum(
+    u32* userIds, const Tree& tree, const float4* planes, const u32 numPlanes) {
+    struct FrustumQueryNode { u32 nodeId; u32 planeMask; };
+    struct PlaneGroup { f32 x[4], y[4], z[4], w[4], absX[4], absY[4], absZ[4]; };
+    assert(numPlanes < 32);
+    if (tree.root == nullNode) { return 0; }
+
+    // SoA planes, w is doubled so it can be added to the doubled centers below
+    // The last group is padded with planes that contain everything, but their mask bits are never set
+    const u32 groupCount = (numPlanes + 3) / 4;
+    PlaneGroup groups[8];
+    for (u32 p = 0; p < groupCount * 4; p++) {
+        const float4 plane = p < numPlanes ? planes[p] : float4(0.f, 0.f, 0.f, 1.f);
+        PlaneGroup& g = groups[p / 4];
+        const u32 lane = p % 4;
+        g.x[lane] = plane.x; g.y[lane] = plane.y; g.z[lane] = plane.z; g.w[lane] = 2.f * plane.w;
+        g.absX[lane] = math::abs(plane.x); g.absY[lane] = math::abs(plane.y); g.absZ[lane] = math::abs(plane.z);
+    }
+    const simd::f32x4 zero = simd::splat4(0.f);
+
+    // rotations keep the tree close to balanced, so its height stays well below this
+    const u32 maxStackCount = 64;
+    FrustumQueryNode nodeStack[maxStackCount];
+    u32 stackCount = 0;
+    u32 count = 0;
+    nodeStack[stackCount++] = { tree.root, (1u << numPlanes) - 1 };
+    while (stackCount > 0) {
+        const FrustumQueryNode n = nodeStack[--stackCount];
+        const Node& node = tree.nodes[n.nodeId];
+        // doubled center and extents, to save the scaling
+        const simd::f32x4 cx = simd::splat4(node.min.x + node.max.x);
+        const simd::f32x4 cy = simd::splat4(node.min.y + node.max.y);
+        const simd::f32x4 cz = simd::splat4(node.min.z + node.max.z);
+        const simd::f32x4 ex = simd::splat4(node.max.x - node.min.x);
+        const simd::f32x4 ey = simd::splat4(node.max.y - node.min.y);
+        const simd::f32x4 ez = simd::splat4(node.max.z - node.min.z);
+        u32 outsideMask = 0;
+        u32 planeMask = 0;
+        for (u32 gi = 0; gi < groupCount; gi++) {
+            const u32 groupMask = (n.planeMask >> (gi * 4)) & 0xf;
+            if (!groupMask) { continue; }
+            const PlaneGroup& g = groups[gi];
+            const simd::f32x4 dist = simd::add4(
+                simd::add4(simd::mul4(simd::load4(g.x), cx), simd::mul4(simd::load4(g.y), cy)),
+                simd::add4(simd::mul4(simd::load4(g.z), cz), simd::load4(g.w)));
+            const simd::f32x4 radius = simd::add4(
+                simd::add4(simd::mul4(simd::load4(g.absX), ex), simd::mul4(simd::load4(g.absY), ey)),
+                simd::mul4(simd::load4(g.absZ), ez));
+            // furthest corner outside: the node is outside; nearest corner outside: keep testing
+            outsideMask |= simd::lessMask4(simd::add4(dist, radius), zero) & groupMask;
+            planeMask |= (simd::lessMask4(dist, radius) & groupMask) << (gi * 4);
+        }
+        if (outsideMask) { continue; }
+        if (isLeaf(node)) { userIds[count++] = userId(node); continue; }
+        assert(stackCount + 2 <= maxStackCount);
+        nodeStack[stackCount++] = { node.children[0], planeMask };
+        nodeStack[stackCount++] = { node.children[1], planeMask };
+    }
+    return count;
+}
+
+}
+
+#endif // __WASTELADNS_AABBTREE_H__
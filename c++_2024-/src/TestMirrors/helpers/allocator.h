@@ -22,7 +22,44 @@ void* alloc_arena(Arena& arena, ptrdiff_t size, ptrdiff_t align) {
     return 0;
 }
 
+// Optional usage stats, shared by an arena and all of its scoped copies (same as the highmark)
+// Sizes are offsets from the start of the arena, so they stay valid across resets
+// Allocations are attributed to the active tag (see tag_arena), or to "untagged" otherwise
+struct ArenaTelemetry {
+    struct Tag {
+        const char* name;
+        size_t peak; // highest offset reached by an allocation with this tag
+        size_t bytes; // total bytes allocated with this tag
+        u64 count; // total number of allocations with this tag
+    };
+    const char* name;
+    u8* start;
+    size_t peak; // highest offset reached by any allocation
+    size_t framePeak; // highest offset since the last call to clear_framepeak
+    Tag tags[16];
+    u32 tagCount;
+    u32 activeTag;
+};
+void init_telemetry(ArenaTelemetry& telemetry, const char* name, u8* start) {
+    telemetry = {};
+    telemetry.name = name;
+    telemetry.start = start;
+    telemetry.tags[0].name = "untagged";
+    telemetry.tagCount = 1;
+}
+void record_alloc(ArenaTelemetry& telemetry, const uintptr_t end, const ptrdiff_t size) {
+    const size_t offset = end - (uintptr_t)telemetry.start;
+    ArenaTelemetry::Tag& tag = telemetry.tags[telemetry.activeTag];
+    tag.peak = math::max(tag.peak, offset);
+    tag.bytes += size;
+    tag.count++;
+    telemetry.peak = math::max(telemetry.peak, offset);
+    telemetry.framePeak = math::max(telemetry.framePeak, offset);
+}
+void clear_framepeak(ArenaTelemetry& telemetry) { telemetry.framePeak = 0; }
+
 // Same as Arena, except we reserve 4GB of memory first, and commit 4KB pages as needed
+// (or 2MB pages, if the arena was reserved with huge pages and the platform supports them)
 // For arenas that are passed by copy, we store a separate pointer to their highmark value.
 // This value is necessary to know when to commit more pages for scoped copies.
 // It also lets us keep track of the highest allocation at any time.
@@ -30,20 +67,68 @@ struct PagedArena {
     u8* curr;
     u8* end;
     uintptr_t* highmark; // pointer to track overall allocations of scoped copies (see mention above)
+    size_t pagesize; // commit granularity
+    ArenaTelemetry* telemetry; // optional
 };
-u8* reserve_pages(const uintptr_t end, const uintptr_t start) {
-    const ptrdiff_t pagesize = 4 * 1024; // assume 4kb pages
+// Sets the tag future allocations will be recorded under, and returns the previous one,
+// so it can be restored afterwards. Tags are compared by pointer, so use string literals
+const char* tag_arena(PagedArena& arena, const char* name) {
+    if (!arena.telemetry) { return nullptr; }
+    ArenaTelemetry& telemetry = *arena.telemetry;
+    const char* prev = telemetry.tags[telemetry.activeTag].name;
+    if (!name) { telemetry.activeTag = 0; return prev; }
+    u32 tagId = 0;
+    for (; tagId < telemetry.tagCount; tagId++) {
+        if (telemetry.tags[tagId].name == name) { break; }
+    }
+    if (tagId == telemetry.tagCount) {
+        if (telemetry.tagCount == countof(telemetry.tags)) { tagId = 0; } // out of tags: untagged
+        else { telemetry.tags[telemetry.tagCount++].name = name; }
+    }
+    telemetry.activeTag = tagId;
+    return prev;
+}
+u8* reserve_pages(const uintptr_t end, const uintptr_t start, const ptrdiff_t pagesize) {
     const size_t commitsize = end - start; assert(end > start);
     size_t commitsize_aligned = (commitsize + (pagesize - 1)) & -pagesize;
     platform::mem_commit((void*)start, commitsize_aligned);
     return (u8*)(start + commitsize_aligned);
 };
-void init_arena(PagedArena& arena, size_t capacity) {
+void init_arena(PagedArena& arena, size_t capacity, platform::PageType::Enum pagetype) {
     // reserve 4GB of virtual memory (we'll crash if we touch anything past that)
-    const size_t capacity_aligned = 4ULL * 1024ULL * 1024ULL * 1024ULL;
-    arena.curr = (u8*)platform::mem_reserve(capacity_aligned);
-    arena.end = reserve_pages(uintptr_t(arena.curr + capacity), (uintptr_t)arena.curr);
+    // explicit huge pages are taken from the OS pool when reserved, so we only reserve the capacity
+    const size_t capacity_aligned =
+        pagetype == platform::PageType::HugeExplicit ?
+              (capacity + (platform::hugePageSize - 1)) & -(ptrdiff_t)platform::hugePageSize
+            : 4ULL * 1024ULL * 1024ULL * 1024ULL;
+    arena.curr = (u8*)platform::mem_reserve(capacity_aligned, pagetype, arena.pagesize);
+    assert(arena.curr); // could not reserve virtual memory
+    arena.end = reserve_pages(uintptr_t(arena.curr + capacity), (uintptr_t)arena.curr, arena.pagesize);
     arena.highmark = nullptr;
+    arena.telemetry = nullptr;
+}
+void init_arena(PagedArena& arena, size_t capacity) {
+    init_arena(arena, capacity, platform::PageType::Small);
+}
+// Highest committed address, including pages committed by scoped copies
+uintptr_t committed_end(const PagedArena& arena) {
+    uintptr_t end = (uintptr_t)arena.end;
+    if (arena.highmark) { end = math::max(*arena.highmark, end); }
+    return end;
+}
+// Rewinds the arena to start, and gives back to the OS all pages committed past start + keepsize
+// Any scoped copies of this arena must be out of scope, since their pages may be gone
+void reset_arena(PagedArena& arena, u8* start, size_t keepsize) {
+    const uintptr_t keep_end =
+        ((uintptr_t)start + keepsize + (arena.pagesize - 1)) & -(ptrdiff_t)arena.pagesize;
+    uintptr_t end = committed_end(arena);
+    if (end > keep_end) {
+        platform::mem_decommit((void*)keep_end, end - keep_end);
+        end = keep_end;
+    }
+    arena.curr = start;
+    arena.end = (u8*)end;
+    if (arena.highmark) { *arena.highmark = (uintptr_t)start; }
 }
 void* alloc_arena(PagedArena& arena, ptrdiff_t size, ptrdiff_t align) {
     assert((align & (align - 1)) == 0); // Alignment needs to be a power of two
@@ -57,10 +142,11 @@ void* alloc_arena(PagedArena& arena, ptrdiff_t size, ptrdiff_t align) {
     } else {
         // allocation goes past our committed memory space
         // commit however many pages we need
-        arena.end = reserve_pages(end_aligned, highmark);
+        arena.end = reserve_pages(end_aligned, highmark, arena.pagesize);
         if (arena.highmark) { *arena.highmark = (uintptr_t)arena.end; }
     }
     arena.curr = (u8*)end_aligned;
+    if (arena.telemetry) { record_alloc(*arena.telemetry, end_aligned, size); }
     return (void*)curr_aligned;
 }
 void* realloc_arena(PagedArena& arena, void* oldptr, ptrdiff_t oldsize, ptrdiff_t newsize, ptrdiff_t align) {
@@ -82,6 +168,175 @@ void free_arena(PagedArena& arena, void* ptr, ptrdiff_t size) {
         arena.curr = (u8*)oldbuff;
     }
 }
+// Gives back the unused tail of the most recent allocation, for lists allocated for the worst case
+// The peak stays where the full allocation reached, but the tag only keeps the bytes still in use
+void shrink_arena(PagedArena& arena, void* ptr, ptrdiff_t oldsize, ptrdiff_t newsize) {
+    assert((u8*)ptr + oldsize == arena.curr); // not the most recent allocation
+    assert(newsize <= oldsize);
+    arena.curr = (u8*)ptr + newsize;
+    if (arena.telemetry) {
+        arena.telemetry->tags[arena.telemetry->activeTag].bytes -= oldsize - newsize;
+    }
+}
+
+// Malloc-style allocator for third party loaders (stb_image, ufbx), on top of a scoped arena.
+// Each allocation is preceded by a header linking it to the previous one, so that:
+// - the most recent allocation grows or shrinks in place, instead of being copied
+// - freeing the most recent allocation gives its memory back to the arena, along with any
+//   allocations below it that were already freed (loaders mostly free in reverse order)
+// Anything else is reclaimed when the backing arena copy goes out of scope, so use one per asset
+struct LoaderArena {
+    struct Header {
+        Header* prev;
+        size_t size; // top bit is set once freed
+    };
+    static const size_t FreedBit = (size_t)1 << (sizeof(size_t) * 8 - 1);
+    static const size_t Align = 16; // sizes are rounded up too, so allocations end where the next starts
+    PagedArena* arena; // may be allocated from outside of the loader, see loader_is_top
+    Header* last;
+    u8* start;
+    size_t peak; // highest number of bytes used since start
+    u32 allocCount;
+    u32 reallocInPlaceCount;
+    u32 reallocCopyCount;
+};
+static_assert(sizeof(LoaderArena::Header) == LoaderArena::Align, "header must keep allocations aligned");
+void init_loader(LoaderArena& loader, PagedArena& arena) {
+    loader = {};
+    loader.arena = &arena;
+    loader.start = arena.curr;
+}
+size_t loader_size_aligned(const size_t size) {
+    return (size + (LoaderArena::Align - 1)) & ~(LoaderArena::Align - 1);
+}
+bool loader_is_top(const LoaderArena& loader, const LoaderArena::Header* h) {
+    const size_t size = h->size & ~LoaderArena::FreedBit;
+    return (u8*)(h + 1) + loader_size_aligned(size) == loader.arena->curr;
+}
+void* alloc_loader(LoaderArena& loader, size_t size) {
+    LoaderArena::Header* h = (LoaderArena::Header*)alloc_arena(
+        *loader.arena, sizeof(LoaderArena::Header) + loader_size_aligned(size),
+        LoaderArena::Align);
+    h->prev = loader.last;
+    h->size = size;
+    loader.last = h;
+    loader.allocCount++;
+    loader.peak = math::max(loader.peak, (size_t)(loader.arena->curr - loader.start));
+    return h + 1;
+}
+void free_loader(LoaderArena& loader, void* ptr) {
+    if (!ptr) { return; }
+    LoaderArena::Header* h = (LoaderArena::Header*)ptr - 1;
+    h->size |= LoaderArena::FreedBit;
+    // pop every freed allocation at the top of the arena
+    while (loader.last && (loader.last->size & LoaderArena::FreedBit)
+           && loader_is_top(loader, loader.last)) {
+        loader.arena->curr = (u8*)loader.last;
+        loader.last = loader.last->prev;
+    }
+}
+void* realloc_loader(LoaderArena& loader, void* ptr, size_t newsize) {
+    if (!ptr) { return alloc_loader(loader, newsize); }
+    LoaderArena::Header* h = (LoaderArena::Header*)ptr - 1;
+    if (h == loader.last && loader_is_top(loader, h)) {
+        // rewind and allocate again: commits pages as needed, and returns the same pointer
+        loader.arena->curr = (u8*)ptr;
+        alloc_arena(*loader.arena, loader_size_aligned(newsize), LoaderArena::Align);
+        h->size = newsize;
+        loader.reallocInPlaceCount++;
+        loader.peak = math::max(loader.peak, (size_t)(loader.arena->curr - loader.start));
+        return ptr;
+    }
+    void* data = alloc_loader(loader, newsize);
+    memcpy(data, ptr, math::min(h->size, newsize));
+    free_loader(loader, ptr);
+    loader.reallocCopyCount++;
+    return data;
+}
+
+// Arena that can be allocated from by multiple threads at once. Each thread allocates from its own
+// ThreadArena block without any synchronization, and only refills it from the shared arena with
+// an atomic bump when it runs out. Pages are committed contiguously from the start of the
+// reservation, so a thread only needs to commit when its block goes past the committed mark.
+// Resetting is single-threaded (no thread can be allocating), and invalidates all thread blocks.
+struct ConcurrentArena {
+    u8* start;
+    volatile uintptr_t curr; // start of the next block to hand out
+    volatile uintptr_t committed; // end of the committed range
+    uintptr_t highmark; // highest block end, updated on reset (see used_bytes for the current one)
+    size_t pagesize;
+    size_t blocksize; // minimum size of each thread block
+    u32 generation; // incremented on each reset
+};
+struct ThreadArena {
+    ConcurrentArena* shared;
+    u8* curr;
+    u8* end;
+    u32 generation;
+};
+void init_arena(ConcurrentArena& arena, size_t capacity, size_t blocksize) {
+    PagedArena paged;
+    init_arena(paged, capacity);
+    arena.start = paged.curr;
+    arena.curr = (uintptr_t)paged.curr;
+    arena.committed = (uintptr_t)paged.end;
+    arena.highmark = (uintptr_t)paged.curr;
+    arena.pagesize = paged.pagesize;
+    arena.blocksize = blocksize;
+    arena.generation = 0;
+}
+void init_arena(ThreadArena& arena, ConcurrentArena& shared) {
+    arena.shared = &shared;
+    arena.curr = arena.end = nullptr;
+    arena.generation = shared.generation;
+}
+void* alloc_arena(ThreadArena& arena, ptrdiff_t size, ptrdiff_t align) {
+    assert((align & (align - 1)) == 0); // Alignment needs to be a power of two
+    ConcurrentArena& shared = *arena.shared;
+    if (arena.generation != shared.generation) { // the shared arena was reset since our last refill
+        arena.curr = arena.end = nullptr;
+        arena.generation = shared.generation;
+    }
+    uintptr_t curr_aligned = ((uintptr_t)arena.curr + (align - 1)) & -align;
+    if (curr_aligned + size > (uintptr_t)arena.end) {
+        // refill: whatever was left in the previous block is wasted
+        const size_t blocksize = math::max(shared.blocksize, (size_t)(size + align));
+        const uintptr_t block = platform::atomic_fetch_add(&shared.curr, blocksize);
+        const uintptr_t block_end = block + blocksize;
+        uintptr_t committed = platform::atomic_load(&shared.committed);
+        while (block_end > committed) {
+            // commit from the committed mark, so the committed range has no holes
+            // commits are idempotent, so it's fine for several threads to overlap here
+            const uintptr_t committed_new = (uintptr_t)reserve_pages(block_end, committed, shared.pagesize);
+            if (platform::atomic_cas(&shared.committed, committed, committed_new)) { break; }
+            committed = platform::atomic_load(&shared.committed);
+        }
+        arena.curr = (u8*)block;
+        arena.end = (u8*)block_end;
+        curr_aligned = ((uintptr_t)arena.curr + (align - 1)) & -align;
+    }
+    arena.curr = (u8*)(curr_aligned + size);
+    return (void*)curr_aligned;
+}
+// Bytes handed out to thread blocks since the last reset (allocations within them may be fewer)
+size_t used_bytes(const ConcurrentArena& arena) {
+    return platform::atomic_load((volatile uintptr_t*)&arena.curr) - (uintptr_t)arena.start;
+}
+void reset_arena(ConcurrentArena& arena) {
+    arena.highmark = math::max(arena.highmark, (uintptr_t)arena.curr);
+    arena.curr = (uintptr_t)arena.start;
+    arena.generation++;
+}
+// Same, and gives back to the OS all pages committed past start + keepsize
+void reset_arena(ConcurrentArena& arena, size_t keepsize) {
+    reset_arena(arena);
+    const uintptr_t keep_end =
+        ((uintptr_t)arena.start + keepsize + (arena.pagesize - 1)) & -(ptrdiff_t)arena.pagesize;
+    if (arena.committed > keep_end) {
+        platform::mem_decommit((void*)keep_end, arena.committed - keep_end);
+        arena.committed = keep_end;
+    }
+}
 
 // Dynamic array. When used with the same arena without any external allocations in between calls
 // to allocator::push, the array will continue to grow in place. Note that, in any other case,
@@ -133,6 +388,157 @@ void reserve(Buffer<T>& b, ptrdiff_t cap, PagedArena& arena) {
     b.cap = cap;
 }
 
+// Fallback for platforms without cheap address space reservations: elements are stored in
+// fixed-size chunks allocated from an arena as needed. Pointers to elements stay valid, and
+// push never copies, but elements are not contiguous: use at() to access them
+template<typename T>
+struct ChunkedBuffer {
+    T** chunks; // table of chunks, the only thing that gets copied as the buffer grows
+    ptrdiff_t chunkCount;
+    ptrdiff_t chunkTableCap;
+    ptrdiff_t len;
+    ptrdiff_t chunkLen; // elements per chunk, must be a power of two
+};
+template<typename T>
+void init_buffer(ChunkedBuffer<T>& b, ptrdiff_t chunkLen) {
+    assert((chunkLen & (chunkLen - 1)) == 0); // chunk length needs to be a power of two
+    b = {};
+    b.chunkLen = chunkLen;
+}
+template<typename T>
+T& push(ChunkedBuffer<T>& b, PagedArena& arena) {
+    if (b.len == b.chunkCount * b.chunkLen) {
+        if (b.chunkCount == b.chunkTableCap) {
+            b.chunkTableCap = b.chunkTableCap ? b.chunkTableCap * 2 : 8;
+            T** chunks = (T**)alloc_arena(arena, sizeof(T*) * b.chunkTableCap, alignof(T*));
+            if (b.chunkCount) { memcpy(chunks, b.chunks, sizeof(T*) * b.chunkCount); }
+            b.chunks = chunks;
+        }
+        b.chunks[b.chunkCount++] = (T*)alloc_arena(arena, sizeof(T) * b.chunkLen, alignof(T));
+    }
+    const ptrdiff_t index = b.len++;
+    return b.chunks[index / b.chunkLen][index & (b.chunkLen - 1)];
+}
+template<typename T>
+T& at(const ChunkedBuffer<T>& b, ptrdiff_t index) {
+    assert(index < b.len);
+    return b.chunks[index / b.chunkLen][index & (b.chunkLen - 1)];
+}
+template<typename T>
+void clear(ChunkedBuffer<T>& b) {
+    // keeps the chunks: only valid if the arena they came from hasn't been reset
+    b.len = 0;
+}
+
+// Dynamic array on its own virtual memory reservation: pages get committed as the array grows,
+// so push never copies, and pointers to elements stay valid until the buffer is cleared
+// Intended to be initialized once and cleared every use, so pages stay committed across frames
+// Platforms that can't reserve address space cheaply don't define __CHEAP_RESERVE, and get a
+// ChunkedBuffer instead, with chunks from the arena passed on init (it must outlive the buffer).
+// Elements are only contiguous within a chunk then: access them with at() and copy_range()
+#ifndef __CHEAP_RESERVE
+#define __CHEAP_RESERVE 0
+#endif
+#if __CHEAP_RESERVE
+template<typename T>
+struct VirtualBuffer {
+    T* data;
+    ptrdiff_t len;
+    PagedArena arena; // only used by this buffer, so allocations are contiguous
+};
+template<typename T>
+void init_buffer(VirtualBuffer<T>& b, ptrdiff_t initialCap, PagedArena&) {
+    init_arena(b.arena, sizeof(T) * initialCap);
+    b.data = (T*)b.arena.curr;
+    b.len = 0;
+}
+template<typename T>
+T& push(VirtualBuffer<T>& b) {
+    b.len++;
+    return *(T*)alloc_arena(b.arena, sizeof(T), alignof(T));
+}
+// Pushes count elements at once, and returns the index of the first one
+template<typename T>
+ptrdiff_t push(VirtualBuffer<T>& b, ptrdiff_t count) {
+    alloc_arena(b.arena, sizeof(T) * count, alignof(T));
+    b.len += count;
+    return b.len - count;
+}
+template<typename T>
+void pop(VirtualBuffer<T>& b) {
+    b.len--;
+    b.arena.curr -= sizeof(T);
+}
+template<typename T>
+void clear(VirtualBuffer<T>& b) {
+    b.arena.curr = (u8*)b.data;
+    b.len = 0;
+}
+template<typename T>
+T& at(const VirtualBuffer<T>& b, ptrdiff_t index) {
+    assert(index < b.len);
+    return b.data[index];
+}
+// Copies count elements from src, starting at srcIndex, to dst, starting at dstIndex
+template<typename T>
+void copy_range(VirtualBuffer<T>& dst, ptrdiff_t dstIndex, const VirtualBuffer<T>& src, ptrdiff_t srcIndex,
+    ptrdiff_t count) {
+    assert(dstIndex + count <= dst.len && srcIndex + count <= src.len);
+    memcpy(dst.data + dstIndex, src.data + srcIndex, sizeof(T) * count);
+}
+#else
+template<typename T>
+struct VirtualBuffer {
+    ChunkedBuffer<T> chunks;
+    ptrdiff_t len; // may be less than chunks.len: chunks.len only grows, and clear() keeps the chunks
+    PagedArena* chunkArena;
+};
+template<typename T>
+void init_buffer(VirtualBuffer<T>& b, ptrdiff_t initialCap, PagedArena& chunkArena) {
+    ptrdiff_t chunkLen = 64;
+    while (chunkLen < initialCap) { chunkLen *= 2; }
+    init_buffer(b.chunks, chunkLen);
+    b.len = 0;
+    b.chunkArena = &chunkArena;
+}
+template<typename T>
+T& push(VirtualBuffer<T>& b) {
+    const ptrdiff_t index = b.len++;
+    if (index == b.chunks.len) { push(b.chunks, *b.chunkArena); }
+    return at(b.chunks, index);
+}
+template<typename T>
+ptrdiff_t push(VirtualBuffer<T>& b, ptrdiff_t count) {
+    for (ptrdiff_t i = 0; i < count; i++) { push(b); }
+    return b.len - count;
+}
+template<typename T>
+void pop(VirtualBuffer<T>& b) {
+    b.len--;
+}
+template<typename T>
+void clear(VirtualBuffer<T>& b) {
+    b.len = 0;
+}
+template<typename T>
+T& at(const VirtualBuffer<T>& b, ptrdiff_t index) {
+    assert(index < b.len);
+    return at(b.chunks, index);
+}
+template<typename T>
+void copy_range(VirtualBuffer<T>& dst, ptrdiff_t dstIndex, const VirtualBuffer<T>& src, ptrdiff_t srcIndex,
+    ptrdiff_t count) {
+    assert(dstIndex + count <= dst.len && srcIndex + count <= src.len);
+    while (count > 0) { // one memcpy per stretch that is contiguous in both buffers
+        const ptrdiff_t dstLeft = dst.chunks.chunkLen - (dstIndex & (dst.chunks.chunkLen - 1));
+        const ptrdiff_t srcLeft = src.chunks.chunkLen - (srcIndex & (src.chunks.chunkLen - 1));
+        const ptrdiff_t n = math::min(count, math::min(dstLeft, srcLeft));
+        memcpy(&at(dst, dstIndex), &at(src, srcIndex), sizeof(T) * n);
+        dstIndex += n; srcIndex += n; count -= n;
+    }
+}
+#endif
+
 // tmp pool: mostly untested
 template<typename T>
 struct Pool {
@@ -173,10 +579,10 @@ T&  alloc_pool(Pool<T>& pool) {
 template<typename T>
 void free_pool(Pool<T>& pool, T& slot) {
     typedef typename Pool<T>::Slot Slot;
-    assert((Slot*)slot >= &pool.data && (Slot*)slot < &pool.data + pool.cap); // object didn't come from this pool
+    assert((Slot*)&slot >= pool.data && (Slot*)&slot < pool.data + pool.cap); // object didn't come from this pool
     ((Slot*)&slot)->state.next = pool.firstAvailable;
     ((Slot*)&slot)->alive = 0;
-    pool.firstAvailable = (Slot*)slot;
+    pool.firstAvailable = (Slot*)&slot;
 	pool.count--;
 }
 template<typename T>
@@ -185,6 +591,301 @@ u32 get_pool_index(Pool<T>& pool, T& slot)
 template<typename T>
 T& get_pool_slot(Pool<T>& pool, const u32 index) { return pool.data[index].state.live; }
 
+// Sparse set pool: live objects are kept packed in [0, count), so iteration cost depends on the
+// number of live objects, not on the capacity. Objects are referenced via generational handles,
+// which go through a sparse indirection table, so they stay valid when objects move on free.
+// Handles store the sparse index + 1 in the lower bits (0 is reserved as the invalid handle),
+// and the slot generation in the upper bits, which is bumped on free to detect stale handles.
+// Note that pointers to objects are invalidated by free_pool, since the last object is moved
+struct SparsePoolHandle { enum Enum {
+    IndexBits = 20, IndexMask = (1 << IndexBits) - 1,
+    GenerationBits = 32 - IndexBits, GenerationMask = (1 << GenerationBits) - 1,
+    MaxCap = IndexMask - 1
+}; };
+template<typename T>
+struct SparsePool {
+    struct Sparse {
+        u32 dense; // index into data when alive, next available sparse slot otherwise
+        u32 generation;
+    };
+    __DEBUGDEF(const char* name;)
+    T* data; // packed live objects
+    u32* denseToSparse; // sparse index of each live object
+    Sparse* sparse;
+    u32 firstAvailable; // SparsePoolHandle::IndexMask if none
+    ptrdiff_t cap;
+    ptrdiff_t count;
+};
+template<typename T>
+void init_pool(SparsePool<T>& pool, ptrdiff_t cap, PagedArena& arena) {
+    typedef typename SparsePool<T>::Sparse Sparse;
+    assert(cap <= SparsePoolHandle::MaxCap);
+    pool.cap = cap;
+    pool.data = (T*)allocator::alloc_arena(arena, sizeof(T) * cap, alignof(T));
+    pool.denseToSparse = (u32*)allocator::alloc_arena(arena, sizeof(u32) * cap, alignof(u32));
+    pool.sparse = (Sparse*)allocator::alloc_arena(arena, sizeof(Sparse) * cap, alignof(Sparse));
+    for (u32 i = 0; i < cap; i++) { pool.sparse[i].dense = i + 1; pool.sparse[i].generation = 0; }
+    pool.sparse[cap - 1].dense = SparsePoolHandle::IndexMask;
+    pool.firstAvailable = 0;
+    pool.count = 0;
+}
+template<typename T>
+u32 get_pool_handle(SparsePool<T>& pool, T& slot) {
+    const u32 sparseIndex = pool.denseToSparse[&slot - pool.data];
+    return (pool.sparse[sparseIndex].generation << SparsePoolHandle::IndexBits) | (sparseIndex + 1);
+}
+template<typename T>
+T& alloc_pool(SparsePool<T>& pool) {
+    assert(pool.firstAvailable != SparsePoolHandle::IndexMask); // pool is full
+    const u32 sparseIndex = pool.firstAvailable;
+    typename SparsePool<T>::Sparse& sparse = pool.sparse[sparseIndex];
+    pool.firstAvailable = sparse.dense;
+    sparse.dense = (u32)pool.count;
+    pool.denseToSparse[pool.count] = sparseIndex;
+    return pool.data[pool.count++];
+}
+template<typename T>
+bool is_handle_valid(SparsePool<T>& pool, const u32 handle) {
+    const u32 sparseIndex = (handle & SparsePoolHandle::IndexMask) - 1;
+    if (sparseIndex >= pool.cap) { return false; }
+    const typename SparsePool<T>::Sparse& sparse = pool.sparse[sparseIndex];
+    return sparse.generation == (handle >> SparsePoolHandle::IndexBits)
+        && sparse.dense < pool.count && pool.denseToSparse[sparse.dense] == sparseIndex;
+}
+template<typename T>
+T& get_pool_slot(SparsePool<T>& pool, const u32 handle) {
+    assert(is_handle_valid(pool, handle)); // stale handle, or handle from another pool
+    return pool.data[pool.sparse[(handle & SparsePoolHandle::IndexMask) - 1].dense];
+}
+template<typename T>
+void free_pool(SparsePool<T>& pool, const u32 handle) {
+    assert(is_handle_valid(pool, handle)); // stale handle, or handle from another pool
+    const u32 sparseIndex = (handle & SparsePoolHandle::IndexMask) - 1;
+    typename SparsePool<T>::Sparse& sparse = pool.sparse[sparseIndex];
+    // move the last object into the freed spot to keep the data packed
+    const u32 lastDense = (u32)(pool.count - 1);
+    if (sparse.dense != lastDense) {
+        const u32 lastSparse = pool.denseToSparse[lastDense];
+        pool.data[sparse.dense] = pool.data[lastDense];
+        pool.denseToSparse[sparse.dense] = lastSparse;
+        pool.sparse[lastSparse].dense = sparse.dense;
+    }
+    pool.count--;
+    sparse.generation = (sparse.generation + 1) & SparsePoolHandle::GenerationMask;
+    sparse.dense = pool.firstAvailable;
+    pool.firstAvailable = sparseIndex;
+}
+
+
+// TLSF (two-level segregated fit) heap, for resources with irregular lifetimes that need to be
+// freed individually. Free blocks are kept in lists segregated by size: the first level splits
+// sizes by powers of two, and the second level splits each of those linearly. Bitmaps of
+// non-empty lists make both alloc and free O(1). Adjacent free blocks are merged on free.
+// Memory is grabbed from a PagedArena in large chunks as needed: if this heap is its only user,
+// chunks are contiguous and get merged with the previous ones.
+// For more details, see http://www.gii.upv.es/tlsf/files/papers/tlsf_desc.pdf
+struct TLSF {
+    enum {
+        AlignLog2 = 4, Align = 1 << AlignLog2,
+        SLLog2 = 4, SLCount = 1 << SLLog2,
+        FLShift = SLLog2 + AlignLog2, // all sizes below 1 << FLShift go into the first list
+        FLMax = 32, FLCount = FLMax - FLShift + 1,
+        BlockOverhead = 16, MinBlockSize = 16
+    };
+    enum BlockFlags { Free = 1, PrevFree = 2, FlagsMask = 3 };
+    struct Block {
+        Block* prevPhys; // previous block in memory, only valid if it is free
+        size_t size; // payload size, with BlockFlags in the lower bits
+        Block* nextFree; // only valid if this block is free, overlaps the payload otherwise
+        Block* prevFree;
+    };
+    PagedArena* arena;
+    Block* sentinel; // zero-sized used block at the end of the last chunk
+    size_t chunkSize;
+    u32 flBitmap;
+    u32 slBitmap[FLCount];
+    Block* freeLists[FLCount][SLCount];
+    size_t heapBytes; // memory taken from the arena
+    size_t usedBytes; // payload of allocated blocks
+    u32 usedBlocks;
+};
+struct TLSFStats {
+    size_t heapBytes;
+    size_t usedBytes;
+    size_t freeBytes;
+    size_t largestFreeBlock;
+    u32 usedBlocks;
+    u32 freeBlocks;
+    f32 fragmentation; // 1 - largest free block / total free: 0 when all free memory is contiguous
+};
+size_t tlsf_size(const TLSF::Block* b) { return b->size & ~(size_t)TLSF::FlagsMask; }
+TLSF::Block* tlsf_next(const TLSF::Block* b) {
+    return (TLSF::Block*)((u8*)b + TLSF::BlockOverhead + tlsf_size(b));
+}
+void tlsf_mapping(size_t size, u32& fl, u32& sl) {
+    if (size < (1 << TLSF::FLShift)) {
+        fl = 0;
+        sl = (u32)(size >> TLSF::AlignLog2);
+    } else {
+        const u32 msb = math::msb64(size);
+        sl = (u32)(size >> (msb - TLSF::SLLog2)) ^ TLSF::SLCount;
+        fl = msb - (TLSF::FLShift - 1);
+    }
+}
+void tlsf_insert(TLSF& t, TLSF::Block* b) {
+    u32 fl, sl;
+    tlsf_mapping(tlsf_size(b), fl, sl);
+    TLSF::Block* head = t.freeLists[fl][sl];
+    b->nextFree = head;
+    b->prevFree = nullptr;
+    if (head) { head->prevFree = b; }
+    t.freeLists[fl][sl] = b;
+    t.flBitmap |= 1u << fl;
+    t.slBitmap[fl] |= 1u << sl;
+}
+void tlsf_remove(TLSF& t, TLSF::Block* b) {
+    u32 fl, sl;
+    tlsf_mapping(tlsf_size(b), fl, sl);
+    if (b->prevFree) { b->prevFree->nextFree = b->nextFree; }
+    else { t.freeLists[fl][sl] = b->nextFree; }
+    if (b->nextFree) { b->nextFree->prevFree = b->prevFree; }
+    if (!t.freeLists[fl][sl]) {
+        t.slBitmap[fl] &= ~(1u << sl);
+        if (!t.slBitmap[fl]) { t.flBitmap &= ~(1u << fl); }
+    }
+}
+// merges a free block (not in any list) with its free physical neighbours
+TLSF::Block* tlsf_merge(TLSF& t, TLSF::Block* b) {
+    if (b->size & TLSF::PrevFree) {
+        TLSF::Block* prev = b->prevPhys;
+        tlsf_remove(t, prev);
+        prev->size += TLSF::BlockOverhead + tlsf_size(b);
+        b = prev;
+        tlsf_next(b)->prevPhys = b;
+    }
+    TLSF::Block* next = tlsf_next(b);
+    if (next->size & TLSF::Free) {
+        tlsf_remove(t, next);
+        b->size += TLSF::BlockOverhead + tlsf_size(next);
+        tlsf_next(b)->prevPhys = b;
+    }
+    return b;
+}
+void tlsf_grow(TLSF& t, size_t minSize) {
+    size_t chunk = math::max(t.chunkSize, minSize + 2 * TLSF::BlockOverhead);
+    chunk = (chunk + (TLSF::Align - 1)) & -(ptrdiff_t)TLSF::Align;
+    u8* mem = (u8*)alloc_arena(*t.arena, chunk, TLSF::Align);
+    t.heapBytes += chunk;
+    TLSF::Block* b;
+    size_t available;
+    if (t.sentinel && mem == (u8*)t.sentinel + TLSF::BlockOverhead) {
+        // contiguous with the last chunk: the old sentinel becomes the header of the new block
+        b = t.sentinel;
+        available = chunk;
+    } else {
+        b = (TLSF::Block*)mem;
+        b->size = 0;
+        available = chunk - TLSF::BlockOverhead;
+    }
+    // the block keeps its PrevFree flag, the new sentinel takes the last header
+    b->size = (available - TLSF::BlockOverhead) | TLSF::Free | (b->size & TLSF::PrevFree);
+    TLSF::Block* sentinel = tlsf_next(b);
+    sentinel->size = TLSF::PrevFree;
+    sentinel->prevPhys = b;
+    t.sentinel = sentinel;
+    tlsf_insert(t, tlsf_merge(t, b));
+}
+// returns a free block from the first non-empty list that only holds blocks of at least searchSize
+TLSF::Block* tlsf_find(TLSF& t, size_t searchSize) {
+    u32 fl, sl;
+    tlsf_mapping(searchSize, fl, sl);
+    assert(fl < TLSF::FLCount); // allocation too large
+    u32 slMap = t.slBitmap[fl] & (~0u << sl);
+    if (!slMap) {
+        const u32 flMap = t.flBitmap & (~0u << (fl + 1));
+        if (!flMap) { return nullptr; }
+        fl = math::lsb32(flMap);
+        slMap = t.slBitmap[fl];
+    }
+    sl = math::lsb32(slMap);
+    return t.freeLists[fl][sl];
+}
+void init_tlsf(TLSF& t, PagedArena& arena, size_t chunkSize) {
+    t = {};
+    t.arena = &arena;
+    t.chunkSize = chunkSize;
+}
+void* alloc_tlsf(TLSF& t, size_t size, size_t align) {
+    assert(align <= TLSF::Align); // larger alignments are not supported
+    size = math::max((size + (TLSF::Align - 1)) & -(ptrdiff_t)TLSF::Align, (size_t)TLSF::MinBlockSize);
+    // round up to the next list, so that any block in it fits
+    size_t searchSize = size;
+    if (searchSize >= (1 << TLSF::FLShift)) {
+        searchSize += ((size_t)1 << (math::msb64(searchSize) - TLSF::SLLog2)) - 1;
+    }
+    TLSF::Block* b = tlsf_find(t, searchSize);
+    if (!b) {
+        tlsf_grow(t, searchSize);
+        b = tlsf_find(t, searchSize);
+    }
+    tlsf_remove(t, b);
+    // split off the tail, if it's big enough to be a block on its own
+    const size_t blockSize = tlsf_size(b);
+    if (blockSize >= size + TLSF::BlockOverhead + TLSF::MinBlockSize) {
+        TLSF::Block* rest = (TLSF::Block*)((u8*)b + TLSF::BlockOverhead + size);
+        rest->size = (blockSize - size - TLSF::BlockOverhead) | TLSF::Free;
+        b->size = size | (b->size & TLSF::FlagsMask);
+        tlsf_next(rest)->prevPhys = rest;
+        tlsf_insert(t, rest);
+    } else {
+        tlsf_next(b)->size &= ~(size_t)TLSF::PrevFree;
+    }
+    b->size &= ~(size_t)TLSF::Free;
+    t.usedBytes += tlsf_size(b);
+    t.usedBlocks++;
+    return (u8*)b + TLSF::BlockOverhead;
+}
+void free_tlsf(TLSF& t, void* ptr) {
+    if (!ptr) { return; }
+    TLSF::Block* b = (TLSF::Block*)((u8*)ptr - TLSF::BlockOverhead);
+    assert(!(b->size & TLSF::Free)); // double free
+    t.usedBytes -= tlsf_size(b);
+    t.usedBlocks--;
+    b->size |= TLSF::Free;
+    TLSF::Block* next = tlsf_next(b);
+    next->size |= TLSF::PrevFree;
+    next->prevPhys = b;
+    tlsf_insert(t, tlsf_merge(t, b));
+}
+void* realloc_tlsf(TLSF& t, void* ptr, size_t newsize, size_t align) {
+    if (!ptr) { return alloc_tlsf(t, newsize, align); }
+    const size_t oldsize = tlsf_size((TLSF::Block*)((u8*)ptr - TLSF::BlockOverhead));
+    if (newsize <= oldsize) { return ptr; }
+    void* data = alloc_tlsf(t, newsize, align);
+    memcpy(data, ptr, oldsize);
+    free_tlsf(t, ptr);
+    return data;
+}
+// Walks the free lists: meant for debugging and telemetry, not every frame
+TLSFStats get_stats(const TLSF& t) {
+    TLSFStats stats = {};
+    stats.heapBytes = t.heapBytes;
+    stats.usedBytes = t.usedBytes;
+    stats.usedBlocks = t.usedBlocks;
+    for (u32 fl = 0; fl < TLSF::FLCount; fl++) {
+        for (u32 sl = 0; sl < TLSF::SLCount; sl++) {
+            for (TLSF::Block* b = t.freeLists[fl][sl]; b; b = b->nextFree) {
+                const size_t size = tlsf_size(b);
+                stats.freeBytes += size;
+                stats.largestFreeBlock = math::max(stats.largestFreeBlock, size);
+                stats.freeBlocks++;
+            }
+        }
+    }
+    stats.fragmentation =
+        stats.freeBytes ? 1.f - stats.largestFreeBlock / (f32)stats.freeBytes : 0.f;
+    return stats;
+}
 }
 
 
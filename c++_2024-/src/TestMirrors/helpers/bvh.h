@@ -3,33 +3,73 @@
 
 namespace bvh {
 
+// 32 bytes, two nodes per cache line
 struct Node {
     float3 min;
     float3 max;
-    u16 lchildId;
-    u16 firstIndexId;
-    u16 sourceId;
-    bool isLeaf;
+    u32 offset; // internal nodes: left child id, the right child is always at offset + 1
+                // leaves: first of triangleCount entries in Tree::sourceIds
+    u32 triangleCount; // 0 for internal nodes. Once packed, leaves list each source once, so this
+                       // counts sources rather than triangles (see packTree)
 };
-    
+static_assert(sizeof(Node) == 32, "bvh::Node should stay 32 bytes");
+force_inline bool isLeaf(const Node& n) { return n.triangleCount != 0; }
+
+// Node of the 4-wide tree collapsed from the binary one, used for queries: child bounds are
+// stored in SoA, so that one simd pass tests all four children against a plane
+// Children are packed at the start, empty slots have offset 0 (the root is never a child),
+// no triangles, and inverted bounds. 128 bytes, two cache lines
+const u32 wideChildCount = 4;
+struct alignas(64) WideNode {
+    f32 minX[wideChildCount], minY[wideChildCount], minZ[wideChildCount];
+    f32 maxX[wideChildCount], maxY[wideChildCount], maxZ[wideChildCount];
+    u32 offset[wideChildCount]; // same as Node::offset, but into Tree::wideNodes for internal children
+    u32 triangleCount[wideChildCount]; // 0 for internal children
+};
+static_assert(sizeof(WideNode) == 128, "bvh::WideNode should stay 128 bytes");
+force_inline bool isEmptySlot(const WideNode& n, const u32 c) { return n.offset[c] == 0 && n.triangleCount[c] == 0; }
+
 struct Triangle {
     float3 min;
     float3 max;
     float3 center;
-    u32 firstVertexIndex;
     u32 sourceId;
 };
+struct SplitMethod { enum Enum { SAH, Midpoint }; };
+struct BuildParams {
+    u32 binCount; // candidate split planes per axis are binCount - 1, up to maxBinCount
+    u32 maxLeafSize; // nodes with this many triangles or less become leaves, if SAH says so
+    SplitMethod::Enum split; // SAH, unless comparing against the midpoint split
+};
+const u32 maxBinCount = 32;
+// SAH cost constants, relative to each other: one traversal step vs one triangle test
+const f32 traversalCost = 1.f;
+const f32 intersectionCost = 1.f;
+struct BuildStats {
+    f32 sahCost; // expected cost of a random ray query, relative to testing one triangle
+    u32 depth;
+    u32 nodeCount;
+    u32 leafCount;
+    u32 wideNodeCount;
+};
 struct BuildTreeContext {
-    allocator::Buffer<Node>& nodes;
-    allocator::PagedArena& persistentArena;
+    Node* nodes;
+    u32* sourceIds;
+    u32 nodeCount;
+    u32 sourceIdCount;
     const Triangle* trianglePool;
-    const f32* vertexPool;
-    const u16* indexPool;
-    u32 indexCount;
+    BuildParams params;
+    u32 depth;
 };
 struct Tree {
-    Node* nodes;
+    Node* nodes; // binary tree, kept for stats and debug drawing
+    WideNode* wideNodes; // collapsed from nodes, used for queries
+    u32* sourceIds; // mirror (or other source) ids of each leaf
+    u32* sourceOrder; // sources get renumbered in leaf order: sourceOrder[id] is the id given to the builder
     u32 nodeCount;
+    u32 wideNodeCount;
+    u32 sourceIdCount;
+    u32 sourceCount;
 };
 force_inline void emptyNode(Node& n) {
     n.min = float3( FLT_MAX,  FLT_MAX,  FLT_MAX);
@@ -39,218 +79,1322 @@ force_inline void expandNodeBounds(Node& n, const Triangle& tri) {
     n.min = math::min(n.min, tri.min);
     n.max = math::max(n.max, tri.max);
 }
-void buildTreeRecursive(
-BuildTreeContext& ctx, u16* triangleIds, u32 triangleId_count, const u32 nodeId) {
-    ctx.nodes.data[nodeId].isLeaf = triangleId_count == 1;
-    if (ctx.nodes.data[nodeId].isLeaf) {
-        const Triangle& tri = ctx.trianglePool[triangleIds[0]];
-        // node: this has already been set by the parent node
-        //ctx.nodes.data[nodeId].min = tri.min;
-        //ctx.nodes.data[nodeId].max = tri.max;
-        ctx.nodes.data[nodeId].firstIndexId = triangleIds[0] * 3;
-        ctx.nodes.data[nodeId].sourceId = tri.sourceId;
-    } else {
-        ctx.nodes.data[nodeId].lchildId = (u32)ctx.nodes.len;
-        Node lchild;
-        Node rchild;
-        emptyNode(lchild);
-        emptyNode(rchild);
-
-        // Choose the largest axis of the bounding box to split the triangles
-        float3 currExtents = math::subtract(ctx.nodes.data[nodeId].max, ctx.nodes.data[nodeId].min);
-        u8 widestCoord = 0;
-        if (currExtents.y > math::max(currExtents.x, currExtents.z)) {
-            widestCoord = 1;
-        } else if (currExtents.z > math::max(currExtents.x, currExtents.y)) {
-            widestCoord = 2;
+force_inline f32 halfArea(const float3& min, const float3& max) {
+    const float3 e = math::subtract(max, min);
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+void makeLeaf(BuildTreeContext& ctx, const u32* triangleIds, u32 triangleId_count, const u32 nodeId) {
+    Node& node = ctx.nodes[nodeId];
+    node.offset = ctx.sourceIdCount;
+    node.triangleCount = triangleId_count;
+    for (u32 i = 0; i < triangleId_count; i++) {
+        ctx.sourceIds[ctx.sourceIdCount++] = ctx.trianglePool[triangleIds[i]].sourceId;
+    }
+}
+void makeTriangle(
+Triangle& tri, const f32* vertexPool, const u32* indexPool, const u32* sourceIds, const u32 triangleId) {
+    float3 a(
+        vertexPool[indexPool[triangleId * 3] * 3],
+        vertexPool[indexPool[triangleId * 3] * 3 + 1],
+        vertexPool[indexPool[triangleId * 3] * 3 + 2]);
+    float3 b(
+        vertexPool[indexPool[triangleId * 3 + 1] * 3],
+        vertexPool[indexPool[triangleId * 3 + 1] * 3 + 1],
+        vertexPool[indexPool[triangleId * 3 + 1] * 3 + 2]);
+    float3 c(
+        vertexPool[indexPool[triangleId * 3 + 2] * 3],
+        vertexPool[indexPool[triangleId * 3 + 2] * 3 + 1],
+        vertexPool[indexPool[triangleId * 3 + 2] * 3 + 2]);
+    tri.min = math::min(math::min(a, b), c);
+    tri.max = math::max(math::max(a, b), c);
+    tri.center = math::scale(math::add(tri.max, tri.min), 0.5f);
+    tri.sourceId = sourceIds[triangleId];
+}
+// Binned SAH split: partitions the node's triangles, and returns how many went to the left child,
+// or 0 if the node should be a leaf instead
+u32 splitSAH(BuildTreeContext& ctx, u32* triangleIds, u32 triangleId_count, const u32 nodeId) {
+    // Bin triangle centers along each axis, and pick the split plane with the lowest
+    // surface area heuristic cost: traversal + sum over children of (area ratio * triangle count)
+    float3 centerMin( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    float3 centerMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (u32 i = 0; i < triangleId_count; i++) {
+        const float3& c = ctx.trianglePool[triangleIds[i]].center;
+        centerMin = math::min(centerMin, c);
+        centerMax = math::max(centerMax, c);
+    }
+    const u32 binCount = ctx.params.binCount;
+    struct Bin { Node bounds; u32 count; };
+    f32 bestCost = FLT_MAX;
+    u32 bestAxis = 0;
+    u32 bestSplit = 0; // bins [0, bestSplit) go to the left child
+    for (u32 axis = 0; axis < 3; axis++) {
+        const f32 extent = centerMax.v[axis] - centerMin.v[axis];
+        if (extent <= 0.f) { continue; }
+        const f32 binScale = binCount / extent;
+        Bin bins[maxBinCount];
+        for (u32 b = 0; b < binCount; b++) { emptyNode(bins[b].bounds); bins[b].count = 0; }
+        for (u32 i = 0; i < triangleId_count; i++) {
+            const Triangle& tri = ctx.trianglePool[triangleIds[i]];
+            const u32 b = math::min(
+                (u32)((tri.center.v[axis] - centerMin.v[axis]) * binScale), binCount - 1);
+            expandNodeBounds(bins[b].bounds, tri);
+            bins[b].count++;
         }
-        f32 widestCoordCenter = 0.5f * 
-            (ctx.nodes.data[nodeId].max.v[widestCoord] + ctx.nodes.data[nodeId].min.v[widestCoord]);
-
-        // Partition triangles in place, on each side of the widest axis
-        u32 lTriangleIdIdx = 0;
-        u32 rTriangleIdIdx = triangleId_count - 1;
-        while (lTriangleIdIdx < rTriangleIdIdx) {
-            while (ctx.trianglePool[triangleIds[lTriangleIdIdx]].center.v[widestCoord] < widestCoordCenter
-                && lTriangleIdIdx <= triangleId_count - 2) { lTriangleIdIdx++; }
-            while (ctx.trianglePool[triangleIds[rTriangleIdIdx]].center.v[widestCoord] >= widestCoordCenter
-                && rTriangleIdIdx >= 1) { rTriangleIdIdx--; }
-            if (lTriangleIdIdx < rTriangleIdIdx) {
-                u32 temp = triangleIds[lTriangleIdIdx];
-                triangleIds[lTriangleIdIdx] = triangleIds[rTriangleIdIdx];
-                triangleIds[rTriangleIdIdx] = temp;
-            }
+        // sweep from the right to get the cost of every right side, then from the left
+        f32 rightCost[maxBinCount];
+        Node accum;
+        emptyNode(accum);
+        u32 count = 0;
+        for (u32 b = binCount - 1; b > 0; b--) {
+            accum.min = math::min(accum.min, bins[b].bounds.min);
+            accum.max = math::max(accum.max, bins[b].bounds.max);
+            count += bins[b].count;
+            rightCost[b] = count ? halfArea(accum.min, accum.max) * count : 0.f;
         }
-        u32 lTriangleCount = lTriangleIdIdx;
-        u32 rTriangleCount = triangleId_count - lTriangleCount;
-
-        // One of the sides is empty (can happen, since the widest axis
-        // is determined from bounding boxes, but the center of every
-        // triangle may lie on one side)
-        if (lTriangleCount == 0 || rTriangleCount == 0) {
-            lTriangleIdIdx = 0;
-            rTriangleIdIdx = triangleId_count - 1;
-            while (lTriangleIdIdx < rTriangleIdIdx) {
-                if ((lTriangleIdIdx & 1) != 0) {
-                    u16 rTriangle = triangleIds[rTriangleIdIdx];
-                    triangleIds[rTriangleIdIdx] = triangleIds[lTriangleIdIdx];
-                    triangleIds[lTriangleIdIdx] = rTriangle;
-                }
-                lTriangleIdIdx++;
-                rTriangleIdIdx--;
+        emptyNode(accum);
+        count = 0;
+        for (u32 split = 1; split < binCount; split++) {
+            const Bin& bin = bins[split - 1];
+            accum.min = math::min(accum.min, bin.bounds.min);
+            accum.max = math::max(accum.max, bin.bounds.max);
+            count += bin.count;
+            if (count == 0 || count == triangleId_count) { continue; }
+            const f32 cost = halfArea(accum.min, accum.max) * count + rightCost[split];
+            if (cost < bestCost) { bestCost = cost; bestAxis = axis; bestSplit = split; }
+        }
+    }
+
+    const Node& node = ctx.nodes[nodeId];
+    const f32 leafCost = intersectionCost * triangleId_count;
+    if (bestSplit == 0) {
+        // every center is on the same spot: split in half (or leaf, if small enough)
+        if (triangleId_count <= ctx.params.maxLeafSize) { return 0; }
+        return triangleId_count / 2;
+    } else {
+        const f32 splitCost =
+            traversalCost + intersectionCost * bestCost / halfArea(node.min, node.max);
+        if (triangleId_count <= ctx.params.maxLeafSize && leafCost <= splitCost) { return 0; }
+        // Partition triangles in place, on each side of the chosen bin
+        const f32 binScale = binCount / (centerMax.v[bestAxis] - centerMin.v[bestAxis]);
+        u32 l = 0;
+        u32 r = triangleId_count;
+        while (l < r) {
+            const Triangle& tri = ctx.trianglePool[triangleIds[l]];
+            const u32 b = math::min(
+                (u32)((tri.center.v[bestAxis] - centerMin.v[bestAxis]) * binScale), binCount - 1);
+            if (b < bestSplit) { l++; }
+            else {
+                r--;
+                u32 temp = triangleIds[l];
+                triangleIds[l] = triangleIds[r];
+                triangleIds[r] = temp;
             }
-            lTriangleCount = lTriangleIdIdx;
-            rTriangleCount = triangleId_count - lTriangleCount;
         }
+        return l;
+    }
+}
+// Split used before the SAH builder, kept so both can be compared (see benchmarks.h): triangles are
+// partitioned by their centers at the middle of the node's widest axis, or in half if that leaves
+// a side empty (the widest axis comes from the bounds, so all centers can end up on one side)
+u32 splitMidpoint(BuildTreeContext& ctx, u32* triangleIds, u32 triangleId_count, const u32 nodeId) {
+    const Node& node = ctx.nodes[nodeId];
+    const float3 extents = math::subtract(node.max, node.min);
+    u32 axis = 0;
+    if (extents.y > math::max(extents.x, extents.z)) { axis = 1; }
+    else if (extents.z > math::max(extents.x, extents.y)) { axis = 2; }
+    const f32 center = 0.5f * (node.max.v[axis] + node.min.v[axis]);
+    u32 l = 0;
+    u32 r = triangleId_count;
+    while (l < r) {
+        if (ctx.trianglePool[triangleIds[l]].center.v[axis] < center) { l++; }
+        else {
+            r--;
+            u32 temp = triangleIds[l];
+            triangleIds[l] = triangleIds[r];
+            triangleIds[r] = temp;
+        }
+    }
+    if (l == 0 || l == triangleId_count) { l = triangleId_count / 2; }
+    return l;
+}
+// Node bounds must have been set by the caller
+void buildTreeRecursive(
+BuildTreeContext& ctx, u32* triangleIds, u32 triangleId_count, const u32 nodeId, const u32 depth) {
+    ctx.depth = math::max(ctx.depth, depth);
+    if (triangleId_count == 1) { makeLeaf(ctx, triangleIds, triangleId_count, nodeId); return; }
 
-        // ensure the children nodes have the right bounds, so they can split triangles inside
-        // of the, appropriately
-        for (u32 i = 0; i < lTriangleCount; i++) {
-            const Triangle& tri = ctx.trianglePool[triangleIds[i]];
-            expandNodeBounds(lchild, tri);
+    const u32 lTriangleCount = ctx.params.split == SplitMethod::Midpoint ?
+          splitMidpoint(ctx, triangleIds, triangleId_count, nodeId)
+        : splitSAH(ctx, triangleIds, triangleId_count, nodeId);
+    if (lTriangleCount == 0) { makeLeaf(ctx, triangleIds, triangleId_count, nodeId); return; }
+
+    const u32 lchildId = ctx.nodeCount;
+    ctx.nodeCount += 2;
+    ctx.nodes[nodeId].offset = lchildId;
+    ctx.nodes[nodeId].triangleCount = 0;
+    Node& lchild = ctx.nodes[lchildId];
+    Node& rchild = ctx.nodes[lchildId + 1];
+    emptyNode(lchild);
+    emptyNode(rchild);
+    for (u32 i = 0; i < lTriangleCount; i++) {
+        expandNodeBounds(lchild, ctx.trianglePool[triangleIds[i]]);
+    }
+    for (u32 i = lTriangleCount; i < triangleId_count; i++) {
+        expandNodeBounds(rchild, ctx.trianglePool[triangleIds[i]]);
+    }
+    buildTreeRecursive(ctx, triangleIds, lTriangleCount, lchildId, depth + 1);
+    buildTreeRecursive(
+        ctx, triangleIds + lTriangleCount, triangleId_count - lTriangleCount, lchildId + 1, depth + 1);
+}
+// Expected query cost of the tree, normalized by the root's area
+f32 computeSAHCost(const Tree& bvh) {
+    const f32 rootArea = halfArea(bvh.nodes[0].min, bvh.nodes[0].max);
+    if (rootArea <= 0.f) { return 0.f; }
+    f32 cost = 0.f;
+    for (u32 n = 0; n < bvh.nodeCount; n++) {
+        const Node& node = bvh.nodes[n];
+        const f32 nodeCost =
+            isLeaf(node) ? intersectionCost * node.triangleCount : traversalCost;
+        cost += nodeCost * halfArea(node.min, node.max) / rootArea;
+    }
+    return cost;
+}
+// Post-build pass, shared by both builders: the binary tree gets rewritten in depth first order
+// (both children of a node next to each other), and subtrees of up to maxLeafSize triangles are
+// collapsed into a single leaf whenever SAH says testing them all is cheaper than traversing them
+// Leaves list each of their sources once (the two triangles of a quad mirror took two entries),
+// and sources are then renumbered in the order leaves first reference them, so that the sources
+// of any subtree have nearby ids. Callers are expected to reorder their own per source data to
+// match, using Tree::sourceOrder, so that queries walk both the tree and the sources in order
+struct PackTreeContext {
+    const Node* nodes;
+    const u32* sourceIds;
+    u32* triangleCounts; // per input node, in its subtree
+    f32* costs; // per input node, SAH cost of its subtree once packed, relative to its own area
+    Node* packedNodes;
+    u32* packedSourceIds;
+    u32 packedNodeCount;
+    u32 packedSourceIdCount;
+    u32 leafCount;
+    u32 depth;
+    u32 maxLeafSize;
+};
+void costTreeRecursive(PackTreeContext& ctx, const u32 nodeId) {
+    const Node& node = ctx.nodes[nodeId];
+    if (isLeaf(node)) {
+        ctx.triangleCounts[nodeId] = node.triangleCount;
+        ctx.costs[nodeId] = intersectionCost * node.triangleCount;
+        return;
+    }
+    const u32 l = node.offset;
+    const u32 r = node.offset + 1;
+    costTreeRecursive(ctx, l);
+    costTreeRecursive(ctx, r);
+    const u32 triangleCount = ctx.triangleCounts[l] + ctx.triangleCounts[r];
+    const f32 area = halfArea(node.min, node.max);
+    const f32 lWeight = area > 0.f ? halfArea(ctx.nodes[l].min, ctx.nodes[l].max) / area : 1.f;
+    const f32 rWeight = area > 0.f ? halfArea(ctx.nodes[r].min, ctx.nodes[r].max) / area : 1.f;
+    f32 cost = traversalCost + lWeight * ctx.costs[l] + rWeight * ctx.costs[r];
+    if (triangleCount <= ctx.maxLeafSize) { cost = math::min(cost, intersectionCost * triangleCount); }
+    ctx.triangleCounts[nodeId] = triangleCount;
+    ctx.costs[nodeId] = cost;
+}
+// Appends the sources of every leaf under nodeId that the packed leaf starting at first doesn't have yet
+void gatherLeafSourcesRecursive(PackTreeContext& ctx, const u32 nodeId, const u32 first) {
+    const Node& node = ctx.nodes[nodeId];
+    if (!isLeaf(node)) {
+        gatherLeafSourcesRecursive(ctx, node.offset, first);
+        gatherLeafSourcesRecursive(ctx, node.offset + 1, first);
+        return;
+    }
+    for (u32 i = 0; i < node.triangleCount; i++) {
+        const u32 sourceId = ctx.sourceIds[node.offset + i];
+        bool found = false;
+        for (u32 j = first; j < ctx.packedSourceIdCount && !found; j++) {
+            found = ctx.packedSourceIds[j] == sourceId;
         }
-        for (u32 i = lTriangleCount; i < triangleId_count; i++) {
-            const Triangle& tri = ctx.trianglePool[triangleIds[i]];
-            expandNodeBounds(rchild, tri);
+        if (!found) { ctx.packedSourceIds[ctx.packedSourceIdCount++] = sourceId; }
+    }
+}
+void packTreeRecursive(PackTreeContext& ctx, const u32 nodeId, const u32 packedId, const u32 depth) {
+    ctx.depth = math::max(ctx.depth, depth);
+    const Node& node = ctx.nodes[nodeId];
+    Node& packed = ctx.packedNodes[packedId];
+    packed.min = node.min;
+    packed.max = node.max;
+    const u32 triangleCount = ctx.triangleCounts[nodeId];
+    if (isLeaf(node)
+     || (triangleCount <= ctx.maxLeafSize && intersectionCost * triangleCount <= ctx.costs[nodeId])) {
+        packed.offset = ctx.packedSourceIdCount;
+        gatherLeafSourcesRecursive(ctx, nodeId, packed.offset);
+        packed.triangleCount = ctx.packedSourceIdCount - packed.offset;
+        ctx.leafCount++;
+        return;
+    }
+    const u32 lchildId = ctx.packedNodeCount;
+    ctx.packedNodeCount += 2;
+    packed.offset = lchildId;
+    packed.triangleCount = 0;
+    packTreeRecursive(ctx, node.offset, lchildId, depth + 1);
+    packTreeRecursive(ctx, node.offset + 1, lchildId + 1, depth + 1);
+}
+// Takes the binary tree in bvh.nodes and bvh.sourceIds, which can live anywhere, and leaves the
+// packed tree and the source order in the persistent arena, with their final sizes
+void packTree(
+allocator::PagedArena& persistentArena, allocator::PagedArena scratchArena,
+Tree& bvh, BuildStats& stats, const u32 maxLeafSize) {
+    PackTreeContext ctx = {};
+    ctx.nodes = bvh.nodes;
+    ctx.sourceIds = bvh.sourceIds;
+    ctx.maxLeafSize = maxLeafSize;
+    ctx.triangleCounts = (u32*)allocator::alloc_arena(
+        scratchArena, bvh.nodeCount * sizeof(u32), alignof(u32));
+    ctx.costs = (f32*)allocator::alloc_arena(scratchArena, bvh.nodeCount * sizeof(f32), alignof(f32));
+    ctx.packedNodes = (Node*)allocator::alloc_arena(
+        scratchArena, bvh.nodeCount * sizeof(Node), alignof(Node));
+    ctx.packedSourceIds = (u32*)allocator::alloc_arena(
+        scratchArena, bvh.sourceIdCount * sizeof(u32), alignof(u32));
+    costTreeRecursive(ctx, 0);
+    ctx.packedNodeCount = 1;
+    packTreeRecursive(ctx, 0, 0, 0);
+
+    // renumber sources by first reference, the ones never referenced go last
+    const u32 unassigned = 0xffffffff;
+    u32 sourceCount = 0;
+    for (u32 i = 0; i < ctx.packedSourceIdCount; i++) {
+        sourceCount = math::max(sourceCount, ctx.packedSourceIds[i] + 1);
+    }
+    u32* newIds = (u32*)allocator::alloc_arena(scratchArena, sourceCount * sizeof(u32), alignof(u32));
+    memset(newIds, 0xff, sourceCount * sizeof(u32));
+    bvh.sourceOrder = (u32*)allocator::alloc_arena(
+        persistentArena, sourceCount * sizeof(u32), alignof(u32));
+    u32 nextId = 0;
+    for (u32 i = 0; i < ctx.packedSourceIdCount; i++) {
+        u32& sourceId = ctx.packedSourceIds[i];
+        if (newIds[sourceId] == unassigned) {
+            bvh.sourceOrder[nextId] = sourceId;
+            newIds[sourceId] = nextId++;
+        }
+        sourceId = newIds[sourceId];
+    }
+    for (u32 sourceId = 0; sourceId < sourceCount; sourceId++) {
+        if (newIds[sourceId] == unassigned) { bvh.sourceOrder[nextId++] = sourceId; }
+    }
+    bvh.sourceCount = sourceCount;
+
+    bvh.nodeCount = ctx.packedNodeCount;
+    bvh.nodes = (Node*)allocator::alloc_arena(
+        persistentArena, bvh.nodeCount * sizeof(Node), alignof(Node));
+    memcpy(bvh.nodes, ctx.packedNodes, bvh.nodeCount * sizeof(Node));
+    bvh.sourceIdCount = ctx.packedSourceIdCount;
+    bvh.sourceIds = (u32*)allocator::alloc_arena(
+        persistentArena, bvh.sourceIdCount * sizeof(u32), alignof(u32));
+    memcpy(bvh.sourceIds, ctx.packedSourceIds, bvh.sourceIdCount * sizeof(u32));
+
+    stats.depth = ctx.depth;
+    stats.nodeCount = ctx.packedNodeCount;
+    stats.leafCount = ctx.leafCount;
+}
+// Builds the wide node for the given binary node: starting from its two children, keep replacing
+// the internal child with the largest area (the most likely to be visited) with its own children,
+// until there are wideChildCount children or they are all leaves. Returns the wide node id
+u32 collapseTreeRecursive(
+WideNode* wideNodes, u32& wideNodeCount, const Node* nodes, const u32 nodeId) {
+    u32 children[wideChildCount];
+    u32 childCount = 0;
+    if (isLeaf(nodes[nodeId])) { children[childCount++] = nodeId; } // only for single leaf trees
+    else {
+        children[childCount++] = nodes[nodeId].offset;
+        children[childCount++] = nodes[nodeId].offset + 1;
+    }
+    while (childCount < wideChildCount) {
+        u32 best = childCount;
+        f32 bestArea = -1.f;
+        for (u32 c = 0; c < childCount; c++) {
+            const Node& child = nodes[children[c]];
+            if (isLeaf(child)) { continue; }
+            const f32 area = halfArea(child.min, child.max);
+            if (area > bestArea) { bestArea = area; best = c; }
         }
+        if (best == childCount) { break; }
+        const u32 opened = children[best];
+        children[best] = nodes[opened].offset;
+        children[childCount++] = nodes[opened].offset + 1;
+    }
 
-        // Note that it's not useful to keep a reference to nodes.data[nodeId] as a variable
-        // inside this function, since the array may move the location of the node during
-        // this reallocate-emplace
-        allocator::push(ctx.nodes, ctx.persistentArena) = lchild;
-        allocator::push(ctx.nodes, ctx.persistentArena) = rchild;
-        buildTreeRecursive(
-            ctx, triangleIds, lTriangleCount,
-            ctx.nodes.data[nodeId].lchildId);
-        buildTreeRecursive(
-            ctx, triangleIds + lTriangleCount, rTriangleCount,
-            ctx.nodes.data[nodeId].lchildId + 1);
+    const u32 wideNodeId = wideNodeCount++;
+    WideNode& wide = wideNodes[wideNodeId];
+    for (u32 c = 0; c < wideChildCount; c++) {
+        if (c >= childCount) {
+            wide.minX[c] = wide.minY[c] = wide.minZ[c] = FLT_MAX;
+            wide.maxX[c] = wide.maxY[c] = wide.maxZ[c] = -FLT_MAX;
+            wide.offset[c] = 0;
+            wide.triangleCount[c] = 0;
+            continue;
+        }
+        const Node& child = nodes[children[c]];
+        wide.minX[c] = child.min.x; wide.minY[c] = child.min.y; wide.minZ[c] = child.min.z;
+        wide.maxX[c] = child.max.x; wide.maxY[c] = child.max.y; wide.maxZ[c] = child.max.z;
+        wide.triangleCount[c] = child.triangleCount;
+        if (isLeaf(child)) { wide.offset[c] = child.offset; }
+        else { wide.offset[c] = collapseTreeRecursive(wideNodes, wideNodeCount, nodes, children[c]); }
     }
+    return wideNodeId;
+}
+// Builds the wide nodes for the binary tree in bvh.nodes
+void collapseTree(
+allocator::PagedArena& persistentArena, allocator::PagedArena scratchArena, Tree& bvh) {
+    // every wide node takes at least one binary internal node (or the root leaf)
+    WideNode* wideNodes = (WideNode*)allocator::alloc_arena(
+        scratchArena, bvh.nodeCount * sizeof(WideNode), alignof(WideNode));
+    bvh.wideNodeCount = 0;
+    collapseTreeRecursive(wideNodes, bvh.wideNodeCount, bvh.nodes, 0);
+    bvh.wideNodes = (WideNode*)allocator::alloc_arena(
+        persistentArena, bvh.wideNodeCount * sizeof(WideNode), alignof(WideNode));
+    memcpy(bvh.wideNodes, wideNodes, bvh.wideNodeCount * sizeof(WideNode));
 }
+// The tree gets built on the scratch arena, and copied to the persistent arena with its final size
 void buildTree(
 allocator::PagedArena& persistentArena, allocator::PagedArena scratchArena,
-Tree& bvh, f32* vertexPool, const u16* indexPool, const u32 indexCount,
-const u32* sourceIds) {
+Tree& bvh, BuildStats& stats, const BuildParams& params,
+const f32* vertexPool, const u32* indexPool, const u32 indexCount, const u32* sourceIds) {
 
+    assert(params.binCount >= 2 && params.binCount <= maxBinCount);
+    assert(params.maxLeafSize >= 1);
     u32 triangleCount = indexCount / 3;
-    u16* triangleIds =
-        (u16*) allocator::alloc_arena(
-            scratchArena, triangleCount * sizeof(u16), alignof(u16));
+    assert(triangleCount > 0 && triangleCount <= 0x7fffffff); // 2n - 1 node ids must fit in u32
+    u32* triangleIds =
+        (u32*) allocator::alloc_arena(
+            scratchArena, triangleCount * sizeof(u32), alignof(u32));
     Triangle* trianglePool =
         (Triangle*)allocator::alloc_arena(
             scratchArena, triangleCount * sizeof(Triangle), alignof(Triangle));
 
-    allocator::Buffer<Node> nodes = {};
-    Node root;
+    BuildTreeContext ctx = {};
+    ctx.nodes = (Node*)allocator::alloc_arena(
+        scratchArena, (triangleCount * 2 - 1) * sizeof(Node), alignof(Node));
+    ctx.sourceIds = (u32*)allocator::alloc_arena(
+        scratchArena, triangleCount * sizeof(u32), alignof(u32));
+    ctx.trianglePool = trianglePool;
+    ctx.params = params;
+
+    Node& root = ctx.nodes[ctx.nodeCount++];
     emptyNode(root);
     for (u32 triangleId = 0; triangleId < triangleCount; triangleId++) {
-        Triangle tri;
-        float3 a(
-            vertexPool[indexPool[triangleId * 3] * 3],
-            vertexPool[indexPool[triangleId * 3] * 3 + 1],
-            vertexPool[indexPool[triangleId * 3] * 3 + 2]);
-        float3 b(
-            vertexPool[indexPool[triangleId * 3 + 1] * 3],
-            vertexPool[indexPool[triangleId * 3 + 1] * 3 + 1],
-            vertexPool[indexPool[triangleId * 3 + 1] * 3 + 2]);
-        float3 c(
-            vertexPool[indexPool[triangleId * 3 + 2] * 3],
-            vertexPool[indexPool[triangleId * 3 + 2] * 3 + 1],
-            vertexPool[indexPool[triangleId * 3 + 2] * 3 + 2]);
-        tri.min = math::min(math::min(a, b), c);
-        tri.max = math::max(math::max(a, b), c);
-        tri.center = math::scale(math::add(tri.max, tri.min), 0.5f);
-        tri.sourceId = sourceIds[triangleId];
-        tri.firstVertexIndex = triangleId * 3;
+        Triangle& tri = trianglePool[triangleId];
+        makeTriangle(tri, vertexPool, indexPool, sourceIds, triangleId);
         expandNodeBounds(root, tri);
-        trianglePool[triangleId] = tri;
         triangleIds[triangleId] = triangleId;
     }
-    allocator::push(nodes, persistentArena) = root;
-
-    BuildTreeContext context = {
-        nodes,
-        persistentArena,
-        trianglePool,
-        vertexPool,
-        indexPool,
-        indexCount
-    };
-    buildTreeRecursive(context, triangleIds, triangleCount, 0);
-    bvh.nodes = nodes.data;
-    bvh.nodeCount = (u32)nodes.len;
-}
-
-struct FrustumStatus { enum Enum { In, Intersecting, Out }; };
-FrustumStatus::Enum queryIsBoxVisibleInFrustum(
-const float4* planes, const u32 numPlanes, const float3& min, const float3& max) {
-    const float4 boxPoints[8] = {
-        { min.x, min.y, min.z, 1.f },
-        { max.x, min.y, min.z, 1.f },
-        { min.x, max.y, min.z, 1.f },
-        { max.x, max.y, min.z, 1.f },
-        { min.x, min.y, max.z, 1.f },
-        { max.x, min.y, max.z, 1.f },
-        { min.x, max.y, max.z, 1.f },
-        { max.x, max.y, max.z, 1.f }
-    };
-    FrustumStatus::Enum status = FrustumStatus::In;
-    for (u32 p = 0; p < numPlanes; p++) {
-        int out = 0;
-        out += (math::dot(planes[p], boxPoints[0]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[1]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[2]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[3]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[4]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[5]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[6]) < 0.f) ? 1 : 0;
-        out += (math::dot(planes[p], boxPoints[7]) < 0.f) ? 1 : 0;
-        if (out == 8) { status = FrustumStatus::Out; break; }
-        else if (out > 0) { status = FrustumStatus::Intersecting; };
-    }
-    return status;
+    buildTreeRecursive(ctx, triangleIds, triangleCount, 0, 0);
+
+    bvh.nodeCount = ctx.nodeCount;
+    bvh.nodes = ctx.nodes;
+    bvh.sourceIdCount = ctx.sourceIdCount;
+    bvh.sourceIds = ctx.sourceIds;
+    packTree(persistentArena, scratchArena, bvh, stats, params.maxLeafSize);
+    collapseTree(persistentArena, scratchArena, bvh);
+
+    stats.sahCost = computeSAHCost(bvh);
+    stats.wideNodeCount = bvh.wideNodeCount;
+}
+
+// Linear BVH, for meshes too large for buildTree at load time (Karras 2012, "Maximizing
+// parallelism in the construction of BVHs, octrees, and k-d trees"): triangles get sorted by the
+// morton code of their centers, and every internal node of the hierarchy can be found
+// independently from the sorted codes. Bounds are then fitted bottom-up, with the second thread
+// to reach a node being the one to process it. Optional treelet restructuring passes (Karras
+// and Aila 2013) rebuild every 5-leaf treelet with its optimal SAH topology on the way up.
+// All steps run in parallel over jobs::parallel_for. Leaves hold one triangle each, until
+// packTree merges small subtrees
+struct LBVHParams {
+    u32 mortonBits; // 30 (10 bits per axis) or 63 (21 bits per axis, for very dense meshes)
+    u32 treeletPasses; // 0 to skip treelet restructuring
+    u32 maxLeafSize; // see packTree
+};
+const u32 lbvhChunkSize = 16 * 1024; // elements per task
+const u32 lbvhLeafBit = 0x80000000; // set on child ids that refer to leaves (sorted triangles)
+const u32 lbvhTreeletLeafCount = 5;
+struct LBVHNode {
+    float3 min;
+    float3 max;
+    u32 children[2]; // internal node ids, or sorted triangle ids with lbvhLeafBit set
+    u32 parent;
+    u32 leafCount;
+    f32 cost; // SAH cost of the subtree, not normalized
+};
+struct LBVHContext {
+    const f32* vertexPool;
+    const u32* indexPool;
+    const u32* sourceIds;
+    Triangle* trianglePool;
+    float3* chunkCenterMin; // per task
+    float3* chunkCenterMax;
+    float3 centerMin;
+    float3 centerScale; // maps centers to [0, 2^bitsPerAxis)
+    u64* keys;
+    u32* ids; // triangle ids, in the same order as keys
+    u64* keysTemp;
+    u32* idsTemp;
+    u32* histograms; // 256 per task
+    u32 radixShift;
+    LBVHNode* nodes; // triangleCount - 1 internal nodes, the root is node 0
+    u32* leafParents;
+    volatile uintptr_t* visitCounts; // per internal node
+    bool restructure;
+    Tree* tree;
+    u32 triangleCount;
+    u32 chunkCount;
+    u32 mortonBits;
+};
+force_inline u32 lbvhChunkEnd(const LBVHContext& ctx, const u32 chunkId) {
+    return math::min((chunkId + 1) * lbvhChunkSize, ctx.triangleCount);
+}
+// Spreads the lowest 21 bits of v so that there are two zero bits between each of them
+force_inline u64 spreadBits3(u64 v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
 }
+void lbvhTrianglesTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    float3 centerMin( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    float3 centerMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (u32 i = chunkId * lbvhChunkSize; i < lbvhChunkEnd(ctx, chunkId); i++) {
+        Triangle& tri = ctx.trianglePool[i];
+        makeTriangle(tri, ctx.vertexPool, ctx.indexPool, ctx.sourceIds, i);
+        centerMin = math::min(centerMin, tri.center);
+        centerMax = math::max(centerMax, tri.center);
+    }
+    ctx.chunkCenterMin[chunkId] = centerMin;
+    ctx.chunkCenterMax[chunkId] = centerMax;
+}
+void lbvhMortonTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    const u32 bitsPerAxis = ctx.mortonBits / 3;
+    const f32 maxCoord = (f32)((1u << bitsPerAxis) - 1);
+    for (u32 i = chunkId * lbvhChunkSize; i < lbvhChunkEnd(ctx, chunkId); i++) {
+        const float3 c = math::subtract(ctx.trianglePool[i].center, ctx.centerMin);
+        const u64 x = (u64)math::min(c.x * ctx.centerScale.x, maxCoord);
+        const u64 y = (u64)math::min(c.y * ctx.centerScale.y, maxCoord);
+        const u64 z = (u64)math::min(c.z * ctx.centerScale.z, maxCoord);
+        ctx.keys[i] = (spreadBits3(x) << 2) | (spreadBits3(y) << 1) | spreadBits3(z);
+        ctx.ids[i] = i;
+    }
+}
+void lbvhHistogramTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    u32* histogram = &ctx.histograms[chunkId * 256];
+    memset(histogram, 0, sizeof(u32) * 256);
+    for (u32 i = chunkId * lbvhChunkSize; i < lbvhChunkEnd(ctx, chunkId); i++) {
+        histogram[(ctx.keys[i] >> ctx.radixShift) & 0xff]++;
+    }
+}
+// Histograms must have been turned into each task's output offsets
+void lbvhScatterTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    u32* offsets = &ctx.histograms[chunkId * 256];
+    for (u32 i = chunkId * lbvhChunkSize; i < lbvhChunkEnd(ctx, chunkId); i++) {
+        const u32 dst = offsets[(ctx.keys[i] >> ctx.radixShift) & 0xff]++;
+        ctx.keysTemp[dst] = ctx.keys[i];
+        ctx.idsTemp[dst] = ctx.ids[i];
+    }
+}
+// Length of the common prefix of the keys at i and j, -1 if j is out of range
+// Duplicate keys are told apart by their index
+force_inline s32 lbvhCommonPrefix(const LBVHContext& ctx, const s64 i, const s64 j) {
+    if (j < 0 || j >= ctx.triangleCount) { return -1; }
+    const u64 diff = ctx.keys[i] ^ ctx.keys[j];
+    if (diff) { return 63 - (s32)math::msb64(diff); }
+    return 64 + 31 - (s32)math::msb32((u32)(i ^ j));
+}
+void lbvhHierarchyTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    const u32 internalEnd = math::min((chunkId + 1) * lbvhChunkSize, ctx.triangleCount - 1);
+    for (u32 nodeId = chunkId * lbvhChunkSize; nodeId < internalEnd; nodeId++) {
+        const s64 i = nodeId;
+        // direction of the range covered by this node, and its other end (j)
+        const s64 d = lbvhCommonPrefix(ctx, i, i + 1) > lbvhCommonPrefix(ctx, i, i - 1) ? 1 : -1;
+        const s32 prefixMin = lbvhCommonPrefix(ctx, i, i - d);
+        s64 lengthMax = 2;
+        while (lbvhCommonPrefix(ctx, i, i + lengthMax * d) > prefixMin) { lengthMax *= 2; }
+        s64 length = 0;
+        for (s64 t = lengthMax / 2; t >= 1; t /= 2) {
+            if (lbvhCommonPrefix(ctx, i, i + (length + t) * d) > prefixMin) { length += t; }
+        }
+        const s64 j = i + length * d;
+        // split where the common prefix with i stops being the node's prefix
+        const s32 prefixNode = lbvhCommonPrefix(ctx, i, j);
+        s64 split = 0;
+        for (s64 div = 2; ; div *= 2) {
+            const s64 t = (length + div - 1) / div;
+            if (lbvhCommonPrefix(ctx, i, i + (split + t) * d) > prefixNode) { split += t; }
+            if (t == 1) { break; }
+        }
+        const s64 gamma = i + split * d + (d < 0 ? -1 : 0);
+        LBVHNode& node = ctx.nodes[nodeId];
+        if ((i < j ? i : j) == gamma) {
+            node.children[0] = (u32)gamma | lbvhLeafBit;
+            ctx.leafParents[gamma] = nodeId;
+        } else {
+            node.children[0] = (u32)gamma;
+            ctx.nodes[gamma].parent = nodeId;
+        }
+        if ((i > j ? i : j) == gamma + 1) {
+            node.children[1] = (u32)(gamma + 1) | lbvhLeafBit;
+            ctx.leafParents[gamma + 1] = nodeId;
+        } else {
+            node.children[1] = (u32)(gamma + 1);
+            ctx.nodes[gamma + 1].parent = nodeId;
+        }
+    }
+}
+struct LBVHChild { float3 min; float3 max; f32 cost; u32 leafCount; };
+force_inline LBVHChild lbvhChild(const LBVHContext& ctx, const u32 childId) {
+    LBVHChild c;
+    if (childId & lbvhLeafBit) {
+        const Triangle& tri = ctx.trianglePool[ctx.ids[childId & ~lbvhLeafBit]];
+        c.min = tri.min; c.max = tri.max;
+        c.cost = intersectionCost * halfArea(tri.min, tri.max);
+        c.leafCount = 1;
+    } else {
+        const LBVHNode& node = ctx.nodes[childId];
+        c.min = node.min; c.max = node.max;
+        c.cost = node.cost;
+        c.leafCount = node.leafCount;
+    }
+    return c;
+}
+void lbvhFitNode(LBVHContext& ctx, const u32 nodeId) {
+    LBVHNode& node = ctx.nodes[nodeId];
+    const LBVHChild l = lbvhChild(ctx, node.children[0]);
+    const LBVHChild r = lbvhChild(ctx, node.children[1]);
+    node.min = math::min(l.min, r.min);
+    node.max = math::max(l.max, r.max);
+    node.leafCount = l.leafCount + r.leafCount;
+    node.cost = traversalCost * halfArea(node.min, node.max) + l.cost + r.cost;
+}
+// Grows a treelet from the node by opening its largest internal leaf until there are
+// lbvhTreeletLeafCount leaves, and rebuilds it with the topology of lowest SAH cost,
+// reusing the treelet's internal nodes
+void lbvhRestructureTreelet(LBVHContext& ctx, const u32 rootId) {
+    const u32 subsetCount = 1 << lbvhTreeletLeafCount;
+    u32 leaves[lbvhTreeletLeafCount];
+    u32 internals[lbvhTreeletLeafCount - 1];
+    u32 leafCount = 0;
+    u32 internalCount = 0;
+    internals[internalCount++] = rootId;
+    leaves[leafCount++] = ctx.nodes[rootId].children[0];
+    leaves[leafCount++] = ctx.nodes[rootId].children[1];
+    while (leafCount < lbvhTreeletLeafCount) {
+        u32 best = leafCount;
+        f32 bestArea = -1.f;
+        for (u32 i = 0; i < leafCount; i++) {
+            if (leaves[i] & lbvhLeafBit) { continue; }
+            const LBVHNode& n = ctx.nodes[leaves[i]];
+            const f32 area = halfArea(n.min, n.max);
+            if (area > bestArea) { bestArea = area; best = i; }
+        }
+        if (best == leafCount) { break; }
+        const u32 opened = leaves[best];
+        internals[internalCount++] = opened;
+        leaves[best] = ctx.nodes[opened].children[0];
+        leaves[leafCount++] = ctx.nodes[opened].children[1];
+    }
+    if (leafCount < 3) { return; } // only one topology
+
+    // cost of the best subtree over each subset of the treelet leaves
+    LBVHChild leafData[lbvhTreeletLeafCount];
+    for (u32 i = 0; i < leafCount; i++) { leafData[i] = lbvhChild(ctx, leaves[i]); }
+    f32 area[subsetCount];
+    f32 cost[subsetCount];
+    u32 partition[subsetCount];
+    const u32 fullSet = (1 << leafCount) - 1;
+    for (u32 s = 1; s <= fullSet; s++) {
+        float3 min( FLT_MAX,  FLT_MAX,  FLT_MAX);
+        float3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (u32 i = 0; i < leafCount; i++) {
+            if (s & (1 << i)) { min = math::min(min, leafData[i].min); max = math::max(max, leafData[i].max); }
+        }
+        area[s] = halfArea(min, max);
+        if ((s & (s - 1)) == 0) { cost[s] = leafData[math::lsb32(s)].cost; continue; }
+        // subsets are visited in increasing order, so all proper subsets are already done
+        f32 bestCost = FLT_MAX;
+        u32 bestPartition = 0;
+        for (u32 p = (s - 1) & s; p; p = (p - 1) & s) {
+            const f32 c = cost[p] + cost[s ^ p];
+            if (c < bestCost) { bestCost = c; bestPartition = p; }
+        }
+        cost[s] = traversalCost * area[s] + bestCost;
+        partition[s] = bestPartition;
+    }
+    if (cost[fullSet] >= ctx.nodes[rootId].cost * 0.999f) { return; } // keep the current one
+
+    // rebuild top-down, then refit bottom-up: internal node i gets subset subsets[i]
+    u32 subsets[lbvhTreeletLeafCount - 1];
+    u32 subsetsCount = 0;
+    subsets[subsetsCount++] = fullSet;
+    for (u32 n = 0; n < subsetsCount; n++) {
+        const u32 s = subsets[n];
+        LBVHNode& node = ctx.nodes[internals[n]];
+        const u32 halves[2] = { partition[s], s ^ partition[s] };
+        for (u32 h = 0; h < 2; h++) {
+            u32 childId;
+            if ((halves[h] & (halves[h] - 1)) == 0) {
+                childId = leaves[math::lsb32(halves[h])];
+                if (childId & lbvhLeafBit) { ctx.leafParents[childId & ~lbvhLeafBit] = internals[n]; }
+                else { ctx.nodes[childId].parent = internals[n]; }
+            } else {
+                childId = internals[subsetsCount];
+                ctx.nodes[childId].parent = internals[n];
+                subsets[subsetsCount++] = halves[h];
+            }
+            node.children[h] = childId;
+        }
+    }
+    for (u32 n = subsetsCount; n > 0; n--) { lbvhFitNode(ctx, internals[n - 1]); }
+}
+void lbvhBottomUpTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    for (u32 leaf = chunkId * lbvhChunkSize; leaf < lbvhChunkEnd(ctx, chunkId); leaf++) {
+        u32 nodeId = ctx.leafParents[leaf];
+        while (true) {
+            // the first thread to get here leaves, the second one sees both children finished
+            if (platform::atomic_fetch_add(&ctx.visitCounts[nodeId], 1) == 0) { break; }
+            lbvhFitNode(ctx, nodeId);
+            if (ctx.restructure && ctx.nodes[nodeId].leafCount >= lbvhTreeletLeafCount) {
+                lbvhRestructureTreelet(ctx, nodeId);
+            }
+            if (nodeId == 0) { break; }
+            nodeId = ctx.nodes[nodeId].parent;
+        }
+    }
+}
+// Internal node i has its children at 2i + 1 and 2i + 2 in the output, the root goes at 0
+void lbvhOutputTask(void* data, u32 chunkId) {
+    LBVHContext& ctx = *(LBVHContext*)data;
+    Tree& bvh = *ctx.tree;
+    for (u32 i = chunkId * lbvhChunkSize; i < lbvhChunkEnd(ctx, chunkId); i++) {
+        bvh.sourceIds[i] = ctx.trianglePool[ctx.ids[i]].sourceId;
+        if (i + 1 == ctx.triangleCount) { continue; } // one less internal node than leaves
+        const LBVHNode& node = ctx.nodes[i];
+        for (u32 h = 0; h < 2; h++) {
+            Node& out = bvh.nodes[2 * i + 1 + h];
+            const u32 childId = node.children[h];
+            if (childId & lbvhLeafBit) {
+                const Triangle& tri = ctx.trianglePool[ctx.ids[childId & ~lbvhLeafBit]];
+                out.min = tri.min;
+                out.max = tri.max;
+                out.offset = childId & ~lbvhLeafBit;
+                out.triangleCount = 1;
+            } else {
+                out.min = ctx.nodes[childId].min;
+                out.max = ctx.nodes[childId].max;
+                out.offset = 2 * childId + 1;
+                out.triangleCount = 0;
+            }
+        }
+    }
+}
+// Same output as buildTree: the tree is built on the scratch arena, and only the final nodes,
+// source ids, source order and wide nodes go into the persistent arena
+void buildTreeLBVH(
+allocator::PagedArena& persistentArena, allocator::PagedArena scratchArena,
+Tree& bvh, BuildStats& stats, const LBVHParams& params,
+const f32* vertexPool, const u32* indexPool, const u32 indexCount, const u32* sourceIds) {
+
+    assert(params.mortonBits == 30 || params.mortonBits == 63);
+    assert(params.maxLeafSize >= 1);
+    const u32 triangleCount = indexCount / 3;
+    assert(triangleCount > 0 && triangleCount < lbvhLeafBit);
+
+    LBVHContext ctx = {};
+    ctx.vertexPool = vertexPool;
+    ctx.indexPool = indexPool;
+    ctx.sourceIds = sourceIds;
+    ctx.triangleCount = triangleCount;
+    ctx.chunkCount = jobs::chunk_count(triangleCount, lbvhChunkSize);
+    ctx.mortonBits = params.mortonBits;
+    ctx.tree = &bvh;
+    ctx.trianglePool = (Triangle*)allocator::alloc_arena(
+        scratchArena, triangleCount * sizeof(Triangle), alignof(Triangle));
+    ctx.chunkCenterMin = (float3*)allocator::alloc_arena(
+        scratchArena, ctx.chunkCount * sizeof(float3), alignof(float3));
+    ctx.chunkCenterMax = (float3*)allocator::alloc_arena(
+        scratchArena, ctx.chunkCount * sizeof(float3), alignof(float3));
+    ctx.keys = (u64*)allocator::alloc_arena(scratchArena, triangleCount * sizeof(u64), alignof(u64));
+    ctx.keysTemp = (u64*)allocator::alloc_arena(scratchArena, triangleCount * sizeof(u64), alignof(u64));
+    ctx.ids = (u32*)allocator::alloc_arena(scratchArena, triangleCount * sizeof(u32), alignof(u32));
+    ctx.idsTemp = (u32*)allocator::alloc_arena(scratchArena, triangleCount * sizeof(u32), alignof(u32));
+    ctx.histograms = (u32*)allocator::alloc_arena(
+        scratchArena, ctx.chunkCount * 256 * sizeof(u32), alignof(u32));
+
+    // triangle bounds, and the bounds of their centers for the morton grid
+    jobs::parallel_for(lbvhTrianglesTask, &ctx, ctx.chunkCount);
+    float3 centerMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    ctx.centerMin = float3(FLT_MAX, FLT_MAX, FLT_MAX);
+    for (u32 i = 0; i < ctx.chunkCount; i++) {
+        ctx.centerMin = math::min(ctx.centerMin, ctx.chunkCenterMin[i]);
+        centerMax = math::max(centerMax, ctx.chunkCenterMax[i]);
+    }
+    const f32 gridSize = (f32)(1u << (params.mortonBits / 3));
+    const float3 extent = math::subtract(centerMax, ctx.centerMin);
+    ctx.centerScale = float3(
+        extent.x > 0.f ? gridSize / extent.x : 0.f,
+        extent.y > 0.f ? gridSize / extent.y : 0.f,
+        extent.z > 0.f ? gridSize / extent.z : 0.f);
+    jobs::parallel_for(lbvhMortonTask, &ctx, ctx.chunkCount);
+
+    // least significant digit radix sort, 8 bits per pass, stable across and within tasks
+    for (ctx.radixShift = 0; ctx.radixShift < params.mortonBits; ctx.radixShift += 8) {
+        jobs::parallel_for(lbvhHistogramTask, &ctx, ctx.chunkCount);
+        u32 offset = 0;
+        bool skipPass = false;
+        for (u32 digit = 0; digit < 256; digit++) {
+            const u32 digitStart = offset;
+            for (u32 chunk = 0; chunk < ctx.chunkCount; chunk++) {
+                u32& count = ctx.histograms[chunk * 256 + digit];
+                const u32 digitCount = count;
+                count = offset;
+                offset += digitCount;
+            }
+            // all keys share this digit: the pass wouldn't change the order
+            if (offset - digitStart == triangleCount) { skipPass = true; break; }
+        }
+        if (skipPass) { continue; }
+        jobs::parallel_for(lbvhScatterTask, &ctx, ctx.chunkCount);
+        u64* keys = ctx.keys; ctx.keys = ctx.keysTemp; ctx.keysTemp = keys;
+        u32* ids = ctx.ids; ctx.ids = ctx.idsTemp; ctx.idsTemp = ids;
+    }
+
+    // one triangle per leaf, packTree moves the final tree to the persistent arena
+    bvh.nodeCount = 2 * triangleCount - 1;
+    bvh.nodes = (Node*)allocator::alloc_arena(
+        scratchArena, bvh.nodeCount * sizeof(Node), alignof(Node));
+    bvh.sourceIdCount = triangleCount;
+    bvh.sourceIds = (u32*)allocator::alloc_arena(
+        scratchArena, triangleCount * sizeof(u32), alignof(u32));
+    if (triangleCount == 1) {
+        bvh.nodes[0].min = ctx.trianglePool[0].min;
+        bvh.nodes[0].max = ctx.trianglePool[0].max;
+        bvh.nodes[0].offset = 0;
+        bvh.nodes[0].triangleCount = 1;
+        bvh.sourceIds[0] = ctx.trianglePool[0].sourceId;
+    } else {
+        const u32 internalCount = triangleCount - 1;
+        ctx.nodes = (LBVHNode*)allocator::alloc_arena(
+            scratchArena, internalCount * sizeof(LBVHNode), alignof(LBVHNode));
+        ctx.leafParents = (u32*)allocator::alloc_arena(
+            scratchArena, triangleCount * sizeof(u32), alignof(u32));
+        ctx.visitCounts = (volatile uintptr_t*)allocator::alloc_arena(
+            scratchArena, internalCount * sizeof(uintptr_t), alignof(uintptr_t));
+        ctx.nodes[0].parent = 0;
+        jobs::parallel_for(lbvhHierarchyTask, &ctx, jobs::chunk_count(internalCount, lbvhChunkSize));
+
+        ctx.restructure = false;
+        for (u32 pass = 0; pass <= params.treeletPasses; pass++) {
+            memset((void*)ctx.visitCounts, 0, internalCount * sizeof(uintptr_t));
+            jobs::parallel_for(lbvhBottomUpTask, &ctx, ctx.chunkCount);
+            ctx.restructure = true;
+        }
+
+        const LBVHNode& root = ctx.nodes[0];
+        bvh.nodes[0].min = root.min;
+        bvh.nodes[0].max = root.max;
+        bvh.nodes[0].offset = 1;
+        bvh.nodes[0].triangleCount = 0;
+        jobs::parallel_for(lbvhOutputTask, &ctx, ctx.chunkCount);
+    }
+    packTree(persistentArena, scratchArena, bvh, stats, params.maxLeafSize);
+    collapseTree(persistentArena, scratchArena, bvh);
+
+    stats.sahCost = computeSAHCost(bvh);
+    stats.wideNodeCount = bvh.wideNodeCount;
+}
+
+// Non-cryptographic 64 bit hash, 8 bytes at a time: good enough to key caches and catch corruption
+u64 hash64(const void* data, const size_t size, u64 h = 0xcbf29ce484222325ull) {
+    const u64 prime = 0x100000001b3ull;
+    const u8* bytes = (const u8*)data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 word;
+        memcpy(&word, bytes + i, sizeof(u64));
+        h = (h ^ word) * prime;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) { h = (h ^ bytes[i]) * prime; }
+    h ^= h >> 33; // final mix, so that all input bits affect all output bits
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// On-disk image of a built tree: a header, then nodes, wide nodes, source ids and source order, each starting
+// at a cacheAlignment boundary. Once validated, the tree points straight into the file data,
+// so the file must stay mapped for as long as the tree is used
+// The source hash identifies the mesh and build settings the tree was built from, and is provided
+// by the caller. Bump cacheVersion whenever Node, WideNode or the builders change their output
+const u32 cacheMagic = 0x43485642; // "BVHC"
+const u32 cacheVersion = 2;
+const u32 cacheAlignment = 128; // wide nodes never straddle more cache lines than needed
+struct CacheHeader {
+    u32 magic;
+    u32 version;
+    u64 sourceHash;
+    u64 payloadHash; // of everything after the header, including padding
+    u64 size; // of the whole file
+    u32 nodesOffset, wideNodesOffset, sourceIdsOffset, sourceOrderOffset; // from the start of the file
+    u32 nodeCount, wideNodeCount, sourceIdCount, sourceCount;
+    BuildStats stats; // the tree isn't rebuilt, but the stats are still useful
+};
+static_assert(sizeof(CacheHeader) <= cacheAlignment, "bvh::CacheHeader should fit before the nodes");
+// 64 bit math, so that bogus counts read from a file can't wrap around
+force_inline u64 cacheSectionEnd(const u64 offset, const u32 count, const u64 elemSize) {
+    return offset + count * elemSize;
+}
+force_inline u64 cacheAlign(const u64 offset) {
+    return (offset + cacheAlignment - 1) & ~(u64)(cacheAlignment - 1);
+}
+CacheHeader makeCacheHeader(const Tree& bvh, const BuildStats& stats, const u64 sourceHash) {
+    CacheHeader header = {};
+    header.magic = cacheMagic;
+    header.version = cacheVersion;
+    header.sourceHash = sourceHash;
+    header.nodeCount = bvh.nodeCount;
+    header.wideNodeCount = bvh.wideNodeCount;
+    header.sourceIdCount = bvh.sourceIdCount;
+    header.sourceCount = bvh.sourceCount;
+    header.nodesOffset = cacheAlignment;
+    const u64 wideNodesOffset =
+        cacheAlign(cacheSectionEnd(header.nodesOffset, bvh.nodeCount, sizeof(Node)));
+    const u64 sourceIdsOffset =
+        cacheAlign(cacheSectionEnd(wideNodesOffset, bvh.wideNodeCount, sizeof(WideNode)));
+    const u64 sourceOrderOffset =
+        cacheAlign(cacheSectionEnd(sourceIdsOffset, bvh.sourceIdCount, sizeof(u32)));
+    assert(sourceOrderOffset <= 0xffffffff);
+    header.wideNodesOffset = (u32)wideNodesOffset;
+    header.sourceIdsOffset = (u32)sourceIdsOffset;
+    header.sourceOrderOffset = (u32)sourceOrderOffset;
+    header.size = cacheSectionEnd(header.sourceOrderOffset, bvh.sourceCount, sizeof(u32));
+    header.stats = stats;
+    return header;
+}
+// The file is laid out in the scratch arena first, so that the payload can be hashed in one go
+// Returns false if the file couldn't be written, the cache will be rebuilt next time
+bool writeCache(
+    allocator::PagedArena scratchArena, const char* path,
+    const Tree& bvh, const BuildStats& stats, const u64 sourceHash) {
+    CacheHeader header = makeCacheHeader(bvh, stats, sourceHash);
+    u8* image = (u8*)allocator::alloc_arena(scratchArena, (size_t)header.size, cacheAlignment);
+    memset(image, 0, (size_t)header.size);
+    memcpy(image + header.nodesOffset, bvh.nodes, bvh.nodeCount * sizeof(Node));
+    memcpy(image + header.wideNodesOffset, bvh.wideNodes, bvh.wideNodeCount * sizeof(WideNode));
+    memcpy(image + header.sourceIdsOffset, bvh.sourceIds, bvh.sourceIdCount * sizeof(u32));
+    memcpy(image + header.sourceOrderOffset, bvh.sourceOrder, bvh.sourceCount * sizeof(u32));
+    header.payloadHash = hash64(image + sizeof(CacheHeader), (size_t)header.size - sizeof(CacheHeader));
+    memcpy(image, &header, sizeof(CacheHeader));
+
+    FILE* f;
+    if (platform::fopen(&f, path, "wb") != 0) { return false; }
+    const bool written = fwrite(image, 1, (size_t)header.size, f) == header.size;
+    platform::fclose(f);
+    return written;
+}
+// Points the tree into a cache file image, without copying. Returns false if the image is
+// truncated, corrupt, from another version, or was built from a different source
+bool mapCache(Tree& bvh, BuildStats& stats, const void* data, const size_t size, const u64 sourceHash) {
+    if (!data || size < cacheAlignment) { return false; }
+    const u8* image = (const u8*)data;
+    const CacheHeader& header = *(const CacheHeader*)image;
+    if (header.magic != cacheMagic || header.version != cacheVersion
+     || header.sourceHash != sourceHash || header.size != size
+     || header.nodeCount == 0 || header.wideNodeCount == 0) { return false; }
+    // sections in order, aligned, and ending at the end of the file
+    if (header.nodesOffset != cacheAlignment
+     || header.wideNodesOffset != cacheAlign(cacheSectionEnd(header.nodesOffset, header.nodeCount, sizeof(Node)))
+     || header.sourceIdsOffset != cacheAlign(cacheSectionEnd(header.wideNodesOffset, header.wideNodeCount, sizeof(WideNode)))
+     || header.sourceOrderOffset != cacheAlign(cacheSectionEnd(header.sourceIdsOffset, header.sourceIdCount, sizeof(u32)))
+     || size != cacheSectionEnd(header.sourceOrderOffset, header.sourceCount, sizeof(u32))) { return false; }
+    if (hash64(image + sizeof(CacheHeader), size - sizeof(CacheHeader)) != header.payloadHash) { return false; }
+
+    bvh.nodes = (Node*)(image + header.nodesOffset);
+    bvh.wideNodes = (WideNode*)(image + header.wideNodesOffset);
+    bvh.sourceIds = (u32*)(image + header.sourceIdsOffset);
+    bvh.sourceOrder = (u32*)(image + header.sourceOrderOffset);
+    bvh.nodeCount = header.nodeCount;
+    bvh.wideNodeCount = header.wideNodeCount;
+    bvh.sourceIdCount = header.sourceIdCount;
+    bvh.sourceCount = header.sourceCount;
+    stats = header.stats;
+    return true;
+}
+
+struct FrustumQueryNode { u32 nodeId; u32 planeMask; };
+// Upper bound of the scratch memory a frustum query takes, alignment included
+size_t frustumQueryScratchSize(const Tree& bvh) {
+    return bvh.wideNodeCount * sizeof(FrustumQueryNode) + alignof(FrustumQueryNode);
+}
+// Marks the sources of all leaves touching the frustum, walking the wide tree
+// For each plane, the children corner furthest along the normal tells whether the child is fully
+// outside, and the nearest one whether it's partially outside: since the plane is the same for
+// all children, picking those corners is a scalar choice between the min and max arrays
+// Each node carries the mask of planes its parent was crossing: planes a child is fully inside of
+// are dropped for its subtree, and subtrees inside all planes are walked without any tests
 void findTrianglesIntersectingFrustum(
     allocator::PagedArena scratchArena,
     bool* sourceVisibility, const Tree& bvh,
     const float4* planes, const u32 numPlanes) {
-    struct FrustumQueryNode { u16 nodeId; FrustumStatus::Enum frustumStatus; };
+    assert(numPlanes <= 32);
 
     FrustumQueryNode* nodeStack = (FrustumQueryNode*)allocator::alloc_arena(
-        scratchArena, bvh.nodeCount * sizeof(FrustumQueryNode), alignof(FrustumQueryNode));
+        scratchArena, bvh.wideNodeCount * sizeof(FrustumQueryNode), alignof(FrustumQueryNode));
     u32 stackCount = 0;
-    nodeStack[stackCount++] = { 0, FrustumStatus::Intersecting };
+    nodeStack[stackCount++] = { 0, numPlanes == 32 ? 0xffffffff : (1u << numPlanes) - 1 };
 
+    const simd::f32x4 zero = simd::splat4(0.f);
     while (stackCount > 0) {
         FrustumQueryNode n = nodeStack[--stackCount];
+        const WideNode& node = bvh.wideNodes[n.nodeId];
 
-        // Add source id to the result array, if the triangle leaf is visible by the frustum
-        if (bvh.nodes[n.nodeId].isLeaf) {
-            u32 sourceId = bvh.nodes[n.nodeId].sourceId;
-            sourceVisibility[sourceId] = true;
-        } else {
-            const Node& lchild = bvh.nodes[bvh.nodes[n.nodeId].lchildId];
-            const Node& rchild = bvh.nodes[bvh.nodes[n.nodeId].lchildId + 1];
-            FrustumStatus::Enum lStatus, rStatus;
-            // if the parent node was fully visible in the frustum,
-            // add the children without testing, and propagate the frustum result
-            if (n.frustumStatus == FrustumStatus::In) {
-                lStatus = rStatus = n.frustumStatus;
-                nodeStack[stackCount++] = { bvh.nodes[n.nodeId].lchildId, lStatus };
-                nodeStack[stackCount++] = { u16(bvh.nodes[n.nodeId].lchildId + 1u), rStatus };
+        // bit c is set if child c is fully out of the frustum
+        u32 outMask = 0;
+        u32 childPlaneMasks[wideChildCount] = { n.planeMask, n.planeMask, n.planeMask, n.planeMask };
+        if (n.planeMask) {
+            const simd::f32x4 minX = simd::load4(node.minX);
+            const simd::f32x4 minY = simd::load4(node.minY);
+            const simd::f32x4 minZ = simd::load4(node.minZ);
+            const simd::f32x4 maxX = simd::load4(node.maxX);
+            const simd::f32x4 maxY = simd::load4(node.maxY);
+            const simd::f32x4 maxZ = simd::load4(node.maxZ);
+            for (u32 mask = n.planeMask; mask && outMask != 0xf; mask &= mask - 1) {
+                const u32 p = math::lsb32(mask);
+                const float4& plane = planes[p];
+                const simd::f32x4 planeX = simd::splat4(plane.x);
+                const simd::f32x4 planeY = simd::splat4(plane.y);
+                const simd::f32x4 planeZ = simd::splat4(plane.z);
+                const simd::f32x4 planeW = simd::splat4(plane.w);
+                const simd::f32x4 farDist = simd::add4(
+                    simd::add4(simd::mul4(planeX, plane.x > 0.f ? maxX : minX),
+                               simd::mul4(planeY, plane.y > 0.f ? maxY : minY)),
+                    simd::add4(simd::mul4(planeZ, plane.z > 0.f ? maxZ : minZ), planeW));
+                const simd::f32x4 nearDist = simd::add4(
+                    simd::add4(simd::mul4(planeX, plane.x > 0.f ? minX : maxX),
+                               simd::mul4(planeY, plane.y > 0.f ? minY : maxY)),
+                    simd::add4(simd::mul4(planeZ, plane.z > 0.f ? minZ : maxZ), planeW));
+                outMask |= simd::lessMask4(farDist, zero);
+                const u32 insideMask = ~simd::lessMask4(nearDist, zero);
+                for (u32 c = 0; c < wideChildCount; c++) {
+                    childPlaneMasks[c] &= ~(((insideMask >> c) & 1u) << p);
+                }
+            }
+        }
+
+        for (u32 c = 0; c < wideChildCount; c++) {
+            if (isEmptySlot(node, c)) { break; }
+            if (outMask & (1 << c)) { continue; }
+            // Add source ids to the result array, if the leaf is visible by the frustum
+            if (node.triangleCount[c]) {
+                for (u32 i = 0; i < node.triangleCount[c]; i++) {
+                    sourceVisibility[bvh.sourceIds[node.offset[c] + i]] = true;
+                }
             } else {
-                // test each child against the frustum, cull if fully not visible
-                lStatus = queryIsBoxVisibleInFrustum(planes, numPlanes, lchild.min, lchild.max);
-                rStatus = queryIsBoxVisibleInFrustum(planes, numPlanes, rchild.min, rchild.max);
-                if (lStatus != FrustumStatus::Out) {
-                    nodeStack[stackCount++] = { bvh.nodes[n.nodeId].lchildId, lStatus };
+                nodeStack[stackCount++] = { node.offset[c], childPlaneMasks[c] };
+            }
+        }
+    }
+}
+
+// Ray queries: the leaves only store source ids, so rays get tested against the source polygons
+// Sources are convex polygons, vertices[vertexOffsets[i], vertexOffsets[i+1]) for source i
+// (same layout as game::Mirrors), tested as triangle fans from their first vertex, from both sides
+// Polygons split across several leaves get tested once per leaf, which is harmless
+struct RaySources {
+    const float3* vertices;
+    const u32* vertexOffsets;
+};
+struct RayMode { enum Enum {
+      ClosestHit // nearest hit along the ray
+    , AnyHit // first hit found, for occlusion tests
+}; };
+struct Ray {
+    float3 origin;
+    float3 dir; // doesn't need to be normalized, t is in units of dir
+    f32 tMax; // hits need 0 < t < tMax: rays leaving a surface should nudge their origin off it
+};
+const u32 noSource = 0xffffffff;
+struct RayHit {
+    f32 t;
+    u32 sourceId; // noSource if nothing was hit
+};
+// Four rays, one per simd lane. Rays in a packet share traversal, so they should be coherent:
+// neighboring pixels, or probes from the same point towards nearby targets
+const u32 rayPacketSize = 4;
+struct RayPacket {
+    f32 originX[rayPacketSize], originY[rayPacketSize], originZ[rayPacketSize];
+    f32 dirX[rayPacketSize], dirY[rayPacketSize], dirZ[rayPacketSize];
+    f32 tMax[rayPacketSize];
+};
+// Wide nodes have up to 4 children, and each visited node replaces itself with them on the stack,
+// so this fits trees 80 levels deep. The wide tree is never deeper than the binary one
+const u32 maxRayStackCount = 256;
+
+// Moller-Trumbore (https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection)
+// t only gets written if there's a hit in (0, t)
+force_inline bool intersectTriangle(
+    f32& t, const float3& origin, const float3& dir, const float3& a, const float3& b, const float3& c) {
+    const float3 e1 = math::subtract(b, a);
+    const float3 e2 = math::subtract(c, a);
+    const float3 p = math::cross(dir, e2);
+    const f32 det = math::dot(e1, p);
+    if (det == 0.f) { return false; } // parallel to the triangle
+    const f32 invDet = 1.f / det;
+    const float3 s = math::subtract(origin, a);
+    const f32 u = math::dot(s, p) * invDet;
+    if (u < 0.f || u > 1.f) { return false; }
+    const float3 q = math::cross(s, e1);
+    const f32 v = math::dot(dir, q) * invDet;
+    if (v < 0.f || u + v > 1.f) { return false; }
+    const f32 tHit = math::dot(e2, q) * invDet;
+    if (tHit <= 0.f || tHit >= t) { return false; }
+    t = tHit;
+    return true;
+}
+force_inline bool intersectSource(
+    f32& t, const RaySources& sources, const u32 sourceId, const float3& origin, const float3& dir) {
+    const float3* v = &sources.vertices[sources.vertexOffsets[sourceId]];
+    const u32 vertexCount = sources.vertexOffsets[sourceId + 1] - sources.vertexOffsets[sourceId];
+    bool hit = false;
+    for (u32 i = 2; i < vertexCount; i++) {
+        hit |= intersectTriangle(t, origin, dir, v[0], v[i - 1], v[i]);
+    }
+    return hit;
+}
+// Returns whether anything was hit. With RayMode::ClosestHit, children are visited near to far,
+// and skipped once a closer hit is found; with RayMode::AnyHit, the query stops at the first hit
+bool intersectRay(
+    RayHit& hit, const Tree& bvh, const RaySources& sources, const Ray& ray, const RayMode::Enum mode) {
+    struct RayQueryNode { u32 offset; u32 triangleCount; f32 tNear; };
+    hit.t = ray.tMax;
+    hit.sourceId = noSource;
+
+    // slabs: t = (plane - origin) / dir, the near plane of each axis depends on the sign of dir
+    // A zero dir component gives infinities, or NaN for a ray on a slab plane: the final
+    // comparison is false for NaN, so at worst those children get visited unnecessarily
+    const float3 invDir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+    const simd::f32x4 invX = simd::splat4(invDir.x);
+    const simd::f32x4 invY = simd::splat4(invDir.y);
+    const simd::f32x4 invZ = simd::splat4(invDir.z);
+    const simd::f32x4 originInvX = simd::splat4(ray.origin.x * invDir.x);
+    const simd::f32x4 originInvY = simd::splat4(ray.origin.y * invDir.y);
+    const simd::f32x4 originInvZ = simd::splat4(ray.origin.z * invDir.z);
+    const bool negX = invDir.x < 0.f, negY = invDir.y < 0.f, negZ = invDir.z < 0.f;
+    const simd::f32x4 zero = simd::splat4(0.f);
+
+    RayQueryNode nodeStack[maxRayStackCount];
+    u32 stackCount = 0;
+    nodeStack[stackCount++] = { 0, 0, 0.f };
+    while (stackCount > 0) {
+        const RayQueryNode n = nodeStack[--stackCount];
+        if (n.tNear > hit.t) { continue; } // a closer hit was found since this was pushed
+        if (n.triangleCount) {
+            for (u32 i = 0; i < n.triangleCount; i++) {
+                const u32 sourceId = bvh.sourceIds[n.offset + i];
+                if (intersectSource(hit.t, sources, sourceId, ray.origin, ray.dir)) {
+                    hit.sourceId = sourceId;
+                    if (mode == RayMode::AnyHit) { return true; }
                 }
-                if (rStatus != FrustumStatus::Out) {
-                    nodeStack[stackCount++] = { u16(bvh.nodes[n.nodeId].lchildId + 1u), rStatus };
+            }
+            continue;
+        }
+
+        const WideNode& node = bvh.wideNodes[n.offset];
+        const simd::f32x4 nearX = simd::sub4(simd::mul4(simd::load4(negX ? node.maxX : node.minX), invX), originInvX);
+        const simd::f32x4 nearY = simd::sub4(simd::mul4(simd::load4(negY ? node.maxY : node.minY), invY), originInvY);
+        const simd::f32x4 nearZ = simd::sub4(simd::mul4(simd::load4(negZ ? node.maxZ : node.minZ), invZ), originInvZ);
+        const simd::f32x4 farX = simd::sub4(simd::mul4(simd::load4(negX ? node.minX : node.maxX), invX), originInvX);
+        const simd::f32x4 farY = simd::sub4(simd::mul4(simd::load4(negY ? node.minY : node.maxY), invY), originInvY);
+        const simd::f32x4 farZ = simd::sub4(simd::mul4(simd::load4(negZ ? node.minZ : node.maxZ), invZ), originInvZ);
+        const simd::f32x4 tNear = simd::max4(simd::max4(nearX, nearY), simd::max4(nearZ, zero));
+        const simd::f32x4 tFar = simd::min4(simd::min4(farX, farY), simd::min4(farZ, simd::splat4(hit.t)));
+        const u32 hitMask = ~simd::lessMask4(tFar, tNear) & 0xf;
+        if (!hitMask) { continue; }
+        f32 tNears[wideChildCount];
+        simd::store4(tNears, tNear);
+
+        // push far to near, so that the nearest child is popped first
+        RayQueryNode children[wideChildCount];
+        u32 childCount = 0;
+        for (u32 c = 0; c < wideChildCount; c++) {
+            if (isEmptySlot(node, c)) { break; }
+            if (!(hitMask & (1 << c))) { continue; }
+            RayQueryNode child = { node.offset[c], node.triangleCount[c], tNears[c] };
+            u32 i = childCount++;
+            for (; i > 0 && children[i - 1].tNear < child.tNear; i--) { children[i] = children[i - 1]; }
+            children[i] = child;
+        }
+        assert(stackCount + childCount <= maxRayStackCount);
+        for (u32 c = 0; c < childCount; c++) { nodeStack[stackCount++] = children[c]; }
+    }
+    return hit.sourceId != noSource;
+}
+// Whether anything lies strictly between two points
+force_inline bool isOccluded(const Tree& bvh, const RaySources& sources, const float3& from, const float3& to) {
+    RayHit hit;
+    const Ray ray = { from, math::subtract(to, from), 1.f };
+    return intersectRay(hit, bvh, sources, ray, RayMode::AnyHit);
+}
+
+// Same as intersectSource, for the rays in rayMask: lanes with a hit in (0, tBest) update tBest
+// and their source id. Returns the lanes that got a hit
+u32 intersectSourcePacket(
+    f32* tBest, u32* sourceIds, const RaySources& sources, const u32 sourceId,
+    const simd::f32x4* origin, const simd::f32x4* dir, const u32 rayMask) {
+    const simd::f32x4 zero = simd::splat4(0.f);
+    const simd::f32x4 one = simd::splat4(1.f);
+    const float3* v = &sources.vertices[sources.vertexOffsets[sourceId]];
+    const u32 vertexCount = sources.vertexOffsets[sourceId + 1] - sources.vertexOffsets[sourceId];
+    u32 packetHitMask = 0;
+    for (u32 tri = 2; tri < vertexCount; tri++) {
+        const float3& a = v[0];
+        const float3 e1 = math::subtract(v[tri - 1], a);
+        const float3 e2 = math::subtract(v[tri], a);
+        const simd::f32x4 e1x = simd::splat4(e1.x), e1y = simd::splat4(e1.y), e1z = simd::splat4(e1.z);
+        const simd::f32x4 e2x = simd::splat4(e2.x), e2y = simd::splat4(e2.y), e2z = simd::splat4(e2.z);
+        // p = cross(dir, e2)
+        const simd::f32x4 px = simd::sub4(simd::mul4(dir[1], e2z), simd::mul4(dir[2], e2y));
+        const simd::f32x4 py = simd::sub4(simd::mul4(dir[2], e2x), simd::mul4(dir[0], e2z));
+        const simd::f32x4 pz = simd::sub4(simd::mul4(dir[0], e2y), simd::mul4(dir[1], e2x));
+        const simd::f32x4 det = simd::add4(
+            simd::add4(simd::mul4(e1x, px), simd::mul4(e1y, py)), simd::mul4(e1z, pz));
+        // parallel rays divide by zero, every comparison below is false for the NaNs that follow,
+        // and at least one for the infinities
+        const simd::f32x4 invDet = simd::div4(one, det);
+        const simd::f32x4 sx = simd::sub4(origin[0], simd::splat4(a.x));
+        const simd::f32x4 sy = simd::sub4(origin[1], simd::splat4(a.y));
+        const simd::f32x4 sz = simd::sub4(origin[2], simd::splat4(a.z));
+        const simd::f32x4 u = simd::mul4(simd::add4(
+            simd::add4(simd::mul4(sx, px), simd::mul4(sy, py)), simd::mul4(sz, pz)), invDet);
+        // q = cross(s, e1)
+        const simd::f32x4 qx = simd::sub4(simd::mul4(sy, e1z), simd::mul4(sz, e1y));
+        const simd::f32x4 qy = simd::sub4(simd::mul4(sz, e1x), simd::mul4(sx, e1z));
+        const simd::f32x4 qz = simd::sub4(simd::mul4(sx, e1y), simd::mul4(sy, e1x));
+        const simd::f32x4 vv = simd::mul4(simd::add4(
+            simd::add4(simd::mul4(dir[0], qx), simd::mul4(dir[1], qy)), simd::mul4(dir[2], qz)), invDet);
+        const simd::f32x4 t = simd::mul4(simd::add4(
+            simd::add4(simd::mul4(e2x, qx), simd::mul4(e2y, qy)), simd::mul4(e2z, qz)), invDet);
+        const u32 hitMask = rayMask
+            & simd::lessEqualMask4(zero, u) & simd::lessEqualMask4(zero, vv)
+            & simd::lessEqualMask4(simd::add4(u, vv), one)
+            & simd::lessMask4(zero, t) & simd::lessMask4(t, simd::load4(tBest));
+        if (!hitMask) { continue; }
+        f32 ts[rayPacketSize];
+        simd::store4(ts, t);
+        for (u32 mask = hitMask; mask; mask &= mask - 1) {
+            const u32 lane = math::lsb32(mask);
+            tBest[lane] = ts[lane];
+            sourceIds[lane] = sourceId;
+        }
+        packetHitMask |= hitMask;
+    }
+    return packetHitMask;
+}
+// Packet version of intersectRay, for the rays in rayMask. hits must have room for rayPacketSize
+// results. Returns the lanes that hit something
+// Nodes are visited if any of the packet's rays hits them, so the packet can only be as fast
+// as its rays are coherent. With RayMode::ClosestHit, children are ordered by their nearest hit
+// among the packet's rays; with RayMode::AnyHit, rays stop taking part as soon as they hit
+u32 intersectRayPacket(
+    RayHit* hits, const Tree& bvh, const RaySources& sources, const RayPacket& packet,
+    const RayMode::Enum mode, const u32 rayMask = 0xf) {
+    struct RayPacketQueryNode { u32 offset; u32 triangleCount; u32 rayMask; f32 tNear; };
+    f32 tBest[rayPacketSize];
+    u32 sourceIds[rayPacketSize];
+    for (u32 i = 0; i < rayPacketSize; i++) { tBest[i] = packet.tMax[i]; sourceIds[i] = noSource; }
+
+    const simd::f32x4 origin[3] = {
+        simd::load4(packet.originX), simd::load4(packet.originY), simd::load4(packet.originZ) };
+    const simd::f32x4 dir[3] = {
+        simd::load4(packet.dirX), simd::load4(packet.dirY), simd::load4(packet.dirZ) };
+    // same slab test as intersectRay, but the signs of dir can differ per lane, so near and far
+    // planes are sorted with min / max instead
+    const simd::f32x4 one = simd::splat4(1.f);
+    const simd::f32x4 invX = simd::div4(one, dir[0]);
+    const simd::f32x4 invY = simd::div4(one, dir[1]);
+    const simd::f32x4 invZ = simd::div4(one, dir[2]);
+    const simd::f32x4 originInvX = simd::mul4(origin[0], invX);
+    const simd::f32x4 originInvY = simd::mul4(origin[1], invY);
+    const simd::f32x4 originInvZ = simd::mul4(origin[2], invZ);
+    const simd::f32x4 zero = simd::splat4(0.f);
+
+    u32 activeMask = rayMask & 0xf; // rays still looking for hits
+    u32 hitMask = 0;
+    RayPacketQueryNode nodeStack[maxRayStackCount];
+    u32 stackCount = 0;
+    nodeStack[stackCount++] = { 0, 0, activeMask, 0.f };
+    while (stackCount > 0 && activeMask) {
+        const RayPacketQueryNode n = nodeStack[--stackCount];
+        const u32 nodeRayMask = n.rayMask & activeMask;
+        if (!nodeRayMask) { continue; }
+        if (mode == RayMode::ClosestHit) { // skip if all the rays found closer hits since the push
+            f32 tLimit = 0.f;
+            for (u32 mask = nodeRayMask; mask; mask &= mask - 1) {
+                tLimit = math::max(tLimit, tBest[math::lsb32(mask)]);
+            }
+            if (n.tNear > tLimit) { continue; }
+        }
+        if (n.triangleCount) {
+            for (u32 i = 0; i < n.triangleCount; i++) {
+                const u32 sourceId = bvh.sourceIds[n.offset + i];
+                const u32 leafHitMask = intersectSourcePacket(
+                    tBest, sourceIds, sources, sourceId, origin, dir, activeMask & nodeRayMask);
+                hitMask |= leafHitMask;
+                if (mode == RayMode::AnyHit) {
+                    activeMask &= ~leafHitMask;
+                    if (!activeMask) { break; }
                 }
             }
+            continue;
+        }
+
+        const WideNode& node = bvh.wideNodes[n.offset];
+        const simd::f32x4 tMax = simd::load4(tBest);
+        RayPacketQueryNode children[wideChildCount];
+        u32 childCount = 0;
+        for (u32 c = 0; c < wideChildCount; c++) {
+            if (isEmptySlot(node, c)) { break; }
+            const simd::f32x4 x0 = simd::sub4(simd::mul4(simd::splat4(node.minX[c]), invX), originInvX);
+            const simd::f32x4 x1 = simd::sub4(simd::mul4(simd::splat4(node.maxX[c]), invX), originInvX);
+            const simd::f32x4 y0 = simd::sub4(simd::mul4(simd::splat4(node.minY[c]), invY), originInvY);
+            const simd::f32x4 y1 = simd::sub4(simd::mul4(simd::splat4(node.maxY[c]), invY), originInvY);
+            const simd::f32x4 z0 = simd::sub4(simd::mul4(simd::splat4(node.minZ[c]), invZ), originInvZ);
+            const simd::f32x4 z1 = simd::sub4(simd::mul4(simd::splat4(node.maxZ[c]), invZ), originInvZ);
+            const simd::f32x4 tNear = simd::max4(
+                simd::max4(simd::min4(x0, x1), simd::min4(y0, y1)), simd::max4(simd::min4(z0, z1), zero));
+            const simd::f32x4 tFar = simd::min4(
+                simd::min4(simd::max4(x0, x1), simd::max4(y0, y1)), simd::min4(simd::max4(z0, z1), tMax));
+            const u32 childRayMask = ~simd::lessMask4(tFar, tNear) & nodeRayMask;
+            if (!childRayMask) { continue; }
+            f32 tNears[rayPacketSize];
+            simd::store4(tNears, tNear);
+            f32 childNear = FLT_MAX;
+            for (u32 mask = childRayMask; mask; mask &= mask - 1) {
+                childNear = math::min(childNear, tNears[math::lsb32(mask)]);
+            }
+            RayPacketQueryNode child = { node.offset[c], node.triangleCount[c], childRayMask, childNear };
+            u32 i = childCount++;
+            for (; i > 0 && children[i - 1].tNear < child.tNear; i--) { children[i] = children[i - 1]; }
+            children[i] = child;
         }
+        assert(stackCount + childCount <= maxRayStackCount);
+        for (u32 c = 0; c < childCount; c++) { nodeStack[stackCount++] = children[c]; }
     }
+    for (u32 i = 0; i < rayPacketSize; i++) { hits[i] = { tBest[i], sourceIds[i] }; }
+    return hitMask;
 }
 
 }; // namespace BVH
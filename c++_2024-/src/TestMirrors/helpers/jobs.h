@@ -0,0 +1,117 @@
+#ifndef __WASTELADNS_JOBS_H__
+#define __WASTELADNS_JOBS_H__
+
+// Fork-join over all cores, the calling thread included: tasks are handed out one at a time with
+// an atomic counter, so they should be coarse (a chunk of elements each, not a single element)
+// The plain parallel_for creates its worker threads on every call, so it's meant for load time
+// work. Per frame work should go through a Pool, whose workers sleep between calls
+namespace jobs {
+
+typedef void (*TaskFunc)(void* data, u32 taskId);
+const u32 maxWorkerCount = 32;
+
+struct ParallelFor {
+    TaskFunc func;
+    void* data;
+    volatile uintptr_t nextTask;
+    u32 taskCount;
+};
+void run_tasks(void* parallelFor) {
+    ParallelFor& p = *(ParallelFor*)parallelFor;
+    while (true) {
+        const uintptr_t task = platform::atomic_fetch_add(&p.nextTask, 1);
+        if (task >= p.taskCount) { break; }
+        p.func(p.data, (u32)task);
+    }
+}
+u32 worker_count() { return math::min((u32)platform::core_count(), maxWorkerCount); }
+// Returns once all tasks are done
+void parallel_for(TaskFunc func, void* data, const u32 taskCount) {
+    ParallelFor p;
+    p.func = func;
+    p.data = data;
+    p.nextTask = 0;
+    p.taskCount = taskCount;
+    platform::Thread threads[maxWorkerCount];
+    u32 threadCount = 0;
+    const u32 workerCount = math::min(worker_count(), taskCount);
+    for (u32 i = 1; i < workerCount; i++) {
+        if (platform::thread_start(threads[threadCount], run_tasks, &p)) { threadCount++; }
+    }
+    run_tasks(&p);
+    for (u32 i = 0; i < threadCount; i++) { platform::thread_join(threads[i]); }
+}
+
+// Workers that stay alive for the whole run. They sleep on a semaphore until a parallel_for
+// wakes them, and the calling thread works on the tasks too, so the pool has one thread less
+// than there are workers. Calls must come from a single thread, one at a time
+struct Pool {
+    platform::Thread threads[maxWorkerCount];
+    platform::Semaphore wake;
+    platform::Semaphore done; // posted by the last woken worker to finish the call in flight
+    volatile uintptr_t current; // ParallelFor* of the call in flight, 0 tells workers to exit
+    volatile uintptr_t finished; // workers done with the call in flight
+    u32 wakeCount; // workers woken for the call in flight
+    u32 threadCount;
+};
+void pool_worker(void* pool) {
+    Pool& p = *(Pool*)pool;
+    while (true) {
+        platform::semaphore_wait(p.wake);
+        ParallelFor* parallelFor = (ParallelFor*)platform::atomic_load(&p.current);
+        if (!parallelFor) { break; }
+        // read before checking in: once the last worker does, the next call may overwrite it
+        const u32 wakeCount = p.wakeCount;
+        run_tasks(parallelFor);
+        if (platform::atomic_fetch_add(&p.finished, 1) + 1 == wakeCount) {
+            platform::semaphore_post(p.done, 1);
+        }
+    }
+}
+void init_pool(Pool& pool) {
+    platform::semaphore_init(pool.wake);
+    platform::semaphore_init(pool.done);
+    pool.current = 0;
+    pool.finished = 0;
+    pool.wakeCount = 0;
+    pool.threadCount = 0;
+    const u32 workerCount = worker_count();
+    for (u32 i = 1; i < workerCount; i++) {
+        if (platform::thread_start(pool.threads[pool.threadCount], pool_worker, &pool)) {
+            pool.threadCount++;
+        }
+    }
+}
+// Wakes every worker with nothing to do so they exit, and waits for them
+void shutdown_pool(Pool& pool) {
+    platform::atomic_store(&pool.current, 0);
+    platform::semaphore_post(pool.wake, pool.threadCount);
+    for (u32 i = 0; i < pool.threadCount; i++) { platform::thread_join(pool.threads[i]); }
+    pool.threadCount = 0;
+    platform::semaphore_destroy(pool.wake);
+    platform::semaphore_destroy(pool.done);
+}
+// Returns once all tasks are done, and no worker is looking at this call anymore
+void parallel_for(Pool& pool, TaskFunc func, void* data, const u32 taskCount) {
+    ParallelFor p;
+    p.func = func;
+    p.data = data;
+    p.nextTask = 0;
+    p.taskCount = taskCount;
+    // the wake semaphore orders these before any worker reads them
+    pool.wakeCount = taskCount ? math::min(pool.threadCount, taskCount - 1) : 0;
+    platform::atomic_store(&pool.current, (uintptr_t)&p);
+    platform::atomic_store(&pool.finished, 0);
+    platform::semaphore_post(pool.wake, pool.wakeCount);
+    run_tasks(&p);
+    // every woken worker has to check in before p goes out of scope, even if it found no tasks
+    if (pool.wakeCount) { platform::semaphore_wait(pool.done); }
+}
+// Splits count elements into chunks of chunkSize, for tasks that work on element ranges
+force_inline u32 chunk_count(const u32 count, const u32 chunkSize) {
+    return (count + chunkSize - 1) / chunkSize;
+}
+
+}
+
+#endif // __WASTELADNS_JOBS_H__
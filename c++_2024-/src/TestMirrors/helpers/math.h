@@ -20,6 +20,16 @@ constexpr unsigned ceillog2(unsigned x) { return x == 1 ? 0 : floorlog2(x - 1) +
 namespace math {
 
 force_inline f32 rand() { return ::rand() / (f32) RAND_MAX; }
+// index of the lowest / highest set bit, x must not be 0
+#if _MSC_VER
+force_inline u32 lsb32(u32 x) { unsigned long i; _BitScanForward(&i, x); return i; }
+force_inline u32 msb32(u32 x) { unsigned long i; _BitScanReverse(&i, x); return i; }
+force_inline u32 msb64(u64 x) { unsigned long i; _BitScanReverse64(&i, x); return i; }
+#else
+force_inline u32 lsb32(u32 x) { return __builtin_ctz(x); }
+force_inline u32 msb32(u32 x) { return 31 - __builtin_clz(x); }
+force_inline u32 msb64(u64 x) { return 63 - __builtin_clzll(x); }
+#endif
 force_inline u8 min(u8 a, u8 b) { return (b < a) ? b : a; }
 force_inline s8 min(s8 a, s8 b) { return (b < a) ? b : a; }
 force_inline u16 min(u16 a, u16 b) { return (b < a) ? b : a; }
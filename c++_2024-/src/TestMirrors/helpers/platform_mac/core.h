@@ -14,6 +14,10 @@
 #import <IOKit/hid/IOHIDLib.h>
 
 #include "../renderer_gl33/loader_gl.h"
+#include "../platform_posix/memory.h"
+#include "../platform_posix/atomic.h"
+#include "../platform_posix/thread.h"
+#include "../platform_posix/file.h"
 
 #define consoleLog(a) printf("%s", a)
 
@@ -21,10 +25,12 @@ namespace platform {
 
 const char* name = "MAC+GL";
 
-void* mem_reserve(size_t size) {
-    return mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+// Seconds since an arbitrary point, for timing code outside of the frame loop
+double time_now() {
+    mach_timebase_info_data_t ticks_to_nanos;
+    mach_timebase_info(&ticks_to_nanos);
+    return (double)mach_absolute_time() * ticks_to_nanos.numer / (1e9 * ticks_to_nanos.denom);
 }
-void mem_commit(void* ptr, size_t size) { /* no-op, OS will commit memory pages as needed */ }
 }
 
 #endif // __WASTELADNS_CORE_MACOS_H__
@@ -258,6 +258,8 @@ int main(int , char** ) {
         } // autorelease pool
     } while (!config.quit);
     
+    game::stop(game);
+    
     }
     return 1;
 }
@@ -0,0 +1,20 @@
+#ifndef __WASTELADNS_ATOMIC_POSIX_H__
+#define __WASTELADNS_ATOMIC_POSIX_H__
+
+// Minimal set of atomic operations on pointer-sized values, via gcc / clang builtins
+namespace platform {
+
+uintptr_t atomic_load(volatile uintptr_t* v) { return __atomic_load_n(v, __ATOMIC_ACQUIRE); }
+void atomic_store(volatile uintptr_t* v, uintptr_t value) { __atomic_store_n(v, value, __ATOMIC_RELEASE); }
+// returns the value before the addition
+uintptr_t atomic_fetch_add(volatile uintptr_t* v, uintptr_t add) {
+    return __atomic_fetch_add(v, add, __ATOMIC_ACQ_REL);
+}
+// returns whether the value was swapped (that is, if *v was equal to expected)
+bool atomic_cas(volatile uintptr_t* v, uintptr_t expected, uintptr_t desired) {
+    return __atomic_compare_exchange_n(
+        v, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+}
+
+#endif // __WASTELADNS_ATOMIC_POSIX_H__
@@ -0,0 +1,35 @@
+#ifndef __WASTELADNS_FILE_POSIX_H__
+#define __WASTELADNS_FILE_POSIX_H__
+
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close
+
+// Read-only file mappings: pages are faulted in from the file as they are touched
+namespace platform {
+
+struct MappedFile {
+    const void* data;
+    size_t size;
+};
+// Returns false if the file doesn't exist or is empty
+bool file_map(MappedFile& file, const char* path) {
+    file = {};
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* ptr = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) { file.data = ptr; file.size = (size_t)info.st_size; }
+    }
+    close(fd); // the mapping keeps the file open
+    return file.data != nullptr;
+}
+void file_unmap(MappedFile& file) {
+    if (file.data) { munmap((void*)file.data, file.size); }
+    file = {};
+}
+}
+
+#endif // __WASTELADNS_FILE_POSIX_H__
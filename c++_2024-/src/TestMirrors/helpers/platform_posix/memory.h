@@ -0,0 +1,95 @@
+#ifndef __WASTELADNS_MEMORY_POSIX_H__
+#define __WASTELADNS_MEMORY_POSIX_H__
+
+#include <sys/mman.h> // mmap, mprotect, madvise, mincore
+#include <unistd.h> // sysconf
+
+// Virtual memory backend shared by posix platforms (linux and macos)
+// Memory is reserved as PROT_NONE, and committed / decommitted by changing page protection,
+// so that touching memory past the committed range crashes, same as VirtualAlloc on windows
+
+// Reserved address space doesn't use memory until committed, so each VirtualBuffer can have
+// its own reservation (see allocator.h)
+#ifndef __CHEAP_RESERVE
+#define __CHEAP_RESERVE 1
+#endif
+
+namespace platform {
+
+struct PageType { enum Enum { Small, HugeTransparent, HugeExplicit }; };
+const size_t smallPageSize = 4 * 1024;
+const size_t hugePageSize = 2 * 1024 * 1024;
+
+// Returns the start of the reserved range, and the granularity at which it should be committed
+void* mem_reserve(size_t size, PageType::Enum type, size_t& pagesize) {
+    pagesize = smallPageSize;
+    #if defined(__linux__)
+    #ifndef MAP_HUGE_SHIFT
+    #define MAP_HUGE_SHIFT 26
+    #endif
+    if (type == PageType::HugeExplicit) {
+        // requires the hugetlb pool to be configured (vm.nr_hugepages), fall back to THP otherwise
+        // no MAP_NORESERVE here: the pool pages are reserved upfront, so mmap fails if the pool
+        // can't back the whole range, instead of raising SIGBUS when the pages are first touched
+        void* ptr = mmap(0, size, PROT_NONE,
+                         MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|(21 << MAP_HUGE_SHIFT), -1, 0);
+        if (ptr != MAP_FAILED) { pagesize = hugePageSize; return ptr; }
+        type = PageType::HugeTransparent;
+    }
+    if (type == PageType::HugeTransparent) {
+        // over-reserve so the usable range starts at a 2MB boundary, otherwise the kernel
+        // can't back the first and last pages with huge pages
+        uint8_t* ptr = (uint8_t*)mmap(0, size + hugePageSize, PROT_NONE,
+                            MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED) { return nullptr; }
+        uint8_t* ptr_aligned = (uint8_t*)(((uintptr_t)ptr + (hugePageSize - 1)) & -hugePageSize);
+        if (ptr_aligned != ptr) { munmap(ptr, ptr_aligned - ptr); }
+        munmap(ptr_aligned + size, (ptr + size + hugePageSize) - (ptr_aligned + size));
+        madvise(ptr_aligned, size, MADV_HUGEPAGE);
+        // commit whole huge pages, so mprotect doesn't split them across two mappings
+        pagesize = hugePageSize;
+        return ptr_aligned;
+    }
+    #endif
+    // macos only supports superpages through mach_vm_allocate, which can't be
+    // partially committed: use regular pages there
+    void* ptr = mmap(0, size, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+void mem_commit(void* ptr, size_t size) { mprotect(ptr, size, PROT_READ|PROT_WRITE); }
+void mem_decommit(void* ptr, size_t size) {
+    // release the physical pages first: a PROT_NONE mapping would otherwise keep them around
+    #if defined(__linux__)
+    madvise(ptr, size, MADV_DONTNEED);
+    #else
+    madvise(ptr, size, MADV_FREE_REUSABLE);
+    #endif
+    mprotect(ptr, size, PROT_NONE);
+}
+// Number of bytes in the range that are currently backed by physical memory
+size_t mem_resident(void* ptr, size_t size) {
+    #if defined(__linux__)
+    typedef unsigned char MincoreEntry;
+    #else
+    typedef char MincoreEntry;
+    #endif
+    const size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t batchPages = 4096;
+    MincoreEntry pages[batchPages];
+    size_t resident = 0;
+    uint8_t* curr = (uint8_t*)ptr;
+    uint8_t* end = curr + size;
+    while (curr < end) {
+        const size_t batchsize = (size_t)(end - curr) < batchPages * pagesize ?
+                                 (size_t)(end - curr) : batchPages * pagesize;
+        if (mincore(curr, batchsize, pages) == 0) {
+            const size_t count = (batchsize + pagesize - 1) / pagesize;
+            for (size_t i = 0; i < count; i++) { if (pages[i] & 1) { resident += pagesize; } }
+        }
+        curr += batchsize;
+    }
+    return resident;
+}
+}
+
+#endif // __WASTELADNS_MEMORY_POSIX_H__
@@ -0,0 +1,63 @@
+#ifndef __WASTELADNS_THREAD_POSIX_H__
+#define __WASTELADNS_THREAD_POSIX_H__
+
+#include <pthread.h> // pthread_create, pthread_join, pthread_mutex, pthread_cond
+#include <unistd.h> // sysconf
+
+// Minimal thread api, enough to fork and join workers
+namespace platform {
+
+typedef void (*ThreadFunc)(void* data);
+struct Thread {
+    pthread_t handle;
+    ThreadFunc func;
+    void* data;
+};
+void* thread_entry(void* thread) {
+    Thread& t = *(Thread*)thread;
+    t.func(t.data);
+    return nullptr;
+}
+// The thread struct must stay alive until thread_join
+bool thread_start(Thread& thread, ThreadFunc func, void* data) {
+    thread.func = func;
+    thread.data = data;
+    return pthread_create(&thread.handle, nullptr, thread_entry, &thread) == 0;
+}
+void thread_join(Thread& thread) { pthread_join(thread.handle, nullptr); }
+// Counting semaphore, so idle workers can sleep until there's work for them
+// Built on a mutex and a condition variable, since macos doesn't support unnamed posix semaphores
+struct Semaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t count;
+};
+void semaphore_init(Semaphore& s) {
+    pthread_mutex_init(&s.mutex, nullptr);
+    pthread_cond_init(&s.cond, nullptr);
+    s.count = 0;
+}
+void semaphore_post(Semaphore& s, uint32_t count) {
+    pthread_mutex_lock(&s.mutex);
+    s.count += count;
+    pthread_mutex_unlock(&s.mutex);
+    if (count == 1) { pthread_cond_signal(&s.cond); }
+    else if (count > 1) { pthread_cond_broadcast(&s.cond); }
+}
+void semaphore_wait(Semaphore& s) {
+    pthread_mutex_lock(&s.mutex);
+    while (s.count == 0) { pthread_cond_wait(&s.cond, &s.mutex); }
+    s.count--;
+    pthread_mutex_unlock(&s.mutex);
+}
+void semaphore_destroy(Semaphore& s) {
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.mutex);
+}
+uint32_t core_count() {
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+}
+
+#endif // __WASTELADNS_THREAD_POSIX_H__
@@ -17,8 +17,13 @@
 #include <winuser.h> // api for windows stuff, PeekMessage, CreateWindowEx, etc // Wall time: 38.148ms
 
 #include <timeapi.h> // for timeBeginPeriod // Wall time: 1.123ms
-#include <synchapi.h> // for Sleep // Wall time: 1.737ms
+#include <synchapi.h> // for Sleep, CreateSemaphore // Wall time: 1.737ms
 #include <memoryapi.h> // for VirtualAlloc // Wall time: 2.469ms
+#include <processthreadsapi.h> // for CreateThread
+#include <handleapi.h> // for CloseHandle
+#include <sysinfoapi.h> // for GetSystemInfo
+#include <fileapi.h> // for CreateFile, GetFileSizeEx
+#include <intrin.h> // for _Interlocked* atomics
 
 #if __DX11
     // types defined by winuser.h->libloaderapi.h->minwinbase.h,
@@ -59,8 +64,137 @@
 
 #define consoleLog OutputDebugString
 
+// Reserved address space doesn't use memory until committed, so each VirtualBuffer can have
+// its own reservation (see allocator.h)
+#ifndef __CHEAP_RESERVE
+#define __CHEAP_RESERVE 1
+#endif
+
 namespace platform {
-void* mem_reserve(size_t size) { return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS); }
+struct PageType { enum Enum { Small, HugeTransparent, HugeExplicit }; };
+const size_t smallPageSize = 4 * 1024;
+const size_t hugePageSize = 2 * 1024 * 1024;
+
+// Large pages on windows need SeLockMemoryPrivilege, and must be committed on reservation,
+// so they can't back a growable arena: all page types use regular pages
+void* mem_reserve(size_t size, PageType::Enum type, size_t& pagesize) {
+    pagesize = smallPageSize;
+    return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);
+}
 void mem_commit(void* ptr, size_t size) { VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE); }
+void mem_decommit(void* ptr, size_t size) { VirtualFree(ptr, size, MEM_DECOMMIT); }
+// Windows doesn't fault in committed pages until they are touched, but the only way to
+// query actual residency is QueryWorkingSetEx (psapi). We report the committed bytes instead
+size_t mem_resident(void* ptr, size_t size) {
+    size_t resident = 0;
+    uint8_t* curr = (uint8_t*)ptr;
+    uint8_t* end = curr + size;
+    while (curr < end) {
+        MEMORY_BASIC_INFORMATION info;
+        if (!VirtualQuery(curr, &info, sizeof(info))) { break; }
+        uint8_t* regionEnd = (uint8_t*)info.BaseAddress + info.RegionSize;
+        if (regionEnd > end) { regionEnd = end; }
+        if (info.State == MEM_COMMIT) { resident += regionEnd - curr; }
+        curr = regionEnd;
+    }
+    return resident;
+}
+
+static_assert(sizeof(uintptr_t) == sizeof(long long), "atomics assume 64 bit pointers");
+uintptr_t atomic_load(volatile uintptr_t* v) { // aligned 64 bit loads are atomic on x64
+    uintptr_t value = *v;
+    _ReadWriteBarrier();
+    return value;
+}
+void atomic_store(volatile uintptr_t* v, uintptr_t value) {
+    _ReadWriteBarrier();
+    *v = value;
+}
+// returns the value before the addition
+uintptr_t atomic_fetch_add(volatile uintptr_t* v, uintptr_t add) {
+    return (uintptr_t)_InterlockedExchangeAdd64((volatile long long*)v, (long long)add);
+}
+// returns whether the value was swapped (that is, if *v was equal to expected)
+bool atomic_cas(volatile uintptr_t* v, uintptr_t expected, uintptr_t desired) {
+    return (uintptr_t)_InterlockedCompareExchange64(
+        (volatile long long*)v, (long long)desired, (long long)expected) == expected;
+}
+
+// Minimal thread api, enough to fork and join workers
+typedef void (*ThreadFunc)(void* data);
+struct Thread {
+    HANDLE handle;
+    ThreadFunc func;
+    void* data;
+};
+DWORD WINAPI thread_entry(LPVOID thread) {
+    Thread& t = *(Thread*)thread;
+    t.func(t.data);
+    return 0;
+}
+// The thread struct must stay alive until thread_join
+bool thread_start(Thread& thread, ThreadFunc func, void* data) {
+    thread.func = func;
+    thread.data = data;
+    thread.handle = CreateThread(nullptr, 0, thread_entry, &thread, 0, nullptr);
+    return thread.handle != nullptr;
+}
+void thread_join(Thread& thread) {
+    WaitForSingleObject(thread.handle, INFINITE);
+    CloseHandle(thread.handle);
+}
+// Counting semaphore, so idle workers can sleep until there's work for them
+struct Semaphore {
+    HANDLE handle;
+};
+void semaphore_init(Semaphore& s) {
+    s.handle = CreateSemaphoreW(nullptr, 0, 0x7fffffff, nullptr);
+}
+void semaphore_post(Semaphore& s, uint32_t count) {
+    if (count) { ReleaseSemaphore(s.handle, (LONG)count, nullptr); }
+}
+void semaphore_wait(Semaphore& s) { WaitForSingleObject(s.handle, INFINITE); }
+void semaphore_destroy(Semaphore& s) { CloseHandle(s.handle); }
+uint32_t core_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+}
+
+// Seconds since an arbitrary point, for timing code outside of the frame loop
+double time_now() {
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return now.QuadPart / (double)frequency.QuadPart;
+}
+
+// Read-only file mappings: pages are faulted in from the file as they are touched
+struct MappedFile {
+    const void* data;
+    size_t size;
+};
+// Returns false if the file doesn't exist or is empty
+bool file_map(MappedFile& file, const char* path) {
+    file = {};
+    HANDLE handle = CreateFileA(
+        path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) { return false; }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            file.data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (file.data) { file.size = (size_t)size.QuadPart; }
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+    }
+    CloseHandle(handle);
+    return file.data != nullptr;
+}
+void file_unmap(MappedFile& file) {
+    if (file.data) { UnmapViewOfFile(file.data); }
+    file = {};
+}
 }
 #endif // __WASTELADNS_CORE_WIN64_H__
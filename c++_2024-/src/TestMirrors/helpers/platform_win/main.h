@@ -433,5 +433,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         
     } while (!config.quit);
 
+    game::stop(game);
+
     return 1;
 }
@@ -88,10 +88,11 @@ namespace driver {
     }
     
     void create_texture_from_file(RscTexture& t, const TextureFromFileParams& params) {
-        Allocator_stb_arena = &params.arena;
+        allocator::LoaderArena loader;
+        allocator::init_loader(loader, params.arena);
+        Allocator_stb_arena = &loader;
         s32 w, h, channels;
         u8* data = stbi_load(params.path, &w, &h, &channels, 4);
-        Allocator_stb_arena = nullptr;
         if (data) {
             GLenum format = GL_RGBA;
             GLenum type = GL_UNSIGNED_BYTE;
@@ -127,6 +128,10 @@ namespace driver {
             
             stbi_image_free(data);
         }
+        Allocator_stb_arena = nullptr;
+        platform::debuglog("%s: loader peak %zu bytes, %u allocs, %u reallocs in place, %u copied\n",
+            params.path, loader.peak,
+            loader.allocCount, loader.reallocInPlaceCount, loader.reallocCopyCount);
     }
     void create_texture_empty(RscTexture& t, const TextureRenderTargetCreateParams& params) {
         GLuint texId;
@@ -0,0 +1,93 @@
+#ifndef __WASTELADNS_SIMD_H__
+#define __WASTELADNS_SIMD_H__
+
+// Minimal 4-wide float operations: SSE2 on x64 (always available there), NEON on arm64,
+// plain arrays everywhere else. Define __SIMD_SCALAR 1 before including to force the fallback
+#ifndef __SIMD_SCALAR
+#define __SIMD_SCALAR 0
+#endif
+#if !__SIMD_SCALAR && (defined _M_X64 || defined _M_AMD64 || defined __x86_64__)
+    #define __SIMD_SSE 1
+    #include <emmintrin.h>
+#elif !__SIMD_SCALAR && (defined __aarch64__ || defined __arm64__ || defined _M_ARM64)
+    #define __SIMD_NEON 1
+    #include <arm_neon.h>
+#else
+    #undef __SIMD_SCALAR
+    #define __SIMD_SCALAR 1
+#endif
+
+namespace simd {
+
+#if __SIMD_SSE
+typedef __m128 f32x4;
+force_inline f32x4 load4(const f32* p) { return _mm_loadu_ps(p); }
+force_inline void store4(f32* p, const f32x4 v) { _mm_storeu_ps(p, v); }
+force_inline f32x4 splat4(const f32 v) { return _mm_set1_ps(v); }
+force_inline f32x4 add4(const f32x4 a, const f32x4 b) { return _mm_add_ps(a, b); }
+force_inline f32x4 sub4(const f32x4 a, const f32x4 b) { return _mm_sub_ps(a, b); }
+force_inline f32x4 mul4(const f32x4 a, const f32x4 b) { return _mm_mul_ps(a, b); }
+force_inline f32x4 div4(const f32x4 a, const f32x4 b) { return _mm_div_ps(a, b); }
+force_inline f32x4 min4(const f32x4 a, const f32x4 b) { return _mm_min_ps(a, b); }
+force_inline f32x4 max4(const f32x4 a, const f32x4 b) { return _mm_max_ps(a, b); }
+// bit i of the result is set if a[i] < b[i]
+force_inline u32 lessMask4(const f32x4 a, const f32x4 b) { return (u32)_mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+// bit i of the result is set if a[i] <= b[i]
+force_inline u32 lessEqualMask4(const f32x4 a, const f32x4 b) { return (u32)_mm_movemask_ps(_mm_cmple_ps(a, b)); }
+#elif __SIMD_NEON
+typedef float32x4_t f32x4;
+force_inline f32x4 load4(const f32* p) { return vld1q_f32(p); }
+force_inline void store4(f32* p, const f32x4 v) { vst1q_f32(p, v); }
+force_inline f32x4 splat4(const f32 v) { return vdupq_n_f32(v); }
+force_inline f32x4 add4(const f32x4 a, const f32x4 b) { return vaddq_f32(a, b); }
+force_inline f32x4 sub4(const f32x4 a, const f32x4 b) { return vsubq_f32(a, b); }
+force_inline f32x4 mul4(const f32x4 a, const f32x4 b) { return vmulq_f32(a, b); }
+force_inline f32x4 div4(const f32x4 a, const f32x4 b) { return vdivq_f32(a, b); }
+force_inline f32x4 min4(const f32x4 a, const f32x4 b) { return vminq_f32(a, b); }
+force_inline f32x4 max4(const f32x4 a, const f32x4 b) { return vmaxq_f32(a, b); }
+force_inline u32 lessMask4(const f32x4 a, const f32x4 b) {
+    const uint32x4_t bits = { 1, 2, 4, 8 };
+    return vaddvq_u32(vandq_u32(vcltq_f32(a, b), bits));
+}
+force_inline u32 lessEqualMask4(const f32x4 a, const f32x4 b) {
+    const uint32x4_t bits = { 1, 2, 4, 8 };
+    return vaddvq_u32(vandq_u32(vcleq_f32(a, b), bits));
+}
+#else
+struct f32x4 { f32 v[4]; };
+force_inline f32x4 load4(const f32* p) { return f32x4{ { p[0], p[1], p[2], p[3] } }; }
+force_inline void store4(f32* p, const f32x4 v) { p[0] = v.v[0]; p[1] = v.v[1]; p[2] = v.v[2]; p[3] = v.v[3]; }
+force_inline f32x4 splat4(const f32 v) { return f32x4{ { v, v, v, v } }; }
+force_inline f32x4 add4(const f32x4 a, const f32x4 b) {
+    return f32x4{ { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } };
+}
+force_inline f32x4 sub4(const f32x4 a, const f32x4 b) {
+    return f32x4{ { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } };
+}
+force_inline f32x4 mul4(const f32x4 a, const f32x4 b) {
+    return f32x4{ { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } };
+}
+force_inline f32x4 div4(const f32x4 a, const f32x4 b) {
+    return f32x4{ { a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3] } };
+}
+force_inline f32x4 min4(const f32x4 a, const f32x4 b) { // same as sse: b if either is NaN
+    return f32x4{ { a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1],
+                    a.v[2] < b.v[2] ? a.v[2] : b.v[2], a.v[3] < b.v[3] ? a.v[3] : b.v[3] } };
+}
+force_inline f32x4 max4(const f32x4 a, const f32x4 b) {
+    return f32x4{ { a.v[0] > b.v[0] ? a.v[0] : b.v[0], a.v[1] > b.v[1] ? a.v[1] : b.v[1],
+                    a.v[2] > b.v[2] ? a.v[2] : b.v[2], a.v[3] > b.v[3] ? a.v[3] : b.v[3] } };
+}
+force_inline u32 lessMask4(const f32x4 a, const f32x4 b) {
+    return (a.v[0] < b.v[0] ? 1 : 0) | (a.v[1] < b.v[1] ? 2 : 0)
+         | (a.v[2] < b.v[2] ? 4 : 0) | (a.v[3] < b.v[3] ? 8 : 0);
+}
+force_inline u32 lessEqualMask4(const f32x4 a, const f32x4 b) {
+    return (a.v[0] <= b.v[0] ? 1 : 0) | (a.v[1] <= b.v[1] ? 2 : 0)
+         | (a.v[2] <= b.v[2] ? 4 : 0) | (a.v[3] <= b.v[3] ? 8 : 0);
+}
+#endif
+
+}
+
+#endif // __WASTELADNS_SIMD_H__
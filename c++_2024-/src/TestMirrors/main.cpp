@@ -46,21 +46,23 @@
 #include "helpers/types.h"
 #include "helpers/math.h"
 #include "helpers/allocator.h"
+#include "helpers/jobs.h"
 
-allocator::PagedArena* Allocator_stb_arena = nullptr;
+allocator::LoaderArena* Allocator_stb_arena = nullptr; // set for the duration of each image load
 struct Allocator_stb {
 	static void* malloc(size_t size) {
-		return allocator::alloc_arena(*Allocator_stb_arena, size, 16);
+		return allocator::alloc_loader(*Allocator_stb_arena, size);
 	}
-	static void* realloc(void* oldptr, size_t oldsize, size_t newsize) {
-		return allocator::realloc_arena(*Allocator_stb_arena, oldptr, oldsize, newsize, 16);
+	static void* realloc(void* oldptr, size_t newsize) {
+		return allocator::realloc_loader(*Allocator_stb_arena, oldptr, newsize);
+	}
+	static void free(void* ptr) {
+		allocator::free_loader(*Allocator_stb_arena, ptr);
 	}
-	static void free(void* ptr) {}
 };
 #define STBI_MALLOC(sz)           Allocator_stb::malloc(sz)
-#define STBI_REALLOC(p,newsz)     Allocator_stb::realloc(p,0,newsz)
+#define STBI_REALLOC(p,newsz)     Allocator_stb::realloc(p,newsz)
 #define STBI_FREE(p)              Allocator_stb::free(p)
-#define STBI_REALLOC_SIZED(p,oldsz,newsz) Allocator_stb::realloc(p,oldsz,newsz)
 #define STB_IMAGE_IMPLEMENTATION
 #include "lib/stb/stb_image.h"
 
@@ -79,7 +81,9 @@ struct Allocator_stb {
 #include "helpers/vec_ops.h"
 #include "helpers/transform.h"
 #include "helpers/color.h"
+#include "helpers/simd.h"
 #include "helpers/bvh.h"
+#include "helpers/aabbtree.h"
 #if __WIN64
 	#include "helpers/platform_win/input_types.h"
 #elif __MACOS
@@ -3,18 +3,39 @@
 
 namespace game {
 
-struct Mirrors { // todo: figure out delete, unhack sizes
-    struct Poly { float3 v[4]; float3 normal; u32 numPts; };
-    Poly* polys; // xy from 0.f to 1.f describe the mirror quad, z is the normal
-    renderer::DrawMesh* drawMeshes;
+struct Mirrors { // todo: figure out delete
+    // SoA, indexed by mirror id: the planes are read for every mirror on every camera of the tree,
+    // the vertices only for the mirrors that pass the backface test
+    float4* planes; // xyz is the normal (v2-v0 x v1-v0), w is -dot(normal, v0)
+    u32* vertexOffsets; // count + 1 entries, mirror i uses [vertexOffsets[i], vertexOffsets[i+1])
+    float3* vertices; // triangles or quads
+    u32* indexOffsets; // first index in its gpu mesh, indexCount is (vertexCount - 2) * 3
+    u8* meshIds; // into drawMeshes
+    renderer::DrawMesh* drawMeshes; // one per gpu mesh the mirrors come from, shared by its mirrors
     bvh::Tree bvh; // used to accelerate visibility queries
     u32 count;
+    u32 drawMeshCount;
 };
 struct GPUCPUMesh {
     renderer::CPUMesh cpuBuffer;
     renderer::driver::RscIndexedVertexBuffer gpuBuffer;
 };
+// Mirror trees are written to disk after being built, and mapped in place on later launches
+// The file stays mapped for the lifetime of the process: scenes (and their snapshots) point into it
+struct MirrorBVHCache {
+    const char* path;
+    platform::MappedFile file;
+};
 
+// Limits on the mirror cameras gathered each frame, on top of the max bounces
+// Portals are ranked by the pixels they cover on screen, times the attenuation of the mirrors
+// they're seen through, so the budget goes to the reflections that contribute the most
+struct MirrorBudget {
+    u32 maxCameras; // not counting the main camera, 0 means no budget
+    f32 minPixels; // portals covering fewer pixels than this are culled
+    f32 minContribution; // same, for the pixels times the attenuation
+    f32 bounceAttenuation; // assumed per mirror, only used for ranking: mirrors aren't tinted
+};
 struct Scene {
     struct InstancedTypes { enum Enum { PlayerTrail, PhysicsBalls, Count }; };
     camera::Camera camera;
@@ -29,6 +50,7 @@ struct Scene {
     u32 playerAnimatedNodeHandle;
     u32 playerPhysicsNodeHandle;
     u32 maxMirrorBounces;
+    MirrorBudget mirrorBudget;
 };
 struct AssetInMemory {
     // render
@@ -48,6 +70,7 @@ struct Resources {
     AssetInMemory assets[AssetsMeta::Count];
     GPUCPUMesh meshes[MeshesMeta::Count];
     GPUCPUMesh mirrorHallMeshes[MirrorHallMeta::Count];
+    MirrorBVHCache mirrorBVHCaches[MeshesMeta::Count];
     renderer::MeshHandle instancedUnitCubeMesh;
     renderer::MeshHandle instancedUnitSphereMesh;
     renderer::MeshHandle groundMesh;
@@ -65,6 +88,7 @@ struct RoomDefinition {
     f32 minCameraZoom;
     f32 maxCameraZoom;
     u32 maxMirrorBounces;
+    MirrorBudget mirrorBudget;
     bool physicsBalls;
 };
 const RoomDefinition roomDefinitions[] = {
@@ -73,33 +97,35 @@ const RoomDefinition roomDefinitions[] = {
       float3(-180.f * math::d2r32, 0.f, -180 * math::d2r32), // min camera eulers
       float3(180.f * math::d2r32, 0.f, 180 * math::d2r32), // max camera eulers
       0.3f, 2.f,
-      4, false },
+      4, { 256, 4.f, 1.f, 0.8f }, false },
     { Resources::MeshesMeta::ToiletHi,
       float3(-180.f * math::d2r32, 0.f, -180 * math::d2r32), // min camera eulers
       float3(180.f * math::d2r32, 0.f, 180 * math::d2r32), // max camera eulers
       0.2f, 0.5f,
-      2, false },
+      2, { 256, 4.f, 1.f, 0.8f }, false },
     { Resources::MeshesMeta::Count,
       float3(-180.f * math::d2r32, 0.f, -180 * math::d2r32), // min camera eulers
       float3(180.f * math::d2r32, 0.f, 180 * math::d2r32), // max camera eulers
       0.3f, 2.f,
-      8, true }
+      // the hall's full tree can reach a few hundred cameras at 8 bounces, mostly slivers
+      8, { 128, 4.f, 1.f, 0.8f }, true }
 #else
     { Resources::MeshesMeta::ToiletLo,
       float3(-45 * math::d2r32, 0.f, -180 * math::d2r32), // min camera eulers
       float3(-1.f * math::d2r32, 0.f, 180 * math::d2r32), // max camera eulers
       0.3f, 2.f,
-      4, false },
+      4, { 256, 4.f, 1.f, 0.8f }, false },
     { Resources::MeshesMeta::ToiletHi,
       float3(-30 * math::d2r32, 0.f, -180 * math::d2r32), // min camera eulers
       float3(-1.f * math::d2r32, 0.f, 180 * math::d2r32), // max camera eulers
       0.2f, 0.5f,
-      2, false },
+      2, { 256, 4.f, 1.f, 0.8f }, false },
     { Resources::MeshesMeta::Count,
       float3(-45 * math::d2r32, 0.f, -180 * math::d2r32), // min camera eulers
       float3(-1.f * math::d2r32, 0.f, 180 * math::d2r32), // max camera eulers
       0.3f, 2.f,
-      8, true }
+      // the hall's full tree can reach a few hundred cameras at 8 bounces, mostly slivers
+      8, { 128, 4.f, 1.f, 0.8f }, true }
 #endif
 };
 
@@ -116,6 +142,7 @@ Scene& scene, const AssetInMemory& def, const float3& spawnPos) {
     renderNode.nodeData.groupColor = Color32(1.f, 1.f, 1.f, 1.f).RGBAv4();
     renderNode.min = def.min;
     renderNode.max = def.max;
+    renderer::markCullDirty(renderScene, renderHandle);
     memcpy(renderNode.meshHandles, def.meshHandles, sizeof(renderNode.meshHandles));
     renderer::driver::RscCBuffer& cbuffercore = allocator::alloc_pool(renderScene.cbuffers);
     renderNode.cbuffer_node = handle_from_cbuffer(renderScene, cbuffercore);
@@ -141,14 +168,115 @@ Scene& scene, const AssetInMemory& def, const float3& spawnPos) {
         renderNode.cbuffer_ext = handle_from_cbuffer(renderScene, cbufferskinning);
         renderer::driver::create_cbuffer(cbufferskinning,
             { (u32) sizeof(float4x4) * animNode.skeleton.jointCount });
-        renderNode.ext_data = animNode.state.skinning;
+        renderNode.animationHandle = animationHandle;
     }
     // todo: physics??
 }
 
+force_inline u32 mirror_vertex_count(const game::Mirrors& mirrors, const u32 mirrorId) {
+    return mirrors.vertexOffsets[mirrorId + 1] - mirrors.vertexOffsets[mirrorId];
+}
+force_inline const float3* mirror_vertices(const game::Mirrors& mirrors, const u32 mirrorId) {
+    return &mirrors.vertices[mirrors.vertexOffsets[mirrorId]];
+}
+renderer::DrawMesh mirror_drawMesh(const game::Mirrors& mirrors, const u32 mirrorId) {
+    renderer::DrawMesh mesh = mirrors.drawMeshes[mirrors.meshIds[mirrorId]];
+    mesh.vertexBuffer.indexOffset = mirrors.indexOffsets[mirrorId];
+    mesh.vertexBuffer.indexCount = (mirror_vertex_count(mirrors, mirrorId) - 2) * 3;
+    return mesh;
+}
+
+// Indices used by the mirror starting at the given index: 6 if the next triangle is coplanar
+// enough to be merged into a quad, 3 otherwise
+u32 mirror_index_count(const renderer::CPUMesh& cpuMesh, const u32 index) {
+    if (index + 6 > cpuMesh.indexCount) { return 3; }
+    float3 v0 = cpuMesh.vertices[cpuMesh.indices[index]];
+    float3 v1 = cpuMesh.vertices[cpuMesh.indices[index + 1]];
+    float3 v2 = cpuMesh.vertices[cpuMesh.indices[index + 2]];
+    float3 v3 = cpuMesh.vertices[cpuMesh.indices[index + 3]];
+    float3 v4 = cpuMesh.vertices[cpuMesh.indices[index + 4]];
+    float3 v5 = cpuMesh.vertices[cpuMesh.indices[index + 5]];
+    const float3 normal012 = math::normalize(math::cross(math::subtract(v1, v0), math::subtract(v2, v0)));
+    const float3 normal345 = math::normalize(math::cross(math::subtract(v4, v3), math::subtract(v5, v3)));
+    const float3 normalCross = math::cross(normal012, normal345);
+    // coplanar enough (may still be degenerate, but we otherwise have too many mirrors)
+    return math::isCloseAll(normalCross, float3(0.f, 0.f, 0.f), 0.01f) ? 6 : 3;
+}
+// Counting pass, so the mirror arrays can be sized exactly
+void count_mirrors(u32& mirrorCount, u32& vertexCount, const renderer::CPUMesh& cpuMesh) {
+    u32 index = 0;
+    while (index + 3 <= cpuMesh.indexCount) {
+        const u32 indexCount = mirror_index_count(cpuMesh, index);
+        mirrorCount++;
+        vertexCount += indexCount == 6 ? 4 : 3;
+        index += indexCount;
+    }
+}
+void alloc_mirrors(
+    game::Mirrors& mirrors, const u32 mirrorCount, const u32 vertexCount, const u32 meshCount,
+    allocator::PagedArena& sceneArena) {
+    assert(meshCount <= 256); // meshIds are u8
+    mirrors = {};
+    mirrors.planes = (float4*)allocator::alloc_arena(
+        sceneArena, sizeof(float4) * mirrorCount, alignof(float4));
+    mirrors.vertexOffsets = (u32*)allocator::alloc_arena(
+        sceneArena, sizeof(u32) * (mirrorCount + 1), alignof(u32));
+    mirrors.vertices = (float3*)allocator::alloc_arena(
+        sceneArena, sizeof(float3) * vertexCount, alignof(float3));
+    mirrors.indexOffsets = (u32*)allocator::alloc_arena(
+        sceneArena, sizeof(u32) * mirrorCount, alignof(u32));
+    mirrors.meshIds = (u8*)allocator::alloc_arena(
+        sceneArena, sizeof(u8) * mirrorCount, alignof(u8));
+    mirrors.drawMeshes = (renderer::DrawMesh*)allocator::alloc_arena(
+        sceneArena, sizeof(renderer::DrawMesh) * meshCount, alignof(renderer::DrawMesh));
+    mirrors.vertexOffsets[0] = 0;
+}
+// Moves every mirror to its new id: mirror order[i] becomes mirror i
+void reorder_mirrors(game::Mirrors& mirrors, allocator::PagedArena scratchArena, const u32* order) {
+    const u32 vertexCount = mirrors.vertexOffsets[mirrors.count];
+    float4* planes = (float4*)allocator::alloc_arena(
+        scratchArena, sizeof(float4) * mirrors.count, alignof(float4));
+    u32* vertexOffsets = (u32*)allocator::alloc_arena(
+        scratchArena, sizeof(u32) * (mirrors.count + 1), alignof(u32));
+    float3* vertices = (float3*)allocator::alloc_arena(
+        scratchArena, sizeof(float3) * vertexCount, alignof(float3));
+    u32* indexOffsets = (u32*)allocator::alloc_arena(
+        scratchArena, sizeof(u32) * mirrors.count, alignof(u32));
+    u8* meshIds = (u8*)allocator::alloc_arena(scratchArena, sizeof(u8) * mirrors.count, alignof(u8));
+    memcpy(planes, mirrors.planes, sizeof(float4) * mirrors.count);
+    memcpy(vertexOffsets, mirrors.vertexOffsets, sizeof(u32) * (mirrors.count + 1));
+    memcpy(vertices, mirrors.vertices, sizeof(float3) * vertexCount);
+    memcpy(indexOffsets, mirrors.indexOffsets, sizeof(u32) * mirrors.count);
+    memcpy(meshIds, mirrors.meshIds, sizeof(u8) * mirrors.count);
+    for (u32 i = 0; i < mirrors.count; i++) {
+        const u32 src = order[i];
+        const u32 srcVertexCount = vertexOffsets[src + 1] - vertexOffsets[src];
+        mirrors.planes[i] = planes[src];
+        mirrors.vertexOffsets[i + 1] = mirrors.vertexOffsets[i] + srcVertexCount;
+        memcpy(&mirrors.vertices[mirrors.vertexOffsets[i]], &vertices[vertexOffsets[src]],
+            sizeof(float3) * srcVertexCount);
+        mirrors.indexOffsets[i] = indexOffsets[src];
+        mirrors.meshIds[i] = meshIds[src];
+    }
+}
+// Whether order is a permutation of all mirrors, as reorder_mirrors expects
+bool is_mirror_order(const game::Mirrors& mirrors, allocator::PagedArena scratchArena, const u32* order, const u32 count) {
+    if (count != mirrors.count) { return false; }
+    bool* seen = (bool*)allocator::alloc_arena(scratchArena, sizeof(bool) * count, alignof(bool));
+    memset(seen, 0, sizeof(bool) * count);
+    for (u32 i = 0; i < count; i++) {
+        if (order[i] >= count || seen[order[i]]) { return false; }
+        seen[order[i]] = true;
+    }
+    return true;
+}
+// Mirrors must have been allocated with enough room for this mesh (see count_mirrors)
+// If a bvh cache is given, the tree is mapped from it when it matches the mesh, or else built and
+// written to it for the next launch. Mirrors with a tree get renumbered in its leaf order
 void spawn_model_as_mirrors(
     game::Mirrors& mirrors, const game::GPUCPUMesh& loadedMesh,
-    allocator::PagedArena scratchArena, allocator::PagedArena& sceneArena, bool accelerateBVH) {
+    allocator::PagedArena scratchArena, allocator::PagedArena& sceneArena, bool accelerateBVH,
+    MirrorBVHCache* bvhCache) {
 
     const renderer::CPUMesh& cpuMesh = loadedMesh.cpuBuffer;
     u32* triangleIds;
@@ -158,53 +286,91 @@ void spawn_model_as_mirrors(
             scratchArena, sizeof(u32) * (cpuMesh.indexCount / 3), alignof(u32));
     }
 
+    // all mirrors in this mesh reference their triangles in the same gpu buffer
+    const u8 meshId = (u8)mirrors.drawMeshCount++;
+    renderer::DrawMesh& mesh = mirrors.drawMeshes[meshId];
+    mesh = {};
+    mesh.shaderTechnique = renderer::ShaderTechniques::Color3D;
+    mesh.vertexBuffer = loadedMesh.gpuBuffer; // copy buffer
+
     u32 index = 0;
     u32 triangles = 0;
     while (index + 3 <= cpuMesh.indexCount) {
-        float3 v0 = cpuMesh.vertices[cpuMesh.indices[index]];
-        float3 v1 = cpuMesh.vertices[cpuMesh.indices[index + 1]];
-        float3 v2 = cpuMesh.vertices[cpuMesh.indices[index + 2]];
+        const u32 indexCount = mirror_index_count(cpuMesh, index);
+        const u32 vertexCount = indexCount == 6 ? 4 : 3;
 
         const u32 mirrorId = mirrors.count++;
-        game::Mirrors::Poly& poly = mirrors.polys[mirrorId];
-        renderer::DrawMesh& mesh = mirrors.drawMeshes[mirrorId];
-
-        // reference triangles in the gpu mesh
-        mesh.shaderTechnique = renderer::ShaderTechniques::Color3D;
-        mesh.vertexBuffer = loadedMesh.gpuBuffer; // copy buffer
-        mesh.vertexBuffer.indexOffset = index;
-        mesh.vertexBuffer.indexCount = 3;
-
-        poly.numPts = 3;
-        poly.v[0] = v0;
-        poly.v[1] = v1;
-        poly.v[2] = v2;
-        if (accelerateBVH) { triangleIds[triangles++] = mirrorId; }
-
-        if (index + 6 <= cpuMesh.indexCount) {
-            float3 v3 = cpuMesh.vertices[cpuMesh.indices[index + 3]];
-            float3 v4 = cpuMesh.vertices[cpuMesh.indices[index + 4]];
-            float3 v5 = cpuMesh.vertices[cpuMesh.indices[index + 5]];
-            const float3 normal012 = math::normalize(math::cross(math::subtract(v1, v0), math::subtract(v2, v0)));
-            const float3 normal345 = math::normalize(math::cross(math::subtract(v4, v3), math::subtract(v5, v3)));
-            const float3 normalCross = math::cross(normal012, normal345);
-            if (math::isCloseAll(normalCross, float3(0.f, 0.f, 0.f), 0.01f)) {
-                // coplanar enough (may still be degenerate, but we otherwise have too many mirrors
-                // add a quad
-                poly.numPts = 4;
-                poly.v[3] = v3;
-                mesh.vertexBuffer.indexCount = 6;
-                if (accelerateBVH) { triangleIds[triangles++] = mirrorId; }
-            }
+        const u32 vertexOffset = mirrors.vertexOffsets[mirrorId];
+        float3* v = &mirrors.vertices[vertexOffset];
+        for (u32 i = 0; i < vertexCount; i++) { v[i] = cpuMesh.vertices[cpuMesh.indices[index + i]]; }
+        mirrors.vertexOffsets[mirrorId + 1] = vertexOffset + vertexCount;
+        mirrors.indexOffsets[mirrorId] = index;
+        mirrors.meshIds[mirrorId] = meshId;
+
+        const float3 normal =
+            math::normalize(math::cross(math::subtract(v[2], v[0]), math::subtract(v[1], v[0])));
+        mirrors.planes[mirrorId] = float4(normal, -math::dot(normal, v[0]));
+
+        if (accelerateBVH) {
+            for (u32 i = 0; i < indexCount; i += 3) { triangleIds[triangles++] = mirrorId; }
         }
-        poly.normal = math::normalize(math::cross(math::subtract(poly.v[2], poly.v[0]), math::subtract(poly.v[1], poly.v[0])));
-        index += mesh.vertexBuffer.indexCount;
+        index += indexCount;
     }
 
     if (accelerateBVH) {
-        bvh::buildTree(
-            sceneArena, scratchArena, mirrors.bvh, &(loadedMesh.cpuBuffer.vertices[0].x),
-            loadedMesh.cpuBuffer.indices, loadedMesh.cpuBuffer.indexCount, triangleIds);
+        // the binned SAH build gives the best trees, but past a few tens of thousands of triangles
+        // the morton-sorted build is several times faster, and a treelet pass recovers most of the quality
+        const u32 lbvhMinTriangleCount = 64 * 1024;
+        const bvh::BuildParams sahParams = { 16, 4, bvh::SplitMethod::SAH };
+        const bvh::LBVHParams lbvhParams = { 30, 1, 4 };
+        const bool useLBVH = triangles >= lbvhMinTriangleCount;
+
+        bvh::BuildStats stats;
+        bool cached = false;
+        u64 sourceHash = 0;
+        if (bvhCache) {
+            // everything the tree depends on: geometry, the ids stored in the leaves, and the builder
+            sourceHash = bvh::hash64(cpuMesh.vertices, sizeof(float3) * cpuMesh.vertexCount);
+            sourceHash = bvh::hash64(cpuMesh.indices, sizeof(u32) * cpuMesh.indexCount, sourceHash);
+            sourceHash = bvh::hash64(triangleIds, sizeof(u32) * triangles, sourceHash);
+            sourceHash = useLBVH ? bvh::hash64(&lbvhParams, sizeof(lbvhParams), sourceHash)
+                                 : bvh::hash64(&sahParams, sizeof(sahParams), sourceHash);
+            if (!bvhCache->file.data) { platform::file_map(bvhCache->file, bvhCache->path); }
+            cached = bvh::mapCache(
+                mirrors.bvh, stats, bvhCache->file.data, bvhCache->file.size, sourceHash)
+                && is_mirror_order(mirrors, scratchArena, mirrors.bvh.sourceOrder, mirrors.bvh.sourceCount);
+        }
+        if (!cached) {
+            if (useLBVH) {
+                bvh::buildTreeLBVH(
+                    sceneArena, scratchArena, mirrors.bvh, stats, lbvhParams,
+                    &(cpuMesh.vertices[0].x), cpuMesh.indices, cpuMesh.indexCount, triangleIds);
+            } else {
+                bvh::buildTree(
+                    sceneArena, scratchArena, mirrors.bvh, stats, sahParams,
+                    &(cpuMesh.vertices[0].x), cpuMesh.indices, cpuMesh.indexCount, triangleIds);
+            }
+            if (bvhCache) {
+                // stale or corrupt, nothing points into it: release it so it can be overwritten
+                platform::file_unmap(bvhCache->file);
+                if (!bvh::writeCache(scratchArena, bvhCache->path, mirrors.bvh, stats, sourceHash)) {
+                    platform::debuglog("mirror bvh: couldn't write cache to %s\n", bvhCache->path);
+                }
+            }
+        }
+        platform::debuglog("mirror bvh (%s): %u nodes, %u leaves, depth %u, SAH cost %.2f, %u wide nodes\n",
+            cached ? "cached" : "built",
+            stats.nodeCount, stats.leafCount, stats.depth, stats.sahCost, stats.wideNodeCount);
+
+        // the tree numbers mirrors in leaf order: move them to match, so that the mirrors under
+        // any node are next to each other in every array
+        if (is_mirror_order(mirrors, scratchArena, mirrors.bvh.sourceOrder, mirrors.bvh.sourceCount)) {
+            reorder_mirrors(mirrors, scratchArena, mirrors.bvh.sourceOrder);
+        } else {
+            // the leaves already use the tree's numbering, so without the reorder it can't be queried
+            platform::debuglog("mirror bvh: tree doesn't cover all %u mirrors, dropping it\n", mirrors.count);
+            mirrors.bvh = {};
+        }
     }
 }
 }
@@ -218,7 +384,7 @@ void load_mesh_cpu_gpu(
     const char* path, const f32 scale) {
 
     allocator::Buffer<renderer::VertexLayout_Color_3D> vertices = {};
-    allocator::Buffer<u16> indices = {};
+    allocator::Buffer<u32> indices = {};
 
     FILE* f;
     if (platform::fopen(&f, path, "r") == 0) {
@@ -261,11 +427,11 @@ void load_mesh_cpu_gpu(
         mesh.vertices = (float3*)allocator::alloc_arena(
             persistentArena,
             sizeof(float3) * vertices.len, alignof(float3));
-        mesh.indices = (u16*)allocator::alloc_arena(
+        mesh.indices = (u32*)allocator::alloc_arena(
             persistentArena,
-            sizeof(u16) * indices.len, alignof(u16));
+            sizeof(u32) * indices.len, alignof(u32));
         for (u32 i = 0; i < vertices.len; i++) { mesh.vertices[i] = vertices.data[i].pos; }
-        memcpy(mesh.indices, indices.data, sizeof(u16) * indices.len);
+        memcpy(mesh.indices, indices.data, sizeof(u32) * indices.len);
         mesh.indexCount = (u32)indices.len;
         mesh.vertexCount = (u32)vertices.len;
 
@@ -285,11 +451,11 @@ void load_mesh_cpu_gpu(
         bufferParams.indexData = indices.data;
         bufferParams.vertexSize = (u32) (sizeof(renderer::VertexLayout_Color_3D) * vertices.len);
         bufferParams.vertexCount = (u32) vertices.len;
-        bufferParams.indexSize = (u32)(sizeof(u16)* indices.len);
+        bufferParams.indexSize = (u32)(sizeof(u32)* indices.len);
         bufferParams.indexCount = (u32) indices.len;
         bufferParams.memoryUsage = renderer::driver::BufferMemoryUsage::GPU;
         bufferParams.accessType = renderer::driver::BufferAccessType::GPU;
-        bufferParams.indexType = renderer::driver::BufferItemType::U16;
+        bufferParams.indexType = renderer::driver::BufferItemType::U32;
         bufferParams.type = renderer::driver::BufferTopologyType::Triangles;
         renderer::driver::create_indexed_vertex_buffer(
             meshToLoad.gpuBuffer, bufferParams, attribs, countof(attribs));
@@ -471,26 +637,30 @@ bool load_with_materials(
 
     struct Allocator_ufbx {
         static void* alloc_fn(void* user, size_t size) {
-            allocator::PagedArena* arena = (allocator::PagedArena*)user;
-            return allocator::alloc_arena(*arena, size, 16);
+            allocator::LoaderArena* loader = (allocator::LoaderArena*)user;
+            return allocator::alloc_loader(*loader, size);
         }
         static void* realloc_fn(void* user, void* old_ptr, size_t old_size, size_t new_size) {
-            allocator::PagedArena* arena = (allocator::PagedArena*)user;
-            return allocator::realloc_arena(*arena, old_ptr, old_size, new_size, 16);
+            allocator::LoaderArena* loader = (allocator::LoaderArena*)user;
+            return allocator::realloc_loader(*loader, old_ptr, new_size);
         }
         static void free_fn(void* user, void* ptr, size_t size) {
-            allocator::PagedArena* arena = (allocator::PagedArena*)user;
-            allocator::free_arena(*arena, ptr, size);
+            allocator::LoaderArena* loader = (allocator::LoaderArena*)user;
+            allocator::free_loader(*loader, ptr);
         }
     };
+    // temp and result allocations share the scratch arena: the asset's scratch copy is discarded
+    // once it's loaded, so the result doesn't need to outlive the temporaries
+    allocator::LoaderArena loader;
+    allocator::init_loader(loader, pipelineContext.scratchArena);
     opts.temp_allocator.allocator.alloc_fn = &Allocator_ufbx::alloc_fn;
     opts.temp_allocator.allocator.realloc_fn = &Allocator_ufbx::realloc_fn;
     opts.temp_allocator.allocator.free_fn = &Allocator_ufbx::free_fn;
-    opts.temp_allocator.allocator.user = &pipelineContext.scratchArena;
+    opts.temp_allocator.allocator.user = &loader;
     opts.result_allocator.allocator.alloc_fn = &Allocator_ufbx::alloc_fn;
     opts.result_allocator.allocator.realloc_fn = &Allocator_ufbx::realloc_fn;
     opts.result_allocator.allocator.free_fn = &Allocator_ufbx::free_fn;
-    opts.result_allocator.allocator.user = &pipelineContext.scratchArena;
+    opts.result_allocator.allocator.user = &loader;
 
     ufbx_scene* scene = ufbx_load_file(path, &opts, &error);
     if (scene) {
@@ -844,14 +1014,68 @@ bool load_with_materials(
 		}
         success = true;
     }
+    platform::debuglog(
+        "%s: loader peak %zu bytes, %u allocs, %u reallocs in place, %u copied, %zu bytes at end\n",
+        path, loader.peak, loader.allocCount, loader.reallocInPlaceCount, loader.reallocCopyCount,
+        (size_t)(pipelineContext.scratchArena.curr - loader.start));
     return success;
 }
 }
+const f32 clipPolyEpsilon = 0.001f; // vertices closer than this to a plane count as on it
+// One Sutherland-Hodgman step: clips the input poly by the plane into output, given the distances
+// of the input vertices to the plane
+void clip_poly_by_plane(
+float3* outputPoly, u32& outputPoly_count, const float3* inputPoly, const u32 inputPoly_count,
+const f32* distances, const float4& plane) {
+
+    outputPoly_count = 0;
+    u32 numPlaneCuts = 0;
+    u32 prev_v = inputPoly_count - 1;
+
+    for (u32 curr_v = 0; curr_v < inputPoly_count; curr_v++) {
+        const f32 eps = clipPolyEpsilon;
+        if (distances[curr_v] > eps) {
+            // current vertex in positive zone,
+            // will be add to poly
+            if (distances[prev_v] < -eps) {
+                // edge entering the positive zone,
+                // add intersection point first
+                float3 ab = math::subtract(inputPoly[curr_v], inputPoly[prev_v]);
+                f32 t = (-distances[prev_v]) / math::dot(plane.xyz, ab);
+                float3 intersection = math::add(inputPoly[prev_v], math::scale(ab, t));
+                
+                numPlaneCuts++;
+                if (numPlaneCuts <= 1) { outputPoly[outputPoly_count++] = intersection; }
+                else {
+                    // poly is cutting the same plane a second time: degenerate
+                    // simply place the intersection in the place of the last vertex
+                    outputPoly[outputPoly_count - 1] = intersection;
+                }
+            }
+            outputPoly[outputPoly_count++] = inputPoly[curr_v];
+        } else if (distances[curr_v] < -eps) {
+            // current vertex in negative zone,
+            // will not be added to poly
+            if (distances[prev_v] > eps) {
+                // edge entering the negative zone,
+                // add intersection to face
+                float3 ab = math::subtract(inputPoly[curr_v], inputPoly[prev_v]);
+                f32 t = (-distances[prev_v]) / math::dot(plane.xyz, ab);
+                float3 intersection = math::add(inputPoly[prev_v], math::scale(ab, t));
+                outputPoly[outputPoly_count++] = intersection;
+            }
+        } else {
+            // current vertex on plane,
+            // add to poly
+            outputPoly[outputPoly_count++] = inputPoly[curr_v];
+        }
+
+        prev_v = curr_v;
+    }
+}
 void clip_poly_in_frustum(
 float3* poly, u32& poly_count, const float4* planes, const u32 planeCount, const u32 polyCountCap) {
 
-    // todo: consider speeding this up somehow, as it's pretty expensive when called 1000+ times
-
     enum { MAX_POLY_VERTICES = 7 };
     assert(polyCountCap <= MAX_POLY_VERTICES);
     
@@ -874,10 +1098,8 @@ float3* poly, u32& poly_count, const float4* planes, const u32 planeCount, const
         inputPoly = outputQuad;
         inputPoly_count = outputPoly_count;
         outputQuad = tmpQuad;
-        outputPoly_count = 0;
 
         const float4 plane = planes[p];
-        u32 numPlaneCuts = 0;
 
         // compute all distances ahead of time
         // even if the poly doesn't have the maximum number of vertices, this speeds things up
@@ -889,48 +1111,7 @@ float3* poly, u32& poly_count, const float4* planes, const u32 planeCount, const
         distances[4] = math::dot(float4(inputPoly[4], 1.f), plane);
         distances[5] = math::dot(float4(inputPoly[5], 1.f), plane);
         distances[6] = math::dot(float4(inputPoly[6], 1.f), plane);
-        u32 prev_v = inputPoly_count - 1;
-
-        for (u32 curr_v = 0; curr_v < inputPoly_count; curr_v++) {
-            const f32 eps = 0.001f;
-            if (distances[curr_v] > eps) {
-                // current vertex in positive zone,
-                // will be add to poly
-                if (distances[prev_v] < -eps) {
-                    // edge entering the positive zone,
-                    // add intersection point first
-                    float3 ab = math::subtract(inputPoly[curr_v], inputPoly[prev_v]);
-                    f32 t = (-distances[prev_v]) / math::dot(plane.xyz, ab);
-                    float3 intersection = math::add(inputPoly[prev_v], math::scale(ab, t));
-                    
-                    numPlaneCuts++;
-                    if (numPlaneCuts <= 1) { outputQuad[outputPoly_count++] = intersection; }
-                    else {
-                        // poly is cutting the same plane a second time: degenerate
-                        // simply place the intersection in the place of the last vertex
-                        outputQuad[outputPoly_count - 1] = intersection;
-                    }
-                }
-                outputQuad[outputPoly_count++] = inputPoly[curr_v];
-            } else if (distances[curr_v] < -eps) {
-                // current vertex in negative zone,
-                // will not be added to poly
-                if (distances[prev_v] > eps) {
-                    // edge entering the negative zone,
-                    // add intersection to face
-                    float3 ab = math::subtract(inputPoly[curr_v], inputPoly[prev_v]);
-                    f32 t = (-distances[prev_v]) / math::dot(plane.xyz, ab);
-                    float3 intersection = math::add(inputPoly[prev_v], math::scale(ab, t));
-                    outputQuad[outputPoly_count++] = intersection;
-                }
-            } else {
-                // current vertex on plane,
-                // add to poly
-                outputQuad[outputPoly_count++] = inputPoly[curr_v];
-            }
-
-            prev_v = curr_v;
-        }
+        clip_poly_by_plane(outputQuad, outputPoly_count, inputPoly, inputPoly_count, distances, plane);
     }
     memcpy(poly, outputQuad, outputPoly_count * sizeof(float3));
     poly_count = outputPoly_count;
@@ -944,139 +1125,984 @@ struct Camera {
 };
 
 struct CameraNode { // Node in camera tree (stored as depth-first)
-    float4x4 viewMatrix;
-    float4x4 projectionMatrix;
-    float4x4 vpMatrix;
-    renderer::Frustum frustum;
-    float3 pos;
     u32 depth;          // depth of this node in the tree (0 == root)
     u32 siblingIndex;   // next sibling index in the tree
-    u32 parentIndex;   // next sibling index in the tree
-    u32 sourceId;
-    renderer::DrawMesh drawMesh;
-    __PROFILEONLY(char str[256];)      // used in non-debug for GPU markers
+    u32 parentIndex;
+    u32 sourceId; // mirror id, see mirror_drawMesh
 };
-struct GatherMirrorTreeContext {
-    allocator::PagedArena& frameArena;
-    allocator::PagedArena scratchArenaRoot;
-    allocator::Buffer<CameraNode>& cameraTree;
-    const game::Mirrors& mirrors;
-    u32 maxDepth;
+struct CameraName { char str[256]; }; // used in non-debug for GPU markers
+// Parallel arrays indexed by node: tree walks only read the links, culling only reads the
+// frustums, and rendering only reads the matrices of the cameras it draws
+struct CameraTree {
+    allocator::VirtualBuffer<CameraNode> nodes;
+    allocator::VirtualBuffer<renderer::Frustum> frustums;
+    allocator::VirtualBuffer<Camera> cameras;
+    __PROFILEONLY(allocator::VirtualBuffer<CameraName> names;)
 };
-u32 gatherMirrorTreeRecursive(GatherMirrorTreeContext& ctx, u32 index, const CameraNode& parent) {
+void init_cameraTree(CameraTree& tree, ptrdiff_t initialCap, allocator::PagedArena& chunkArena) {
+    allocator::init_buffer(tree.nodes, initialCap, chunkArena);
+    allocator::init_buffer(tree.frustums, initialCap, chunkArena);
+    allocator::init_buffer(tree.cameras, initialCap, chunkArena);
+    __PROFILEONLY(allocator::init_buffer(tree.names, initialCap, chunkArena);)
+}
+void clear_cameraTree(CameraTree& tree) {
+    allocator::clear(tree.nodes);
+    allocator::clear(tree.frustums);
+    allocator::clear(tree.cameras);
+    __PROFILEONLY(allocator::clear(tree.names);)
+}
+u32 push_cameraNode(CameraTree& tree) { // arrays don't move as the tree grows
+    allocator::push(tree.nodes);
+    allocator::push(tree.frustums);
+    allocator::push(tree.cameras);
+    __PROFILEONLY(allocator::push(tree.names);)
+    return (u32)tree.nodes.len - 1;
+}
+u32 push_cameraNodes(CameraTree& tree, u32 count) { // returns the index of the first one
+    allocator::push(tree.nodes, count);
+    allocator::push(tree.frustums, count);
+    allocator::push(tree.cameras, count);
+    __PROFILEONLY(allocator::push(tree.names, count);)
+    return (u32)tree.nodes.len - count;
+}
+#if __DEBUG
+void copy_cameraTree(CameraTree& dst, const CameraTree& src) {
+    clear_cameraTree(dst);
+    const ptrdiff_t count = src.nodes.len;
+    push_cameraNodes(dst, (u32)count);
+    allocator::copy_range(dst.nodes, 0, src.nodes, 0, count);
+    allocator::copy_range(dst.frustums, 0, src.frustums, 0, count);
+    allocator::copy_range(dst.cameras, 0, src.cameras, 0, count);
+    __PROFILEONLY(allocator::copy_range(dst.names, 0, src.names, 0, count);)
+}
+#endif
 
+// Marks the mirrors that may be visible from the frustum: all of them if there's no bvh
+// The result is allocated from the arena, the query's own scratch is freed on return
+bool* find_visibleMirrors(
+    allocator::PagedArena& scratchArena, const game::Mirrors& mirrors, const renderer::Frustum& frustum) {
     bool* mirrorVisibility =
         (bool*)allocator::alloc_arena(
-            ctx.scratchArenaRoot, sizeof(bool) * ctx.mirrors.count, alignof(bool));
-    memset(mirrorVisibility, 0, ctx.mirrors.count * sizeof(bool));
-    if (ctx.mirrors.bvh.nodeCount) {
-        memset(mirrorVisibility, 0, ctx.mirrors.count * sizeof(bool));
+            scratchArena, sizeof(bool) * mirrors.count, alignof(bool));
+    if (mirrors.bvh.nodeCount) {
+        memset(mirrorVisibility, 0, mirrors.count * sizeof(bool));
         bvh::findTrianglesIntersectingFrustum(
-            ctx.scratchArenaRoot,
-            mirrorVisibility, ctx.mirrors.bvh,
-            parent.frustum.planes, parent.frustum.numPlanes);
+            scratchArena,
+            mirrorVisibility, mirrors.bvh,
+            frustum.planes, frustum.numPlanes);
     } else {
-        memset(mirrorVisibility, 1, ctx.mirrors.count * sizeof(bool));
+        memset(mirrorVisibility, 1, mirrors.count * sizeof(bool));
+    }
+    return mirrorVisibility;
+}
+// Upper bound of the scratch memory find_visibleMirrors takes
+size_t visibleMirrorsScratchSize(const game::Mirrors& mirrors) {
+    size_t size = sizeof(bool) * mirrors.count;
+    if (mirrors.bvh.nodeCount) { size += bvh::frustumQueryScratchSize(mirrors.bvh); }
+    return size;
+}
+// Mirror portals are mirror ids, with this bit set on the ones that need clipping
+const u32 portalNeedsClipping = 0x80000000;
+// Mirrors are triangles or quads, this leaves room for the vertices clipping adds
+enum { MAX_MIRROR_POLY_VERTICES = 7 };
+// Classifies up to 4 mirror polys against the frustum at once, one mirror per simd lane, and
+// appends the ones that aren't culled to the portals. A poly with all of its vertices outside one
+// plane is culled, and a poly with no vertex outside any plane would come out of
+// clip_poly_in_frustum unchanged, so only the rest are flagged for clipping.
+// Both tests keep a margin over the clipping epsilon: polys too close to call are clipped, which
+// keeps the result the same as clipping every poly, however the distances round. The exception
+// are polys that clip_poly_in_frustum stops clipping at the vertex cap before reaching the plane
+// they are all outside of: those are culled here, as they should have been
+u32 classify_mirrorPortals(
+    u32* portals, u32 portalCount, const u32* ids, const u32 count,
+    const game::Mirrors& mirrors, const renderer::Frustum& frustum) {
+
+    // lanes past the count repeat the first mirror, and vertices past a poly's count repeat its
+    // first vertex, neither changes the result
+    f32 x[MAX_MIRROR_POLY_VERTICES][4];
+    f32 y[MAX_MIRROR_POLY_VERTICES][4];
+    f32 z[MAX_MIRROR_POLY_VERTICES][4];
+    u32 vertexCount = 0;
+    for (u32 l = 0; l < 4; l++) {
+        const u32 id = ids[l < count ? l : 0];
+        const u32 n = game::mirror_vertex_count(mirrors, id);
+        assert(n <= MAX_MIRROR_POLY_VERTICES);
+        vertexCount = n > vertexCount ? n : vertexCount;
+    }
+    for (u32 l = 0; l < 4; l++) {
+        const u32 id = ids[l < count ? l : 0];
+        const float3* v = game::mirror_vertices(mirrors, id);
+        const u32 n = game::mirror_vertex_count(mirrors, id);
+        for (u32 i = 0; i < vertexCount; i++) {
+            const float3 p = v[i < n ? i : 0];
+            x[i][l] = p.x; y[i][l] = p.y; z[i][l] = p.z;
+        }
     }
 
-    u32 parentIndex = index - 1;
-    for (u32 i = 0; i < ctx.mirrors.count; i++) {
+    const simd::f32x4 cullDistance = simd::splat4(-2.f * clipPolyEpsilon);
+    const simd::f32x4 insideDistance = simd::splat4(-0.5f * clipPolyEpsilon);
+    u32 culled = 0; // bit per lane
+    u32 clipped = 0;
+    for (u32 p = 0; p < frustum.numPlanes && culled != 0xf; p++) {
+        const float4 plane = frustum.planes[p];
+        const simd::f32x4 px = simd::splat4(plane.x);
+        const simd::f32x4 py = simd::splat4(plane.y);
+        const simd::f32x4 pz = simd::splat4(plane.z);
+        const simd::f32x4 pw = simd::splat4(plane.w);
+        u32 outside = 0xf;
+        for (u32 i = 0; i < vertexCount; i++) {
+            simd::f32x4 d = simd::mul4(simd::load4(x[i]), px);
+            d = simd::add4(d, simd::mul4(simd::load4(y[i]), py));
+            d = simd::add4(d, simd::mul4(simd::load4(z[i]), pz));
+            d = simd::add4(d, pw);
+            outside &= simd::lessMask4(d, cullDistance);
+            clipped |= simd::lessMask4(d, insideDistance);
+        }
+        culled |= outside;
+    }
+    for (u32 l = 0; l < count; l++) {
+        if (culled & (1 << l)) { continue; }
+        portals[portalCount++] = ids[l] | ((clipped & (1 << l)) ? portalNeedsClipping : 0);
+    }
+    return portalCount;
+}
+struct MirrorPortalPoly {
+    float3 vertices[MAX_MIRROR_POLY_VERTICES];
+    u32 count;
+};
+// Clips up to 4 polys at once, one per simd lane, with the same results as clip_poly_in_frustum
+// on each: the distances of all the lanes' vertices to a plane are computed together, then each
+// lane rebuilds its poly on its own, since their vertex counts diverge
+void clip_polys_in_frustum(
+    MirrorPortalPoly* const* polys, const u32 count, const float4* planes, const u32 planeCount) {
+
+    // lanes past the count repeat the first poly, and vertices past a poly's count repeat its
+    // first vertex, but neither is ever read back
+    assert(count <= 4);
+    f32 x[MAX_MIRROR_POLY_VERTICES][4];
+    f32 y[MAX_MIRROR_POLY_VERTICES][4];
+    f32 z[MAX_MIRROR_POLY_VERTICES][4];
+    u32 counts[4];
+    for (u32 l = 0; l < 4; l++) {
+        const MirrorPortalPoly& poly = *polys[l < count ? l : 0];
+        counts[l] = l < count ? poly.count : 0;
+        for (u32 i = 0; i < MAX_MIRROR_POLY_VERTICES; i++) {
+            const float3 v = poly.vertices[i < poly.count ? i : 0];
+            x[i][l] = v.x; y[i][l] = v.y; z[i][l] = v.z;
+        }
+    }
+
+    for (u32 p = 0; p < planeCount; p++) {
+        // same stopping condition as clip_poly_in_frustum, per lane
+        u32 active = 0;
+        u32 vertexCount = 0;
+        for (u32 l = 0; l < count; l++) {
+            if (counts[l] <= 2 || counts[l] >= MAX_MIRROR_POLY_VERTICES) { continue; }
+            active |= 1 << l;
+            vertexCount = counts[l] > vertexCount ? counts[l] : vertexCount;
+        }
+        if (!active) { break; }
+
+        // summed in the same order as math::dot, so the distances round the same way
+        const float4 plane = planes[p];
+        const simd::f32x4 px = simd::splat4(plane.x);
+        const simd::f32x4 py = simd::splat4(plane.y);
+        const simd::f32x4 pz = simd::splat4(plane.z);
+        const simd::f32x4 pw = simd::splat4(plane.w);
+        f32 distances[MAX_MIRROR_POLY_VERTICES][4];
+        for (u32 i = 0; i < vertexCount; i++) {
+            simd::f32x4 d = simd::mul4(simd::load4(x[i]), px);
+            d = simd::add4(d, simd::mul4(simd::load4(y[i]), py));
+            d = simd::add4(d, simd::mul4(simd::load4(z[i]), pz));
+            d = simd::add4(d, pw);
+            simd::store4(distances[i], d);
+        }
+        for (u32 mask = active; mask; mask &= mask - 1) {
+            const u32 l = math::lsb32(mask);
+            float3 inputPoly[MAX_MIRROR_POLY_VERTICES];
+            f32 inputDistances[MAX_MIRROR_POLY_VERTICES];
+            for (u32 i = 0; i < counts[l]; i++) {
+                inputPoly[i] = float3(x[i][l], y[i][l], z[i][l]);
+                inputDistances[i] = distances[i][l];
+            }
+            float3 outputPoly[MAX_MIRROR_POLY_VERTICES];
+            clip_poly_by_plane(outputPoly, counts[l], inputPoly, counts[l], inputDistances, plane);
+            for (u32 i = 0; i < counts[l]; i++) {
+                x[i][l] = outputPoly[i].x; y[i][l] = outputPoly[i].y; z[i][l] = outputPoly[i].z;
+            }
+        }
+    }
+    for (u32 l = 0; l < count; l++) {
+        MirrorPortalPoly& poly = *polys[l];
+        poly.count = counts[l];
+        for (u32 i = 0; i < counts[l]; i++) { poly.vertices[i] = float3(x[i][l], y[i][l], z[i][l]); }
+    }
+}
+struct MirrorPortals {
+    u32* portals;
+    MirrorPortalPoly* polys; // clipped poly of each portal, only set on the ones flagged with portalNeedsClipping
+    u32 count;
+};
+// Clips the polys of the portals flagged with portalNeedsClipping by the frustum, 4 at a time,
+// and drops the portals that get clipped away
+void clip_mirrorPortals(
+    MirrorPortals& portals, const game::Mirrors& mirrors, const renderer::Frustum& frustum) {
+    MirrorPortalPoly* batch[4];
+    u32 batchCount = 0;
+    for (u32 p = 0; p < portals.count; p++) {
+        if (!(portals.portals[p] & portalNeedsClipping)) { continue; }
+        const u32 i = portals.portals[p] & ~portalNeedsClipping;
+        MirrorPortalPoly& poly = portals.polys[p];
+        poly.count = game::mirror_vertex_count(mirrors, i);
+        memcpy(poly.vertices, game::mirror_vertices(mirrors, i), sizeof(float3) * poly.count);
+        batch[batchCount++] = &poly;
+        if (batchCount == 4) {
+            clip_polys_in_frustum(batch, batchCount, frustum.planes, frustum.numPlanes);
+            batchCount = 0;
+        }
+    }
+    if (batchCount) { clip_polys_in_frustum(batch, batchCount, frustum.planes, frustum.numPlanes); }
+
+    u32 count = 0;
+    for (u32 p = 0; p < portals.count; p++) {
+        const u32 portal = portals.portals[p];
+        if (portal & portalNeedsClipping) {
+            if (portals.polys[p].count < 3) { continue; }
+            portals.polys[count] = portals.polys[p];
+        }
+        portals.portals[count++] = portal;
+    }
+    portals.count = count;
+}
+// Lists the mirrors that can be seen through from the parent camera, in id order: the ones that
+// pass the visibility query, other than the parent's own mirror, that face the parent and aren't
+// culled by its frustum, along with the polys of the ones it clips. The result is allocated from
+// the arena
+MirrorPortals find_mirrorPortals(
+    allocator::PagedArena& scratchArena, const game::Mirrors& mirrors,
+    const CameraTree& parentTree, const u32 parentIndex) {
+
+    const CameraNode& parent = allocator::at(parentTree.nodes, parentIndex);
+    const renderer::Frustum& parentFrustum = allocator::at(parentTree.frustums, parentIndex);
+    const Camera& parentCamera = allocator::at(parentTree.cameras, parentIndex);
+    assert(mirrors.count <= portalNeedsClipping);
+
+    const bool* mirrorVisibility = find_visibleMirrors(scratchArena, mirrors, parentFrustum);
+    MirrorPortals result;
+    result.portals =
+        (u32*)allocator::alloc_arena(scratchArena, sizeof(u32) * mirrors.count, alignof(u32));
+    result.count = 0;
+    u32 batch[4];
+    u32 batchCount = 0;
+    for (u32 i = 0; i < mirrors.count; i++) {
 
         // didn't pass visibility pre-pass, if appropriate
         if (!mirrorVisibility[i]) { continue; }
+
         // do not self-reflect
         if (parent.sourceId == i) { continue; }
 
-        const game::Mirrors::Poly& mirrorGeo = ctx.mirrors.polys[i];
         // cull backfacing mirrors
         // normal is v2-v0xv1-v0 assuming clockwise winding and right handed coordinates
-        if (math::dot(mirrorGeo.normal, math::subtract(parent.pos, mirrorGeo.v[0])) < 0.f) { continue; }
-
-        // copy mirror quad (we'll modify it during clipping)
-        enum { MAX_MIRROR_POLY_VERTICES = 7 };
-        static_assert(MAX_MIRROR_POLY_VERTICES <= countof(parent.frustum.planes) + 2,
-            "mirror poly has too many vertices, it will generate too many frustum planes");
-        float3 poly[MAX_MIRROR_POLY_VERTICES];
-        u32 poly_count = ctx.mirrors.polys[i].numPts;
-        memcpy(poly, ctx.mirrors.polys[i].v, sizeof(float3) * ctx.mirrors.polys[i].numPts);
-        clip_poly_in_frustum(
-            poly, poly_count, parent.frustum.planes, parent.frustum.numPlanes, countof(poly));
-        if (poly_count < 3) continue; // resulting mirror poly is fully culled
-
-        // acknowledge this mirror as part of the tree
-        CameraNode& curr = allocator::push(ctx.cameraTree, ctx.frameArena);
-        curr.parentIndex = parentIndex;
-        curr.depth = parent.depth + 1;
-        curr.sourceId = i;
-        __PROFILEONLY(platform::format(curr.str, sizeof(curr.str), "%s-%d", parent.str, i, curr.depth);)
-        index++;
-
-        // compute mirror matrices
-        auto reflectionMatrix = [](float4 p) -> float4x4 { // todo: understand properly
-            float4x4 o;
-            o.col0.x = 1 - 2.f * p.x * p.x; o.col1.x = -2.f * p.x * p.y;    o.col2.x = -2.f * p.x * p.z;        o.col3.x = -2.f * p.x * p.w;
-            o.col0.y = -2.f * p.y * p.x;    o.col1.y = 1 - 2.f * p.y * p.y; o.col2.y = -2.f * p.y * p.z;        o.col3.y = -2.f * p.y * p.w;
-            o.col0.z = -2.f * p.z * p.x;    o.col1.z = -2.f * p.z * p.y;    o.col2.z = 1.f - 2.f * p.z * p.z;   o.col3.z = -2.f * p.z * p.w;
-            o.col0.w = 0.f;                 o.col1.w = 0.f;                 o.col2.w = 0.f;                     o.col3.w = 1.f;
-            return o;
-        };
-        // World Space (WS) values
-        float3 posWS = poly[0];
-        float4 planeWS(
-            mirrorGeo.normal.x, mirrorGeo.normal.y, mirrorGeo.normal.z,
-            -math::dot(posWS, mirrorGeo.normal));
-        float4x4 reflect = reflectionMatrix(planeWS);
-        curr.viewMatrix = math::mult(parent.viewMatrix, reflect);
-        curr.projectionMatrix = parent.projectionMatrix;
-        // Eye Space (ES) values
-        float3 normalES = math::mult(curr.viewMatrix, float4(mirrorGeo.normal, 0.f)).xyz;
-        float3 posES = math::mult(curr.viewMatrix, float4(posWS, 1.f)).xyz;
-        float4 planeES(normalES.x, normalES.y, normalES.z, -math::dot(posES, normalES));
-        renderer::add_oblique_plane_to_persp(curr.projectionMatrix, planeES);
-        curr.vpMatrix = math::mult(curr.projectionMatrix, curr.viewMatrix);
-        // camera position from inverse orthogonal transform
-        curr.pos = float3(-math::dot(curr.viewMatrix.col3, curr.viewMatrix.col0),
-                          -math::dot(curr.viewMatrix.col3, curr.viewMatrix.col1),
-                          -math::dot(curr.viewMatrix.col3, curr.viewMatrix.col2));
+        const float4 planeWS = mirrors.planes[i];
+        if (math::dot(planeWS.xyz, parentCamera.pos) + planeWS.w < 0.f) { continue; }
+
+        batch[batchCount++] = i;
+        if (batchCount == 4) {
+            result.count = classify_mirrorPortals(
+                result.portals, result.count, batch, batchCount, mirrors, parentFrustum);
+            batchCount = 0;
+        }
+    }
+    if (batchCount) {
+        result.count = classify_mirrorPortals(
+            result.portals, result.count, batch, batchCount, mirrors, parentFrustum);
+    }
+    result.polys = (MirrorPortalPoly*)allocator::alloc_arena(
+        scratchArena, sizeof(MirrorPortalPoly) * result.count, alignof(MirrorPortalPoly));
+    clip_mirrorPortals(result, mirrors, parentFrustum);
+    return result;
+}
+// Upper bound of the scratch memory find_mirrorPortals takes
+size_t mirrorPortalsScratchSize(const game::Mirrors& mirrors) {
+    return visibleMirrorsScratchSize(mirrors) + sizeof(u32) * mirrors.count + alignof(u32)
+        + sizeof(MirrorPortalPoly) * mirrors.count + alignof(MirrorPortalPoly);
+}
+// Pushes into the tree the camera seen through mirror i from the parent camera, which may be in
+// another tree. The poly is the mirror's, already clipped by the parent's frustum if needed
+// The new node's sibling isn't known yet, the caller sets it once its subtree is done
+u32 push_clippedMirrorCamera(
+    CameraTree& tree, const CameraTree& parentTree, const u32 parentIndex,
+    const game::Mirrors& mirrors, const u32 i, const float3* poly, const u32 poly_count) {
+
+    const CameraNode& parent = allocator::at(parentTree.nodes, parentIndex);
+    const Camera& parentCamera = allocator::at(parentTree.cameras, parentIndex);
+    const float4 planeWS = mirrors.planes[i];
+    static_assert(MAX_MIRROR_POLY_VERTICES <= countof(renderer::Frustum::planes) + 2,
+        "mirror poly has too many vertices, it will generate too many frustum planes");
+    assert(poly_count >= 3 && poly_count <= MAX_MIRROR_POLY_VERTICES);
+
+    // acknowledge this mirror as part of the tree
+    const u32 currIndex = push_cameraNode(tree);
+    CameraNode& curr = allocator::at(tree.nodes, currIndex);
+    renderer::Frustum& currFrustum = allocator::at(tree.frustums, currIndex);
+    Camera& currCamera = allocator::at(tree.cameras, currIndex);
+    currFrustum = {}; // the tree memory is reused, don't leave stale planes past numPlanes
+    curr.parentIndex = parentIndex;
+    curr.depth = parent.depth + 1;
+    curr.sourceId = i;
+    __PROFILEONLY(platform::format(
+        allocator::at(tree.names, currIndex).str, sizeof(CameraName::str), "%s-%d",
+        allocator::at(parentTree.names, parentIndex).str, i, curr.depth);)
+
+    // compute mirror matrices
+    auto reflectionMatrix = [](float4 p) -> float4x4 { // todo: understand properly
+        float4x4 o;
+        o.col0.x = 1 - 2.f * p.x * p.x; o.col1.x = -2.f * p.x * p.y;    o.col2.x = -2.f * p.x * p.z;        o.col3.x = -2.f * p.x * p.w;
+        o.col0.y = -2.f * p.y * p.x;    o.col1.y = 1 - 2.f * p.y * p.y; o.col2.y = -2.f * p.y * p.z;        o.col3.y = -2.f * p.y * p.w;
+        o.col0.z = -2.f * p.z * p.x;    o.col1.z = -2.f * p.z * p.y;    o.col2.z = 1.f - 2.f * p.z * p.z;   o.col3.z = -2.f * p.z * p.w;
+        o.col0.w = 0.f;                 o.col1.w = 0.f;                 o.col2.w = 0.f;                     o.col3.w = 1.f;
+        return o;
+    };
+    // World Space (WS) values
+    float3 posWS = poly[0];
+    float4x4 reflect = reflectionMatrix(planeWS);
+    currCamera.viewMatrix = math::mult(parentCamera.viewMatrix, reflect);
+    currCamera.projectionMatrix = parentCamera.projectionMatrix;
+    // Eye Space (ES) values
+    float3 normalES = math::mult(currCamera.viewMatrix, float4(planeWS.xyz, 0.f)).xyz;
+    float3 posES = math::mult(currCamera.viewMatrix, float4(posWS, 1.f)).xyz;
+    float4 planeES(normalES.x, normalES.y, normalES.z, -math::dot(posES, normalES));
+    renderer::add_oblique_plane_to_persp(currCamera.projectionMatrix, planeES);
+    currCamera.vpMatrix = math::mult(currCamera.projectionMatrix, currCamera.viewMatrix);
+    // camera position from inverse orthogonal transform
+    currCamera.pos = float3(-math::dot(currCamera.viewMatrix.col3, currCamera.viewMatrix.col0),
+                      -math::dot(currCamera.viewMatrix.col3, currCamera.viewMatrix.col1),
+                      -math::dot(currCamera.viewMatrix.col3, currCamera.viewMatrix.col2));
 
-        {
-            // frustum planes: near and far come from the projection matrix
-            // the rest come from the poly
-            float4x4 transpose = math::transpose(curr.vpMatrix);
-            curr.frustum.planes[0] =
-                math::add(math::scale(transpose.col3, -renderer::min_z), transpose.col2);   // near
-            curr.frustum.planes[1] = math::subtract(transpose.col3, transpose.col2);        // far
-            curr.frustum.planes[0] =
-                math::invScale(curr.frustum.planes[0], math::mag(curr.frustum.planes[0].xyz));
-            curr.frustum.planes[1] =
-                math::invScale(curr.frustum.planes[1], math::mag(curr.frustum.planes[1].xyz));
-            curr.frustum.numPlanes = 2;
-
-            float3 prev_v = poly[poly_count - 1];
-            for (u32 v = 0; v < poly_count; v++) {
-                float3 curr_v = poly[v];
-                // normal is cam-v0xv1-v0 assuming clockwise winding and right handed coordinates
-                float3 normal =
-                    math::cross(math::subtract(curr.pos, curr_v), math::subtract(curr_v, prev_v));
-                normal = math::normalize(normal);
-                curr.frustum.planes[curr.frustum.numPlanes++] =
-                    float4(normal, -math::dot(curr_v, normal));
-                prev_v = curr_v;
-            }
+    {
+        // frustum planes: near and far come from the projection matrix
+        // the rest come from the poly
+        float4x4 transpose = math::transpose(currCamera.vpMatrix);
+        currFrustum.planes[0] =
+            math::add(math::scale(transpose.col3, -renderer::min_z), transpose.col2);   // near
+        currFrustum.planes[1] = math::subtract(transpose.col3, transpose.col2);        // far
+        currFrustum.planes[0] =
+            math::invScale(currFrustum.planes[0], math::mag(currFrustum.planes[0].xyz));
+        currFrustum.planes[1] =
+            math::invScale(currFrustum.planes[1], math::mag(currFrustum.planes[1].xyz));
+        currFrustum.numPlanes = 2;
+
+        float3 prev_v = poly[poly_count - 1];
+        for (u32 v = 0; v < poly_count; v++) {
+            float3 curr_v = poly[v];
+            // normal is cam-v0xv1-v0 assuming clockwise winding and right handed coordinates
+            float3 normal =
+                math::cross(math::subtract(currCamera.pos, curr_v), math::subtract(curr_v, prev_v));
+            normal = math::normalize(normal);
+            currFrustum.planes[currFrustum.numPlanes++] =
+                float4(normal, -math::dot(curr_v, normal));
+            prev_v = curr_v;
         }
+    }
+    return currIndex;
+}
+// Same, for portal p from find_mirrorPortals of the parent camera. Returns the new node's index
+u32 push_mirrorCamera(
+    CameraTree& tree, const CameraTree& parentTree, const u32 parentIndex,
+    const game::Mirrors& mirrors, const MirrorPortals& portals, const u32 p) {
+
+    const u32 portal = portals.portals[p];
+    const u32 i = portal & ~portalNeedsClipping;
+    if (portal & portalNeedsClipping) {
+        const MirrorPortalPoly& poly = portals.polys[p];
+        return push_clippedMirrorCamera(
+            tree, parentTree, parentIndex, mirrors, i, poly.vertices, poly.count);
+    }
+    return push_clippedMirrorCamera(
+        tree, parentTree, parentIndex, mirrors, i,
+        game::mirror_vertices(mirrors, i), game::mirror_vertex_count(mirrors, i));
+}
+
+struct GatherMirrorTreeContext {
+    CameraTree& cameraTree;
+    const game::Mirrors& mirrors;
+    u32 maxDepth;
+};
+// The parent camera is the last node in the tree, at index - 1
+// Each level of recursion takes mirrorPortalsScratchSize from the scratch arena
+u32 gatherMirrorTreeRecursive(
+    GatherMirrorTreeContext& ctx, allocator::PagedArena scratchArena, u32 index) {
+
+    const u32 parentIndex = index - 1;
+    const MirrorPortals portals =
+        find_mirrorPortals(scratchArena, ctx.mirrors, ctx.cameraTree, parentIndex);
+
+    for (u32 p = 0; p < portals.count; p++) {
+
+        const u32 currIndex = push_mirrorCamera(
+            ctx.cameraTree, ctx.cameraTree, parentIndex, ctx.mirrors, portals, p);
+        CameraNode& curr = allocator::at(ctx.cameraTree.nodes, currIndex);
+        index++;
 
         // recurse if there is room for one more mirror
         if (curr.depth + 1 < ctx.maxDepth) {
-            index = gatherMirrorTreeRecursive(ctx, index, curr);
+            index = gatherMirrorTreeRecursive(ctx, scratchArena, index);
         }
-        curr.drawMesh = ctx.mirrors.drawMeshes[i];
         curr.siblingIndex = index;
     }
     return index;
 }
 
+// Parallel version of gatherMirrorTreeRecursive, with the same output
+// The top levels are expanded breadth first, with the parents of each level spread over the
+// workers, until a level has enough nodes to keep all workers busy. The subtrees under that cut
+// level are then gathered depth first as tasks. All nodes are written to the trees of the workers
+// that computed them, and copied back into the output tree in depth-first order at the end.
+// Each node is computed from the same parent data as in the serial version, so the merged tree is
+// identical to it
+struct GatherMirrorNodeRef {
+    u32 workerId; // tree the node is in
+    u32 index;
+    u32 firstChild; // into the next level
+    u32 childCount;
+    u32 finalIndex; // in the output tree, once merged
+};
+struct GatherMirrorSubtree { // range of nodes in a worker tree
+    u32 workerId;
+    u32 start; // for cut subtrees, this is a copy of the cut node, and the subtree follows it
+    u32 end;
+};
+// Scratch for the gather tasks. Each worker slot takes its slice from its own block of the shared
+// arena the first time it runs a task, so the slots don't contend on the arena, and slots that
+// never get to run take nothing. The tasks take a PagedArena, so the slice is wrapped in one
+struct MirrorWorkerScratch {
+    allocator::ThreadArena threads[jobs::maxWorkerCount];
+    allocator::PagedArena slices[jobs::maxWorkerCount];
+    uintptr_t highmarks[jobs::maxWorkerCount]; // how far each slice's scoped copies got
+    size_t sliceSize;
+};
+// Resets the shared arena, so no task from a previous gather may be running
+void init_workerScratch(
+    MirrorWorkerScratch& scratch, allocator::ConcurrentArena& arena, const u32 workerCount,
+    const size_t sliceSize) {
+    allocator::reset_arena(arena);
+    for (u32 i = 0; i < workerCount; i++) {
+        allocator::init_arena(scratch.threads[i], arena);
+        scratch.slices[i] = {};
+    }
+    scratch.sliceSize = sliceSize;
+}
+// Only to be called by the task running the slot
+allocator::PagedArena& slice_workerScratch(MirrorWorkerScratch& scratch, const u32 workerId) {
+    allocator::PagedArena& slice = scratch.slices[workerId];
+    if (!slice.end) {
+        allocator::ThreadArena& thread = scratch.threads[workerId];
+        slice.curr = (u8*)allocator::alloc_arena(thread, scratch.sliceSize, 16);
+        slice.end = slice.curr + scratch.sliceSize;
+        scratch.highmarks[workerId] = (uintptr_t)slice.curr;
+        slice.highmark = &scratch.highmarks[workerId];
+        slice.pagesize = thread.shared->pagesize;
+    }
+    return slice;
+}
+// A slice can't grow without running into whatever follows it, so the tasks must fit in it
+void check_workerScratch(const MirrorWorkerScratch& scratch, const u32 workerCount) {
+    for (u32 i = 0; i < workerCount; i++) {
+        if (!scratch.slices[i].end) { continue; }
+        assert(scratch.highmarks[i] <= (uintptr_t)scratch.slices[i].end); // worker scratch overrun
+    }
+}
+struct ParallelGatherMirrorTree {
+    CameraTree* workerTrees;
+    MirrorWorkerScratch& workerScratch;
+    const game::Mirrors& mirrors;
+    u32 maxDepth;
+    GatherMirrorNodeRef* parents; // level being expanded, or cut level
+    u32 parentCount;
+    GatherMirrorSubtree* children; // one range of children per parent, or one subtree per cut node
+    volatile uintptr_t nextParent;
+};
+// Tasks are worker slots, each with its own tree and scratch. Parents are handed out one at a time
+// on top of that, so that a few expensive parents don't leave the other workers idle
+void gatherMirrorChildrenTask(void* data, u32 workerId) {
+    ParallelGatherMirrorTree& ctx = *(ParallelGatherMirrorTree*)data;
+    CameraTree& tree = ctx.workerTrees[workerId];
+    while (true) {
+        const uintptr_t p = platform::atomic_fetch_add(&ctx.nextParent, 1);
+        if (p >= ctx.parentCount) { break; }
+        const GatherMirrorNodeRef& parent = ctx.parents[p];
+        const CameraTree& parentTree = ctx.workerTrees[parent.workerId];
+        allocator::PagedArena scratchArena = slice_workerScratch(ctx.workerScratch, workerId);
+        const MirrorPortals portals =
+            find_mirrorPortals(scratchArena, ctx.mirrors, parentTree, parent.index);
+        const u32 start = (u32)tree.nodes.len;
+        for (u32 i = 0; i < portals.count; i++) {
+            push_mirrorCamera(tree, parentTree, parent.index, ctx.mirrors, portals, i);
+        }
+        ctx.children[p] = { workerId, start, (u32)tree.nodes.len };
+    }
+}
+void gatherMirrorSubtreesTask(void* data, u32 workerId) {
+    ParallelGatherMirrorTree& ctx = *(ParallelGatherMirrorTree*)data;
+    CameraTree& tree = ctx.workerTrees[workerId];
+    GatherMirrorTreeContext gatherContext = { tree, ctx.mirrors, ctx.maxDepth };
+    while (true) {
+        const uintptr_t p = platform::atomic_fetch_add(&ctx.nextParent, 1);
+        if (p >= ctx.parentCount) { break; }
+        // the recursion expects the parent right before its children
+        const GatherMirrorNodeRef& cut = ctx.parents[p];
+        const CameraTree& cutTree = ctx.workerTrees[cut.workerId];
+        const u32 start = push_cameraNode(tree);
+        allocator::at(tree.nodes, start) = allocator::at(cutTree.nodes, cut.index);
+        allocator::at(tree.frustums, start) = allocator::at(cutTree.frustums, cut.index);
+        allocator::at(tree.cameras, start) = allocator::at(cutTree.cameras, cut.index);
+        __PROFILEONLY(allocator::at(tree.names, start) = allocator::at(cutTree.names, cut.index);)
+        const u32 end = gatherMirrorTreeRecursive(
+            gatherContext, slice_workerScratch(ctx.workerScratch, workerId), start + 1);
+        ctx.children[p] = { workerId, start, end };
+    }
+}
+void copy_cameraNode(CameraTree& dst, const u32 dstIndex, const CameraTree& src, const u32 srcIndex) {
+    allocator::at(dst.nodes, dstIndex) = allocator::at(src.nodes, srcIndex);
+    allocator::at(dst.frustums, dstIndex) = allocator::at(src.frustums, srcIndex);
+    allocator::at(dst.cameras, dstIndex) = allocator::at(src.cameras, srcIndex);
+    __PROFILEONLY(allocator::at(dst.names, dstIndex) = allocator::at(src.names, srcIndex);)
+}
+struct MergeMirrorTreeContext {
+    CameraTree& cameraTree;
+    const CameraTree* workerTrees;
+    GatherMirrorNodeRef* const* levels;
+    const GatherMirrorSubtree* subtrees; // under the cut level, if any
+    u32 cutDepth;
+};
+// Copies the node into the output tree at the given index, along with the levels below it down
+// to the cut. Returns the index past the node's subtree, leaving room for the cut subtrees
+u32 mergeMirrorTreeRecursive(
+    MergeMirrorTreeContext& ctx, const u32 depth, const u32 refIndex, const u32 parentIndex,
+    const u32 dst) {
+    GatherMirrorNodeRef& ref = ctx.levels[depth][refIndex];
+    ref.finalIndex = dst;
+    copy_cameraNode(ctx.cameraTree, dst, ctx.workerTrees[ref.workerId], ref.index);
+    u32 next = dst + 1;
+    if (depth < ctx.cutDepth) {
+        for (u32 c = 0; c < ref.childCount; c++) {
+            next = mergeMirrorTreeRecursive(ctx, depth + 1, ref.firstChild + c, dst, next);
+        }
+    } else if (ctx.subtrees) {
+        next += ctx.subtrees[refIndex].end - ctx.subtrees[refIndex].start - 1;
+    }
+    CameraNode& node = allocator::at(ctx.cameraTree.nodes, dst);
+    node.parentIndex = parentIndex;
+    node.siblingIndex = next;
+    return next;
+}
+// Copies the subtree under a cut node, right after the cut node in the output tree
+void mergeMirrorSubtreeTask(void* data, u32 cut) {
+    MergeMirrorTreeContext& ctx = *(MergeMirrorTreeContext*)data;
+    const GatherMirrorSubtree& subtree = ctx.subtrees[cut];
+    const CameraTree& src = ctx.workerTrees[subtree.workerId];
+    const u32 dst = ctx.levels[ctx.cutDepth][cut].finalIndex;
+    const u32 count = subtree.end - subtree.start - 1;
+    allocator::copy_range(ctx.cameraTree.nodes, dst + 1, src.nodes, subtree.start + 1, count);
+    allocator::copy_range(ctx.cameraTree.frustums, dst + 1, src.frustums, subtree.start + 1, count);
+    allocator::copy_range(ctx.cameraTree.cameras, dst + 1, src.cameras, subtree.start + 1, count);
+    __PROFILEONLY(allocator::copy_range(ctx.cameraTree.names, dst + 1, src.names, subtree.start + 1, count);)
+    // worker indices are offset by where the subtree starts in each tree
+    const u32 offset = dst - subtree.start;
+    for (u32 i = dst + 1; i <= dst + count; i++) {
+        allocator::at(ctx.cameraTree.nodes, i).parentIndex += offset;
+        allocator::at(ctx.cameraTree.nodes, i).siblingIndex += offset;
+    }
+}
+// The root camera must be the only node in the tree. Worker trees are only used as scratch,
+// there must be one per pool worker plus one for the calling thread. The worker arena is reset on
+// every call, see MirrorWorkerScratch
+u32 gatherMirrorTree(
+    CameraTree& cameraTree, CameraTree* workerTrees, jobs::Pool& pool,
+    allocator::PagedArena scratchArena, allocator::ConcurrentArena& workerArena,
+    const game::Mirrors& mirrors, const u32 maxDepth) {
+    const u32 workerCount = pool.threadCount + 1;
+    if (workerCount == 1 || maxDepth <= 2) {
+        GatherMirrorTreeContext ctx = { cameraTree, mirrors, maxDepth };
+        return gatherMirrorTreeRecursive(ctx, scratchArena, 1);
+    }
+
+    // each worker slot gets a fixed slice of scratch, enough for one scoped level per depth
+    MirrorWorkerScratch workerScratch;
+    init_workerScratch(
+        workerScratch, workerArena, workerCount, mirrorPortalsScratchSize(mirrors) * maxDepth);
+    for (u32 i = 0; i < workerCount; i++) { clear_cameraTree(workerTrees[i]); }
+    // the root goes into the first worker tree, so that all parents are referenced the same way
+    copy_cameraNode(workerTrees[0], push_cameraNode(workerTrees[0]), cameraTree, 0);
+
+    GatherMirrorNodeRef** levels = (GatherMirrorNodeRef**)allocator::alloc_arena(
+        scratchArena, sizeof(GatherMirrorNodeRef*) * maxDepth, alignof(GatherMirrorNodeRef*));
+    levels[0] = (GatherMirrorNodeRef*)allocator::alloc_arena(
+        scratchArena, sizeof(GatherMirrorNodeRef), alignof(GatherMirrorNodeRef));
+    levels[0][0] = { 0, 0, 0, 0, 0 };
+    u32 levelCount = 1;
+    u32 topCount = 1; // nodes down to the cut
+
+    ParallelGatherMirrorTree ctx = {
+        workerTrees, workerScratch, mirrors, maxDepth, nullptr, 0, nullptr, 0 };
+    // breadth first, until the cut level is wide enough, or the tree ends
+    const u32 minCutCount = 4 * workerCount;
+    u32 cutDepth = 0;
+    while (true) {
+        ctx.parents = levels[cutDepth];
+        ctx.parentCount = levelCount;
+        ctx.children = (GatherMirrorSubtree*)allocator::alloc_arena(
+            scratchArena, sizeof(GatherMirrorSubtree) * levelCount, alignof(GatherMirrorSubtree));
+        ctx.nextParent = 0;
+        jobs::parallel_for(pool, gatherMirrorChildrenTask, &ctx, workerCount);
+        check_workerScratch(workerScratch, workerCount);
+
+        u32 childCount = 0;
+        for (u32 p = 0; p < levelCount; p++) {
+            GatherMirrorNodeRef& parent = levels[cutDepth][p];
+            parent.firstChild = childCount;
+            parent.childCount = ctx.children[p].end - ctx.children[p].start;
+            childCount += parent.childCount;
+        }
+        GatherMirrorNodeRef* children = (GatherMirrorNodeRef*)allocator::alloc_arena(
+            scratchArena, sizeof(GatherMirrorNodeRef) * childCount, alignof(GatherMirrorNodeRef));
+        for (u32 p = 0, c = 0; p < levelCount; p++) {
+            const GatherMirrorSubtree& range = ctx.children[p];
+            for (u32 i = range.start; i < range.end; i++) { children[c++] = { range.workerId, i, 0, 0, 0 }; }
+        }
+        cutDepth++;
+        levels[cutDepth] = children;
+        levelCount = childCount;
+        topCount += childCount;
+        if (levelCount == 0 || levelCount >= minCutCount || cutDepth + 1 == maxDepth) { break; }
+    }
+
+    // depth first under the cut, unless the cut is at the leaves
+    GatherMirrorSubtree* subtrees = nullptr;
+    if (levelCount && cutDepth + 1 < maxDepth) {
+        subtrees = (GatherMirrorSubtree*)allocator::alloc_arena(
+            scratchArena, sizeof(GatherMirrorSubtree) * levelCount, alignof(GatherMirrorSubtree));
+        ctx.parents = levels[cutDepth];
+        ctx.parentCount = levelCount;
+        ctx.children = subtrees;
+        ctx.nextParent = 0;
+        jobs::parallel_for(pool, gatherMirrorSubtreesTask, &ctx, workerCount);
+        check_workerScratch(workerScratch, workerCount);
+    }
+
+    // the levels down to the cut are copied here, the subtrees under it in parallel
+    u32 count = topCount;
+    if (subtrees) {
+        for (u32 i = 0; i < levelCount; i++) { count += subtrees[i].end - subtrees[i].start - 1; }
+    }
+    clear_cameraTree(cameraTree);
+    push_cameraNodes(cameraTree, count);
+    MergeMirrorTreeContext mergeContext = { cameraTree, workerTrees, levels, subtrees, cutDepth };
+    // the root stays where it is, the caller sets its sibling
+    for (u32 c = 0, next = 1; c < levels[0][0].childCount; c++) {
+        next = mergeMirrorTreeRecursive(mergeContext, 1, c, 0, next);
+    }
+    if (subtrees) { jobs::parallel_for(pool, mergeMirrorSubtreeTask, &mergeContext, levelCount); }
+    return count;
+}
+
+// Budgeted version of gatherMirrorTree: instead of following every portal down to the max depth,
+// portals are expanded best first, ranked by the pixels of the clipped portal on screen times the
+// attenuation of the mirrors it's seen through, until the budget runs out. A portal is clipped by
+// its parent's frustum, so it never covers more of the screen than its parent: the tree only goes
+// deep where the reflections are large
+// Portals are expanded in waves of a fixed size: the nodes of each wave look for their portals in
+// parallel, and the best candidates are popped for the next wave. The wave size doesn't depend on
+// the worker count, so neither does the tree. Once the budget is spent, the tree is laid out depth
+// first, with siblings in mirror order. Without a budget or thresholds, the tree is the same as
+// gatherMirrorTree's
+// Portals that needed clipping keep their clipped poly, so it's only clipped once
+struct MirrorPortalCandidate {
+    f32 priority; // pixels times attenuation
+    u32 order; // ties go to the candidate found first
+    u32 parentIndex; // in the gather tree
+    u32 portal; // see find_mirrorPortals
+    u32 polyWorker; // if the portal needed clipping, its poly is in this worker's polys
+    u32 polyIndex;
+};
+const u32 mirrorWaveSize = 32;
+bool higher_priority(const MirrorPortalCandidate& a, const MirrorPortalCandidate& b) {
+    return a.priority > b.priority || (a.priority == b.priority && a.order < b.order);
+}
+// Binary heap, with the highest priority candidate first
+void push_candidate(
+    allocator::VirtualBuffer<MirrorPortalCandidate>& heap, const MirrorPortalCandidate& candidate) {
+    allocator::push(heap);
+    u32 i = (u32)heap.len - 1;
+    while (i > 0 && higher_priority(candidate, allocator::at(heap, (i - 1) / 2))) {
+        allocator::at(heap, i) = allocator::at(heap, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    allocator::at(heap, i) = candidate;
+}
+MirrorPortalCandidate pop_candidate(allocator::VirtualBuffer<MirrorPortalCandidate>& heap) {
+    const MirrorPortalCandidate top = allocator::at(heap, 0);
+    const MirrorPortalCandidate last = allocator::at(heap, heap.len - 1);
+    allocator::pop(heap);
+    const u32 count = (u32)heap.len;
+    u32 i = 0;
+    while (true) {
+        u32 child = 2 * i + 1;
+        if (child >= count) { break; }
+        if (child + 1 < count && higher_priority(allocator::at(heap, child + 1), allocator::at(heap, child))) {
+            child++;
+        }
+        if (!higher_priority(allocator::at(heap, child), last)) { break; }
+        allocator::at(heap, i) = allocator::at(heap, child);
+        i = child;
+    }
+    if (count) { allocator::at(heap, i) = last; }
+    return top;
+}
+// Pixels covered by the poly on screen, as seen by the camera. The poly must be in front of it
+f32 screen_area(const float3* poly, const u32 poly_count, const float4x4& vpMatrix, const float2 pixelScale) {
+    assert(poly_count <= MAX_MIRROR_POLY_VERTICES);
+    float2 screen[MAX_MIRROR_POLY_VERTICES];
+    for (u32 v = 0; v < poly_count; v++) {
+        const float4 pCS = math::mult(vpMatrix, float4(poly[v], 1.f));
+        const f32 w = math::max(pCS.w, 1e-6f);
+        screen[v] = float2(pCS.x / w * pixelScale.x, pCS.y / w * pixelScale.y);
+    }
+    f32 area = 0.f;
+    for (u32 v = 0, prev = poly_count - 1; v < poly_count; prev = v, v++) {
+        area += screen[prev].x * screen[v].y - screen[v].x * screen[prev].y;
+    }
+    return math::abs(area) * 0.5f;
+}
+struct BudgetedGatherMirrorTree {
+    const CameraTree& tree;
+    MirrorWorkerScratch& workerScratch;
+    allocator::VirtualBuffer<MirrorPortalPoly>* workerPolys;
+    const game::Mirrors& mirrors;
+    const game::MirrorBudget& budget;
+    float2 pixelScale;
+    const u32* wave; // nodes to find the portals of
+    u32 waveCount;
+    MirrorPortalCandidate** candidates; // output per wave node, room for one per mirror
+    u32* candidateCounts;
+    volatile uintptr_t nextNode;
+};
+void findMirrorCandidatesTask(void* data, u32 workerId) {
+    BudgetedGatherMirrorTree& ctx = *(BudgetedGatherMirrorTree*)data;
+    while (true) {
+        const uintptr_t n = platform::atomic_fetch_add(&ctx.nextNode, 1);
+        if (n >= ctx.waveCount) { break; }
+        const u32 parentIndex = ctx.wave[n];
+        const Camera& parentCamera = allocator::at(ctx.tree.cameras, parentIndex);
+        f32 attenuation = 1.f; // of the portals' cameras, one bounce past the parent
+        for (u32 d = 0; d <= allocator::at(ctx.tree.nodes, parentIndex).depth; d++) {
+            attenuation *= ctx.budget.bounceAttenuation;
+        }
+        allocator::PagedArena scratchArena = slice_workerScratch(ctx.workerScratch, workerId);
+        allocator::VirtualBuffer<MirrorPortalPoly>& polys = ctx.workerPolys[workerId];
+        const MirrorPortals portals =
+            find_mirrorPortals(scratchArena, ctx.mirrors, ctx.tree, parentIndex);
+        u32 count = 0;
+        for (u32 p = 0; p < portals.count; p++) {
+            const u32 portal = portals.portals[p];
+            const u32 i = portal & ~portalNeedsClipping;
+            const float3* poly = game::mirror_vertices(ctx.mirrors, i);
+            u32 poly_count = game::mirror_vertex_count(ctx.mirrors, i);
+            const u32 polyIndex = (u32)polys.len;
+            if (portal & portalNeedsClipping) { // already clipped by find_mirrorPortals
+                MirrorPortalPoly& clipped = allocator::push(polys);
+                clipped = portals.polys[p];
+                poly = clipped.vertices;
+                poly_count = clipped.count;
+            }
+            const f32 pixels = screen_area(poly, poly_count, parentCamera.vpMatrix, ctx.pixelScale);
+            const f32 contribution = pixels * attenuation;
+            if (pixels < ctx.budget.minPixels || contribution < ctx.budget.minContribution) {
+                if (portal & portalNeedsClipping) { allocator::pop(polys); }
+                continue;
+            }
+            ctx.candidates[n][count++] = { contribution, 0, parentIndex, portal, workerId, polyIndex };
+        }
+        ctx.candidateCounts[n] = count;
+    }
+}
+struct LayoutMirrorTreeContext {
+    CameraTree& cameraTree;
+    const CameraTree& gatherTree;
+    const u32* firstChild; // per gather node, into children
+    const u32* childCount;
+    const u32* children;
+};
+// Copies the node into the output tree at the given index, followed by its subtree
+// Returns the index past the subtree
+u32 layoutMirrorTreeRecursive(
+    LayoutMirrorTreeContext& ctx, const u32 node, const u32 parentIndex, const u32 dst) {
+    copy_cameraNode(ctx.cameraTree, dst, ctx.gatherTree, node);
+    u32 next = dst + 1;
+    for (u32 c = 0; c < ctx.childCount[node]; c++) {
+        next = layoutMirrorTreeRecursive(ctx, ctx.children[ctx.firstChild[node] + c], dst, next);
+    }
+    CameraNode& curr = allocator::at(ctx.cameraTree.nodes, dst);
+    curr.parentIndex = parentIndex;
+    curr.siblingIndex = next;
+    return next;
+}
+// Same requirements as gatherMirrorTree. The candidate heap and the worker polys (one per worker
+// tree) are only used as scratch
+u32 gatherMirrorTreeBudgeted(
+    CameraTree& cameraTree, CameraTree* workerTrees,
+    allocator::VirtualBuffer<MirrorPortalCandidate>& heap,
+    allocator::VirtualBuffer<MirrorPortalPoly>* workerPolys, jobs::Pool& pool,
+    allocator::PagedArena scratchArena, allocator::ConcurrentArena& workerArena,
+    const game::Mirrors& mirrors, const u32 maxDepth, const game::MirrorBudget& budget, const float2 screenSize) {
+    const u32 workerCount = pool.threadCount + 1;
+
+    // nodes are gathered into the first worker tree in the order they are expanded
+    CameraTree& tree = workerTrees[0];
+    clear_cameraTree(tree);
+    copy_cameraNode(tree, push_cameraNode(tree), cameraTree, 0);
+    allocator::clear(heap);
+    for (u32 i = 0; i < workerCount; i++) { allocator::clear(workerPolys[i]); }
+
+    MirrorWorkerScratch workerScratch;
+    init_workerScratch(workerScratch, workerArena, workerCount, mirrorPortalsScratchSize(mirrors));
+    u32* wave = (u32*)allocator::alloc_arena(scratchArena, sizeof(u32) * mirrorWaveSize, alignof(u32));
+    wave[0] = 0;
+    BudgetedGatherMirrorTree ctx = {
+        tree, workerScratch, workerPolys, mirrors, budget, math::scale(screenSize, 0.5f), wave, 1,
+        nullptr, nullptr, 0 };
+    ctx.candidates = (MirrorPortalCandidate**)allocator::alloc_arena(
+        scratchArena, sizeof(MirrorPortalCandidate*) * mirrorWaveSize, alignof(MirrorPortalCandidate*));
+    for (u32 n = 0; n < mirrorWaveSize; n++) {
+        ctx.candidates[n] = (MirrorPortalCandidate*)allocator::alloc_arena(
+            scratchArena, sizeof(MirrorPortalCandidate) * mirrors.count, alignof(MirrorPortalCandidate));
+    }
+    ctx.candidateCounts =
+        (u32*)allocator::alloc_arena(scratchArena, sizeof(u32) * mirrorWaveSize, alignof(u32));
+
+    const u32 maxCameras = budget.maxCameras ? budget.maxCameras : 0xffffffff;
+    u32 cameraCount = 0;
+    u32 order = 0;
+    while (ctx.waveCount) {
+        ctx.nextNode = 0;
+        jobs::parallel_for(pool, findMirrorCandidatesTask, &ctx, workerCount);
+        check_workerScratch(workerScratch, workerCount);
+        for (u32 n = 0; n < ctx.waveCount; n++) {
+            for (u32 c = 0; c < ctx.candidateCounts[n]; c++) {
+                MirrorPortalCandidate& candidate = ctx.candidates[n][c];
+                candidate.order = order++;
+                push_candidate(heap, candidate);
+            }
+        }
+        // the next wave: nodes at the max depth take from the budget, but not from the wave
+        ctx.waveCount = 0;
+        while (ctx.waveCount < mirrorWaveSize && heap.len && cameraCount < maxCameras) {
+            const MirrorPortalCandidate candidate = pop_candidate(heap);
+            const u32 i = candidate.portal & ~portalNeedsClipping;
+            const float3* poly = game::mirror_vertices(mirrors, i);
+            u32 poly_count = game::mirror_vertex_count(mirrors, i);
+            if (candidate.portal & portalNeedsClipping) {
+                const MirrorPortalPoly& clipped = allocator::at(workerPolys[candidate.polyWorker], candidate.polyIndex);
+                poly = clipped.vertices;
+                poly_count = clipped.count;
+            }
+            const u32 index =
+                push_clippedMirrorCamera(tree, tree, candidate.parentIndex, mirrors, i, poly, poly_count);
+            cameraCount++;
+            if (allocator::at(tree.nodes, index).depth + 1 < maxDepth) { wave[ctx.waveCount++] = index; }
+        }
+    }
+
+    // lay out the tree depth first, with children in mirror order
+    const u32 count = (u32)tree.nodes.len;
+    u32* firstChild = (u32*)allocator::alloc_arena(scratchArena, sizeof(u32) * count, alignof(u32));
+    u32* childCount = (u32*)allocator::alloc_arena(scratchArena, sizeof(u32) * count, alignof(u32));
+    u32* children = (u32*)allocator::alloc_arena(scratchArena, sizeof(u32) * count, alignof(u32));
+    memset(childCount, 0, sizeof(u32) * count);
+    for (u32 i = 1; i < count; i++) { childCount[allocator::at(tree.nodes, i).parentIndex]++; }
+    for (u32 i = 0, first = 0; i < count; i++) {
+        firstChild[i] = first;
+        first += childCount[i];
+        childCount[i] = 0;
+    }
+    for (u32 i = 1; i < count; i++) {
+        const u32 parent = allocator::at(tree.nodes, i).parentIndex;
+        u32* siblings = &children[firstChild[parent]];
+        u32 c = childCount[parent]++;
+        for (; c > 0 && allocator::at(tree.nodes, siblings[c - 1]).sourceId > allocator::at(tree.nodes, i).sourceId; c--) {
+            siblings[c] = siblings[c - 1];
+        }
+        siblings[c] = i;
+    }
+    clear_cameraTree(cameraTree);
+    push_cameraNodes(cameraTree, count);
+    LayoutMirrorTreeContext layoutContext = { cameraTree, tree, firstChild, childCount, children };
+    // the root stays where it is, the caller sets its sibling
+    for (u32 c = 0, next = 1; c < childCount[0]; c++) {
+        next = layoutMirrorTreeRecursive(layoutContext, children[firstChild[0] + c], 0, next);
+    }
+    return count;
+}
+
+// Inputs of the last camera tree gather. The gather is deterministic, so if none of them changed,
+// last frame's tree is still the right one, and can be kept as is: the orbit camera only moves
+// while it's dragged, so most frames are like this
+// Only the whole tree is kept, there's no reuse of subtrees while the camera moves: each node's
+// camera is its parent's reflected by the mirror, so a root camera change reaches every node, and
+// keeping subtrees within a tolerance would change what's drawn
+// The mirrors are static once spawned, but a new room's may reuse the old ones' memory, so the
+// inputs must be reset on room changes
+struct MirrorTreeInputs {
+    Camera rootCamera;
+    renderer::Frustum rootFrustum;
+    game::MirrorBudget budget;
+    float2 screenSize;
+    const float3* mirrorVertices;
+    u32 mirrorCount;
+    u32 maxDepth;
+    u32 cameraCount; // in the tree gathered from these inputs
+    bool valid; // set once a tree has been gathered from these inputs
+};
+// the inputs are compared bitwise, so padding bytes would make equal inputs look different
+static_assert(sizeof(Camera) == 3 * sizeof(float4x4) + sizeof(float3), "Camera has padding");
+static_assert(sizeof(renderer::Frustum) == countof(renderer::Frustum::planes) * sizeof(float4) + sizeof(u32),
+    "Frustum has padding");
+// The frustum's unused planes must be zeroed, they're compared too
+MirrorTreeInputs make_mirrorTreeInputs(
+    const Camera& rootCamera, const renderer::Frustum& rootFrustum, const game::Mirrors& mirrors,
+    const u32 maxDepth, const game::MirrorBudget& budget, const float2 screenSize) {
+    MirrorTreeInputs inputs = {};
+    inputs.rootCamera = rootCamera;
+    inputs.rootFrustum = rootFrustum;
+    inputs.budget = budget;
+    inputs.screenSize = screenSize;
+    inputs.mirrorVertices = mirrors.vertices;
+    inputs.mirrorCount = mirrors.count;
+    inputs.maxDepth = maxDepth;
+    return inputs;
+}
+// Returns whether the camera tree was gathered from the last inputs, and these are the same
+bool can_reuse_mirrorTree(
+    const MirrorTreeInputs& last, const MirrorTreeInputs& inputs, const CameraTree& cameraTree) {
+    return last.valid && last.cameraCount == cameraTree.nodes.len
+        && last.mirrorVertices == inputs.mirrorVertices && last.mirrorCount == inputs.mirrorCount
+        && last.maxDepth == inputs.maxDepth
+        && memcmp(&last.rootCamera, &inputs.rootCamera, sizeof(Camera)) == 0
+        && memcmp(&last.rootFrustum, &inputs.rootFrustum, sizeof(renderer::Frustum)) == 0
+        && memcmp(&last.budget, &inputs.budget, sizeof(game::MirrorBudget)) == 0
+        && memcmp(&last.screenSize, &inputs.screenSize, sizeof(float2)) == 0;
+}
+// Records the inputs of the tree that was just gathered, along with its camera count
+void record_mirrorTree(MirrorTreeInputs& last, const MirrorTreeInputs& inputs, const u32 cameraCount) {
+    last = inputs;
+    last.cameraCount = cameraCount;
+    last.valid = true;
+}
+
 struct RenderSceneContext {
-    const CameraNode& camera;
+    const Camera& camera;
+    const u32 depth; // of the camera in the tree, used as the stencil reference
     const renderer::VisibleNodes& visibleNodes;
     game::Scene& gameScene;
     renderer::CoreResources& core;
@@ -1107,7 +2133,7 @@ void renderBaseScene(RenderSceneContext& sceneCtx) {
         driver::RscCBuffer& clearColor_cbuffer =
             rsc.cbuffers[renderer::CoreResources::CBuffersMeta::ClearColor];
         renderer::driver::bind_blend_state(rsc.blendStateBlendOff);
-        driver::bind_DS(sceneCtx.ds_always, sceneCtx.camera.depth);
+        driver::bind_DS(sceneCtx.ds_always, sceneCtx.depth);
         driver::bind_RS(rsc.rasterizerStateFillFrontfaces);
         driver::bind_cbuffers(
             rsc.shaders[renderer::ShaderTechniques::FullscreenBlitClearColor],
@@ -1135,7 +2161,7 @@ void renderBaseScene(RenderSceneContext& sceneCtx) {
             0, renderer::DrawlistFilter::Alpha, renderer::SortParams::Type::Default);
         if (dl.count[DrawlistBuckets::Base] + dl.count[DrawlistBuckets::Instanced] > 0) {
             driver::set_marker_name(marker, "OPAQUE"); driver::start_event(marker);
-            driver::bind_DS(sceneCtx.ds_opaque, sceneCtx.camera.depth);
+            driver::bind_DS(sceneCtx.ds_opaque, sceneCtx.depth);
             Drawlist_Context ctx = {};
             Drawlist_Overrides overrides = {};
             ctx.cbuffers[overrides.forced_cbuffer_count++] = scene_cbuffer;
@@ -1165,7 +2191,7 @@ void renderBaseScene(RenderSceneContext& sceneCtx) {
             dl, sceneCtx.visibleNodes, sceneCtx.camera.pos, scene, rsc,
             renderer::DrawlistFilter::Alpha, 0, renderer::SortParams::Type::BackToFront);
         if (dl.count[DrawlistBuckets::Base] + dl.count[DrawlistBuckets::Instanced] > 0) {
-            driver::bind_DS(sceneCtx.ds_alpha, sceneCtx.camera.depth);
+            driver::bind_DS(sceneCtx.ds_alpha, sceneCtx.depth);
             driver::set_marker_name(marker, "ALPHA"); driver::start_event(marker);
             Drawlist_Context ctx = {};
             Drawlist_Overrides overrides = {};
@@ -1181,6 +2207,7 @@ void renderBaseScene(RenderSceneContext& sceneCtx) {
 struct RenderMirrorContext {
     const CameraNode& camera;
     const CameraNode& parent;
+    const Camera& parentCamera;
     game::Scene& gameScene;
     renderer::CoreResources& renderCore;
 };
@@ -1207,8 +2234,8 @@ void markMirror(RenderMirrorContext& mirrorCtx) {
 
         driver::bind_blend_state(rsc.blendStateOff);
 
-        const renderer::DrawMesh& mesh =
-            mirrorCtx.camera.drawMesh;
+        const renderer::DrawMesh mesh =
+            game::mirror_drawMesh(mirrorCtx.gameScene.mirrors, mirrorCtx.camera.sourceId);
         driver::bind_shader(rsc.shaders[mesh.shaderTechnique]);
         driver::bind_indexed_vertex_buffer(mesh.vertexBuffer);
         driver::RscCBuffer buffers[] = { scene_cbuffer, identity_cbuffer };
@@ -1234,7 +2261,7 @@ void unmarkMirror(RenderMirrorContext& mirrorCtx) {
     {
         renderer::SceneData cbufferPerScene;
         cbufferPerScene.vpMatrix =
-            math::mult(mirrorCtx.parent.projectionMatrix, mirrorCtx.parent.viewMatrix);
+            math::mult(mirrorCtx.parentCamera.projectionMatrix, mirrorCtx.parentCamera.viewMatrix);
         renderer::driver::update_cbuffer(scene_cbuffer, &cbufferPerScene);
     }
 
@@ -1245,8 +2272,8 @@ void unmarkMirror(RenderMirrorContext& mirrorCtx) {
         driver::bind_RS(rasterizerStateParent);
         driver::bind_blend_state(rsc.blendStateOn);
 
-        renderer::DrawMesh mesh = //renderer::drawMesh_from_handle(rsc, mirrorCtx.camera.meshHandle);
-            mirrorCtx.camera.drawMesh;
+        renderer::DrawMesh mesh =
+            game::mirror_drawMesh(mirrorCtx.gameScene.mirrors, mirrorCtx.camera.sourceId);
         driver::bind_shader(rsc.shaders[mesh.shaderTechnique]);
         driver::bind_indexed_vertex_buffer(mesh.vertexBuffer);
         driver::RscCBuffer buffers[] = { scene_cbuffer, identity_cbuffer };
@@ -1257,14 +2284,15 @@ void unmarkMirror(RenderMirrorContext& mirrorCtx) {
 }
 
 void renderMirrorTree(
-        const CameraNode* cameraTree,
+        const CameraTree& cameraTree,
         const renderer::VisibleNodes* visibleNodes,
         game::Scene& gameScene,
         renderer::CoreResources& renderCore,
         allocator::PagedArena scratchArena) {
 
     using namespace renderer;
-    u32 numCameras = cameraTree[0].siblingIndex;
+    const allocator::VirtualBuffer<CameraNode>& nodes = cameraTree.nodes;
+    u32 numCameras = allocator::at(nodes, 0).siblingIndex;
     u32* parents =
         (u32*) allocator::alloc_arena(
                 scratchArena, sizeof(u32) * numCameras,
@@ -1273,17 +2301,20 @@ void renderMirrorTree(
     parents[parentCount++] = 0;
     for (u32 index = 1; index < numCameras; index++) {
 
-        const CameraNode& camera = cameraTree[index];
-        const CameraNode& parent = cameraTree[parents[parentCount - 1]];
+        const CameraNode& camera = allocator::at(nodes, index);
+        const u32 parentIndex = parents[parentCount - 1];
+        const CameraNode& parent = allocator::at(nodes, parentIndex);
 
         // render this mirror
         driver::Marker_t marker;
-        __PROFILEONLY(driver::set_marker_name(marker, camera.str); driver::start_event(marker);)
+        __PROFILEONLY(
+            driver::set_marker_name(marker, allocator::at(cameraTree.names, index).str);
+            driver::start_event(marker);)
         
 
         // mark mirror
         RenderMirrorContext mirrorContext {
-            camera, parent, gameScene, renderCore
+            camera, parent, allocator::at(cameraTree.cameras, parentIndex), gameScene, renderCore
         };
         markMirror(mirrorContext);
 
@@ -1295,7 +2326,7 @@ void renderMirrorTree(
                       renderCore.rasterizerStateFillFrontfaces
                     : renderCore.rasterizerStateFillBackfaces;
             RenderSceneContext renderSceneContext = {
-                camera, visibleNodes[index], gameScene, renderCore,
+                allocator::at(cameraTree.cameras, index), camera.depth, visibleNodes[index], gameScene, renderCore,
                 renderCore.depthStateMirrorReflectionsDepthAlways,
                 renderCore.depthStateMirrorReflections,
                 renderCore.depthStateMirrorReflectionsDepthReadOnly,
@@ -1306,12 +2337,13 @@ void renderMirrorTree(
         __PROFILEONLY(driver::end_event();)
 
         parents[parentCount++] = index;
-        while (parentCount > 1 && index + 1 >= cameraTree[parents[parentCount - 1]].siblingIndex) {
+        while (parentCount > 1 && index + 1 >= allocator::at(nodes, parents[parentCount - 1]).siblingIndex) {
             // unmark mirror
-            const CameraNode& camera = cameraTree[parents[parentCount - 1]];
-            const CameraNode& parent = cameraTree[parents[parentCount - 2]];
+            const CameraNode& camera = allocator::at(nodes, parents[parentCount - 1]);
+            const CameraNode& parent = allocator::at(nodes, parents[parentCount - 2]);
             RenderMirrorContext mirrorContext {
-                camera, parent, gameScene, renderCore
+                camera, parent, allocator::at(cameraTree.cameras, parents[parentCount - 2]),
+                gameScene, renderCore
             };
             unmarkMirror(mirrorContext);
             driver::end_event();
@@ -1921,6 +2953,8 @@ void load_coreResources(
     obj::load_mesh_cpu_gpu(
         core.meshes[game::Resources::MeshesMeta::ToiletHi], renderCore,
         scratchArena, persistentArena, "assets/meshes/mid-smooth.obj", 1.5f);
+    core.mirrorBVHCaches[game::Resources::MeshesMeta::ToiletLo] = { "assets/data/throne.bvh" };
+    core.mirrorBVHCaches[game::Resources::MeshesMeta::ToiletHi] = { "assets/data/mid-smooth.bvh" };
 
     // Hall of mirrors
     for (u32 m = 0; m < game::Resources::MirrorHallMeta::Count; m++) {
@@ -1943,7 +2977,7 @@ void load_coreResources(
             v[i].pos = math::mult(t.matrix, float4(v[i].pos, 1.f)).xyz;
         }
         // clock-wise indices
-        u16 i[] = { 2, 1, 0, 3, 2, 0 }; // todo: start of second tri needs to be the last vertex, fix this weird restriction
+        u32 i[] = { 2, 1, 0, 3, 2, 0 }; // todo: start of second tri needs to be the last vertex, fix this weird restriction
         renderer::driver::IndexedVertexBufferDesc bufferParams;
         bufferParams.vertexData = v;
         bufferParams.indexData = i;
@@ -1953,7 +2987,7 @@ void load_coreResources(
         bufferParams.indexCount = countof(i);
         bufferParams.memoryUsage = renderer::driver::BufferMemoryUsage::GPU;
         bufferParams.accessType = renderer::driver::BufferAccessType::GPU;
-        bufferParams.indexType = renderer::driver::BufferItemType::U16;
+        bufferParams.indexType = renderer::driver::BufferItemType::U32;
         bufferParams.type = renderer::driver::BufferTopologyType::Triangles;
         renderer::driver::VertexAttribDesc attribs[] = {
             renderer::driver::make_vertexAttribDesc(
@@ -1972,11 +3006,11 @@ void load_coreResources(
         mesh.vertices = (float3*)allocator::alloc_arena(
             persistentArena,
             sizeof(float3) * countof(v), alignof(float3));
-        mesh.indices = (u16*)allocator::alloc_arena(
+        mesh.indices = (u32*)allocator::alloc_arena(
             persistentArena,
-            sizeof(u16) * countof(i), alignof(u16));
+            sizeof(u32) * countof(i), alignof(u32));
         for (u32 i = 0; i < countof(v); i++) { mesh.vertices[i] = v[i].pos; }
-        memcpy(mesh.indices, i, sizeof(u16) * countof(i));
+        memcpy(mesh.indices, i, sizeof(u32) * countof(i));
         mesh.indexCount = countof(i);
         mesh.vertexCount = countof(v);
     }
@@ -2093,7 +3127,7 @@ void load_coreResources(
 }
 void spawn_scene_mirrorRoom(
     game::Scene& scene, allocator::PagedArena& sceneArena, allocator::PagedArena scratchArena,
-    const game::Resources& core, const platform::Screen& screen,
+    game::Resources& core, const platform::Screen& screen,
     const game::RoomDefinition& roomDef) {
 
     renderer::Scene& renderScene = scene.renderScene;
@@ -2124,6 +3158,7 @@ void spawn_scene_mirrorRoom(
 	__DEBUGDEF(renderScene.instancedDrawNodes.name = "instanced draw nodes";)
     allocator::init_pool(renderScene.drawNodes, maxDrawNodes, sceneArena);
 	__DEBUGDEF(renderScene.drawNodes.name = "draw nodes";)
+    renderer::initCullTree(renderScene, sceneArena);
     allocator::init_pool(animScene.nodes, maxAnimNodes, sceneArena);
 	__DEBUGDEF(animScene.nodes.name = "anim nodes";)
 
@@ -2255,46 +3290,36 @@ void spawn_scene_mirrorRoom(
     }
 
     if (roomDef.mirrorMesh < game::Resources::MeshesMeta::Count) {
-        const u32 numMirrors = 1024 * 1024;
-        scene.mirrors.polys = (game::Mirrors::Poly*)
-            allocator::alloc_arena(
-                sceneArena,
-                sizeof(game::Mirrors::Poly) * numMirrors,
-                alignof(game::Mirrors::Poly));
-        scene.mirrors.drawMeshes = (renderer::DrawMesh*)
-            allocator::alloc_arena(
-                sceneArena,
-                sizeof(renderer::DrawMesh) * numMirrors,
-                alignof(renderer::DrawMesh));
-        scene.mirrors.bvh = {};
+        const game::GPUCPUMesh& mirrorMesh = core.meshes[roomDef.mirrorMesh];
+        u32 mirrorCount = 0, vertexCount = 0;
+        game::count_mirrors(mirrorCount, vertexCount, mirrorMesh.cpuBuffer);
+        game::alloc_mirrors(scene.mirrors, mirrorCount, vertexCount, 1, sceneArena);
         game::spawn_model_as_mirrors(
-            scene.mirrors, core.meshes[roomDef.mirrorMesh], scratchArena, sceneArena, true);
+            scene.mirrors, mirrorMesh, scratchArena, sceneArena, true,
+            &core.mirrorBVHCaches[roomDef.mirrorMesh]);
     } else { // hall of mirrors
-        const u32 numMirrors = game::Resources::MirrorHallMeta::Count * 2;
-        scene.mirrors.polys = (game::Mirrors::Poly*)
-            allocator::alloc_arena(
-                sceneArena,
-                sizeof(game::Mirrors::Poly) * numMirrors,
-                alignof(game::Mirrors::Poly));
-        scene.mirrors.drawMeshes = (renderer::DrawMesh*)
-            allocator::alloc_arena(
-                sceneArena,
-                sizeof(renderer::DrawMesh) * numMirrors,
-                alignof(renderer::DrawMesh));
-        scene.mirrors.bvh = {};
+        u32 mirrorCount = 0, vertexCount = 0;
+        for (u32 m = 0; m < game::Resources::MirrorHallMeta::Count; m++) {
+            game::count_mirrors(mirrorCount, vertexCount, core.mirrorHallMeshes[m].cpuBuffer);
+        }
+        game::alloc_mirrors(
+            scene.mirrors, mirrorCount, vertexCount, game::Resources::MirrorHallMeta::Count,
+            sceneArena);
         for (u32 m = 0; m < game::Resources::MirrorHallMeta::Count; m++) {
             const game::GPUCPUMesh& mirrorMesh = core.mirrorHallMeshes[m];
             game::spawn_model_as_mirrors(
-                scene.mirrors, mirrorMesh, scratchArena, sceneArena, false);
+                scene.mirrors, mirrorMesh, scratchArena, sceneArena, false, nullptr);
         }
         for (u32 i = 0; i < scene.mirrors.count; i++) {
-            game::Mirrors::Poly& p = scene.mirrors.polys[i];
+            const float3* v = game::mirror_vertices(scene.mirrors, i);
+            const u32 vertexCount = game::mirror_vertex_count(scene.mirrors, i);
+            assert(physicsScene.wall_count < countof(physicsScene.walls)); // too many hall mirrors
             physics::StaticObject_Line& wall = physicsScene.walls[physicsScene.wall_count++];
             wall = {};
-            wall.start = p.v[0];
-            for (u32 j = 1; j < p.numPts; j++) {
-                if ((p.v[j].x != wall.start.x) || (p.v[j].y != wall.start.y)) {
-                    wall.end = p.v[j];
+            wall.start = v[0];
+            for (u32 j = 1; j < vertexCount; j++) {
+                if ((v[j].x != wall.start.x) || (v[j].y != wall.start.y)) {
+                    wall.end = v[j];
                 }
             }
             wall.start.z = 0.f;
@@ -2302,6 +3327,7 @@ void spawn_scene_mirrorRoom(
         }
     }
     scene.maxMirrorBounces = roomDef.maxMirrorBounces;
+    scene.mirrorBudget = roomDef.mirrorBudget;
 
     // camera
     scene.orbitCamera.offset = float3(0.f, -100.f, 0.f);
@@ -2314,4 +3340,181 @@ void spawn_scene_mirrorRoom(
     scene.orbitCamera.maxScale = roomDef.maxCameraZoom;
 }
 
+// Copy of a fully spawned scene arena, plus the scene struct that points into it, so that a room
+// can be restored with a memcpy instead of spawning it again. Pointers into the arena are stored
+// as offsets (plus one, so null pointers stay null), so the image can be restored at any address.
+// Pointers outside of the arena (resources, GPU objects) are kept as is: they are expected to
+// outlive the snapshot, which is only valid for the process that captured it.
+struct SceneSnapshot {
+    u8* image;
+    size_t size;
+    game::Scene scene;
+};
+// Moves pointers in [from, from + size) to [to, to + size), for data that currently lives at mem
+struct Relocation {
+    u8* mem;
+    uintptr_t from;
+    uintptr_t to;
+    size_t size;
+};
+// Where the data for a not-yet-relocated pointer lives
+template<typename T>
+T* resolve(const Relocation& r, T* ptr) {
+    const uintptr_t offset = (uintptr_t)ptr - r.from;
+    return offset < r.size ? (T*)(r.mem + offset) : nullptr;
+}
+template<typename T>
+void relocate(const Relocation& r, T*& ptr) {
+    const uintptr_t offset = (uintptr_t)ptr - r.from;
+    if (offset < r.size) { ptr = (T*)(r.to + offset); }
+}
+template<typename T>
+void relocate_pool(const Relocation& r, allocator::Pool<T>& pool) {
+    typename allocator::Pool<T>::Slot* slots = resolve(r, pool.data);
+    for (ptrdiff_t i = 0; i < pool.cap; i++) {
+        if (!slots[i].alive) { relocate(r, slots[i].state.next); }
+    }
+    relocate(r, pool.firstAvailable);
+    relocate(r, pool.data);
+}
+// Needs to be kept in sync with any pointers into the scene arena added to game::Scene
+void relocate_scene(const Relocation& r, game::Scene& scene) {
+    renderer::Scene& renderScene = scene.renderScene;
+    relocate_pool(r, renderScene.drawNodes);
+    relocate_pool(r, renderScene.instancedDrawNodes);
+    relocate_pool(r, renderScene.cbuffers);
+    relocate(r, renderScene.cullTree.nodes);
+    relocate(r, renderScene.cullTree.links);
+    relocate(r, renderScene.cullLeaves);
+    relocate(r, renderScene.cullDirtyNodes);
+    relocate(r, renderScene.cullDirty);
+    allocator::SparsePool<animation::Node>& animNodes = scene.animScene.nodes;
+    relocate(r, animNodes.data);
+    relocate(r, animNodes.denseToSparse);
+    relocate(r, animNodes.sparse);
+    game::Mirrors& mirrors = scene.mirrors;
+    relocate(r, mirrors.planes);
+    relocate(r, mirrors.vertexOffsets);
+    relocate(r, mirrors.vertices);
+    relocate(r, mirrors.indexOffsets);
+    relocate(r, mirrors.meshIds);
+    relocate(r, mirrors.drawMeshes);
+    relocate(r, mirrors.bvh.nodes);
+    relocate(r, mirrors.bvh.wideNodes);
+    relocate(r, mirrors.bvh.sourceIds);
+    relocate(r, mirrors.bvh.sourceOrder);
+}
+void capture_snapshot(
+    SceneSnapshot& snapshot, allocator::TLSF& heap, const game::Scene& scene,
+    u8* arenaStart, u8* arenaEnd) {
+    snapshot.size = arenaEnd - arenaStart;
+    // the image is only ever copied from, so the heap's 16 byte alignment is enough here
+    snapshot.image = (u8*)allocator::alloc_tlsf(heap, snapshot.size, 16);
+    memcpy(snapshot.image, arenaStart, snapshot.size);
+    snapshot.scene = scene;
+    const Relocation r = { snapshot.image, (uintptr_t)arenaStart, 1, snapshot.size };
+    relocate_scene(r, snapshot.scene);
+}
+void restore_snapshot(
+    game::Scene& scene, allocator::PagedArena& arena, const SceneSnapshot& snapshot) {
+    // the arena was 4KB aligned when captured: the restored copy needs the largest alignment of
+    // any scene allocation, so that data keeps it at the same offsets (mirror bvh wide nodes)
+    u8* dst = (u8*)allocator::alloc_arena(arena, snapshot.size, alignof(bvh::WideNode));
+    memcpy(dst, snapshot.image, snapshot.size);
+    scene = snapshot.scene;
+    const Relocation r = { dst, 1, (uintptr_t)dst, snapshot.size };
+    relocate_scene(r, scene);
+}
+void free_snapshot(SceneSnapshot& snapshot, allocator::TLSF& heap) {
+    allocator::free_tlsf(heap, snapshot.image);
+    snapshot = {};
+}
+
+#if __DEBUG
+// Deep comparison of two scenes living in different memory: pointers into each scene's arena
+// are compared as offsets from the data they point into
+template<typename T>
+bool pools_match(const allocator::Pool<T>& a, const allocator::Pool<T>& b) {
+    if (a.cap != b.cap || a.count != b.count) { return false; }
+    if ((a.firstAvailable ? a.firstAvailable - a.data : -1)
+        != (b.firstAvailable ? b.firstAvailable - b.data : -1)) { return false; }
+    for (ptrdiff_t i = 0; i < a.cap; i++) {
+        if (a.data[i].alive != b.data[i].alive) { return false; }
+        if (a.data[i].alive) { continue; } // contents are compared per type
+        if ((a.data[i].state.next ? a.data[i].state.next - a.data : -1)
+            != (b.data[i].state.next ? b.data[i].state.next - b.data : -1)) { return false; }
+    }
+    return true;
+}
+bool scenes_match(const game::Scene& a, const game::Scene& b) {
+    const renderer::Scene& ra = a.renderScene;
+    const renderer::Scene& rb = b.renderScene;
+    if (!pools_match(ra.drawNodes, rb.drawNodes)
+     || !pools_match(ra.instancedDrawNodes, rb.instancedDrawNodes)
+     || !pools_match(ra.cbuffers, rb.cbuffers)) { return false; }
+    for (ptrdiff_t i = 0; i < ra.drawNodes.cap; i++) {
+        if (!ra.drawNodes.data[i].alive) { continue; }
+        const renderer::DrawNode& na = ra.drawNodes.data[i].state.live;
+        const renderer::DrawNode& nb = rb.drawNodes.data[i].state.live;
+        if (memcmp(&na, &nb, sizeof(na))) { return false; }
+    }
+    const aabbtree::Tree& ta = ra.cullTree;
+    const aabbtree::Tree& tb = rb.cullTree;
+    if (ta.capacity != tb.capacity || ta.root != tb.root || ta.freeList != tb.freeList
+     || ta.leafCount != tb.leafCount || ta.margin != tb.margin
+     || memcmp(ta.nodes, tb.nodes, ta.capacity * sizeof(aabbtree::Node))
+     || memcmp(ta.links, tb.links, ta.capacity * sizeof(aabbtree::NodeLinks))
+     || memcmp(ra.cullLeaves, rb.cullLeaves, ra.drawNodes.cap * sizeof(u32))
+     || ra.cullDirtyCount != rb.cullDirtyCount
+     || memcmp(ra.cullDirtyNodes, rb.cullDirtyNodes, ra.cullDirtyCount * sizeof(u32))
+     || memcmp(ra.cullDirty, rb.cullDirty, ra.drawNodes.cap)) { return false; }
+    for (ptrdiff_t i = 0; i < ra.instancedDrawNodes.cap; i++) {
+        if (ra.instancedDrawNodes.data[i].alive
+            && memcmp(&ra.instancedDrawNodes.data[i].state.live,
+                      &rb.instancedDrawNodes.data[i].state.live,
+                      sizeof(renderer::DrawNodeInstanced))) { return false; }
+    }
+    for (ptrdiff_t i = 0; i < ra.cbuffers.cap; i++) {
+        if (ra.cbuffers.data[i].alive
+            && memcmp(&ra.cbuffers.data[i].state.live, &rb.cbuffers.data[i].state.live,
+                      sizeof(renderer::driver::RscCBuffer))) { return false; }
+    }
+    const allocator::SparsePool<animation::Node>& aa = a.animScene.nodes;
+    const allocator::SparsePool<animation::Node>& ab = b.animScene.nodes;
+    if (aa.cap != ab.cap || aa.count != ab.count || aa.firstAvailable != ab.firstAvailable
+     || memcmp(aa.data, ab.data, sizeof(animation::Node) * aa.count)
+     || memcmp(aa.denseToSparse, ab.denseToSparse, sizeof(u32) * aa.count)
+     || memcmp(aa.sparse, ab.sparse, sizeof(aa.sparse[0]) * aa.cap)) { return false; }
+    const game::Mirrors& ma = a.mirrors;
+    const game::Mirrors& mb = b.mirrors;
+    if (ma.count != mb.count || ma.drawMeshCount != mb.drawMeshCount
+     || ma.bvh.nodeCount != mb.bvh.nodeCount
+     || (ma.count && (memcmp(ma.planes, mb.planes, sizeof(float4) * ma.count)
+         || memcmp(ma.vertexOffsets, mb.vertexOffsets, sizeof(u32) * (ma.count + 1))
+         || memcmp(ma.vertices, mb.vertices, sizeof(float3) * ma.vertexOffsets[ma.count])
+         || memcmp(ma.indexOffsets, mb.indexOffsets, sizeof(u32) * ma.count)
+         || memcmp(ma.meshIds, mb.meshIds, sizeof(u8) * ma.count)))
+     || memcmp(ma.drawMeshes, mb.drawMeshes, sizeof(renderer::DrawMesh) * ma.drawMeshCount)
+     || ma.bvh.sourceIdCount != mb.bvh.sourceIdCount
+     || ma.bvh.wideNodeCount != mb.bvh.wideNodeCount
+     || ma.bvh.sourceCount != mb.bvh.sourceCount
+     || memcmp(ma.bvh.nodes, mb.bvh.nodes, sizeof(bvh::Node) * ma.bvh.nodeCount)
+     || memcmp(ma.bvh.wideNodes, mb.bvh.wideNodes, sizeof(bvh::WideNode) * ma.bvh.wideNodeCount)
+     || memcmp(ma.bvh.sourceIds, mb.bvh.sourceIds, sizeof(u32) * ma.bvh.sourceIdCount)
+     || memcmp(ma.bvh.sourceOrder, mb.bvh.sourceOrder, sizeof(u32) * ma.bvh.sourceCount)) {
+        return false;
+    }
+    return !memcmp(&a.physicsScene, &b.physicsScene, sizeof(a.physicsScene))
+        && !memcmp(&a.camera, &b.camera, sizeof(a.camera))
+        && !memcmp(&a.player, &b.player, sizeof(a.player))
+        && !memcmp(&a.orbitCamera, &b.orbitCamera, sizeof(a.orbitCamera))
+        && !memcmp(a.instancedNodesHandles, b.instancedNodesHandles, sizeof(a.instancedNodesHandles))
+        && a.playerDrawNodeHandle == b.playerDrawNodeHandle
+        && a.playerAnimatedNodeHandle == b.playerAnimatedNodeHandle
+        && a.playerPhysicsNodeHandle == b.playerPhysicsNodeHandle
+        && a.maxMirrorBounces == b.maxMirrorBounces
+        && !memcmp(&a.mirrorBudget, &b.mirrorBudget, sizeof(a.mirrorBudget));
+}
+#endif
+
 #endif // __WASTELADNS_SCENE_H__
@@ -0,0 +1,141 @@
+#ifndef __WASTELADNS_TELEMETRY_H__
+#define __WASTELADNS_TELEMETRY_H__
+
+// Arena usage stats, available in release builds, so that arena sizes can be picked from real data
+namespace telemetry {
+
+struct ArenaId { enum Enum { Persistent, Scene, Frame, Scratch, Count }; };
+const char* arenaNames[] = { "persistent", "scene", "frame", "scratch" };
+static_assert(countof(arenaNames) == ArenaId::Count, "check");
+
+// Frame arena usage gets stored in a ring buffer for the last frames, and in a histogram for the
+// whole run, with power of two buckets: [0,4KB), [4KB,8KB), [8KB,16KB), ..., [64MB,inf)
+const u32 frameHistoryCount = 256;
+const u32 histogramBucketCount = 16;
+const size_t histogramMinBytes = 4 * 1024;
+
+struct State {
+    allocator::ArenaTelemetry arenas[ArenaId::Count];
+    allocator::PagedArena* trackedArenas[ArenaId::Count];
+    size_t frameHistory[frameHistoryCount];
+    u64 frameHistogram[histogramBucketCount];
+    u64 frameCount;
+};
+
+struct ArenaSample { size_t committed; size_t used; size_t peak; };
+ArenaSample sample(const State& state, const ArenaId::Enum id) {
+    const allocator::ArenaTelemetry& telemetry = state.arenas[id];
+    const allocator::PagedArena& arena = *state.trackedArenas[id];
+    ArenaSample s;
+    s.committed = allocator::committed_end(arena) - (uintptr_t)telemetry.start;
+    s.used = arena.curr - telemetry.start; // scoped copies are not visible here
+    s.peak = telemetry.peak;
+    return s;
+}
+u32 histogramBucket(const size_t bytes) {
+    u32 bucket = 0;
+    for (size_t bucketMax = histogramMinBytes;
+         bytes >= bucketMax && bucket < histogramBucketCount - 1; bucketMax *= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+size_t histogramBucketMin(const u32 bucket) {
+    return bucket ? histogramMinBytes << (bucket - 1) : 0;
+}
+
+// Arenas must be initialized already, and have a stable address for the lifetime of the state
+void init(State& state, allocator::PagedArena& persistent, allocator::PagedArena& scene,
+          allocator::PagedArena& frame, allocator::PagedArena& scratch) {
+    state = {};
+    state.trackedArenas[ArenaId::Persistent] = &persistent;
+    state.trackedArenas[ArenaId::Scene] = &scene;
+    state.trackedArenas[ArenaId::Frame] = &frame;
+    state.trackedArenas[ArenaId::Scratch] = &scratch;
+    for (u32 i = 0; i < ArenaId::Count; i++) {
+        allocator::init_telemetry(state.arenas[i], arenaNames[i], state.trackedArenas[i]->curr);
+        state.trackedArenas[i]->telemetry = &state.arenas[i];
+    }
+}
+// Call before resetting the frame arena
+void end_frame(State& state) {
+    const size_t usage = state.arenas[ArenaId::Frame].framePeak;
+    state.frameHistory[state.frameCount % frameHistoryCount] = usage;
+    state.frameHistogram[histogramBucket(usage)]++;
+    state.frameCount++;
+    for (u32 i = 0; i < ArenaId::Count; i++) { allocator::clear_framepeak(state.arenas[i]); }
+}
+
+bool dump_csv(const State& state, const char* path) {
+    FILE* f;
+    if (platform::fopen(&f, path, "w") != 0) { return false; }
+    fprintf(f, "arena,committed,used,peak\n");
+    for (u32 i = 0; i < ArenaId::Count; i++) {
+        const ArenaSample s = sample(state, (ArenaId::Enum)i);
+        fprintf(f, "%s,%zu,%zu,%zu\n", arenaNames[i], s.committed, s.used, s.peak);
+    }
+    fprintf(f, "\narena,tag,peak,bytes,allocations\n");
+    for (u32 i = 0; i < ArenaId::Count; i++) {
+        const allocator::ArenaTelemetry& telemetry = state.arenas[i];
+        for (u32 t = 0; t < telemetry.tagCount; t++) {
+            const allocator::ArenaTelemetry::Tag& tag = telemetry.tags[t];
+            if (!tag.count) { continue; }
+            fprintf(f, "%s,%s,%zu,%zu,%llu\n",
+                arenaNames[i], tag.name, tag.peak, tag.bytes, (unsigned long long)tag.count);
+        }
+    }
+    fprintf(f, "\nframe_bytes_min,frames\n");
+    for (u32 b = 0; b < histogramBucketCount; b++) {
+        fprintf(f, "%zu,%llu\n", histogramBucketMin(b), (unsigned long long)state.frameHistogram[b]);
+    }
+    fprintf(f, "\nframe,frame_bytes\n");
+    const u64 historyCount =
+        state.frameCount < frameHistoryCount ? state.frameCount : frameHistoryCount;
+    for (u64 frame = state.frameCount - historyCount; frame < state.frameCount; frame++) {
+        fprintf(f, "%llu,%zu\n",
+            (unsigned long long)frame, state.frameHistory[frame % frameHistoryCount]);
+    }
+    platform::fclose(f);
+    return true;
+}
+
+bool dump_json(const State& state, const char* path) {
+    FILE* f;
+    if (platform::fopen(&f, path, "w") != 0) { return false; }
+    fprintf(f, "{\n  \"frames\": %llu,\n  \"arenas\": [", (unsigned long long)state.frameCount);
+    for (u32 i = 0; i < ArenaId::Count; i++) {
+        const ArenaSample s = sample(state, (ArenaId::Enum)i);
+        const allocator::ArenaTelemetry& telemetry = state.arenas[i];
+        fprintf(f, "%s\n    { \"name\": \"%s\", \"committed\": %zu, \"used\": %zu, \"peak\": %zu, \"tags\": [",
+            i ? "," : "", arenaNames[i], s.committed, s.used, s.peak);
+        bool first = true;
+        for (u32 t = 0; t < telemetry.tagCount; t++) {
+            const allocator::ArenaTelemetry::Tag& tag = telemetry.tags[t];
+            if (!tag.count) { continue; }
+            fprintf(f, "%s\n      { \"name\": \"%s\", \"peak\": %zu, \"bytes\": %zu, \"allocations\": %llu }",
+                first ? "" : ",", tag.name, tag.peak, tag.bytes, (unsigned long long)tag.count);
+            first = false;
+        }
+        fprintf(f, " ] }");
+    }
+    fprintf(f, "\n  ],\n  \"frameHistogram\": [");
+    for (u32 b = 0; b < histogramBucketCount; b++) {
+        fprintf(f, "%s\n    { \"minBytes\": %zu, \"frames\": %llu }",
+            b ? "," : "", histogramBucketMin(b), (unsigned long long)state.frameHistogram[b]);
+    }
+    fprintf(f, "\n  ],\n  \"recentFrames\": [");
+    const u64 historyCount =
+        state.frameCount < frameHistoryCount ? state.frameCount : frameHistoryCount;
+    for (u64 frame = state.frameCount - historyCount; frame < state.frameCount; frame++) {
+        fprintf(f, "%s%zu",
+            frame == state.frameCount - historyCount ? "" : ", ",
+            state.frameHistory[frame % frameHistoryCount]);
+    }
+    fprintf(f, "]\n}\n");
+    platform::fclose(f);
+    return true;
+}
+
+}
+
+#endif // __WASTELADNS_TELEMETRY_H__